@@ -11,14 +11,25 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
+#include <errno.h>
 #include <string>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <pthread.h>
 #include <iostream>
 #include <sstream>
 #include <libgen.h>
 #include "ansi_color.h"
 #include "code_inbox.h"
+#include "logging.h"
 #include "application_base.h"
 
 using namespace tnt;
@@ -27,6 +38,12 @@ using namespace tnt;
 static const unsigned int APP_DEFAULT_IDLE_COUNT = 10;
 static const unsigned int APP_DEFAULT_IDLE_SLEEP = 10 /*MS*/;
 static const unsigned int APP_DEFAULT_TICK_TIMER = 100 /*MS*/;
+static const int APP_DEFAULT_EPOLL_WAIT = 0 /*MS*/;
+static const unsigned int APP_DEFAULT_PROC_BATCH = 1;
+static const int APP_DEFAULT_PROC_BUDGET = 0 /*US*/;
+static const uint64_t APP_METRICS_PUBLISH_INTERVAL = 1000000000ULL /*NS*/;
+// 一直有事做时, 每这么多圈不阻塞地看一眼注册的fd, 免得饿死
+static const size_t APP_BUSY_POLL_INTERVAL = 16;
 
 static const char* APP_CMD_START = "start";
 static const char* APP_CMD_STOP = "stop";
@@ -43,18 +60,12 @@ ApplicationBase::ApplicationBase()
     total_proc_count_ = 0;
     total_tick_count_ = 0;
     total_ilde_count_ = 0;
+    total_msg_count_ = 0;
 
-    proc_min_cost_ = 100000;
-    proc_max_cost_ = 0;
-    proc_last_cost_ = 0;
-    proc_total_cost_ = 0;
-
-    tick_min_cost_ = 100000;
-    tick_max_cost_ = 0;
-    tick_last_cost_ = 0;
-    tick_total_cost_ = 0;
-
-    last_tick_ms_ = 0;
+    next_tick_ns_ = 0;
+    tick_elapsed_ = 0;
+    total_tick_skipped_ = 0;
+    last_publish_ns_ = 0;
 
     runtime_env_ = 0;
 
@@ -62,10 +73,29 @@ ApplicationBase::ApplicationBase()
     idle_count_ = APP_DEFAULT_IDLE_COUNT;
     idle_sleep_= APP_DEFAULT_IDLE_SLEEP;
     tick_timer_ = APP_DEFAULT_TICK_TIMER;
+    tick_catchup_ = TICK_CATCHUP_SKIP;
+    epoll_wait_ = APP_DEFAULT_EPOLL_WAIT;
+    proc_batch_ = APP_DEFAULT_PROC_BATCH;
+    proc_budget_ = APP_DEFAULT_PROC_BUDGET;
+    workers_ = 0;
+    busy_poll_ = false;
+
+    sched_policy_ = -1;
+    sched_priority_ = 0;
+    mlockall_ = false;
+    numa_node_ = -1;
+
+    epoll_fd_ = -1;
+    poll_fd_count_ = 0;
 }
 
 ApplicationBase::~ApplicationBase()
 {
+    if (-1 != epoll_fd_)
+    {
+        close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
 }
 
 // 提供给调用者的接口
@@ -85,6 +115,14 @@ ApplicationBase::Init(int argc, char** argv)
 
     std::cout << COLOR_FG_YELLOW << OptStr() << COLOR_RESET << std::endl;
 
+    // 在 OnInit 之前, 这样 OnInit 分配的内存也在绑定的节点上, 也被锁住
+    ApplyRuntimeOptions();
+
+    if (!metrics_dir_.empty() && 0 != InitMetrics())
+    {
+        std::cout << COLOR_FG_RED << "App Init Metrics Error, metrics_dir = "<< metrics_dir_ << COLOR_RESET << std::endl;
+    }
+
     int ret = OnInit(conf_file_.c_str());
     if (0 != ret)
     {
@@ -98,10 +136,19 @@ ApplicationBase::Init(int argc, char** argv)
 int
 ApplicationBase::Run()
 {
+    if (workers_ > 0)
+    {
+        return RunWorkers();
+    }
+
     is_run_ = true;
 
     size_t ilde_count = 0;
+    size_t busy_count = 0;
     int ret = 0;
+    bool is_batch = (proc_batch_ > 1 || proc_budget_ > 0);
+    // 第一个Tick马上就到
+    next_tick_ns_ = MonotonicNowNs();
     while (is_run_)
     {
         if (is_exit_)
@@ -120,32 +167,28 @@ ApplicationBase::Run()
         }
 
         ///////////////////////////////////////////////////////////////////////
-        struct timeval tv_start;
-        struct timeval tv_end;
-        struct timeval tv_diff;
-        float time_cost;
-
-        gettimeofday(&tv_start, NULL);
-        ret = OnProc();
-        gettimeofday(&tv_end, NULL);
-        ++total_proc_count_;
-
-        tv_diff = TV_DIFF(tv_end, tv_start);
-        time_cost = tv_diff.tv_sec*1000 + tv_diff.tv_usec/1000.0;
-
-        proc_last_cost_ = time_cost;
-
-        if (time_cost < proc_min_cost_)
+        uint64_t ns_start = MonotonicNowNs();
+        if (is_batch)
         {
-            proc_min_cost_ = time_cost;
+            ProcBudget budget(ns_start, (proc_batch_ > 1) ? proc_batch_ : (size_t)-1, BatchDeadline(ns_start), &msg_cost_);
+            ret = OnProcBatch(budget);
+            total_msg_count_ += (ret > 0) ? ret : 0;
+            ret = (ret > 0) ? ret : -1;
         }
-
-        if (time_cost > proc_max_cost_)
+        else
         {
-            proc_max_cost_ = time_cost;
+            ret = OnProc();
         }
+        uint64_t ns_end = MonotonicNowNs();
+        ++total_proc_count_;
 
-        proc_total_cost_ += time_cost;
+        proc_cost_.Record(ns_end - ns_start);
+        if (!is_batch && ret >= 0)
+        {
+            // 一次一条, 每条的耗时就是这次的
+            ++total_msg_count_;
+            msg_cost_.Record(ns_end - ns_start);
+        }
         ///////////////////////////////////////////////////////////////////////
 
         if (ret < 0)
@@ -159,49 +202,142 @@ ApplicationBase::Run()
         }
 
         ///////////////////////////////////////////////////////////////////////
-        struct timeval tv_now;
-        time_t ms_now;
-        gettimeofday(&tv_now, NULL);
-        ms_now = TV_TO_MS(tv_now);
-        if (last_tick_ms_ + tick_timer_ <= ms_now)
+        // ns_end 是刚取的, 不用再读一次时钟
+        if (next_tick_ns_ <= ns_end)
         {
-            OnTick();
-            gettimeofday(&tv_end, NULL);
-
-            ++total_tick_count_;
-
-            last_tick_ms_ = ms_now;
+            RunTick(ns_end);
+        }
 
+        ///////////////////////////////////////////////////////////////////////
+        if (ilde_count >= idle_count_)
+        {
+            LatencyTimer idle_timer(idle_cost_);
 
-            tv_diff = TV_DIFF(tv_end, tv_now);
-            time_cost = tv_diff.tv_sec*1000 + tv_diff.tv_usec/1000.0;
+            OnIdle();
 
-            tick_last_cost_ = time_cost;
+            ilde_count = 0;
 
-            if (time_cost < tick_min_cost_)
+            if (0 != epoll_wait_)
             {
-                tick_min_cost_ = time_cost;
+                WaitPoll();
             }
-
-            if (time_cost > tick_max_cost_)
+            else if (busy_poll_)
+            {
+                TNT_CPU_RELAX();
+            }
+            else
             {
-                tick_max_cost_ = time_cost;
+                usleep(idle_sleep_ * 1000);
             }
+        }
+        else if (0 != epoll_wait_ && poll_fd_count_ > 0 && ++busy_count >= APP_BUSY_POLL_INTERVAL)
+        {
+            // OnProc 一直有事做时也要处理注册的fd, 只是不阻塞
+            busy_count = 0;
+            DispatchPoll(0);
+        }
+    };
+
+    return ret;
+}
 
-            tick_total_cost_ += time_cost;
+int ApplicationBase::OnProcBatch(ProcBudget& budget)
+{
+    do
+    {
+        if (OnProc() < 0)
+        {
+            break;
         }
+    } while (budget.Consume());
 
-        ///////////////////////////////////////////////////////////////////////
-        if (ilde_count >= idle_count_)
+    return static_cast<int>(budget.processed());
+}
+
+// 批处理最晚到下一次Tick, 再和 --proc_budget 取小的
+uint64_t ApplicationBase::BatchDeadline(uint64_t now_ns) const
+{
+    uint64_t deadline_ns = next_tick_ns_;
+    if (proc_budget_ > 0 && now_ns + static_cast<uint64_t>(proc_budget_) * 1000 < deadline_ns)
+    {
+        deadline_ns = now_ns + static_cast<uint64_t>(proc_budget_) * 1000;
+    }
+
+    return deadline_ns;
+}
+
+/**
+ * @brief:  Tick到期了, 按 catchup 决定这次代表几个周期, 把计划时间推到下一个格子
+ *
+ * 计划时间是 启动时间 + n*tick_timer, 不管这次晚了多少, 下一次还在格子上
+ * 主循环和工作线程共用
+ */
+static size_t AdvanceTick(uint64_t now_ns, uint64_t period_ns, int catchup,
+                          uint64_t& next_tick_ns, size_t& total_skipped)
+{
+    if (0 == period_ns)
+    {
+        // 每圈都Tick
+        next_tick_ns = now_ns;
+        return 1;
+    }
+
+    size_t tick_count = 1;
+
+    // 这次到期的之后又错过了几个
+    uint64_t missed = (now_ns - next_tick_ns) / period_ns;
+    if (missed > 0)
+    {
+        switch (catchup)
         {
-            OnIdle();
+            case ApplicationBase::TICK_CATCHUP_COALESCE:
+                tick_count += missed;
+                next_tick_ns += missed * period_ns;
+                break;
 
-            ilde_count = 0;
-            usleep(idle_sleep_ * 1000);
+            case ApplicationBase::TICK_CATCHUP_REPLAY:
+                // 下一圈主循环接着补
+                break;
+
+            case ApplicationBase::TICK_CATCHUP_SKIP:
+            default:
+                total_skipped += missed;
+                next_tick_ns += missed * period_ns;
+                break;
         }
-    };
+    }
+    next_tick_ns += period_ns;
 
-    return ret;
+    return tick_count;
+}
+
+uint64_t ApplicationBase::TickPeriodNs() const
+{
+    return (tick_timer_ > 0) ? static_cast<uint64_t>(tick_timer_) * 1000000 : 0;
+}
+
+void ApplicationBase::RunTick(uint64_t now_ns)
+{
+    tick_jitter_.Record(now_ns - next_tick_ns_);
+
+    size_t tick_count = AdvanceTick(now_ns, TickPeriodNs(), tick_catchup_, next_tick_ns_, total_tick_skipped_);
+
+    tick_elapsed_ = tick_count;
+    OnTick();
+    uint64_t ns_end = MonotonicNowNs();
+
+    total_tick_count_ += tick_count;
+
+    tick_cost_.Record(ns_end - now_ns);
+
+    if (metrics_.is_open() && last_publish_ns_ + APP_METRICS_PUBLISH_INTERVAL <= ns_end)
+    {
+        struct timeval tv_now;
+        gettimeofday(&tv_now, NULL);
+
+        metrics_.Publish(TV_TO_MS(tv_now));
+        last_publish_ns_ = ns_end;
+    }
 }
 
 void ApplicationBase::Usage() const
@@ -218,10 +354,29 @@ void ApplicationBase::Usage() const
 	printf("      the identifier of this process.\n");
 	printf("  %s--tick_timer=[millisec]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
 	printf("      the tick timer period, default %d ms.\n", APP_DEFAULT_TICK_TIMER);
+	printf("  %s--tick_catchup=[skip|coalesce|replay]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      what to do with the missed ticks when a tick is late, default skip.\n");
 	printf("  %s--wait=[millisec]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
 	printf("      the milliseconds to wait the previous process to exit, default %d s.\n", 0);
 	printf("  %s--epoll_wait=[millisec]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
-	printf("      the milliseconds for epall_wait to timeout, default %d ms.\n", 0);
+	printf("      the milliseconds for epoll_wait to timeout when the process enter idle status,\n");
+	printf("      0 use idle_sleep instead, -1 wait until the next tick, default %d ms.\n", APP_DEFAULT_EPOLL_WAIT);
+	printf("  %s--proc_batch=[num]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      the max messages for one OnProcBatch, default %d (batch mode off).\n", APP_DEFAULT_PROC_BATCH);
+	printf("  %s--proc_budget=[microsec]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      the max microseconds for one OnProcBatch, never beyond the next tick, 0 no limit, default %d us.\n", APP_DEFAULT_PROC_BUDGET);
+	printf("  %s--workers=[num]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      run OnWorkerProc/OnWorkerTick in this many threads pinned to cpus, default 0 (single thread).\n");
+	printf("  %s--busy_poll:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      never sleep when idle, epoll_wait does not block either, for cpus isolated by isolcpus.\n");
+	printf("  %s--cpu_affinity=[cpu list]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      pin the process to these cpus like taskset -c, e.g. 0,2-3, workers take one each in turn.\n");
+	printf("  %s--sched_policy=[fifo:prio|rr:prio|other]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      the scheduling policy like chrt, e.g. fifo:50, fifo and rr need CAP_SYS_NICE.\n");
+	printf("  %s--mlockall:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      lock all current and future memory, no page faults after init.\n");
+	printf("  %s--numa_node=[node]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      allocate memory only from this node, and run on its cpus if no cpu_affinity.\n");
 	printf("  %s--idle_sleep=[millisec]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
 	printf("      the milliseconds for for sleep when the process enter idle status, default %d ms.\n", APP_DEFAULT_IDLE_SLEEP);
 	printf("  %s--idle_count=[num]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
@@ -235,7 +390,10 @@ void ApplicationBase::Usage() const
 	printf("  %s--log_file=[path]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
 	printf("      the path of the file for logging.\n");
 	printf("  %s--log_level=[num]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
-	printf("      the logging level for this process.\n");
+	printf("      the logging level for this process, 0 TRACE ... 5 FATAL.\n");
+
+	printf("  %s--metrics_dir=[path]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
+	printf("      publish statistics to shared memory under this dir, read by tnt_metrics.\n");
 
 	printf("  %s--runtime_env=[level]:%s\n", COLOR_FG_GREEN, COLOR_RESET);
 	printf("      the env of app running. 0 formal; 1 dev; 2 test; 3 informal\n");
@@ -277,12 +435,23 @@ int ApplicationBase::GetOpt(int argc, char** argv)
 		{"log_level", 1, &opt_char, 'l'},
 
 		{"tick_timer", 1, &opt_char, 't'},
+		{"tick_catchup", 1, &opt_char, 'k'},
 		{"wait", 1, &opt_char, 'w'},
 		{"epoll_wait", 1, &opt_char, 'e'},
 		{"idle_sleep", 1, &opt_char, 's'},
 		{"idle_count", 1, &opt_char, 'c'},
+		{"proc_batch", 1, &opt_char, 'b'},
+		{"proc_budget", 1, &opt_char, 'u'},
+		{"workers", 1, &opt_char, 'W'},
+		{"busy_poll", 0, &opt_char, 'B'},
+
+		{"cpu_affinity", 1, &opt_char, 'a'},
+		{"sched_policy", 1, &opt_char, 'S'},
+		{"mlockall", 0, &opt_char, 'M'},
+		{"numa_node", 1, &opt_char, 'N'},
 
 		{"runtime_env", 1, &opt_char, 'r'},
+		{"metrics_dir", 1, &opt_char, 'm'},
 
 		{"daemon", 0, 0, 'D'},
 		{"version", 0, 0, 'v'},
@@ -307,10 +476,26 @@ int ApplicationBase::GetOpt(int argc, char** argv)
                         tick_timer_ = strtol(optarg, NULL, 0);
                         break;
 
+                    case 'k':
+                        if (0 == strcmp(optarg, "coalesce"))
+                        {
+                            tick_catchup_ = TICK_CATCHUP_COALESCE;
+                        }
+                        else if (0 == strcmp(optarg, "replay"))
+                        {
+                            tick_catchup_ = TICK_CATCHUP_REPLAY;
+                        }
+                        else
+                        {
+                            tick_catchup_ = TICK_CATCHUP_SKIP;
+                        }
+                        break;
+
                     case 'w':
                         break;
 
                     case 'e':
+                        epoll_wait_ = strtol(optarg, NULL, 0);
                         break;
 
                     case 'c':
@@ -321,13 +506,80 @@ int ApplicationBase::GetOpt(int argc, char** argv)
                         idle_sleep_ = strtol(optarg, NULL, 0);
                         break;
 
+                    case 'b':
+                        proc_batch_ = strtol(optarg, NULL, 0);
+                        break;
+
+                    case 'u':
+                        proc_budget_ = strtol(optarg, NULL, 0);
+                        break;
+
+                    case 'W':
+                        workers_ = strtol(optarg, NULL, 0);
+                        break;
+
+                    case 'B':
+                        busy_poll_ = true;
+                        break;
+
+                    case 'a':
+                        if (0 != ParseCpuList(optarg, cpu_affinity_))
+                        {
+                            std::cout << COLOR_FG_RED << "Invalid cpu_affinity " << optarg << COLOR_RESET << std::endl;
+                            exit(-1);
+                        }
+                        break;
+
+                    case 'S':
+                        if (0 == strncmp(optarg, "fifo", 4))
+                        {
+                            sched_policy_ = SCHED_FIFO;
+                        }
+                        else if (0 == strncmp(optarg, "rr", 2))
+                        {
+                            sched_policy_ = SCHED_RR;
+                        }
+                        else if (0 == strncmp(optarg, "other", 5))
+                        {
+                            sched_policy_ = SCHED_OTHER;
+                        }
+                        else
+                        {
+                            std::cout << COLOR_FG_RED << "Invalid sched_policy " << optarg << COLOR_RESET << std::endl;
+                            exit(-1);
+                        }
+
+                        // fifo:50, 不写优先级就用最低的
+                        sched_priority_ = sched_get_priority_min(sched_policy_);
+                        if (NULL != strchr(optarg, ':'))
+                        {
+                            sched_priority_ = strtol(strchr(optarg, ':') + 1, NULL, 0);
+                        }
+                        break;
+
+                    case 'M':
+                        mlockall_ = true;
+                        break;
+
+                    case 'N':
+                        numa_node_ = strtol(optarg, NULL, 0);
+                        break;
+
                     case 'C':
                         conf_file_ = optarg;
                         break;
 
+                    case 'l':
+                        SetLogLevel(static_cast<LogLevel>(strtol(optarg, NULL, 0)));
+                        break;
+
                     case 'r':
                         runtime_env_ = strtol(optarg, NULL, 0);
                         break;
+
+                    case 'm':
+                        metrics_dir_ = optarg;
+                        break;
                }
                break;
 
@@ -495,6 +747,810 @@ void ApplicationBase::SendSignal(unsigned int sig)
     }
 }
 
+int ApplicationBase::InitPoll()
+{
+    if (-1 != epoll_fd_)
+    {
+        return 0;
+    }
+
+    // exec 出去的子进程不需要继承
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == epoll_fd_)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int ApplicationBase::AddPollFd(int fd, unsigned int events)
+{
+    if (0 != InitPoll())
+    {
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    if (0 == ret)
+    {
+        ++poll_fd_count_;
+    }
+
+    return ret;
+}
+
+int ApplicationBase::ModPollFd(int fd, unsigned int events)
+{
+    if (-1 == epoll_fd_)
+    {
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int ApplicationBase::DelPollFd(int fd)
+{
+    if (-1 == epoll_fd_)
+    {
+        return -1;
+    }
+
+    // 2.6.9 之前的内核 EPOLL_CTL_DEL 也要求 event 非空
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+
+    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, &ev);
+    if (0 == ret && poll_fd_count_ > 0)
+    {
+        --poll_fd_count_;
+    }
+
+    return ret;
+}
+
+// 空闲时阻塞等待, 超时时间取 下次Tick, 子类定时器, --epoll_wait 三者最小的
+// 被信号打断时直接返回, 主循环会马上处理 is_exit_/is_reload_
+int ApplicationBase::WaitPoll()
+{
+    if (0 != InitPoll())
+    {
+        usleep(idle_sleep_ * 1000);
+        return -1;
+    }
+
+    // 向上取整, 不然会在Tick之前提前醒来空转
+    uint64_t now_ns = MonotonicNowNs();
+    time_t timeout = 0;
+    if (next_tick_ns_ > now_ns)
+    {
+        timeout = static_cast<time_t>((next_tick_ns_ - now_ns + 999999) / 1000000);
+    }
+
+    time_t next_timeout = OnNextTimeout();
+    if (next_timeout >= 0 && next_timeout < timeout)
+    {
+        timeout = next_timeout;
+    }
+
+    if (epoll_wait_ > 0 && epoll_wait_ < timeout)
+    {
+        timeout = epoll_wait_;
+    }
+
+    // 只看一眼有没有事件
+    if (busy_poll_)
+    {
+        timeout = 0;
+    }
+
+    return DispatchPoll((int)timeout);
+}
+
+// 等到有事件或者超时, 就绪的fd调用 OnPoll, 返回处理了几个
+int ApplicationBase::DispatchPoll(int timeout_ms)
+{
+    int num = epoll_wait(epoll_fd_, poll_events_, MAX_POLL_EVENTS, timeout_ms);
+    if (num < 0)
+    {
+        return (EINTR == errno) ? 0 : -1;
+    }
+
+    for (int i=0; i<num; ++i)
+    {
+        OnPoll(poll_events_[i].data.fd, poll_events_[i].events);
+    }
+
+    return num;
+}
+
+int ApplicationBase::ParseCpuList(const char* str, std::vector<int>& cpus)
+{
+    cpus.clear();
+
+    const char* p = str;
+    while ('\0' != *p)
+    {
+        char* end = NULL;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+
+        long last = first;
+        p = end;
+        if ('-' == *p)
+        {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+            {
+                return -1;
+            }
+            p = end;
+        }
+
+        for (long cpu=first; cpu<=last; ++cpu)
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+
+        if (',' == *p)
+        {
+            ++p;
+        }
+        else if ('\0' != *p && '\n' != *p)
+        {
+            return -1;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return cpus.empty() ? -1 : 0;
+}
+
+int ApplicationBase::ApplyRuntimeOptions()
+{
+    int failed = 0;
+
+    if (numa_node_ >= 0)
+    {
+        // 和 ShmMmap 一样直接走系统调用, 不依赖libnuma
+        unsigned long node_mask[16] = {0};
+        unsigned long max_node = sizeof(node_mask) * 8;
+        std::size_t bits = sizeof(node_mask[0]) * 8;
+        if (static_cast<unsigned long>(numa_node_) < max_node)
+        {
+            node_mask[numa_node_ / bits] |= 1UL << (numa_node_ % bits);
+        }
+
+        if (static_cast<unsigned long>(numa_node_) >= max_node
+            || 0 != syscall(SYS_set_mempolicy, MPOL_BIND, node_mask, max_node))
+        {
+            std::cout << COLOR_FG_RED << "set_mempolicy failed, numa_node = " << numa_node_
+                << ", errno = " << errno << COLOR_RESET << std::endl;
+            ++failed;
+        }
+
+        // 没有指定CPU时用这个节点的
+        if (cpu_affinity_.empty())
+        {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numa_node_);
+            FILE* fp = fopen(path, "r");
+            if (NULL != fp)
+            {
+                char cpu_list[1024] = {0};
+                if (NULL == fgets(cpu_list, sizeof(cpu_list), fp) || 0 != ParseCpuList(cpu_list, cpu_affinity_))
+                {
+                    cpu_affinity_.clear();
+                }
+                fclose(fp);
+            }
+        }
+    }
+
+    if (!cpu_affinity_.empty())
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (std::size_t i=0; i<cpu_affinity_.size(); ++i)
+        {
+            CPU_SET(cpu_affinity_[i], &cpu_set);
+        }
+
+        if (0 != sched_setaffinity(0, sizeof(cpu_set), &cpu_set))
+        {
+            std::cout << COLOR_FG_RED << "sched_setaffinity failed, errno = " << errno << COLOR_RESET << std::endl;
+            ++failed;
+        }
+    }
+
+    // 工作线程创建时继承
+    if (sched_policy_ >= 0)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = (SCHED_OTHER == sched_policy_) ? 0 : sched_priority_;
+        if (0 != sched_setscheduler(0, sched_policy_, &param))
+        {
+            std::cout << COLOR_FG_RED << "sched_setscheduler failed, policy = " << sched_policy_
+                << ", priority = " << param.sched_priority << ", errno = " << errno << COLOR_RESET << std::endl;
+            ++failed;
+        }
+    }
+
+    // 最后锁, 锁住的页已经在绑定的节点上了
+    if (mlockall_)
+    {
+        if (0 != mlockall(MCL_CURRENT | MCL_FUTURE))
+        {
+            std::cout << COLOR_FG_RED << "mlockall failed, errno = " << errno << COLOR_RESET << std::endl;
+            ++failed;
+        }
+    }
+
+    return failed;
+}
+
+// 文件名是 metrics_dir/app_name.id.metrics, 重启后还用同一个
+int ApplicationBase::InitMetrics()
+{
+    if (0 != mkdir(metrics_dir_.c_str(), 0755) && EEXIST != errno)
+    {
+        return -1;
+    }
+
+    std::string file = metrics_dir_ + "/" + app_name_;
+    if (!id_.empty())
+    {
+        file += "." + id_;
+    }
+    file += ".metrics";
+
+    struct timeval tv_now;
+    gettimeofday(&tv_now, NULL);
+
+    if (0 != metrics_.Open(file.c_str(), app_name_.c_str(), id_.c_str(), TV_TO_MS(tv_now)))
+    {
+        return -1;
+    }
+
+    metrics_.RegisterCounter("total_proc_count", &total_proc_count_);
+    metrics_.RegisterCounter("total_tick_count", &total_tick_count_);
+    metrics_.RegisterCounter("total_idle_count", &total_ilde_count_);
+    metrics_.RegisterCounter("total_msg_count", &total_msg_count_);
+    metrics_.RegisterCounter("total_tick_skipped", &total_tick_skipped_);
+    metrics_.RegisterHistogram("proc_latency", &proc_cost_);
+    metrics_.RegisterHistogram("msg_latency", &msg_cost_);
+    metrics_.RegisterHistogram("tick_latency", &tick_cost_);
+    metrics_.RegisterHistogram("tick_jitter", &tick_jitter_);
+    metrics_.RegisterHistogram("idle_latency", &idle_cost_);
+
+    return 0;
+}
+
+WorkerContext::WorkerContext(int worker_id, int worker_count)
+{
+    worker_id_ = worker_id;
+    worker_count_ = worker_count;
+    data_ = NULL;
+
+    event_fd_ = -1;
+    epoll_fd_ = -1;
+    poll_fd_count_ = 0;
+    commands_.store(0, std::memory_order_relaxed);
+    init_state_.store(0, std::memory_order_relaxed);
+
+    next_tick_ns_ = 0;
+    total_proc_count_ = 0;
+    total_tick_count_ = 0;
+    total_ilde_count_ = 0;
+    total_tick_skipped_ = 0;
+    tick_elapsed_ = 0;
+
+    last_save_ns_ = 0;
+    saved_proc_count_ = 0;
+    saved_tick_count_ = 0;
+    saved_idle_count_ = 0;
+    saved_tick_skipped_ = 0;
+}
+
+WorkerContext::~WorkerContext()
+{
+    Close();
+}
+
+int WorkerContext::Open()
+{
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == event_fd_ || -1 == epoll_fd_)
+    {
+        Close();
+        return -1;
+    }
+
+    if (0 != AddPollFd(event_fd_, EPOLLIN))
+    {
+        Close();
+        return -1;
+    }
+    // 命令每圈都会看, 自己的eventfd不算
+    poll_fd_count_ = 0;
+
+    return 0;
+}
+
+void WorkerContext::Close()
+{
+    if (-1 != epoll_fd_)
+    {
+        close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
+
+    if (-1 != event_fd_)
+    {
+        close(event_fd_);
+        event_fd_ = -1;
+    }
+}
+
+int WorkerContext::AddPollFd(int fd, unsigned int events)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    if (0 == ret)
+    {
+        ++poll_fd_count_;
+    }
+
+    return ret;
+}
+
+int WorkerContext::DelPollFd(int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+
+    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, &ev);
+    if (0 == ret && poll_fd_count_ > 0)
+    {
+        --poll_fd_count_;
+    }
+
+    return ret;
+}
+
+void WorkerContext::Notify(uint32_t cmd)
+{
+    commands_.fetch_or(cmd, std::memory_order_release);
+
+    uint64_t one = 1;
+    ssize_t ret = write(event_fd_, &one, sizeof(one));
+    (void)ret;
+}
+
+int WorkerContext::Wait(int timeout_ms, ApplicationBase* app)
+{
+    static const int MAX_WORKER_POLL_EVENTS = 64;
+    struct epoll_event events[MAX_WORKER_POLL_EVENTS];
+
+    int num = epoll_wait(epoll_fd_, events, MAX_WORKER_POLL_EVENTS, timeout_ms);
+    if (num < 0)
+    {
+        return (EINTR == errno) ? 0 : -1;
+    }
+
+    for (int i=0; i<num; ++i)
+    {
+        if (events[i].data.fd == event_fd_)
+        {
+            // 命令在 commands_ 里, 这里只是清掉
+            uint64_t value = 0;
+            ssize_t ret = read(event_fd_, &value, sizeof(value));
+            (void)ret;
+            continue;
+        }
+
+        app->OnWorkerPoll(*this, events[i].data.fd, events[i].events);
+    }
+
+    return num;
+}
+
+void WorkerContext::SaveStat(uint64_t now_ns)
+{
+    // 工作线程不等主线程
+    if (!stat_mutex_.try_lock())
+    {
+        return;
+    }
+
+    saved_proc_count_ = total_proc_count_;
+    saved_tick_count_ = total_tick_count_;
+    saved_idle_count_ = total_ilde_count_;
+    saved_tick_skipped_ = total_tick_skipped_;
+    saved_proc_cost_ = proc_cost_;
+    saved_tick_cost_ = tick_cost_;
+    saved_tick_jitter_ = tick_jitter_;
+    stat_mutex_.unlock();
+
+    last_save_ns_ = now_ns;
+}
+
+int WorkerContext::RegisterMetrics(ShmMetrics& metrics)
+{
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "worker%d_", worker_id_);
+    const std::string name = prefix;
+
+    int ret = 0;
+    ret |= metrics.RegisterCounter((name + "total_proc_count").c_str(), &saved_proc_count_);
+    ret |= metrics.RegisterCounter((name + "total_tick_count").c_str(), &saved_tick_count_);
+    ret |= metrics.RegisterCounter((name + "total_idle_count").c_str(), &saved_idle_count_);
+    ret |= metrics.RegisterCounter((name + "total_tick_skipped").c_str(), &saved_tick_skipped_);
+    ret |= metrics.RegisterHistogram((name + "proc_latency").c_str(), &saved_proc_cost_);
+    ret |= metrics.RegisterHistogram((name + "tick_latency").c_str(), &saved_tick_cost_);
+    ret |= metrics.RegisterHistogram((name + "tick_jitter").c_str(), &saved_tick_jitter_);
+
+    return (0 == ret) ? 0 : -1;
+}
+
+const std::string WorkerContext::StatStr() const
+{
+    std::ostringstream stream;
+    stream << "worker_id:" << worker_id_ << ";";
+    stream << "total_proc_count_:" << total_proc_count_ << ";";
+    stream << "total_tick_count_:" << total_tick_count_ << ";";
+    stream << "total_ilde_count_:" << total_ilde_count_ << ";";
+    stream << "total_tick_skipped_:" << total_tick_skipped_ << ";";
+    stream << std::endl;
+
+    stream << proc_cost_.StatStr("proc") << std::endl;
+    stream << tick_cost_.StatStr("tick") << std::endl;
+    stream << tick_jitter_.StatStr("tick_jitter") << std::endl;
+
+    return stream.str();
+}
+
+void WorkerContext::ResetStat()
+{
+    proc_cost_.Reset();
+    tick_cost_.Reset();
+    tick_jitter_.Reset();
+}
+
+// 工作线程模式的主线程: 起线程, 用signalfd收信号, 再转给各个线程
+int ApplicationBase::RunWorkers()
+{
+    // 在起线程之前屏蔽, 新线程会继承, 这些信号就只能从signalfd读到
+    sigset_t mask;
+    sigset_t old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (-1 == signal_fd)
+    {
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        return -1;
+    }
+
+    is_run_ = true;
+
+    std::vector<WorkerContext*> workers;
+    int ret = 0;
+    for (int i=0; i<workers_; ++i)
+    {
+        WorkerContext* ctx = new WorkerContext(i, workers_);
+        workers.push_back(ctx);
+        if (0 != ctx->Open())
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    // RunTick 不会跑, 主线程发布各个线程拷出来的统计
+    for (size_t i=0; 0 == ret && metrics_.is_open() && i<workers.size(); ++i)
+    {
+        if (0 != workers[i]->RegisterMetrics(metrics_))
+        {
+            std::cout << COLOR_FG_RED << "Worker " << i << " Register Metrics Error" << COLOR_RESET << std::endl;
+            break;
+        }
+    }
+
+    if (0 == ret)
+    {
+        for (size_t i=0; i<workers.size(); ++i)
+        {
+            workers[i]->thread_ = std::thread(&ApplicationBase::WorkerLoop, this, workers[i]);
+        }
+
+        // 等所有线程的 OnWorkerInit, 有一个失败就都退出
+        for (size_t i=0; i<workers.size(); ++i)
+        {
+            while (0 == workers[i]->init_state_.load(std::memory_order_acquire))
+            {
+                usleep(1000);
+            }
+
+            if (1 != workers[i]->init_state_.load(std::memory_order_acquire))
+            {
+                std::cout << COLOR_FG_RED << "Worker " << i << " Init Error" << COLOR_RESET << std::endl;
+                ret = -1;
+            }
+        }
+    }
+
+    while (0 == ret)
+    {
+        // 信号处理函数被其他没有屏蔽信号的线程(比如启动前就有的)执行了, 也要看
+        if (is_reload_)
+        {
+            is_reload_ = false;
+            OnReload();
+            NotifyWorkers(workers, WorkerContext::WORKER_CMD_RELOAD);
+        }
+
+        if (is_exit_)
+        {
+            break;
+        }
+
+        if (metrics_.is_open())
+        {
+            PublishWorkerMetrics(workers);
+        }
+
+        struct pollfd pfd;
+        pfd.fd = signal_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, APP_DEFAULT_TICK_TIMER) <= 0)
+        {
+            continue;
+        }
+
+        struct signalfd_siginfo info;
+        while (sizeof(info) == read(signal_fd, &info, sizeof(info)))
+        {
+            switch (info.ssi_signo)
+            {
+                case SIGUSR1:
+                    is_reload_ = true;
+                    break;
+
+                case SIGUSR2:
+                    break;
+
+                default:
+                    is_exit_ = true;
+                    break;
+            }
+        }
+    }
+
+    NotifyWorkers(workers, WorkerContext::WORKER_CMD_EXIT);
+    for (size_t i=0; i<workers.size(); ++i)
+    {
+        if (workers[i]->thread_.joinable())
+        {
+            workers[i]->thread_.join();
+        }
+        workers[i]->SaveStat(MonotonicNowNs());
+    }
+
+    // 退出前再发布一次最终的, 之后注册的地址就没了
+    if (metrics_.is_open())
+    {
+        last_publish_ns_ = 0;
+        PublishWorkerMetrics(workers);
+        metrics_.Close();
+    }
+
+    for (size_t i=0; i<workers.size(); ++i)
+    {
+        delete workers[i];
+    }
+
+    if (0 == ret)
+    {
+        OnStop();
+        OnExit();
+    }
+
+    is_run_ = false;
+    close(signal_fd);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    return ret;
+}
+
+void ApplicationBase::NotifyWorkers(std::vector<WorkerContext*>& workers, uint32_t cmd)
+{
+    for (size_t i=0; i<workers.size(); ++i)
+    {
+        if (-1 != workers[i]->event_fd_)
+        {
+            workers[i]->Notify(cmd);
+        }
+    }
+}
+
+void ApplicationBase::PublishWorkerMetrics(std::vector<WorkerContext*>& workers)
+{
+    uint64_t now_ns = MonotonicNowNs();
+    if (last_publish_ns_ + APP_METRICS_PUBLISH_INTERVAL > now_ns)
+    {
+        return;
+    }
+
+    for (size_t i=0; i<workers.size(); ++i)
+    {
+        workers[i]->stat_mutex_.lock();
+    }
+
+    struct timeval tv_now;
+    gettimeofday(&tv_now, NULL);
+    metrics_.Publish(TV_TO_MS(tv_now));
+    last_publish_ns_ = now_ns;
+
+    for (size_t i=0; i<workers.size(); ++i)
+    {
+        workers[i]->stat_mutex_.unlock();
+    }
+}
+
+// 和单线程的 Run 一样的循环, 只是各个回调带上自己的 WorkerContext
+void ApplicationBase::WorkerLoop(WorkerContext* ctx)
+{
+    // 绑到一个CPU上, 失败了也照样跑
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!cpu_affinity_.empty())
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu_affinity_[ctx->worker_id() % cpu_affinity_.size()], &cpu_set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    }
+    else if (cpu_count > 0)
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(ctx->worker_id() % cpu_count, &cpu_set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    }
+
+    if (0 != OnWorkerInit(*ctx))
+    {
+        ctx->init_state_.store(-1, std::memory_order_release);
+        return;
+    }
+    ctx->init_state_.store(1, std::memory_order_release);
+
+    const uint64_t period_ns = TickPeriodNs();
+    const bool is_metrics_open = metrics_.is_open();
+    size_t ilde_count = 0;
+    size_t busy_count = 0;
+    ctx->next_tick_ns_ = MonotonicNowNs();
+    while (true)
+    {
+        // 平时只是一次读
+        if (0 != ctx->commands_.load(std::memory_order_relaxed))
+        {
+            // 先reload再退出, 和发信号的顺序一致
+            uint32_t cmds = ctx->commands_.exchange(0, std::memory_order_acquire);
+            if (cmds & WorkerContext::WORKER_CMD_RELOAD)
+            {
+                OnWorkerReload(*ctx);
+            }
+
+            if (cmds & WorkerContext::WORKER_CMD_EXIT)
+            {
+                break;
+            }
+        }
+
+        uint64_t ns_start = MonotonicNowNs();
+        int ret = OnWorkerProc(*ctx);
+        uint64_t ns_end = MonotonicNowNs();
+        ++ctx->total_proc_count_;
+        ctx->proc_cost_.Record(ns_end - ns_start);
+
+        if (ret < 0)
+        {
+            ++ilde_count;
+            ++ctx->total_ilde_count_;
+        }
+        else
+        {
+            ilde_count = 0;
+        }
+
+        if (ctx->next_tick_ns_ <= ns_end)
+        {
+            ctx->tick_jitter_.Record(ns_end - ctx->next_tick_ns_);
+            size_t tick_count = AdvanceTick(ns_end, period_ns, tick_catchup_,
+                                            ctx->next_tick_ns_, ctx->total_tick_skipped_);
+
+            ctx->tick_elapsed_ = tick_count;
+            OnWorkerTick(*ctx);
+            ctx->total_tick_count_ += tick_count;
+            uint64_t tick_end_ns = MonotonicNowNs();
+            ctx->tick_cost_.Record(tick_end_ns - ns_end);
+
+            if (is_metrics_open && ctx->last_save_ns_ + APP_METRICS_PUBLISH_INTERVAL <= tick_end_ns)
+            {
+                ctx->SaveStat(tick_end_ns);
+            }
+        }
+
+        if (ilde_count >= idle_count_)
+        {
+            ilde_count = 0;
+
+            // 等到下一次Tick, 有事件或者命令会提前醒
+            uint64_t now_ns = MonotonicNowNs();
+            time_t timeout = 0;
+            if (ctx->next_tick_ns_ > now_ns)
+            {
+                timeout = static_cast<time_t>((ctx->next_tick_ns_ - now_ns + 999999) / 1000000);
+            }
+
+            if (0 == epoll_wait_ && idle_sleep_ < timeout)
+            {
+                timeout = idle_sleep_;
+            }
+            else if (epoll_wait_ > 0 && epoll_wait_ < timeout)
+            {
+                timeout = epoll_wait_;
+            }
+
+            if (busy_poll_)
+            {
+                timeout = 0;
+            }
+
+            ctx->Wait(static_cast<int>(timeout), this);
+        }
+        else if (ctx->poll_fd_count_ > 0 && ++busy_count >= APP_BUSY_POLL_INTERVAL)
+        {
+            busy_count = 0;
+            ctx->Wait(0, this);
+        }
+    }
+
+    OnWorkerExit(*ctx);
+}
+
 void ApplicationBase::ExitProcessCtrl(int )
 {
     is_exit_ = true;
@@ -537,31 +1593,28 @@ const std::string ApplicationBase::StatStr() const
     stream << "total_proc_count_:" << total_proc_count_ << ";";
     stream << "total_tick_count_:" << total_tick_count_ << ";";
     stream << "total_ilde_count_:" << total_ilde_count_ << ";";
+    stream << "total_msg_count_:" << total_msg_count_ << ";";
+    stream << "total_tick_skipped_:" << total_tick_skipped_ << ";";
     stream << std::endl;
 
-    stream << "proc_min_cost_:" << proc_min_cost_ << ";";
-    stream << "proc_max_cost_:" << proc_max_cost_ << ";";
-    stream << "proc_last_cost_:" << proc_last_cost_ << ";";
-    stream << "proc_total_cost_:" << proc_total_cost_ << ";";
-    if (total_proc_count_ > 0)
-    {
-        stream << "proc_average_cost_:" << proc_total_cost_/total_proc_count_ << ";";
-    }
-    stream << std::endl;
-
-    stream << "tick_min_cost_:" << tick_min_cost_ << ";";
-    stream << "tick_max_cost_:" << tick_max_cost_ << ";";
-    stream << "tick_last_cost_:" << tick_last_cost_ << ";";
-    stream << "tick_total_cost_:" << tick_total_cost_ << ";";
-    if (total_tick_count_ > 0)
-    {
-        stream << "tick_average_cost_:" << tick_total_cost_/total_tick_count_ << ";";
-    }
-    stream << std::endl;
+    stream << proc_cost_.StatStr("proc") << std::endl;
+    stream << msg_cost_.StatStr("msg") << std::endl;
+    stream << tick_cost_.StatStr("tick") << std::endl;
+    stream << tick_jitter_.StatStr("tick_jitter") << std::endl;
+    stream << idle_cost_.StatStr("idle") << std::endl;
 
     return stream.str();
 }
 
+void ApplicationBase::ResetStat()
+{
+    proc_cost_.Reset();
+    msg_cost_.Reset();
+    tick_cost_.Reset();
+    tick_jitter_.Reset();
+    idle_cost_.Reset();
+}
+
 const std::string ApplicationBase::OptStr() const
 {
     std::ostringstream stream;
@@ -569,13 +1622,31 @@ const std::string ApplicationBase::OptStr() const
     stream << std::endl;
     stream << "conf_file = " <<  conf_file_ << std::endl;
     stream << "id = " << id_  << std::endl;
+    stream << "log_level = " << GetLogLevel() << std::endl;
 
     stream << "idle_count = " << idle_count_ << std::endl;
     stream << "idle_sleep(ms) = " << idle_sleep_  << std::endl;
 
     stream << "tick_timer(ms) = " << tick_timer_ << std::endl;
+    stream << "tick_catchup = " << tick_catchup_ << std::endl;
+    stream << "epoll_wait(ms) = " << epoll_wait_ << std::endl;
+    stream << "proc_batch = " << proc_batch_ << std::endl;
+    stream << "proc_budget(us) = " << proc_budget_ << std::endl;
+    stream << "workers = " << workers_ << std::endl;
+    stream << "busy_poll = " << busy_poll_ << std::endl;
+
+    stream << "cpu_affinity = ";
+    for (std::size_t i=0; i<cpu_affinity_.size(); ++i)
+    {
+        stream << (0 == i ? "" : ",") << cpu_affinity_[i];
+    }
+    stream << std::endl;
+    stream << "sched_policy = " << sched_policy_ << ":" << sched_priority_ << std::endl;
+    stream << "mlockall = " << mlockall_ << std::endl;
+    stream << "numa_node = " << numa_node_ << std::endl;
 
     stream << "pid_file = " << pid_file_ << std::endl;
+    stream << "metrics_dir = " << metrics_dir_ << std::endl;
 
     return stream.str();
 }
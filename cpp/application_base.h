@@ -38,12 +38,166 @@
 #define APPLICATION_BASE_H
 
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include "latency_histogram.h"
+#include "shm_metrics.h"
 
 namespace tnt
 {
 
+/**
+ * @brief:  批处理模式下一次 OnProcBatch 的预算
+ *
+ * 每处理完一条消息调用一次 Consume, 记这条消息的耗时, 返回 false 时
+ * 条数或者时间用完了, 应该马上返回. 至少可以处理一条
+ */
+class ProcBudget
+{
+public:
+    ProcBudget(uint64_t begin_ns, std::size_t max_msgs, uint64_t deadline_ns, LatencyHistogram* msg_cost) :
+        max_msgs_(max_msgs),
+        deadline_ns_(deadline_ns),
+        last_ns_(begin_ns),
+        processed_(0),
+        msg_cost_(msg_cost)
+    {
+    }
+
+    bool Consume()
+    {
+        uint64_t now_ns = MonotonicNowNs();
+        msg_cost_->Record(now_ns - last_ns_);
+        last_ns_ = now_ns;
+        ++processed_;
+
+        return processed_ < max_msgs_ && now_ns < deadline_ns_;
+    }
+
+    inline std::size_t processed() const {return processed_;}
+    inline std::size_t max_msgs() const {return max_msgs_;}
+    // CLOCK_MONOTONIC, 纳秒, 不会晚于下一次Tick
+    inline uint64_t deadline_ns() const {return deadline_ns_;}
+
+private:
+    std::size_t max_msgs_;
+    uint64_t deadline_ns_;
+    uint64_t last_ns_;
+    std::size_t processed_;
+    LatencyHistogram* msg_cost_;
+};
+
+class ApplicationBase;
+
+/**
+ * @brief:  工作线程模式下每个线程一个, 分片自己的状态和统计
+ *
+ * 除了 Notify 都只在自己的工作线程里用
+ */
+class WorkerContext
+{
+public:
+    enum WorkerCommand
+    {
+        WORKER_CMD_RELOAD = 0x01,
+        WORKER_CMD_EXIT = 0x02,
+    };
+
+public:
+    WorkerContext(int worker_id, int worker_count);
+    ~WorkerContext();
+
+    inline int worker_id() const {return worker_id_;}
+    inline int worker_count() const {return worker_count_;}
+
+    // 分片自己的状态, 一般在 OnWorkerInit 里设置, OnWorkerExit 里释放
+    inline void* data() const {return data_;}
+    inline void set_data(void* data) {data_ = data;}
+
+    // 工作线程自己的epoll, 有事件时进入 OnWorkerPoll
+    int AddPollFd(int fd, unsigned int events = EPOLLIN);
+    int DelPollFd(int fd);
+
+    inline size_t total_proc_count() const {return total_proc_count_;}
+    inline size_t total_tick_count() const {return total_tick_count_;}
+    inline size_t total_tick_skipped() const {return total_tick_skipped_;}
+    inline size_t tick_elapsed() const {return tick_elapsed_;}
+    inline const LatencyHistogram& proc_cost() const {return proc_cost_;}
+    inline const LatencyHistogram& tick_cost() const {return tick_cost_;}
+    inline const LatencyHistogram& tick_jitter() const {return tick_jitter_;}
+
+    const std::string StatStr() const;
+    void ResetStat();
+
+private:
+    friend class ApplicationBase;
+
+    // 0 成功, -1 创建eventfd或者epoll失败
+    int Open();
+    void Close();
+
+    // 主线程调用, 设置命令再敲eventfd, 空闲时也能马上醒
+    void Notify(uint32_t cmd);
+
+    // 等到有事件或者超时, 返回处理了几个事件
+    int Wait(int timeout_ms, ApplicationBase* app);
+
+    // 工作线程调, 拷一份统计给主线程发布, 主线程正在发布就下一圈再拷
+    void SaveStat(uint64_t now_ns);
+    // 主线程调, 注册拷出来的那份, 名字前面加 workerN_
+    int RegisterMetrics(ShmMetrics& metrics);
+
+private:
+    int worker_id_;
+    int worker_count_;
+    void* data_;
+
+    int event_fd_;
+    int epoll_fd_;
+    // 子类注册的fd个数, 不含 event_fd_
+    size_t poll_fd_count_;
+    std::atomic<uint32_t> commands_;
+    // 0 还在初始化, 1 成功, -1 失败
+    std::atomic<int> init_state_;
+    std::thread thread_;
+
+    uint64_t next_tick_ns_;
+    size_t total_proc_count_;
+    size_t total_tick_count_;
+    size_t total_ilde_count_;
+    size_t total_tick_skipped_;
+    size_t tick_elapsed_;
+
+    LatencyHistogram proc_cost_;
+    LatencyHistogram tick_cost_;
+    LatencyHistogram tick_jitter_;
+
+    // 拷给主线程发布到共享内存的, 由 stat_mutex_ 保护
+    std::mutex stat_mutex_;
+    uint64_t last_save_ns_;
+    uint64_t saved_proc_count_;
+    uint64_t saved_tick_count_;
+    uint64_t saved_idle_count_;
+    uint64_t saved_tick_skipped_;
+    LatencyHistogram saved_proc_cost_;
+    LatencyHistogram saved_tick_cost_;
+    LatencyHistogram saved_tick_jitter_;
+};
+
 class ApplicationBase
 {
+public:
+    // Tick晚了超过一个周期时怎么补, --tick_catchup
+    enum TickCatchup
+    {
+        TICK_CATCHUP_SKIP = 0,      // 错过的不补, 只调一次 OnTick, total_tick_count 只加1
+        TICK_CATCHUP_COALESCE = 1,  // 只调一次 OnTick, total_tick_count 加上错过的, 见 tick_elapsed()
+        TICK_CATCHUP_REPLAY = 2,    // 错过几次补几次, 每圈主循环补一次
+    };
+
 public:
     ApplicationBase();
     virtual ~ApplicationBase();
@@ -53,8 +207,10 @@ protected:
     // 初始化, 这里子类只关心配置文件的路径就行了
     virtual int OnInit(const char* conf_file) = 0;
     // 定时进入, 定时时间可配, 默认100MS
+    // 按 CLOCK_MONOTONIC 对齐到 启动时间 + n*tick_timer, 晚了不会累积
     virtual int OnTick(){return 0;}
     // 重载
+    // 日志限流和uin白名单也在这里重新加载, 见 log_limiter.h
     virtual int OnReload(){return 0;}
 
     // 主处理逻辑 例如收消息
@@ -65,6 +221,13 @@ protected:
     // 如果服务比较空闲，则会进入IDLE
     virtual int OnProc() = 0;
 
+    // 批处理模式, --proc_batch 大于1 或者 --proc_budget 不为0 时代替 OnProc
+    // 一次处理多条消息, 直到 budget 的条数用完, 超过 --proc_budget 微秒,
+    // 或者到了下一次Tick, 所以不会让Tick漂移
+    // 返回处理了多少条, 0 表示没事做(计入空闲)
+    // 默认循环调用 OnProc, 直到它返回<0; 子类可以自己批量收包, 每条调用 budget.Consume()
+    virtual int OnProcBatch(ProcBudget& budget);
+
     // 进入Idle之前
     virtual int OnIdle(){return 0;}
     // 进程退出之前, 直接kill掉
@@ -72,6 +235,50 @@ protected:
     // 进程停止之前, 使用stop参数
     virtual int OnStop(){return 0;}
 
+    // epoll 模式下, 注册的fd有事件时进入
+    virtual int OnPoll(int fd, unsigned int events){return 0;}
+
+    // 子类自己维护的定时器下一次到期还有多少毫秒, <0 表示没有
+    // epoll 模式下用来计算 epoll_wait 最多可以阻塞多久
+    virtual time_t OnNextTimeout(){return -1;}
+
+    // 工作线程模式, --workers=N 大于0时 Run 起N个线程, 每个绑一个CPU
+    // (有 --cpu_affinity 时在列表里轮流绑),
+    // 各自跑下面这套 Proc/Tick 循环, 不再调用 OnProc/OnTick/OnIdle
+    // 1 OnInit 还在主线程, 加载的配置之后只读, 所有线程共享
+    // 2 分片自己的状态放在 WorkerContext 里, 在 OnWorkerInit 里创建,
+    //   在本线程里分配, 内存离这个CPU近
+    // 3 信号都在主线程用signalfd收, 再通过每个线程的eventfd通知:
+    //   reload 先在主线程调 OnReload, 再在每个线程里调 OnWorkerReload;
+    //   stop/kill 每个线程调 OnWorkerExit 退出, 都退出以后主线程调 OnStop/OnExit
+    //   XXX: OnReload 改共享的配置时, 要新建一份再替换, 工作线程还在读旧的
+    virtual int OnWorkerInit(WorkerContext& ctx){return 0;}
+    // 和 OnProc 一样, <0 表示没事做
+    virtual int OnWorkerProc(WorkerContext& ctx){return -1;}
+    virtual int OnWorkerTick(WorkerContext& ctx){return 0;}
+    virtual int OnWorkerReload(WorkerContext& ctx){return 0;}
+    virtual int OnWorkerPoll(WorkerContext& ctx, int fd, unsigned int events){return 0;}
+    virtual int OnWorkerExit(WorkerContext& ctx){return 0;}
+
+protected:
+    // 提供给子类调用的接口
+    // epoll 事件循环
+    // --epoll_wait 不为0时, 空闲时不再usleep, 而是阻塞在epoll_wait上,
+    // 直到注册的fd(bus pipe, socket, eventfd, timerfd...)就绪,
+    // 或者下一次Tick/定时器到期
+    // --busy_poll 时 epoll_wait 不阻塞, 没有epoll也不usleep
+    // OnProc 一直有事做时, 每 APP_BUSY_POLL_INTERVAL 圈不阻塞地看一次注册的fd
+    int AddPollFd(int fd, unsigned int events = EPOLLIN);
+    int ModPollFd(int fd, unsigned int events);
+    int DelPollFd(int fd);
+
+    // 共享内存统计, --metrics_dir 不为空时在 OnInit 之前打开
+    // 子类可以在 OnInit 里注册自己的计数器和直方图, 主循环每秒发布一次
+    // 工作线程模式下由主线程发布, 各个线程的统计带 workerN_ 前缀,
+    // 子类注册的变量也是主线程读, 不要注册工作线程里在改的
+    // 没有打开时注册返回-1
+    inline ShmMetrics& metrics() {return metrics_;}
+
 public:
     // 提供给调用者的接口
     void Init(int argc, char** argv);
@@ -91,19 +298,52 @@ public:
 
     /**
      * @brief:  获取统计数据
+     *
+     * proc, tick, idle 的耗时分位数是从上次 ResetStat 开始的
      */
     const std::string StatStr() const;
 
+    /**
+     * @brief:  清空耗时直方图, 每个统计周期打完 StatStr 以后调用
+     * 总次数不清
+     */
+    void ResetStat();
+
+    // 耗时直方图, 纳秒
+    // 批处理模式下 proc 是每批, msg 是每条
+    inline const LatencyHistogram& proc_cost() const {return proc_cost_;}
+    inline const LatencyHistogram& msg_cost() const {return msg_cost_;}
+    inline const LatencyHistogram& tick_cost() const {return tick_cost_;}
+    inline const LatencyHistogram& idle_cost() const {return idle_cost_;}
+
     /**
      * @brief: 总tick数, 结合tick_timer可以精确控制定时
      */
     inline size_t total_tick_count() const {return total_tick_count_;}
 
+    /**
+     * @brief: 这次 OnTick 代表几个周期, 只有 TICK_CATCHUP_COALESCE 会大于1
+     */
+    inline size_t tick_elapsed() const {return tick_elapsed_;}
+
+    // 因为 TICK_CATCHUP_SKIP 没有调用的Tick数
+    inline size_t total_tick_skipped() const {return total_tick_skipped_;}
+
+    // 每次 OnTick 比计划晚了多少, 纳秒
+    inline const LatencyHistogram& tick_jitter() const {return tick_jitter_;}
+
     /**
      * @brief:  获取运行的环境
      */
     inline int runtime_env() const {return runtime_env_;}
 
+    /**
+     * @brief:  解析CPU列表, 格式和 taskset -c 一样, 如 "0,2-3"
+     *
+     * @return 0 成功, -1 格式不对
+     */
+    static int ParseCpuList(const char* str, std::vector<int>& cpus);
+
 private:
     void InitSigHandler();
     void MakeDaemon();
@@ -111,6 +351,28 @@ private:
     pid_t ReadPid();
     void SendSignal(unsigned int sig);
 
+    int InitPoll();
+    int WaitPoll();
+    int DispatchPoll(int timeout_ms);
+
+    int InitMetrics();
+
+    // --cpu_affinity --sched_policy --mlockall --numa_node, OnInit 之前调用
+    // 都是尽力而为, 返回失败的个数
+    int ApplyRuntimeOptions();
+
+    uint64_t BatchDeadline(uint64_t now_ns) const;
+
+    uint64_t TickPeriodNs() const;
+    void RunTick(uint64_t now_ns);
+
+    int RunWorkers();
+    void WorkerLoop(WorkerContext* ctx);
+    void NotifyWorkers(std::vector<WorkerContext*>& workers, uint32_t cmd);
+    void PublishWorkerMetrics(std::vector<WorkerContext*>& workers);
+
+    friend class WorkerContext;
+
     void Usage() const;
     int GetOpt(int argc, char** argv);
 
@@ -131,18 +393,22 @@ private:
     size_t total_proc_count_;
     size_t total_tick_count_;
     size_t total_ilde_count_;
+    size_t total_msg_count_;
 
-    float proc_min_cost_;
-    float proc_max_cost_;
-    float proc_last_cost_;
-    float proc_total_cost_;
+    // OnProc, OnTick, 空闲(OnIdle + sleep/epoll_wait) 的耗时
+    LatencyHistogram proc_cost_;
+    LatencyHistogram msg_cost_;
+    LatencyHistogram tick_cost_;
+    LatencyHistogram idle_cost_;
 
-    float tick_min_cost_;
-    float tick_max_cost_;
-    float tick_last_cost_;
-    float tick_total_cost_;
+    // 下一次Tick的计划时间, CLOCK_MONOTONIC 纳秒
+    uint64_t next_tick_ns_;
+    size_t tick_elapsed_;
+    size_t total_tick_skipped_;
+    LatencyHistogram tick_jitter_;
 
-    time_t last_tick_ms_;
+    ShmMetrics metrics_;
+    uint64_t last_publish_ns_;
 
     // version
     std::string version_major_;
@@ -161,8 +427,36 @@ private:
     size_t idle_count_;
     time_t idle_sleep_;
     time_t tick_timer_;
+    int tick_catchup_;
+    // 0 不使用epoll; >0 epoll_wait 最多阻塞的毫秒数; <0 一直阻塞到下次Tick
+    time_t epoll_wait_;
+    // 批处理, 一次最多处理多少条, 最多多少微秒
+    size_t proc_batch_;
+    time_t proc_budget_;
+    // 工作线程数, 0 是原来的单线程
+    int workers_;
+    // 空闲时不睡, 只轮询, 给 isolcpus 隔离出来的核用
+    bool busy_poll_;
+
+    // 进程绑的CPU, 工作线程在这里面轮流绑, 空就是不绑
+    std::vector<int> cpu_affinity_;
+    // SCHED_OTHER/SCHED_FIFO/SCHED_RR, -1 不改
+    int sched_policy_;
+    int sched_priority_;
+    bool mlockall_;
+    // 内存只从这个节点分配, 没有指定 cpu_affinity 时也只用这个节点的CPU, -1 不绑
+    int numa_node_;
 
     std::string pid_file_;
+    std::string metrics_dir_;
+
+private:
+    static const int MAX_POLL_EVENTS = 64;
+
+    int epoll_fd_;
+    struct epoll_event poll_events_[MAX_POLL_EVENTS];
+    // 子类注册的fd个数, 有的时候忙也要定期看一眼
+    size_t poll_fd_count_;
 }; // class ApplicationBase
 
 } // namespace tntlib
@@ -0,0 +1,548 @@
+/**
+ * @file:   async_logging.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  异步日志
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <cstdio>
+#include "binary_logging.h"
+#include "async_logging.h"
+
+namespace tnt
+{
+
+// 一次 writev 最多多少块
+static const std::size_t ASYNC_LOG_BATCH = 64 < IOV_MAX ? 64 : IOV_MAX;
+
+static const char* ASYNC_LOG_LEVEL_NAMES[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+// 每个线程自己缓存当前这一秒的时间串, 一秒只调一次 localtime_r
+struct AsyncLogTimeCache
+{
+    time_t sec;
+    char str[32];
+    int len;
+};
+
+static __thread AsyncLogTimeCache async_log_time_cache = {0, {0}, 0};
+
+// 日志头不用snprintf, 按字段直接拷, 放不下的截断
+class AsyncLogLine
+{
+public:
+    AsyncLogLine(char* buf, std::size_t size)
+        : begin_(buf), cur_(buf), end_(buf + size)
+    {
+    }
+
+    void Append(const char* str, std::size_t len)
+    {
+        if (len > static_cast<std::size_t>(end_ - cur_))
+        {
+            len = end_ - cur_;
+        }
+        memcpy(cur_, str, len);
+        cur_ += len;
+    }
+
+    void Append(const char* str)
+    {
+        Append(str, strlen(str));
+    }
+
+    void Append(char c)
+    {
+        if (cur_ < end_)
+        {
+            *cur_++ = c;
+        }
+    }
+
+    // width 不够时前面补0
+    void Append(unsigned long value, int width = 0)
+    {
+        char tmp[24];
+        char* p = tmp + sizeof(tmp);
+        do
+        {
+            *--p = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+
+        while (tmp + sizeof(tmp) - p < width)
+        {
+            *--p = '0';
+        }
+
+        Append(p, tmp + sizeof(tmp) - p);
+    }
+
+    void AppendV(const char* fmt, va_list vl)
+    {
+        if (cur_ >= end_)
+        {
+            return;
+        }
+
+        // vsnprintf 要留一个字节给'\0'
+        std::size_t left = end_ - cur_;
+        int len = vsnprintf(cur_, left + 1, fmt, vl);
+        if (len > 0)
+        {
+            cur_ += (static_cast<std::size_t>(len) < left) ? len : left;
+        }
+    }
+
+    std::size_t size() const
+    {
+        return cur_ - begin_;
+    }
+
+private:
+    char* begin_;
+    char* cur_;
+    char* end_;
+};
+
+AsyncLogging& AsyncLogging::Instance()
+{
+    static AsyncLogging instance;
+    return instance;
+}
+
+AsyncLogging::AsyncLogging()
+    : running_(false),
+      blocks_(NULL),
+      block_count_(0),
+      dropped_(0),
+      dropped_reported_(0),
+      fd_(-1),
+      file_size_(0),
+      rotate_period_(0),
+      sites_written_(0),
+      written_(0),
+      bytes_(0),
+      rotations_(0)
+{
+}
+
+AsyncLogging::~AsyncLogging()
+{
+    Stop();
+}
+
+int AsyncLogging::Start(const AsyncLogOptions& options)
+{
+    if (running())
+    {
+        return -2;
+    }
+
+    options_ = options;
+
+    if (0 != OpenFile())
+    {
+        return -1;
+    }
+
+    block_count_ = options_.memory_budget / sizeof(Block);
+    if (block_count_ < 1)
+    {
+        block_count_ = 1;
+    }
+    else if (block_count_ > MAX_BLOCKS - 1)
+    {
+        block_count_ = MAX_BLOCKS - 1;
+    }
+
+    // 清零顺便把页都分配好, 不在调用线程上缺页
+    blocks_ = new Block[block_count_]();
+    for (std::size_t i=0; i<block_count_; ++i)
+    {
+        free_blocks_.try_push(&blocks_[i]);
+    }
+
+    rotate_period_ = RotatePeriod(time(NULL));
+
+    running_.store(true, std::memory_order_release);
+    writer_ = std::thread(&AsyncLogging::WriterLoop, this);
+
+    return 0;
+}
+
+void AsyncLogging::Stop()
+{
+    if (!running())
+    {
+        return;
+    }
+
+    running_.store(false, std::memory_order_release);
+
+    // 放在最后面, 写线程看到它时前面的都写完了
+    pending_blocks_.push(NULL);
+    writer_.join();
+
+    // XXX: 要先 SetVaLogHandler 换掉, 不然别的线程可能还拿着块
+    Block* block = NULL;
+    while (free_blocks_.try_pop(block) || pending_blocks_.try_pop(block))
+    {
+    }
+    delete [] blocks_;
+    blocks_ = NULL;
+    block_count_ = 0;
+
+    close(fd_);
+    fd_ = -1;
+}
+
+void AsyncLogging::VaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
+{
+    Instance().Append(lr, fmt, vl);
+}
+
+void AsyncLogging::Append(const LogRecord& lr, const char* fmt, va_list vl)
+{
+    if (!running())
+    {
+        // 还没启动或者已经停了, 直接写stderr
+        std::fprintf(stderr, "%s|%lu|%lu|%s|%s:%lu(%s)|", ASYNC_LOG_LEVEL_NAMES[lr.log_level_], lr.log_id_,
+                     lr.user_id_, lr.user_name_.c_str(), lr.file_, lr.line_, lr.func_);
+        std::vfprintf(stderr, fmt, vl);
+        std::fprintf(stderr, "\n");
+        return;
+    }
+
+    Block* block = NULL;
+    if (!free_blocks_.try_pop(block))
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    if (options_.binary)
+    {
+        int64_t now_us = static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+        block->len = EncodeBinaryLog(lr, now_us, fmt, vl, block->data, sizeof(block->data));
+        if (0 == block->len)
+        {
+            free_blocks_.try_push(block);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        pending_blocks_.try_push(block);
+        return;
+    }
+
+    AsyncLogTimeCache& cache = async_log_time_cache;
+    if (cache.sec != now.tv_sec)
+    {
+        struct tm tm;
+        localtime_r(&now.tv_sec, &tm);
+        cache.len = strftime(cache.str, sizeof(cache.str), "%Y-%m-%d %H:%M:%S", &tm);
+        cache.sec = now.tv_sec;
+    }
+
+    // 留一个字节给vsnprintf的'\0', 写完换成换行
+    AsyncLogLine line(block->data, sizeof(block->data) - 1);
+    line.Append(cache.str, cache.len);
+    line.Append('.');
+    line.Append(now.tv_usec, 6);
+    line.Append('|');
+    line.Append(ASYNC_LOG_LEVEL_NAMES[lr.log_level_]);
+    line.Append('|');
+    line.Append(lr.log_id_);
+    line.Append('|');
+    line.Append(lr.user_id_);
+    line.Append('|');
+    line.Append(lr.user_name_.data(), lr.user_name_.size());
+    line.Append('|');
+    line.Append(lr.file_);
+    line.Append(':');
+    line.Append(lr.line_);
+    line.Append('(');
+    line.Append(lr.func_);
+    line.Append(")|");
+    line.AppendV(fmt, vl);
+
+    block->len = line.size();
+    block->data[block->len++] = '\n';
+
+    // 块数比队列小, 不会满. 写线程不在队列上等, 不会有系统调用
+    pending_blocks_.try_push(block);
+}
+
+AsyncLogStats AsyncLogging::stats() const
+{
+    AsyncLogStats stats;
+    stats.written = written_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    stats.rotations = rotations_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// 写线程不在队列上睡, 空了就睡一会儿再来取, 调用线程就不用去唤醒它
+void AsyncLogging::WriterLoop()
+{
+    Block* batch[ASYNC_LOG_BATCH];
+
+    bool stop = false;
+    while (!stop)
+    {
+        std::size_t count = 0;
+        Block* block = NULL;
+        while (count < ASYNC_LOG_BATCH && pending_blocks_.try_pop(block))
+        {
+            if (NULL == block)
+            {
+                stop = true;
+                break;
+            }
+            batch[count++] = block;
+        }
+
+        CheckRotate(time(NULL));
+
+        if (count > 0)
+        {
+            // 这批日志用到的site在它们入队之前就注册了
+            WriteNewSites();
+            WriteBatch(batch, count);
+        }
+
+        if (0 == count || stop)
+        {
+            WriteDropped();
+        }
+
+        if (!stop && count < ASYNC_LOG_BATCH)
+        {
+            usleep(options_.flush_interval_ms * 1000);
+        }
+    }
+}
+
+void AsyncLogging::WriteBatch(Block** blocks, std::size_t count)
+{
+    struct iovec iov[ASYNC_LOG_BATCH];
+    std::size_t total = 0;
+    for (std::size_t i=0; i<count; ++i)
+    {
+        iov[i].iov_base = blocks[i]->data;
+        iov[i].iov_len = blocks[i]->len;
+        total += blocks[i]->len;
+    }
+
+    struct iovec* cur = iov;
+    int left = count;
+    while (left > 0)
+    {
+        ssize_t ret = writev(fd_, cur, left);
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            // 写不进去也没办法, 不能卡住
+            break;
+        }
+
+        // 写了一部分
+        while (left > 0 && static_cast<std::size_t>(ret) >= cur->iov_len)
+        {
+            ret -= cur->iov_len;
+            ++cur;
+            --left;
+        }
+        if (left > 0)
+        {
+            cur->iov_base = static_cast<char*>(cur->iov_base) + ret;
+            cur->iov_len -= ret;
+        }
+    }
+
+    for (std::size_t i=0; i<count; ++i)
+    {
+        free_blocks_.try_push(blocks[i]);
+    }
+
+    file_size_ += total;
+    written_.fetch_add(count, std::memory_order_relaxed);
+    bytes_.fetch_add(total, std::memory_order_relaxed);
+}
+
+// 补一条丢了多少的日志
+void AsyncLogging::WriteDropped()
+{
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    uint64_t reported = dropped_reported_;
+    if (dropped == reported)
+    {
+        return;
+    }
+
+    dropped_reported_ = dropped;
+    WriteNotice("dropped %lu log records, %lu in total",
+                static_cast<unsigned long>(dropped - reported), static_cast<unsigned long>(dropped));
+}
+
+// 写线程自己的日志, 二进制格式时也要编码
+void AsyncLogging::WriteNotice(const char* fmt, ...)
+{
+    LogRecord lr(LOG_LEVEL_WARN, 0, 0, "AsyncLogging", __FILE__, __LINE__, __FUNCTION__);
+    Block block;
+
+    va_list vl;
+    va_start(vl, fmt);
+    if (options_.binary)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        block.len = EncodeBinaryLog(lr, static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_usec, fmt, vl,
+                                    block.data, sizeof(block.data));
+    }
+    else
+    {
+        int len = snprintf(block.data, sizeof(block.data), "WARN|AsyncLogging|");
+        len += vsnprintf(block.data + len, sizeof(block.data) - len - 1, fmt, vl);
+        if (static_cast<std::size_t>(len) > sizeof(block.data) - 1)
+        {
+            len = sizeof(block.data) - 1;
+        }
+        block.data[len++] = '\n';
+        block.len = len;
+    }
+    va_end(vl);
+
+    WriteRaw(block.data, block.len);
+}
+
+void AsyncLogging::WriteNewSites()
+{
+    if (!options_.binary)
+    {
+        return;
+    }
+
+    uint32_t count = LogSiteCount();
+    if (count == sites_written_)
+    {
+        return;
+    }
+
+    std::string buf;
+    for (uint32_t i=sites_written_+1; i<=count; ++i)
+    {
+        EncodeLogSite(i, buf);
+    }
+    sites_written_ = count;
+
+    WriteRaw(buf.data(), buf.size());
+}
+
+void AsyncLogging::WriteRaw(const char* data, std::size_t len)
+{
+    ssize_t ret = write(fd_, data, len);
+    if (ret > 0)
+    {
+        file_size_ += ret;
+    }
+}
+
+void AsyncLogging::CheckRotate(time_t now)
+{
+    bool by_size = (options_.max_file_size > 0 && file_size_ >= options_.max_file_size);
+    bool by_time = (options_.rotate_interval > 0 && RotatePeriod(now) != rotate_period_);
+
+    if (by_size || by_time)
+    {
+        Rotate(now);
+    }
+}
+
+int AsyncLogging::OpenFile()
+{
+    fd_ = open(options_.file_path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (-1 == fd_)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    file_size_ = (0 == fstat(fd_, &st)) ? st.st_size : 0;
+
+    // 二进制格式每个文件都要能单独解码
+    if (options_.binary)
+    {
+        std::string buf;
+        EncodeLogFileHeader(buf);
+        sites_written_ = 0;
+        WriteRaw(buf.data(), buf.size());
+        WriteNewSites();
+    }
+
+    return 0;
+}
+
+void AsyncLogging::Rotate(time_t now)
+{
+    struct tm tm;
+    localtime_r(&now, &tm);
+
+    char suffix[32];
+    strftime(suffix, sizeof(suffix), ".%Y%m%d-%H%M%S", &tm);
+
+    // 同一秒切了好几次
+    std::string new_path = options_.file_path + suffix;
+    for (int i=1; 0 == access(new_path.c_str(), F_OK); ++i)
+    {
+        char seq[16];
+        snprintf(seq, sizeof(seq), ".%d", i);
+        new_path = options_.file_path + suffix + seq;
+    }
+
+    rename(options_.file_path.c_str(), new_path.c_str());
+
+    int old_fd = fd_;
+    if (0 != OpenFile())
+    {
+        // 打不开新的就继续写旧的
+        fd_ = old_fd;
+        return;
+    }
+    close(old_fd);
+
+    rotate_period_ = RotatePeriod(now);
+    rotations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 按本地时间对齐的第几个周期
+time_t AsyncLogging::RotatePeriod(time_t now) const
+{
+    if (options_.rotate_interval <= 0)
+    {
+        return 0;
+    }
+
+    struct tm tm;
+    localtime_r(&now, &tm);
+
+    return (now + tm.tm_gmtoff) / options_.rotate_interval;
+}
+
+} // namespace tnt
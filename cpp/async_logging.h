@@ -0,0 +1,163 @@
+/**
+ * @file:   async_logging.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  异步日志
+ *
+ * 默认的 DefaultVaLogHandler 每条日志都 fprintf + fflush, FUNC_TRACE 多的时候
+ * 主循环大部分时间都在写日志
+ *
+ * 1 调用线程只格式化: 从内存池取一个块, 直接格式化到块里, 放进无锁队列,
+ *   不加锁, 没有系统调用
+ * 2 后台写线程一次取一批, writev 到文件, 队列空了就睡 flush_interval_ms
+ * 3 按大小和时间切文件, 旧文件改名为 file.YYYYmmdd-HHMMSS
+ * 4 内存池大小固定(memory_budget), 池子空了直接丢掉并计数, 日志再多也不会
+ *   阻塞主循环, 也不会无限占内存. 丢掉的条数写线程会补一条日志说明
+ * 5 binary 打开时写二进制格式(见 binary_logging.h), 用 tools/tnt_logcat 看
+ *
+ * use like this:
+ *   tnt::AsyncLogOptions options;
+ *   options.file_path = "../log/svr.log";
+ *   tnt::AsyncLogging::Instance().Start(options);
+ *   tnt::SetVaLogHandler(tnt::AsyncLogging::VaLogHandler);
+ *   ...
+ *   // 退出前, 把剩下的写完
+ *   tnt::SetVaLogHandler(NULL);
+ *   tnt::AsyncLogging::Instance().Stop();
+ */
+
+#ifndef TNT_ASYNC_LOGGING_H
+#define TNT_ASYNC_LOGGING_H
+
+#include <stdint.h>
+#include <time.h>
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include <thread>
+#include "logging.h"
+#include "mpmc_ring_queue.h"
+
+namespace tnt
+{
+
+struct AsyncLogOptions
+{
+    AsyncLogOptions()
+        : memory_budget(16 * 1024 * 1024),
+          max_file_size(1024 * 1024 * 1024),
+          rotate_interval(0),
+          flush_interval_ms(5),
+          binary(false)
+    {
+    }
+
+    std::string file_path;
+    // 缓冲用的内存上限
+    std::size_t memory_budget;
+    // 超过就切文件, 0 不按大小切
+    std::size_t max_file_size;
+    // 秒, 按本地时间对齐, 例如3600每个整点切, 0 不按时间切
+    time_t rotate_interval;
+    // 队列空了写线程睡多久, 日志最多晚这么久落地, 内存要够缓冲这段时间的日志
+    int flush_interval_ms;
+    // 二进制格式
+    bool binary;
+};
+
+struct AsyncLogStats
+{
+    uint64_t written;
+    uint64_t dropped;
+    uint64_t bytes;
+    uint64_t rotations;
+};
+
+class AsyncLogging
+{
+public:
+    // 一条日志最长, 超过的截断
+    static const std::size_t LINE_MAX_SIZE = 1024 - sizeof(uint32_t);
+    // 队列大小, 内存池最多 MAX_BLOCKS - 1 块, 留一个位置放停止用的NULL
+    static const std::size_t MAX_BLOCKS = 65536;
+
+public:
+    static AsyncLogging& Instance();
+
+    ~AsyncLogging();
+
+    /**
+     * @brief:  打开文件, 启动写线程
+     *
+     * @return: 0 成功
+     *          -1 打开文件失败
+     *          -2 已经启动了
+     */
+    int Start(const AsyncLogOptions& options);
+
+    // 写完队列里的, 停止写线程, 关闭文件
+    void Stop();
+
+    // 给 SetVaLogHandler 用
+    static void VaLogHandler(const LogRecord& lr, const char* fmt, va_list vl);
+
+    void Append(const LogRecord& lr, const char* fmt, va_list vl);
+
+    AsyncLogStats stats() const;
+
+    bool running() const
+    {
+        return running_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Block
+    {
+        uint32_t len;
+        char data[LINE_MAX_SIZE];
+    };
+
+    AsyncLogging();
+    AsyncLogging(const AsyncLogging&);
+    AsyncLogging& operator=(const AsyncLogging&);
+
+    void WriterLoop();
+    void WriteBatch(Block** blocks, std::size_t count);
+    void WriteDropped();
+    void WriteNotice(const char* fmt, ...);
+    void WriteNewSites();
+    void WriteRaw(const char* data, std::size_t len);
+    void CheckRotate(time_t now);
+    int OpenFile();
+    void Rotate(time_t now);
+    time_t RotatePeriod(time_t now) const;
+
+private:
+    AsyncLogOptions options_;
+
+    std::atomic<bool> running_;
+    std::thread writer_;
+
+    Block* blocks_;
+    std::size_t block_count_;
+    mpmc_ring_queue<Block*, MAX_BLOCKS> free_blocks_;
+    mpmc_ring_queue<Block*, MAX_BLOCKS> pending_blocks_;
+
+    std::atomic<uint64_t> dropped_;
+    uint64_t dropped_reported_;
+
+    // 下面的只有写线程用
+    int fd_;
+    std::size_t file_size_;
+    time_t rotate_period_;
+    // 二进制格式, 当前文件里已经写了的site
+    uint32_t sites_written_;
+
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<uint64_t> rotations_;
+
+}; // class AsyncLogging
+
+} // namespace tnt
+
+#endif //TNT_ASYNC_LOGGING_H
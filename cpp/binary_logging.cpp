@@ -0,0 +1,745 @@
+/**
+ * @file:   binary_logging.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  二进制日志格式
+ */
+
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "binary_logging.h"
+
+namespace tnt
+{
+
+enum LogArgType
+{
+    LOG_ARG_NONE = 0,           // %%
+    LOG_ARG_INT = 1,            // int, char, short, 还有 * 的宽度精度
+    LOG_ARG_INT64 = 2,          // long, long long, size_t ...
+    LOG_ARG_DOUBLE = 3,
+    LOG_ARG_LONG_DOUBLE = 4,    // 按double存
+    LOG_ARG_STRING = 5,
+    LOG_ARG_POINTER = 6,
+    LOG_ARG_UNSUPPORTED = 7,    // %n %ls 这些
+};
+
+// LogSite::arg_precisions, 不是字符串或者没写精度的是 LOG_PRECISION_NONE
+static const int LOG_PRECISION_NONE = -1;
+// %.*s, 精度是前一个 * 参数
+static const int LOG_PRECISION_STAR = -2;
+
+struct LogSite
+{
+    std::string file;
+    uint32_t line;
+    std::string func;
+    std::string fmt;
+
+    // 注册时的格式串地址, 对不上的不按site编码
+    const char* fmt_ptr;
+    bool binary;
+    std::vector<uint8_t> arg_types;
+    // 和 arg_types 一一对应, 字符串按精度最多读这么多, 不一定有'\0'
+    std::vector<int> arg_precisions;
+};
+
+// 编码在调用线程上不加锁, 用定长的数组, MAX_LOG_SITES 见 logging.h
+static std::mutex log_site_mutex;
+static std::atomic<LogSite*> log_sites[MAX_LOG_SITES + 1];
+static std::atomic<uint32_t> log_site_count(0);
+
+/**
+ * @brief:  解析一个转换说明
+ *
+ * @param  p 指向'%'后面
+ * @param  stars 宽度和精度里'*'的个数
+ * @param  type LogArgType
+ * @param  precision 精度, 没有是 LOG_PRECISION_NONE, '*' 是 LOG_PRECISION_STAR
+ *
+ * @return: 转换字符后面的位置
+ */
+static const char* ParseLogSpec(const char* p, int& stars, int& type, int& precision)
+{
+    stars = 0;
+    type = LOG_ARG_UNSUPPORTED;
+    precision = LOG_PRECISION_NONE;
+
+    if ('%' == *p)
+    {
+        type = LOG_ARG_NONE;
+        return p + 1;
+    }
+
+    while (*p && strchr("-+ #0'", *p))
+    {
+        ++p;
+    }
+
+    // 宽度
+    if ('*' == *p)
+    {
+        ++stars;
+        ++p;
+    }
+    while (*p >= '0' && *p <= '9')
+    {
+        ++p;
+    }
+
+    // 精度
+    if ('.' == *p)
+    {
+        ++p;
+        // 只有'.'是0
+        precision = 0;
+        if ('*' == *p)
+        {
+            ++stars;
+            ++p;
+            precision = LOG_PRECISION_STAR;
+        }
+        while (*p >= '0' && *p <= '9')
+        {
+            if (precision < 0xFFFF)
+            {
+                precision = precision * 10 + (*p - '0');
+            }
+            ++p;
+        }
+    }
+
+    // 长度
+    int longs = 0;
+    bool is_long_double = false;
+    bool is_64 = false;
+    while (*p && strchr("hlLqjzt", *p))
+    {
+        if ('l' == *p)
+        {
+            ++longs;
+        }
+        else if ('L' == *p)
+        {
+            is_long_double = true;
+        }
+        else if (strchr("qjzt", *p))
+        {
+            is_64 = true;
+        }
+        ++p;
+    }
+
+    if ('\0' == *p)
+    {
+        return p;
+    }
+
+    switch (*p)
+    {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            type = (longs > 0 || is_64 || is_long_double) ? LOG_ARG_INT64 : LOG_ARG_INT;
+            break;
+
+        case 'c':
+            type = LOG_ARG_INT;
+            break;
+
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            type = is_long_double ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
+            break;
+
+        case 's':
+            type = (longs > 0) ? LOG_ARG_UNSUPPORTED : LOG_ARG_STRING;
+            break;
+
+        case 'p':
+            type = LOG_ARG_POINTER;
+            break;
+
+        default:
+            type = LOG_ARG_UNSUPPORTED;
+            break;
+    }
+
+    return p + 1;
+}
+
+uint32_t RegisterLogSite(const char* file, std::size_t line, const char* func, const char* fmt)
+{
+    std::lock_guard<std::mutex> lock(log_site_mutex);
+
+    uint32_t count = log_site_count.load(std::memory_order_relaxed);
+    if (count >= MAX_LOG_SITES || NULL == fmt)
+    {
+        return 0;
+    }
+
+    LogSite* site = new LogSite;
+    site->file = (NULL != file) ? file : "";
+    site->line = static_cast<uint32_t>(line);
+    site->func = (NULL != func) ? func : "";
+    site->fmt = fmt;
+    site->fmt_ptr = fmt;
+    site->binary = true;
+
+    for (const char* p=fmt; *p; )
+    {
+        if ('%' != *p++)
+        {
+            continue;
+        }
+
+        int stars = 0;
+        int type = LOG_ARG_NONE;
+        int precision = LOG_PRECISION_NONE;
+        p = ParseLogSpec(p, stars, type, precision);
+        if (LOG_ARG_UNSUPPORTED == type)
+        {
+            site->binary = false;
+            break;
+        }
+
+        for (int i=0; i<stars; ++i)
+        {
+            site->arg_types.push_back(LOG_ARG_INT);
+            site->arg_precisions.push_back(LOG_PRECISION_NONE);
+        }
+        if (LOG_ARG_NONE != type)
+        {
+            site->arg_types.push_back(type);
+            site->arg_precisions.push_back((LOG_ARG_STRING == type) ? precision : LOG_PRECISION_NONE);
+        }
+    }
+
+    ++count;
+    log_sites[count].store(site, std::memory_order_release);
+    log_site_count.store(count, std::memory_order_release);
+
+    return count;
+}
+
+uint32_t LogSiteCount()
+{
+    return log_site_count.load(std::memory_order_acquire);
+}
+
+// 往buf里写, 放不下就不写了, 最后看有没有溢出
+class LogEncoder
+{
+public:
+    LogEncoder(char* buf, std::size_t size)
+        : buf_(buf), size_(size), len_(0)
+    {
+    }
+
+    template<typename T>
+    bool Put(T value)
+    {
+        if (len_ + sizeof(value) > size_)
+        {
+            len_ = size_ + 1;
+            return false;
+        }
+        memcpy(buf_ + len_, &value, sizeof(value));
+        len_ += sizeof(value);
+        return true;
+    }
+
+    // 放不下时截断, 后面还要留 reserve 个字节给别的字段
+    void PutString(const char* str, std::size_t len, std::size_t reserve = 0)
+    {
+        std::size_t left = (size_ > len_ + sizeof(uint16_t) + reserve) ? (size_ - len_ - sizeof(uint16_t) - reserve) : 0;
+        if (len > left)
+        {
+            len = left;
+        }
+        if (len > 0xFFFF)
+        {
+            len = 0xFFFF;
+        }
+
+        if (Put(static_cast<uint16_t>(len)))
+        {
+            memcpy(buf_ + len_, str, len);
+            len_ += len;
+        }
+    }
+
+    bool ok() const
+    {
+        return len_ <= size_;
+    }
+
+    std::size_t size() const
+    {
+        return len_;
+    }
+
+    void SetHeader(uint8_t type, uint8_t level)
+    {
+        uint16_t len = static_cast<uint16_t>(len_);
+        memcpy(buf_, &len, sizeof(len));
+        buf_[2] = type;
+        buf_[3] = level;
+    }
+
+private:
+    char* buf_;
+    std::size_t size_;
+    std::size_t len_;
+};
+
+// 记录头 4 字节
+static const std::size_t LOG_RECORD_HEAD_SIZE = 4;
+
+static std::size_t EncodeTextLog(const LogRecord& lr, int64_t time_us, const char* fmt, va_list vl,
+                                 char* buf, std::size_t size)
+{
+    char text[1024];
+    int text_len = vsnprintf(text, sizeof(text), fmt, vl);
+    if (text_len < 0)
+    {
+        text_len = 0;
+    }
+    else if (static_cast<std::size_t>(text_len) >= sizeof(text))
+    {
+        text_len = sizeof(text) - 1;
+    }
+
+    LogEncoder encoder(buf, size);
+    encoder.Put(static_cast<uint32_t>(0));
+    encoder.Put(time_us);
+    encoder.Put(static_cast<uint64_t>(lr.log_id_));
+    encoder.Put(static_cast<uint64_t>(lr.user_id_));
+    encoder.Put(static_cast<uint32_t>(lr.line_));
+    encoder.PutString(lr.user_name_.data(), lr.user_name_.size(), 64);
+    encoder.PutString(lr.file_, strlen(lr.file_), 32);
+    encoder.PutString(lr.func_, strlen(lr.func_), 2);
+    encoder.PutString(text, text_len);
+
+    if (!encoder.ok())
+    {
+        return 0;
+    }
+
+    encoder.SetHeader(LOG_RECORD_TEXT, lr.log_level_);
+    return encoder.size();
+}
+
+std::size_t EncodeBinaryLog(const LogRecord& lr, int64_t time_us, const char* fmt, va_list vl,
+                            char* buf, std::size_t size)
+{
+    LogSite* site = NULL;
+    if (lr.site_id_ > 0 && lr.site_id_ <= MAX_LOG_SITES)
+    {
+        site = log_sites[lr.site_id_].load(std::memory_order_acquire);
+    }
+
+    if (NULL == site || !site->binary || site->fmt_ptr != fmt)
+    {
+        return EncodeTextLog(lr, time_us, fmt, vl, buf, size);
+    }
+
+    LogEncoder encoder(buf, size);
+    encoder.Put(static_cast<uint32_t>(0));
+    encoder.Put(lr.site_id_);
+    encoder.Put(time_us);
+    encoder.Put(static_cast<uint64_t>(lr.log_id_));
+    encoder.Put(static_cast<uint64_t>(lr.user_id_));
+    encoder.PutString(lr.user_name_.data(), lr.user_name_.size(), 64);
+
+    // 最近一个 int 参数, %.*s 的精度
+    int last_int = 0;
+    for (std::size_t i=0; i<site->arg_types.size(); ++i)
+    {
+        switch (site->arg_types[i])
+        {
+            case LOG_ARG_INT:
+                last_int = va_arg(vl, int);
+                encoder.Put(static_cast<int32_t>(last_int));
+                break;
+
+            case LOG_ARG_INT64:
+                encoder.Put(static_cast<int64_t>(va_arg(vl, long long)));
+                break;
+
+            case LOG_ARG_DOUBLE:
+                encoder.Put(va_arg(vl, double));
+                break;
+
+            case LOG_ARG_LONG_DOUBLE:
+                encoder.Put(static_cast<double>(va_arg(vl, long double)));
+                break;
+
+            case LOG_ARG_POINTER:
+                encoder.Put(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(va_arg(vl, void*))));
+                break;
+
+            case LOG_ARG_STRING:
+            {
+                const char* str = va_arg(vl, const char*);
+                if (NULL == str)
+                {
+                    str = "(null)";
+                }
+
+                // 有精度时和printf一样最多读这么多, 定长的协议字段可能没有'\0'
+                // 负的 * 精度等于没写
+                int precision = site->arg_precisions[i];
+                if (LOG_PRECISION_STAR == precision)
+                {
+                    precision = (last_int >= 0) ? last_int : LOG_PRECISION_NONE;
+                }
+                std::size_t len = (precision >= 0) ? strnlen(str, precision) : strlen(str);
+
+                // 后面的参数最多8字节一个
+                encoder.PutString(str, len, (site->arg_types.size() - i - 1) * 8);
+                break;
+            }
+        }
+    }
+
+    if (!encoder.ok())
+    {
+        return 0;
+    }
+
+    encoder.SetHeader(LOG_RECORD_LOG, lr.log_level_);
+    return encoder.size();
+}
+
+void EncodeLogFileHeader(std::string& out)
+{
+    char buf[16];
+    LogEncoder encoder(buf, sizeof(buf));
+    encoder.Put(static_cast<uint32_t>(0));
+    encoder.Put(BINARY_LOG_MAGIC);
+    encoder.Put(BINARY_LOG_VERSION);
+    encoder.SetHeader(LOG_RECORD_FILE, 0);
+
+    out.append(buf, encoder.size());
+}
+
+void EncodeLogSite(uint32_t site_id, std::string& out)
+{
+    LogSite* site = NULL;
+    if (site_id > 0 && site_id <= MAX_LOG_SITES)
+    {
+        site = log_sites[site_id].load(std::memory_order_acquire);
+    }
+
+    if (NULL == site)
+    {
+        return;
+    }
+
+    // 一条记录最长 0xFFFF
+    char buf[0xFFFF];
+    LogEncoder encoder(buf, sizeof(buf));
+    encoder.Put(static_cast<uint32_t>(0));
+    encoder.Put(site_id);
+    encoder.Put(site->line);
+    encoder.PutString(site->file.data(), site->file.size(), 1024);
+    encoder.PutString(site->func.data(), site->func.size(), 1024);
+    encoder.PutString(site->fmt.data(), site->fmt.size());
+    encoder.SetHeader(LOG_RECORD_SITE, 0);
+
+    out.append(buf, encoder.size());
+}
+
+// 解码
+
+class LogDecoder
+{
+public:
+    LogDecoder(const char* buf, std::size_t size)
+        : buf_(buf), size_(size), pos_(0)
+    {
+    }
+
+    template<typename T>
+    bool Get(T& value)
+    {
+        if (pos_ + sizeof(value) > size_)
+        {
+            return false;
+        }
+        memcpy(&value, buf_ + pos_, sizeof(value));
+        pos_ += sizeof(value);
+        return true;
+    }
+
+    bool GetString(std::string& str)
+    {
+        uint16_t len = 0;
+        if (!Get(len) || pos_ + len > size_)
+        {
+            return false;
+        }
+        str.assign(buf_ + pos_, len);
+        pos_ += len;
+        return true;
+    }
+
+private:
+    const char* buf_;
+    std::size_t size_;
+    std::size_t pos_;
+};
+
+struct DecodedSite
+{
+    uint32_t line;
+    std::string file;
+    std::string func;
+    std::string fmt;
+};
+
+static const char* BINARY_LOG_LEVEL_NAMES[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+static void PrintLogHead(FILE* out, int64_t time_us, uint8_t level, uint64_t log_id, uint64_t user_id,
+                         const std::string& user_name, const std::string& file, uint32_t line, const std::string& func)
+{
+    time_t sec = static_cast<time_t>(time_us / 1000000);
+    struct tm tm;
+    localtime_r(&sec, &tm);
+
+    char time_str[32];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+
+    const char* level_name = (level <= LOG_LEVEL_FATAL) ? BINARY_LOG_LEVEL_NAMES[level] : "UNKNOWN";
+    fprintf(out, "%s.%06ld|%s|%lu|%lu|%s|%s:%u(%s)|", time_str, static_cast<long>(time_us % 1000000), level_name,
+            static_cast<unsigned long>(log_id), static_cast<unsigned long>(user_id), user_name.c_str(),
+            file.c_str(), line, func.c_str());
+}
+
+// 一个转换说明一个转换说明地用snprintf
+static bool FormatLog(FILE* out, const std::string& fmt, LogDecoder& decoder)
+{
+    std::string spec;
+    char text[4096];
+
+    for (const char* p=fmt.c_str(); *p; )
+    {
+        if ('%' != *p)
+        {
+            fputc(*p++, out);
+            continue;
+        }
+
+        const char* begin = p++;
+        int stars = 0;
+        int type = LOG_ARG_NONE;
+        int precision = LOG_PRECISION_NONE;
+        p = ParseLogSpec(p, stars, type, precision);
+
+        if (LOG_ARG_NONE == type)
+        {
+            fputc('%', out);
+            continue;
+        }
+
+        int star[2] = {0, 0};
+        for (int i=0; i<stars; ++i)
+        {
+            if (!decoder.Get(star[i]))
+            {
+                return false;
+            }
+        }
+
+        // 存的时候已经按double了, 去掉L
+        spec.clear();
+        for (const char* s=begin; s<p; ++s)
+        {
+            if (!(LOG_ARG_LONG_DOUBLE == type && 'L' == *s))
+            {
+                spec.push_back(*s);
+            }
+        }
+
+        const char* f = spec.c_str();
+        int len = 0;
+
+#define TNT_LOGCAT_FORMAT(value) \
+        (0 == stars ? snprintf(text, sizeof(text), f, value) : \
+         1 == stars ? snprintf(text, sizeof(text), f, star[0], value) : \
+                      snprintf(text, sizeof(text), f, star[0], star[1], value))
+
+        switch (type)
+        {
+            case LOG_ARG_INT:
+            {
+                int32_t value = 0;
+                if (!decoder.Get(value)) return false;
+                len = TNT_LOGCAT_FORMAT(value);
+                break;
+            }
+
+            case LOG_ARG_INT64:
+            {
+                int64_t value = 0;
+                if (!decoder.Get(value)) return false;
+                len = TNT_LOGCAT_FORMAT(static_cast<long long>(value));
+                break;
+            }
+
+            case LOG_ARG_DOUBLE:
+            case LOG_ARG_LONG_DOUBLE:
+            {
+                double value = 0;
+                if (!decoder.Get(value)) return false;
+                len = TNT_LOGCAT_FORMAT(value);
+                break;
+            }
+
+            case LOG_ARG_POINTER:
+            {
+                uint64_t value = 0;
+                if (!decoder.Get(value)) return false;
+                len = TNT_LOGCAT_FORMAT(reinterpret_cast<void*>(static_cast<uintptr_t>(value)));
+                break;
+            }
+
+            case LOG_ARG_STRING:
+            {
+                std::string value;
+                if (!decoder.GetString(value)) return false;
+                len = TNT_LOGCAT_FORMAT(value.c_str());
+                break;
+            }
+
+            default:
+                return false;
+        }
+
+#undef TNT_LOGCAT_FORMAT
+
+        if (len > 0)
+        {
+            fwrite(text, 1, (static_cast<std::size_t>(len) < sizeof(text)) ? len : sizeof(text) - 1, out);
+        }
+    }
+
+    return true;
+}
+
+int DecodeBinaryLog(FILE* in, FILE* out)
+{
+    std::vector<DecodedSite> sites;
+    std::vector<char> buf(0xFFFF);
+    bool has_header = false;
+
+    while (true)
+    {
+        char head[LOG_RECORD_HEAD_SIZE];
+        std::size_t n = fread(head, 1, sizeof(head), in);
+        if (0 == n)
+        {
+            break;
+        }
+
+        uint16_t len = 0;
+        memcpy(&len, head, sizeof(len));
+        uint8_t type = head[2];
+        uint8_t level = head[3];
+
+        if (n != sizeof(head) || len < LOG_RECORD_HEAD_SIZE ||
+            len - LOG_RECORD_HEAD_SIZE != fread(&buf[0], 1, len - LOG_RECORD_HEAD_SIZE, in))
+        {
+            return -2;
+        }
+
+        LogDecoder decoder(&buf[0], len - LOG_RECORD_HEAD_SIZE);
+
+        if (LOG_RECORD_FILE == type)
+        {
+            uint32_t magic = 0;
+            uint32_t version = 0;
+            if (!decoder.Get(magic) || !decoder.Get(version) ||
+                BINARY_LOG_MAGIC != magic || BINARY_LOG_VERSION != version)
+            {
+                return -2;
+            }
+            has_header = true;
+            continue;
+        }
+
+        if (!has_header)
+        {
+            return -2;
+        }
+
+        if (LOG_RECORD_SITE == type)
+        {
+            uint32_t site_id = 0;
+            DecodedSite site;
+            if (!decoder.Get(site_id) || !decoder.Get(site.line) || !decoder.GetString(site.file) ||
+                !decoder.GetString(site.func) || !decoder.GetString(site.fmt))
+            {
+                return -2;
+            }
+
+            if (sites.size() < site_id + 1)
+            {
+                sites.resize(site_id + 1);
+            }
+            sites[site_id] = site;
+        }
+        else if (LOG_RECORD_LOG == type)
+        {
+            uint32_t site_id = 0;
+            int64_t time_us = 0;
+            uint64_t log_id = 0;
+            uint64_t user_id = 0;
+            std::string user_name;
+            if (!decoder.Get(site_id) || !decoder.Get(time_us) || !decoder.Get(log_id) ||
+                !decoder.Get(user_id) || !decoder.GetString(user_name))
+            {
+                return -2;
+            }
+
+            if (site_id >= sites.size() || sites[site_id].fmt.empty())
+            {
+                fprintf(out, "unknown log site %u\n", site_id);
+                continue;
+            }
+
+            const DecodedSite& site = sites[site_id];
+            PrintLogHead(out, time_us, level, log_id, user_id, user_name, site.file, site.line, site.func);
+            if (!FormatLog(out, site.fmt, decoder))
+            {
+                fprintf(out, "<bad args>");
+            }
+            fputc('\n', out);
+        }
+        else if (LOG_RECORD_TEXT == type)
+        {
+            int64_t time_us = 0;
+            uint64_t log_id = 0;
+            uint64_t user_id = 0;
+            uint32_t line = 0;
+            std::string user_name;
+            std::string file;
+            std::string func;
+            std::string text;
+            if (!decoder.Get(time_us) || !decoder.Get(log_id) || !decoder.Get(user_id) ||
+                !decoder.Get(line) || !decoder.GetString(user_name) || !decoder.GetString(file) ||
+                !decoder.GetString(func) || !decoder.GetString(text))
+            {
+                return -2;
+            }
+
+            PrintLogHead(out, time_us, level, log_id, user_id, user_name, file, line, func);
+            fprintf(out, "%s\n", text.c_str());
+        }
+        // 不认识的类型跳过, 以后加的
+    }
+
+    return 0;
+}
+
+} // namespace tnt
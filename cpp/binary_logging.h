@@ -0,0 +1,76 @@
+/**
+ * @file:   binary_logging.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  二进制日志格式
+ *
+ * 文本日志每条都要格式化, 还要把文件名, 函数名, 格式串再写一遍
+ * 二进制格式里每个 LOG_* 的位置第一次执行时注册一个 site:
+ *   文件 行号 函数 格式串, 以及从格式串解析出来的参数类型
+ * 之后每条日志只记 site_id, 时间, log_id, user_id, user_name 和参数的原始
+ * 字节, 格式化留给离线的 tools/tnt_logcat 去做
+ *
+ * 文件是一串记录, 每条记录前面是 | 长度(uint16, 含这4字节) | 类型 | 级别 |
+ *   LOG_RECORD_FILE: magic version, 每个文件开头都有
+ *   LOG_RECORD_SITE: site_id line file func fmt, 文件开头写一遍所有已知的,
+ *                    之后新注册的在用到它的日志前面写
+ *   LOG_RECORD_LOG:  site_id time_us log_id user_id user_name 参数...
+ *   LOG_RECORD_TEXT: 格式串不是常量, 或者有不支持的转换(%n %ls)时, 直接记
+ *                    格式化好的文本
+ * 字符串都是 uint16 长度 + 内容, 数字都是本机字节序
+ *
+ * 用 AsyncLogging 写, 打开 AsyncLogOptions::binary, LOG_* 宏不用改
+ */
+
+#ifndef TNT_BINARY_LOGGING_H
+#define TNT_BINARY_LOGGING_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include "logging.h"
+
+namespace tnt
+{
+
+enum LogRecordType
+{
+    LOG_RECORD_FILE = 1,
+    LOG_RECORD_SITE = 2,
+    LOG_RECORD_LOG = 3,
+    LOG_RECORD_TEXT = 4,
+};
+
+static const uint32_t BINARY_LOG_MAGIC = 0x544E544C;    // "TNTL"
+static const uint32_t BINARY_LOG_VERSION = 1;
+
+// 已经注册的site个数, site_id 是 1 ... LogSiteCount()
+uint32_t LogSiteCount();
+
+/**
+ * @brief:  把一条日志编码到buf里
+ *
+ * 字符串参数太长时截断
+ *
+ * @return: 编码后的长度
+ */
+std::size_t EncodeBinaryLog(const LogRecord& lr, int64_t time_us, const char* fmt, va_list vl,
+                            char* buf, std::size_t size);
+
+// 文件头记录, 追加到out
+void EncodeLogFileHeader(std::string& out);
+
+// site记录, 追加到out
+void EncodeLogSite(uint32_t site_id, std::string& out);
+
+/**
+ * @brief:  把二进制日志转成文本, 格式和 AsyncLogging 的文本模式一样
+ *
+ * @return: 0 成功, -2 格式不对
+ */
+int DecodeBinaryLog(FILE* in, FILE* out);
+
+} // namespace tnt
+
+#endif //TNT_BINARY_LOGGING_H
@@ -17,6 +17,10 @@
 #ifndef TNT_CODE_INBOX_H
 #define TNT_CODE_INBOX_H
 
+#include <cstddef>
+#include <assert.h>
+#include <sys/time.h>
+
 namespace tnt
 {
 
@@ -67,6 +71,20 @@ inline time_t TV_TO_MS(const struct timeval& tv)
     return tv.tv_sec*1000 + tv.tv_usec/1000;
 }
 
+// 缓存行大小, 多线程共享的数据按这个对齐避免伪共享
+#ifndef TNT_CACHE_LINE_SIZE
+#define TNT_CACHE_LINE_SIZE 64
+#endif
+
+// 自旋等待时让出流水线
+#ifndef TNT_CPU_RELAX
+#if defined(__i386__) || defined(__x86_64__)
+#define TNT_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define TNT_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+#endif
+
 #ifndef TNT_ASSERT
 
 #define TNT_ASSERT(expr)\
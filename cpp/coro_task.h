@@ -0,0 +1,250 @@
+/**
+ * @file:   coro_task.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  C++20 无栈协程, 协程帧从池里分配
+ *
+ * 异步流程写成顺序的代码, 不用再拆成状态机, 见 transaction/coro_transaction.h
+ *
+ * 1 CoroTask 创建后先挂起, 由调用者 Resume, 跑完了也挂在最后, 由 CoroTask 释放
+ *   什么时候跑, 什么时候超时还是由外面(TransactionMgr)决定
+ * 2 协程帧按64字节分档放在每个线程自己的空闲链表里, 释放的帧下次直接复用,
+ *   稳定以后不再向系统申请内存; 超过 MAX_POOLED_SIZE 的直接 new
+ * 3 协程里抛出的异常会在 Resume 的地方重新抛出
+ *
+ * 需要 -std=c++20 (-fcoroutines), 不支持时 TNT_HAS_COROUTINE 没有定义, 这里什么都没有
+ */
+
+#ifndef CORO_TASK_H
+#define CORO_TASK_H
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define TNT_HAS_COROUTINE 1
+#endif
+#endif
+
+#ifdef TNT_HAS_COROUTINE
+
+#include <stdint.h>
+#include <cstddef>
+#include <new>
+#include <coroutine>
+
+namespace tnt
+{
+
+/**
+ * @brief:  协程帧的池, 每个线程一个
+ */
+class CoroFramePool
+{
+public:
+    static const std::size_t SIZE_CLASS = 64;
+    static const std::size_t MAX_POOLED_SIZE = 4096;
+
+public:
+    CoroFramePool()
+        : system_alloc_count_(0), reuse_count_(0), in_use_count_(0), pooled_count_(0)
+    {
+        for (std::size_t i=0; i<CLASS_COUNT; ++i)
+        {
+            free_lists_[i] = NULL;
+        }
+    }
+
+    ~CoroFramePool()
+    {
+        for (std::size_t i=0; i<CLASS_COUNT; ++i)
+        {
+            while (NULL != free_lists_[i])
+            {
+                FreeNode* node = free_lists_[i];
+                free_lists_[i] = node->next;
+                ::operator delete(node);
+            }
+        }
+    }
+
+    static CoroFramePool& Instance()
+    {
+        static thread_local CoroFramePool pool;
+        return pool;
+    }
+
+    void* Allocate(std::size_t size)
+    {
+        ++in_use_count_;
+
+        if (size > MAX_POOLED_SIZE)
+        {
+            ++system_alloc_count_;
+            return ::operator new(size);
+        }
+
+        std::size_t index = ClassIndex(size);
+        FreeNode* node = free_lists_[index];
+        if (NULL != node)
+        {
+            free_lists_[index] = node->next;
+            ++reuse_count_;
+            --pooled_count_;
+            return node;
+        }
+
+        ++system_alloc_count_;
+        return ::operator new((index + 1) * SIZE_CLASS);
+    }
+
+    // size 必须和 Allocate 时的一样, 协程帧的 operator delete 会带上
+    void Deallocate(void* ptr, std::size_t size)
+    {
+        --in_use_count_;
+
+        if (size > MAX_POOLED_SIZE)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        std::size_t index = ClassIndex(size);
+        FreeNode* node = static_cast<FreeNode*>(ptr);
+        node->next = free_lists_[index];
+        free_lists_[index] = node;
+        ++pooled_count_;
+    }
+
+    // 向系统申请的次数, 稳定以后应该不再增加
+    inline uint64_t system_alloc_count() const {return system_alloc_count_;}
+    inline uint64_t reuse_count() const {return reuse_count_;}
+    inline uint64_t in_use_count() const {return in_use_count_;}
+    inline uint64_t pooled_count() const {return pooled_count_;}
+
+private:
+    static const std::size_t CLASS_COUNT = MAX_POOLED_SIZE / SIZE_CLASS;
+
+    struct FreeNode
+    {
+        FreeNode* next;
+    };
+
+    static std::size_t ClassIndex(std::size_t size)
+    {
+        return (size + SIZE_CLASS - 1) / SIZE_CLASS - 1;
+    }
+
+private:
+    FreeNode* free_lists_[CLASS_COUNT];
+
+    uint64_t system_alloc_count_;
+    uint64_t reuse_count_;
+    uint64_t in_use_count_;
+    uint64_t pooled_count_;
+};
+
+/**
+ * @brief:  协程的返回类型, co_return 一个int
+ *
+ * 只能移动, 析构时释放协程帧(没跑完的也释放)
+ */
+class CoroTask
+{
+public:
+    struct promise_type
+    {
+        int result;
+
+        promise_type() : result(0) {}
+
+        CoroTask get_return_object()
+        {
+            return CoroTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {return std::suspend_always();}
+        std::suspend_always final_suspend() noexcept {return std::suspend_always();}
+
+        void return_value(int value) {result = value;}
+        void unhandled_exception() {throw;}
+
+        static void* operator new(std::size_t size)
+        {
+            return CoroFramePool::Instance().Allocate(size);
+        }
+
+        static void operator delete(void* ptr, std::size_t size)
+        {
+            CoroFramePool::Instance().Deallocate(ptr, size);
+        }
+    };
+
+    typedef std::coroutine_handle<promise_type> Handle;
+
+public:
+    CoroTask() : handle_(NULL) {}
+
+    CoroTask(CoroTask&& other) noexcept : handle_(other.handle_)
+    {
+        other.handle_ = NULL;
+    }
+
+    CoroTask& operator=(CoroTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            handle_ = other.handle_;
+            other.handle_ = NULL;
+        }
+        return *this;
+    }
+
+    CoroTask(const CoroTask&) = delete;
+    CoroTask& operator=(const CoroTask&) = delete;
+
+    ~CoroTask()
+    {
+        Reset();
+    }
+
+    /**
+     * @brief:  跑到下一个挂起点或者结束
+     *
+     * @return: true 已经结束, result() 是 co_return 的值
+     */
+    bool Resume()
+    {
+        if (!handle_ || handle_.done())
+        {
+            return true;
+        }
+
+        handle_.resume();
+        return handle_.done();
+    }
+
+    // 释放协程帧
+    void Reset()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+            handle_ = NULL;
+        }
+    }
+
+    inline bool valid() const {return static_cast<bool>(handle_);}
+    inline bool done() const {return !handle_ || handle_.done();}
+    inline int result() const {return handle_ ? handle_.promise().result : 0;}
+
+private:
+    explicit CoroTask(Handle handle) : handle_(handle) {}
+
+private:
+    Handle handle_;
+};
+
+} // namespace tnt
+
+#endif // TNT_HAS_COROUTINE
+
+#endif //CORO_TASK_H
@@ -7,79 +7,510 @@
  */
 
 #include "timeout_pool.h"
+#include <string.h>
 #include <algorithm>
-#include <vector>
-#include <utility>
-#include <iostream>
 
 namespace tnt
 {
 
-TimeoutPool::Id TimeoutPool::Add(int64_t now, int64_t delay)
+namespace
 {
-  Id id = nextId_++;
-  // Event e;
-  timeouts_.insert({id, now + delay, -1});
-  // timeouts_.insert(e);
-  return id;
+
+// Id = 代数 << 32 | (节点下标 + 1), 保证大于0
+const int ID_INDEX_BITS = 32;
+const uint64_t ID_INDEX_MASK = 0xFFFFFFFFULL;
+const uint32_t ID_GENERATION_MASK = 0x7FFFFFFF;
+
+inline int HighestBit(uint64_t x)
+{
+    return 63 - __builtin_clzll(x);
 }
 
-TimeoutPool::Id TimeoutPool::AddRepeating(int64_t now, int64_t interval)
+} // namespace
+
+TimeoutPool::TimeoutPool()
+    : free_head_(-1), cur_(0), count_(0), next_expiration_(-1), next_dirty_(false)
 {
-    Id id = nextId_++;
-    // Event e;
-    timeouts_.insert({id, now + interval, interval});
+    for (int i=0; i<SLOT_COUNT; ++i)
+    {
+        heads_[i] = -1;
+    }
 
-    return id;
+    memset(bitmap_, 0, sizeof(bitmap_));
 }
 
-// TimeoutPool::Id TimeoutPool::addRepeating(int64_t now, int64_t interval);
+void TimeoutPool::Reserve(size_t n)
+{
+    nodes_.reserve(n);
+    expired_.reserve(n);
+    expired_events_.reserve(n);
+}
+
+TimeoutPool::Id TimeoutPool::Add(int64_t now, int64_t delay, uint64_t data)
+{
+    // 空的时候直接对齐到当前时间, 省得 runInternal 一直没调用时从很早的时间开始推进
+    if (0 == count_)
+    {
+        cur_ = now;
+    }
+
+    int32_t idx = AllocNode();
+    Node& node = nodes_[idx];
+    node.event.expiration = now + delay;
+    node.event.repeat_interval = -1;
+    node.event.data = data;
+
+    Place(idx);
+
+    return node.event.id;
+}
+
+TimeoutPool::Id TimeoutPool::AddRepeating(int64_t now, int64_t interval, uint64_t data)
+{
+    if (interval < 1)
+    {
+        interval = 1;
+    }
+
+    if (0 == count_)
+    {
+        cur_ = now;
+    }
+
+    int32_t idx = AllocNode();
+    Node& node = nodes_[idx];
+    node.event.expiration = now + interval;
+    node.event.repeat_interval = interval;
+    node.event.data = data;
+
+    Place(idx);
+
+    return node.event.id;
+}
 
 bool TimeoutPool::Erase(Id id)
 {
-    return timeouts_.get<BY_ID>().erase(id);
+    if (id <= 0)
+    {
+        return false;
+    }
+
+    uint64_t idx = (static_cast<uint64_t>(id) & ID_INDEX_MASK) - 1;
+    if (idx >= nodes_.size())
+    {
+        return false;
+    }
+
+    Node& node = nodes_[idx];
+    if (node.event.id != id || SLOT_NONE == node.slot)
+    {
+        return false;
+    }
+
+    if (SLOT_EXPIRED == node.slot)
+    {
+        // 同一批到期还没回调的, 直接回收, Run 里会跳过
+        FreeNode(idx);
+        return true;
+    }
+
+    Unlink(idx);
+    FreeNode(idx);
+
+    return true;
 }
 
 int64_t TimeoutPool::NextExpiration() const
 {
-  return (timeouts_.empty() ? -1:
-          timeouts_.get<BY_EXPIRATION>().begin()->expiration);
+    if (next_dirty_)
+    {
+        next_expiration_ = ComputeNextExpiration();
+        next_dirty_ = false;
+    }
+
+    return next_expiration_;
+}
+
+int64_t TimeoutPool::Run(int64_t now, Callback* callback, void* arg)
+{
+    runInternal(now, expired_events_);
+
+    for (size_t i=0; i<expired_events_.size(); ++i)
+    {
+        const Event& event = expired_events_[i];
+        int32_t idx = expired_[i];
+
+        // 被前面的回调删掉了
+        if (nodes_[idx].event.id != event.id)
+        {
+            continue;
+        }
+
+        // 不重复的先回收, 回调里再 Erase 自己就会返回false
+        if (SLOT_EXPIRED == nodes_[idx].slot)
+        {
+            FreeNode(idx);
+        }
+
+        callback(event, now, arg);
+    }
+
+    return NextExpiration();
+}
+
+int64_t TimeoutPool::Run(int64_t now, std::vector<Event>& expired)
+{
+    runInternal(now, expired);
+
+    for (size_t i=0; i<expired_.size(); ++i)
+    {
+        if (SLOT_EXPIRED == nodes_[expired_[i]].slot)
+        {
+            FreeNode(expired_[i]);
+        }
+    }
+
+    return NextExpiration();
 }
 
-int64_t TimeoutPool::runInternal(int64_t now, bool runOnce)
+// 摘下所有 <= now 的事件, 快照到 expired 里
+// 重复的先重新加入, 这样回调里还可以删掉它; 不重复的留给调用者回收
+void TimeoutPool::runInternal(int64_t now, std::vector<Event>& expired)
 {
-    // Set::index<Id>::type& byExpiration = timeouts_.get<BY_EXPIRATION>();
-    auto& byExpiration = timeouts_.get<BY_EXPIRATION>();
-    int64_t nextExp;
+    expired.clear();
+    expired_.clear();
+
+    if (now < cur_)
+    {
+        return;
+    }
+
+    while (count_ > 0)
+    {
+        int64_t next = NextExpiration();
+        if (next > now)
+        {
+            break;
+        }
+
+        int64_t t = std::max(next, cur_);
+        MoveTo(t);
+
+        int32_t idx = Detach(static_cast<int>(t & (WHEEL_SIZE0 - 1)));
+        while (-1 != idx)
+        {
+            int32_t next_idx = nodes_[idx].next;
+            nodes_[idx].slot = SLOT_EXPIRED;
+            --count_;
+            expired_.push_back(idx);
+            idx = next_idx;
+        }
+
+        MoveTo(t + 1);
+    }
+
+    MoveTo(now + 1);
 
-    do
+    for (size_t i=0; i<expired_.size(); ++i)
     {
-        auto end = byExpiration.upper_bound(now);
-        std::vector<Event> expired;
-        // std::move(byExpiration.begin(), end, std::back_inserter(expired));
-        byExpiration.erase(byExpiration.begin(), end);
-        // for (auto& event : expired) {
-        for (size_t i=0; i<expired.size(); ++i) {
-            Event& event = expired[i];
-            // Reinsert if repeating, do this before executing callbacks
-            // so the callbacks have a chance to call erase
-            if (event.repeat_interval >= 0) {
-                timeouts_.insert({event.id, now + event.repeat_interval, event.repeat_interval});
+        int32_t idx = expired_[i];
+        Node& node = nodes_[idx];
+
+        expired.push_back(node.event);
+
+        int64_t interval = node.event.repeat_interval;
+        if (interval > 0)
+        {
+            // 按计划时间推进, 错过的周期直接跳过
+            int64_t expiration = node.event.expiration + interval;
+            if (expiration <= now)
+            {
+                expiration += ((now - expiration) / interval + 1) * interval;
             }
+
+            node.event.expiration = expiration;
+            Place(idx);
+        }
+    }
+}
+
+int32_t TimeoutPool::AllocNode()
+{
+    int32_t idx = free_head_;
+    if (-1 != idx)
+    {
+        free_head_ = nodes_[idx].next;
+    }
+    else
+    {
+        idx = static_cast<int32_t>(nodes_.size());
+        nodes_.push_back(Node());
+        nodes_[idx].generation = 0;
+    }
+
+    Node& node = nodes_[idx];
+    node.event.id = (static_cast<Id>(node.generation) << ID_INDEX_BITS) | (idx + 1);
+    node.prev = -1;
+    node.next = -1;
+    node.slot = SLOT_NONE;
+
+    return idx;
+}
+
+void TimeoutPool::FreeNode(int32_t idx)
+{
+    Node& node = nodes_[idx];
+    node.event.id = 0;
+    node.slot = SLOT_NONE;
+    node.generation = (node.generation + 1) & ID_GENERATION_MASK;
+
+    node.next = free_head_;
+    free_head_ = idx;
+}
+
+// 事件应该放在哪个槽
+// 看到期时间和当前时间最高的不同位落在哪一层
+int TimeoutPool::SlotOf(int64_t expiration) const
+{
+    uint64_t t = static_cast<uint64_t>(std::max(expiration, cur_));
+    uint64_t diff = t ^ static_cast<uint64_t>(cur_);
+
+    if (diff < static_cast<uint64_t>(WHEEL_SIZE0))
+    {
+        return static_cast<int>(t & (WHEEL_SIZE0 - 1));
+    }
+
+    if (0 != (diff >> WHEEL_RANGE_BITS))
+    {
+        return SLOT_OVERFLOW;
+    }
+
+    int level = (HighestBit(diff) - WHEEL_BITS0) / WHEEL_BITS + 1;
+    int shift = WHEEL_BITS0 + (level - 1) * WHEEL_BITS;
+    int digit = static_cast<int>((t >> shift) & (WHEEL_SIZE - 1));
+
+    return WHEEL_SIZE0 + (level - 1) * WHEEL_SIZE + digit;
+}
+
+void TimeoutPool::Place(int32_t idx)
+{
+    Node& node = nodes_[idx];
+    Link(idx, SlotOf(node.event.expiration));
+
+    if (!next_dirty_ && (0 == count_ || node.event.expiration < next_expiration_))
+    {
+        next_expiration_ = node.event.expiration;
+    }
+
+    ++count_;
+}
+
+void TimeoutPool::Link(int32_t idx, int slot)
+{
+    Node& node = nodes_[idx];
+    node.slot = slot;
+    node.prev = -1;
+    node.next = heads_[slot];
+
+    if (-1 != node.next)
+    {
+        nodes_[node.next].prev = idx;
+    }
+
+    heads_[slot] = idx;
+
+    if (slot != SLOT_OVERFLOW)
+    {
+        bitmap_[slot / 64] |= (1ULL << (slot % 64));
+    }
+}
+
+void TimeoutPool::Unlink(int32_t idx)
+{
+    Node& node = nodes_[idx];
+    int slot = node.slot;
+
+    if (-1 != node.prev)
+    {
+        nodes_[node.prev].next = node.next;
+    }
+    else
+    {
+        heads_[slot] = node.next;
+    }
+
+    if (-1 != node.next)
+    {
+        nodes_[node.next].prev = node.prev;
+    }
+
+    if (-1 == heads_[slot] && slot != SLOT_OVERFLOW)
+    {
+        bitmap_[slot / 64] &= ~(1ULL << (slot % 64));
+    }
+
+    if (!next_dirty_ && node.event.expiration == next_expiration_)
+    {
+        next_dirty_ = true;
+    }
+
+    node.slot = SLOT_NONE;
+    --count_;
+}
+
+// 把整个槽摘下来, 返回链表头
+// 链表里的节点还算在 count_ 里, 由调用者逐个处理时减掉
+int32_t TimeoutPool::Detach(int slot)
+{
+    int32_t head = heads_[slot];
+    if (-1 == head)
+    {
+        return -1;
+    }
+
+    heads_[slot] = -1;
+    if (slot != SLOT_OVERFLOW)
+    {
+        bitmap_[slot / 64] &= ~(1ULL << (slot % 64));
+    }
+
+    next_dirty_ = true;
+
+    return head;
+}
+
+// 推进当前时间, 调用者保证 t 之前的事件都已经处理过
+void TimeoutPool::MoveTo(int64_t t)
+{
+    if (t <= cur_)
+    {
+        return;
+    }
+
+    uint64_t diff = static_cast<uint64_t>(t) ^ static_cast<uint64_t>(cur_);
+    cur_ = t;
+
+    if (diff < static_cast<uint64_t>(WHEEL_SIZE0))
+    {
+        return;
+    }
+
+    // 从进位的最高层往下, 把当前时间所在的槽挂到低层
+    int top = WHEEL_LEVELS - 1;
+    if (0 != (diff >> WHEEL_RANGE_BITS))
+    {
+        Cascade(SLOT_OVERFLOW);
+    }
+    else
+    {
+        top = (HighestBit(diff) - WHEEL_BITS0) / WHEEL_BITS + 1;
+    }
+
+    for (int level=top; level>=1; --level)
+    {
+        int shift = WHEEL_BITS0 + (level - 1) * WHEEL_BITS;
+        int digit = static_cast<int>((static_cast<uint64_t>(t) >> shift) & (WHEEL_SIZE - 1));
+        Cascade(WHEEL_SIZE0 + (level - 1) * WHEEL_SIZE + digit);
+    }
+}
+
+void TimeoutPool::Cascade(int slot)
+{
+    // 只是换个槽, 最早的到期时间不会变
+    bool next_dirty = next_dirty_;
+
+    int32_t idx = Detach(slot);
+    while (-1 != idx)
+    {
+        int32_t next_idx = nodes_[idx].next;
+        --count_;
+        Place(idx);
+        idx = next_idx;
+    }
+
+    next_dirty_ = next_dirty;
+}
+
+int64_t TimeoutPool::SlotMin(int slot) const
+{
+    int64_t min = -1;
+    for (int32_t idx = heads_[slot]; -1 != idx; idx = nodes_[idx].next)
+    {
+        if (-1 == min || nodes_[idx].event.expiration < min)
+        {
+            min = nodes_[idx].event.expiration;
         }
+    }
 
-        // Call callbacks
-        // for (auto& event : expired) {
-        for (size_t i=0; i<expired.size(); ++i) {
-            Event& event = expired[i];
-            // event.callback(event.id, now);
-            std::cout<<event.id;
+    return min;
+}
+
+// 在某一层里找 from 之后第一个非空的槽, 没有返回-1
+int TimeoutPool::FindNextSlot(int level, int from) const
+{
+    if (0 == level)
+    {
+        for (int word = from / 64; word < WHEEL_SIZE0 / 64; ++word)
+        {
+            uint64_t bits = bitmap_[word];
+            if (word == from / 64)
+            {
+                bits &= (~0ULL << (from % 64));
+            }
+
+            if (0 != bits)
+            {
+                return word * 64 + __builtin_ctzll(bits);
+            }
         }
 
-        nextExp = NextExpiration();
-    } while (!runOnce && nextExp <= now);
-    return nextExp;
+        return -1;
+    }
+
+    if (from >= WHEEL_SIZE)
+    {
+        return -1;
+    }
+
+    uint64_t bits = bitmap_[WHEEL_SIZE0 / 64 + level - 1] & (~0ULL << from);
+    return (0 != bits) ? __builtin_ctzll(bits) : -1;
 }
 
+int64_t TimeoutPool::ComputeNextExpiration() const
+{
+    if (0 == count_)
+    {
+        return -1;
+    }
+
+    // 第0层当前的槽可能有过期了才加进来的事件, 要遍历一下
+    int digit = static_cast<int>(cur_ & (WHEEL_SIZE0 - 1));
+    if (-1 != heads_[digit])
+    {
+        return SlotMin(digit);
+    }
+
+    // 第0层后面的槽里到期时间就是槽对应的时间
+    int slot = FindNextSlot(0, digit + 1);
+    if (-1 != slot)
+    {
+        return (cur_ & ~static_cast<int64_t>(WHEEL_SIZE0 - 1)) | slot;
+    }
+
+    // 高层的槽里时间跨度比较大, 只需要遍历第一个非空的槽
+    for (int level=1; level<WHEEL_LEVELS; ++level)
+    {
+        int shift = WHEEL_BITS0 + (level - 1) * WHEEL_BITS;
+        digit = static_cast<int>((static_cast<uint64_t>(cur_) >> shift) & (WHEEL_SIZE - 1));
+
+        slot = FindNextSlot(level, digit + 1);
+        if (-1 != slot)
+        {
+            return SlotMin(WHEEL_SIZE0 + (level - 1) * WHEEL_SIZE + slot);
+        }
+    }
+
+    return SlotMin(SLOT_OVERFLOW);
 }
 
+} // namespace tnt
@@ -4,17 +4,32 @@
  * @brief:  simple timeout pool
  *
  * @date:   2014-04-16
+ *
+ * 分层时间轮实现
+ * 原来的 boost::multi_index 版本每次 Add/Erase 都是O(logn)并且要分配节点,
+ * 事务多的时候是个热点, 见 ordered_timeout_pool.h
+ *
+ * 1 Add/AddRepeating/Erase 都是O(1)
+ * 2 事件节点放在池(vector)里复用, Id 里带了节点下标和代数, 不用查找
+ * 3 时间单位由调用者决定(一般是毫秒), 精度为1个单位
+ *
+ * 第0层256个槽, 第1~4层各64个槽, 一共覆盖2^32个单位, 更远的放到溢出链表
+ * 第k层的事件和当前时间在k层以上的位都相同, 所以低层的事件总是比高层的早,
+ * 当前时间进位时再把高层对应槽里的事件挂到低层(cascade)
+ *
+ * 到期处理:
+ * 每次 Run 把所有 <= now 的事件作为一批交给回调或者调用者的buffer,
+ * 内部只复用自己的缓冲, 热路径上没有分配和IO.
+ * 重复的事件按计划时间(而不是now)重新加入, 不会累积漂移, 如果落后了好几个
+ * 周期, 中间错过的直接跳过, 一批里只回调一次
  */
 
 #ifndef TIMEOUT_POOL_H
 #define TIMEOUT_POOL_H
 
 #include <stdint.h>
-#include <functional>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/indexed_by.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/member.hpp>
+#include <cstddef>
+#include <vector>
 
 namespace tnt
 {
@@ -23,54 +38,119 @@ class TimeoutPool
 {
 public:
   typedef int64_t Id;
-  // typedef std::function<void(Id, int64_t)> Callback;
 
-  TimeoutPool() : nextId_(1) { }
+  struct Event
+  {
+    Id id;
+    int64_t expiration;     // 本次到期的计划时间
+    int64_t repeat_interval;
+    uint64_t data;          // 调用者自己的数据, 比如事务ID, 到期时原样带回
+  };
+
+  typedef void Callback(const Event& event, int64_t now, void* arg);
 
-  Id Add(int64_t now, int64_t delay);
+  TimeoutPool();
 
-  Id AddRepeating(int64_t now, int64_t interval);
+  Id Add(int64_t now, int64_t delay, uint64_t data = 0);
+
+  // interval 小于1时按1处理
+  Id AddRepeating(int64_t now, int64_t interval, uint64_t data = 0);
 
   bool Erase(Id id);
 
+  // 最早的到期时间, 没有时返回-1
   int64_t NextExpiration() const;
 
+  size_t size() const { return count_; }
+
+  // 预先分配节点, 避免运行中扩容
+  void Reserve(size_t n);
+
+  /**
+   * @brief:  处理到期的事件, 每个事件回调一次
+   *
+   * 回调里可以 Add/Erase, 被 Erase 掉的同一批事件不会再回调,
+   * 但是不能再调用 Run
+   *
+   * @return: 下一次到期时间, 没有时返回-1
+   */
+  int64_t Run(int64_t now, Callback* callback, void* arg);
+
+  /**
+   * @brief:  到期的事件放到调用者的 expired 里(会先清空)
+   *
+   * expired 由调用者复用, 就不会有分配
+   *
+   * @return: 下一次到期时间, 没有时返回-1
+   */
+  int64_t Run(int64_t now, std::vector<Event>& expired);
+
+private:
+  void runInternal(int64_t now, std::vector<Event>& expired);
 
-// private:
-  int64_t runInternal(int64_t now, bool runOnce);
-
-  struct Event
+  enum
   {
-    Id id;
-    int64_t expiration;
-    int64_t repeat_interval;
-    // Callback callback;
-  };
+    WHEEL_BITS0 = 8,
+    WHEEL_SIZE0 = 1 << WHEEL_BITS0,
+    WHEEL_BITS = 6,
+    WHEEL_SIZE = 1 << WHEEL_BITS,
+    WHEEL_LEVELS = 5,
+    WHEEL_RANGE_BITS = WHEEL_BITS0 + WHEEL_BITS * (WHEEL_LEVELS - 1),
 
-  typedef boost::multi_index_container<
-    Event,
-    boost::multi_index::indexed_by<
-      boost::multi_index::ordered_unique<boost::multi_index::member<
-        Event, Id, &Event::id
-      > >,
-      boost::multi_index::ordered_non_unique<boost::multi_index::member<
-        Event, int64_t, &Event::expiration
-      > >
-    >
-  > Set;
+    // 所有槽连续编号, 最后一个是溢出链表
+    SLOT_OVERFLOW = WHEEL_SIZE0 + WHEEL_SIZE * (WHEEL_LEVELS - 1),
+    SLOT_COUNT = SLOT_OVERFLOW + 1,
 
-  enum
+    BITMAP_WORDS = WHEEL_SIZE0 / 64 + (WHEEL_LEVELS - 1),
+
+    SLOT_NONE = -1,     // 空闲节点
+    SLOT_EXPIRED = -2,  // 已到期, 还在本次 runInternal 处理中
+  };
+
+  struct Node
   {
-    BY_ID=0,
-    BY_EXPIRATION=1
+    Event event;
+    int32_t prev;
+    int32_t next;
+    int32_t slot;
+    uint32_t generation;
   };
 
-  Set timeouts_;
-  Id nextId_;
+  int32_t AllocNode();
+  void FreeNode(int32_t idx);
+
+  int SlotOf(int64_t expiration) const;
+  void Place(int32_t idx);
+  void Link(int32_t idx, int slot);
+  void Unlink(int32_t idx);
+  int32_t Detach(int slot);
+
+  void MoveTo(int64_t t);
+  void Cascade(int slot);
+
+  int64_t SlotMin(int slot) const;
+  int FindNextSlot(int level, int from) const;
+  int64_t ComputeNextExpiration() const;
+
+  std::vector<Node> nodes_;
+  int32_t free_head_;
+
+  int32_t heads_[SLOT_COUNT];
+  uint64_t bitmap_[BITMAP_WORDS];
+
+  // 下一个还没处理的时间, 比它早的事件都已经到期
+  int64_t cur_;
+  size_t count_;
+
+  mutable int64_t next_expiration_;
+  mutable bool next_dirty_;
+
+  // 本次到期的节点, 复用避免每次分配
+  std::vector<int32_t> expired_;
+  std::vector<Event> expired_events_;
 
 }; // class TimeoutPool
 
 } // namespace tnt
 
 #endif //TNT_TIMEOUT_POOL_H
-
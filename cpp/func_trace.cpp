@@ -0,0 +1,302 @@
+/**
+ * @file:   func_trace.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  FUNC_TRACE 的二进制模式
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "func_trace.h"
+
+namespace tnt
+{
+
+static const uint32_t FUNC_TRACE_MAGIC = 0x544E5446;    // "TNTF"
+static const uint32_t FUNC_TRACE_VERSION = 1;
+
+struct FuncTraceInfo
+{
+    std::string file;
+    uint32_t line;
+    std::string func;
+};
+
+// 注册和创建环都只在第一次, 用锁就行
+static std::mutex func_trace_mutex;
+static std::vector<FuncTraceInfo> func_trace_infos;
+static std::vector<FuncTraceRing*> func_trace_rings;
+static std::size_t func_trace_ring_size = 65536;
+
+namespace internal {
+
+std::atomic<int> func_trace_mode_(FUNC_TRACE_TEXT);
+std::atomic<uint32_t> func_trace_sample_(1);
+__thread uint32_t func_trace_countdown_ = 0;
+__thread uint32_t func_trace_depth_ = 0;
+__thread bool func_trace_sampled_ = false;
+__thread FuncTraceRing* func_trace_ring_ = NULL;
+
+// 线程退出后环还留着, Dump 时还能看到
+FuncTraceRing* CreateFuncTraceRing()
+{
+    std::lock_guard<std::mutex> lock(func_trace_mutex);
+
+    std::size_t size = 1;
+    while (size < func_trace_ring_size)
+    {
+        size <<= 1;
+    }
+
+    FuncTraceRing* ring = new FuncTraceRing;
+    ring->tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    ring->mask = static_cast<uint32_t>(size - 1);
+    ring->pos.store(0, std::memory_order_relaxed);
+    ring->events = new FuncTraceEvent[size];
+
+    func_trace_rings.push_back(ring);
+    func_trace_ring_ = ring;
+
+    return ring;
+}
+
+} // end namespace internal
+
+FuncTraceMode SetFuncTraceMode(FuncTraceMode mode)
+{
+    return static_cast<FuncTraceMode>(internal::func_trace_mode_.exchange(mode, std::memory_order_relaxed));
+}
+
+void SetFuncTraceSample(uint32_t sample)
+{
+    internal::func_trace_sample_.store(sample, std::memory_order_relaxed);
+}
+
+void SetFuncTraceRingSize(std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(func_trace_mutex);
+    func_trace_ring_size = (size > 0) ? size : 1;
+}
+
+uint32_t RegisterFuncTrace(const char* file, std::size_t line, const char* func)
+{
+    std::lock_guard<std::mutex> lock(func_trace_mutex);
+
+    FuncTraceInfo info;
+    info.file = (NULL != file) ? file : "";
+    info.line = static_cast<uint32_t>(line);
+    info.func = (NULL != func) ? func : "";
+    func_trace_infos.push_back(info);
+
+    return static_cast<uint32_t>(func_trace_infos.size());
+}
+
+static void WriteString(FILE* fp, const std::string& str)
+{
+    uint32_t len = static_cast<uint32_t>(str.size());
+    fwrite(&len, sizeof(len), 1, fp);
+    fwrite(str.data(), 1, len, fp);
+}
+
+static bool ReadString(FILE* fp, std::string& str)
+{
+    uint32_t len = 0;
+    if (1 != fread(&len, sizeof(len), 1, fp) || len > 65536)
+    {
+        return false;
+    }
+
+    str.resize(len);
+    return 0 == len || len == fread(&str[0], 1, len, fp);
+}
+
+/**
+ * 文件格式, 都是本机字节序:
+ *   magic version func_count ring_count      4 x uint32
+ *   func_count 个: id line file(uint32长度 + 内容) func(同上)
+ *   ring_count 个: tid reserved(uint32) count(uint64) count个FuncTraceEvent
+ */
+int DumpFuncTrace(const char* file)
+{
+    FILE* fp = fopen(file, "wb");
+    if (NULL == fp)
+    {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(func_trace_mutex);
+
+    uint32_t header[4] = {FUNC_TRACE_MAGIC, FUNC_TRACE_VERSION,
+                          static_cast<uint32_t>(func_trace_infos.size()),
+                          static_cast<uint32_t>(func_trace_rings.size())};
+    fwrite(header, sizeof(header), 1, fp);
+
+    for (std::size_t i=0; i<func_trace_infos.size(); ++i)
+    {
+        uint32_t id_line[2] = {static_cast<uint32_t>(i + 1), func_trace_infos[i].line};
+        fwrite(id_line, sizeof(id_line), 1, fp);
+        WriteString(fp, func_trace_infos[i].file);
+        WriteString(fp, func_trace_infos[i].func);
+    }
+
+    std::vector<FuncTraceEvent> events;
+    for (std::size_t i=0; i<func_trace_rings.size(); ++i)
+    {
+        FuncTraceRing* ring = func_trace_rings[i];
+        uint64_t capacity = static_cast<uint64_t>(ring->mask) + 1;
+
+        // 别的线程还在写, 先拷出来, 再把拷的时候被覆盖掉的去掉
+        uint64_t end = ring->pos.load(std::memory_order_acquire);
+        uint64_t begin = (end > capacity) ? (end - capacity) : 0;
+        events.resize(end - begin);
+        for (uint64_t pos=begin; pos<end; ++pos)
+        {
+            events[pos - begin] = ring->events[pos & ring->mask];
+        }
+
+        // 位置p的槽在写p+capacity时被复用, 正在写的那个也不要
+        uint64_t now = ring->pos.load(std::memory_order_acquire);
+        uint64_t skip = 0;
+        if (now + 1 > begin + capacity)
+        {
+            skip = now + 1 - capacity - begin;
+            if (skip > events.size())
+            {
+                skip = events.size();
+            }
+        }
+
+        uint32_t tid_reserved[2] = {ring->tid, 0};
+        uint64_t count = events.size() - skip;
+        fwrite(tid_reserved, sizeof(tid_reserved), 1, fp);
+        fwrite(&count, sizeof(count), 1, fp);
+        if (count > 0)
+        {
+            fwrite(&events[skip], sizeof(FuncTraceEvent), count, fp);
+        }
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+static void WriteJsonString(FILE* out, const std::string& str)
+{
+    fputc('"', out);
+    for (std::size_t i=0; i<str.size(); ++i)
+    {
+        char c = str[i];
+        if ('"' == c || '\\' == c)
+        {
+            fputc('\\', out);
+            fputc(c, out);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            fprintf(out, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+int FuncTraceToChromeJson(const char* dump_file, FILE* out)
+{
+    FILE* fp = fopen(dump_file, "rb");
+    if (NULL == fp)
+    {
+        return -1;
+    }
+
+    uint32_t header[4];
+    if (1 != fread(header, sizeof(header), 1, fp) ||
+        FUNC_TRACE_MAGIC != header[0] || FUNC_TRACE_VERSION != header[1])
+    {
+        fclose(fp);
+        return -2;
+    }
+
+    std::vector<FuncTraceInfo> infos(header[2]);
+    for (uint32_t i=0; i<header[2]; ++i)
+    {
+        uint32_t id_line[2];
+        if (1 != fread(id_line, sizeof(id_line), 1, fp) ||
+            !ReadString(fp, infos[i].file) || !ReadString(fp, infos[i].func))
+        {
+            fclose(fp);
+            return -2;
+        }
+        infos[i].line = id_line[1];
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    bool first = true;
+    std::vector<FuncTraceEvent> events;
+    for (uint32_t r=0; r<header[3]; ++r)
+    {
+        uint32_t tid_reserved[2];
+        uint64_t count = 0;
+        if (1 != fread(tid_reserved, sizeof(tid_reserved), 1, fp) || 1 != fread(&count, sizeof(count), 1, fp))
+        {
+            fclose(fp);
+            return -2;
+        }
+
+        events.resize(count);
+        if (count > 0 && count != fread(&events[0], sizeof(FuncTraceEvent), count, fp))
+        {
+            fclose(fp);
+            return -2;
+        }
+
+        // 进入被覆盖掉了的离开事件不要, 不然火焰图会乱
+        uint64_t depth = 0;
+        for (uint64_t i=0; i<count; ++i)
+        {
+            const FuncTraceEvent& event = events[i];
+            if (0 == event.func_id || event.func_id > infos.size())
+            {
+                continue;
+            }
+
+            if (FUNC_TRACE_ENTER == event.type)
+            {
+                ++depth;
+            }
+            else if (FUNC_TRACE_LEAVE == event.type && depth > 0)
+            {
+                --depth;
+            }
+            else
+            {
+                continue;
+            }
+
+            const FuncTraceInfo& info = infos[event.func_id - 1];
+            fprintf(out, "%s{\"name\":", first ? "" : ",\n");
+            WriteJsonString(out, info.func);
+            fprintf(out, ",\"cat\":\"func\",\"ph\":\"%s\",\"ts\":%ld.%03ld,\"pid\":1,\"tid\":%u,\"args\":{\"uin\":%u,\"file\":",
+                    (FUNC_TRACE_ENTER == event.type) ? "B" : "E",
+                    static_cast<long>(event.timestamp / 1000), static_cast<long>(event.timestamp % 1000),
+                    tid_reserved[0], event.user_id);
+            WriteJsonString(out, info.file);
+            fprintf(out, ",\"line\":%u}}", info.line);
+            first = false;
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    fclose(fp);
+
+    return 0;
+}
+
+} // namespace tnt
@@ -0,0 +1,184 @@
+/**
+ * @file:   func_trace.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  FUNC_TRACE 的二进制模式
+ *
+ * 文本模式每次进出函数都要格式化两条日志, 线上没法一直开着
+ * 二进制模式只往当前线程的环形缓冲里写一个定长事件:
+ *
+ *   | 时间(CLOCK_MONOTONIC, ns) | 函数id | uin | 进/出 |
+ *
+ * 1 函数id 每个 FUNC_TRACE 的位置第一次执行时注册一次
+ * 2 每个线程一个环, 写满了覆盖最旧的, 没有锁也没有系统调用
+ * 3 可以1/N采样, 按最外层的调用采, 采中的整棵调用树都记, 没采中的都不记
+ * 4 SetFuncTraceMode 运行期切换, DumpFuncTrace 把所有线程的环写到文件,
+ *   再用 tools/tnt_trace_decode 转成 Chrome trace 的json, 用
+ *   chrome://tracing 或者 https://ui.perfetto.dev 打开看火焰图
+ *
+ * TNT_LOG_MIN_LEVEL 大于0时只编译掉文本模式的进出日志, 二进制模式还在;
+ * 要整个去掉 FUNC_TRACE 定义 TNT_FUNC_TRACE_DISABLE
+ *
+ * use like this:
+ *   tnt::SetFuncTraceMode(tnt::FUNC_TRACE_BINARY);
+ *   tnt::SetFuncTraceSample(100);
+ *   ...
+ *   tnt::DumpFuncTrace("../log/func_trace.bin");
+ */
+
+#ifndef TNT_FUNC_TRACE_H
+#define TNT_FUNC_TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <cstddef>
+#include <cstdio>
+#include <atomic>
+
+namespace tnt
+{
+
+enum FuncTraceMode
+{
+    FUNC_TRACE_TEXT = 0,    // 原来的做法, TRACE级别的日志
+    FUNC_TRACE_BINARY = 1,  // 写到环形缓冲
+    FUNC_TRACE_OFF = 2,
+};
+
+enum FuncTraceEventType
+{
+    FUNC_TRACE_ENTER = 1,
+    FUNC_TRACE_LEAVE = 2,
+};
+
+struct FuncTraceEvent
+{
+    int64_t timestamp;
+    uint32_t func_id;
+    uint32_t user_id;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+struct FuncTraceRing
+{
+    uint32_t tid;
+    uint32_t mask;
+    // 一直递增
+    std::atomic<uint64_t> pos;
+    FuncTraceEvent* events;
+};
+
+namespace internal {
+// 每个线程的 FUNC_TRACE 都在读, 运行期可能在改, 只要求原子, 不要求顺序
+extern std::atomic<int> func_trace_mode_;
+extern std::atomic<uint32_t> func_trace_sample_;
+extern __thread uint32_t func_trace_countdown_;
+extern __thread uint32_t func_trace_depth_;
+extern __thread bool func_trace_sampled_;
+extern __thread FuncTraceRing* func_trace_ring_;
+
+FuncTraceRing* CreateFuncTraceRing();
+} // end namespace internal
+
+// 返回原来的
+FuncTraceMode SetFuncTraceMode(FuncTraceMode mode);
+
+inline FuncTraceMode GetFuncTraceMode()
+{
+    return static_cast<FuncTraceMode>(internal::func_trace_mode_.load(std::memory_order_relaxed));
+}
+
+// 每 sample 次调用记一次, 0 和 1 都是全记
+void SetFuncTraceSample(uint32_t sample);
+
+// 每个线程环的大小(事件数, 向上取2的幂), 只对之后创建的环有效
+void SetFuncTraceRingSize(std::size_t size);
+
+/**
+ * @brief:  注册一个函数, FUNC_TRACE 里用
+ *
+ * @return: 函数id, 从1开始
+ */
+uint32_t RegisterFuncTrace(const char* file, std::size_t line, const char* func);
+
+// 这次调用要不要记
+inline bool FuncTraceSampled()
+{
+    uint32_t sample = internal::func_trace_sample_.load(std::memory_order_relaxed);
+    if (sample <= 1)
+    {
+        return true;
+    }
+
+    if (internal::func_trace_countdown_ > 1)
+    {
+        --internal::func_trace_countdown_;
+        return false;
+    }
+
+    internal::func_trace_countdown_ = sample;
+    return true;
+}
+
+/**
+ * @brief:  进入一层, 最外层时决定这棵调用树要不要记
+ *
+ * @return: 要不要记, 不管返回什么离开时都要调用 LeaveFuncTrace
+ */
+inline bool EnterFuncTrace()
+{
+    if (0 == internal::func_trace_depth_++)
+    {
+        internal::func_trace_sampled_ = FuncTraceSampled();
+    }
+
+    return internal::func_trace_sampled_;
+}
+
+inline void LeaveFuncTrace()
+{
+    --internal::func_trace_depth_;
+}
+
+inline void RecordFuncTrace(uint32_t func_id, uint32_t user_id, uint32_t type)
+{
+    FuncTraceRing* ring = internal::func_trace_ring_;
+    if (__builtin_expect(NULL == ring, 0))
+    {
+        ring = internal::CreateFuncTraceRing();
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t pos = ring->pos.load(std::memory_order_relaxed);
+    FuncTraceEvent& event = ring->events[pos & ring->mask];
+    event.timestamp = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    event.func_id = func_id;
+    event.user_id = user_id;
+    event.type = type;
+    event.reserved = 0;
+
+    // Dump 的线程按pos读, 最多读到正在写的那一个是半截的
+    ring->pos.store(pos + 1, std::memory_order_release);
+}
+
+/**
+ * @brief:  把所有线程的环和函数表写到文件
+ *
+ * @return: 0 成功, -1 打开文件失败
+ */
+int DumpFuncTrace(const char* file);
+
+/**
+ * @brief:  DumpFuncTrace 的文件转成Chrome trace的json
+ *
+ * 开头那些进入事件已经被覆盖掉的离开事件会被丢掉
+ *
+ * @return: 0 成功, -1 读文件失败, -2 格式不对
+ */
+int FuncTraceToChromeJson(const char* dump_file, FILE* out);
+
+} // namespace tnt
+
+#endif //TNT_FUNC_TRACE_H
@@ -0,0 +1,127 @@
+/**
+ * @file:   latency_histogram.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  耗时直方图
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include "latency_histogram.h"
+
+namespace tnt
+{
+
+const int LatencyHistogram::SUB_BUCKET_BITS;
+const uint64_t LatencyHistogram::SUB_BUCKET_COUNT;
+const int LatencyHistogram::MAX_VALUE_BITS;
+const uint64_t LatencyHistogram::MAX_VALUE;
+const std::size_t LatencyHistogram::BUCKET_COUNT;
+
+LatencyHistogram::LatencyHistogram()
+{
+    total_count_ = 0;
+    total_sum_ = 0;
+    Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+    memset(counts_, 0, sizeof(counts_));
+    count_ = 0;
+    sum_ = 0;
+    min_ = MAX_VALUE;
+    max_ = 0;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    // 对方这个周期没有数据, 累计的也要加上
+    total_count_ += other.total_count_;
+    total_sum_ += other.total_sum_;
+
+    if (0 == other.count_)
+    {
+        return;
+    }
+
+    for (std::size_t i=0; i<BUCKET_COUNT; ++i)
+    {
+        counts_[i] += other.counts_[i];
+    }
+
+    count_ += other.count_;
+    sum_ += other.sum_;
+
+    if (other.min_ < min_)
+    {
+        min_ = other.min_;
+    }
+
+    if (other.max_ > max_)
+    {
+        max_ = other.max_;
+    }
+}
+
+uint64_t LatencyHistogram::BucketHighestValue(std::size_t index)
+{
+    if (index < SUB_BUCKET_COUNT)
+    {
+        return index;
+    }
+
+    uint64_t shift = index / SUB_BUCKET_COUNT - 1;
+    uint64_t mantissa = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const
+{
+    if (0 == count_)
+    {
+        return 0;
+    }
+
+    // 第几个, 从1开始
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    else if (rank > count_)
+    {
+        rank = count_;
+    }
+
+    uint64_t seen = 0;
+    for (std::size_t i=0; i<BUCKET_COUNT; ++i)
+    {
+        seen += counts_[i];
+        if (seen >= rank)
+        {
+            uint64_t value = BucketHighestValue(i);
+            return (value > max_) ? max_ : value;
+        }
+    }
+
+    return max_;
+}
+
+std::string LatencyHistogram::StatStr(const char* name) const
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "%s_count:%llu;%s_p50_us:%.3f;%s_p90_us:%.3f;%s_p99_us:%.3f;%s_p999_us:%.3f;"
+             "%s_max_us:%.3f;%s_mean_us:%.3f;",
+             name, static_cast<unsigned long long>(count_),
+             name, Percentile(50) / 1000.0,
+             name, Percentile(90) / 1000.0,
+             name, Percentile(99) / 1000.0,
+             name, Percentile(99.9) / 1000.0,
+             name, max() / 1000.0,
+             name, mean() / 1000.0);
+
+    return buf;
+}
+
+} // namespace tnt
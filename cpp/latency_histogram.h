@@ -0,0 +1,163 @@
+/**
+ * @file:   latency_histogram.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  耗时直方图
+ *
+ * min/max/平均看不到长尾, 这里按HDR的做法分桶:
+ * 每个2的幂区间再线性分成 2^SUB_BUCKET_BITS 个桶, 相对误差不超过
+ * 1/2^SUB_BUCKET_BITS (约1.6%), 记一次只是几次位运算和一次加法
+ *
+ * 单位是纳秒, 最大记到 MAX_VALUE (约18分钟), 再大的算在最后一个桶里
+ * count/min/max/sum 是精确的, 分位数是所在桶的上界
+ * total_count/total_sum 从创建开始累计, Reset 不清, 给只认单调递增的采集用
+ *
+ * 不是线程安全的, 每个线程自己一个, 需要时 Merge
+ *
+ * use like this:
+ *   tnt::LatencyHistogram cmd_cost;
+ *   {
+ *       tnt::LatencyTimer timer(cmd_cost);
+ *       ProcessCmd();
+ *   }
+ *   LOG_INFO(0, 0, "", "%s", cmd_cost.StatStr("cmd").c_str());
+ *   cmd_cost.Reset();
+ */
+
+#ifndef TNT_LATENCY_HISTOGRAM_H
+#define TNT_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <time.h>
+#include <cstddef>
+#include <string>
+
+namespace tnt
+{
+
+// CLOCK_MONOTONIC, 纳秒
+inline uint64_t MonotonicNowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 6;
+    static const uint64_t SUB_BUCKET_COUNT = 1ULL << SUB_BUCKET_BITS;
+    // 2^40 ns
+    static const int MAX_VALUE_BITS = 40;
+    static const uint64_t MAX_VALUE = (1ULL << MAX_VALUE_BITS) - 1;
+    static const std::size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+public:
+    LatencyHistogram();
+
+    void Record(uint64_t value)
+    {
+        if (value > MAX_VALUE)
+        {
+            value = MAX_VALUE;
+        }
+
+        ++counts_[BucketIndex(value)];
+        ++count_;
+        sum_ += value;
+        ++total_count_;
+        total_sum_ += value;
+
+        if (value < min_)
+        {
+            min_ = value;
+        }
+
+        if (value > max_)
+        {
+            max_ = value;
+        }
+    }
+
+    // 清空, 每个统计周期开始时调用
+    void Reset();
+
+    void Merge(const LatencyHistogram& other);
+
+    /**
+     * @brief:  分位数, 例如 Percentile(99.9)
+     *
+     * @return: 所在桶的上界, 不会超过max, 没有数据时是0
+     */
+    uint64_t Percentile(double percentile) const;
+
+    uint64_t count() const {return count_;}
+    uint64_t sum() const {return sum_;}
+    uint64_t min() const {return (0 == count_) ? 0 : min_;}
+    uint64_t max() const {return max_;}
+    uint64_t mean() const {return (0 == count_) ? 0 : sum_ / count_;}
+
+    // 从创建开始的, 不受 Reset 影响
+    uint64_t total_count() const {return total_count_;}
+    uint64_t total_sum() const {return total_sum_;}
+
+    /**
+     * @brief:  和 ApplicationBase::StatStr 一样的格式, 微秒
+     *
+     * proc_count:100;proc_p50_us:1.2;proc_p90_us:...;proc_p99_us:...;proc_p999_us:...;proc_max_us:...;proc_mean_us:...;
+     */
+    std::string StatStr(const char* name) const;
+
+    // 桶的下标
+    static std::size_t BucketIndex(uint64_t value)
+    {
+        if (value < SUB_BUCKET_COUNT)
+        {
+            return static_cast<std::size_t>(value);
+        }
+
+        // value 的最高位, >= SUB_BUCKET_BITS
+        int exponent = 63 - __builtin_clzll(value);
+        int shift = exponent - SUB_BUCKET_BITS;
+        return static_cast<std::size_t>((shift + 1) * SUB_BUCKET_COUNT + ((value >> shift) - SUB_BUCKET_COUNT));
+    }
+
+    // 桶里最大的值
+    static uint64_t BucketHighestValue(std::size_t index);
+
+private:
+    uint64_t counts_[BUCKET_COUNT];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+    uint64_t total_count_;
+    uint64_t total_sum_;
+};
+
+// 作用域结束时把耗时记到直方图里
+class LatencyTimer
+{
+public:
+    explicit LatencyTimer(LatencyHistogram& histogram) :
+        histogram_(histogram),
+        begin_(MonotonicNowNs())
+    {
+    }
+
+    ~LatencyTimer()
+    {
+        histogram_.Record(MonotonicNowNs() - begin_);
+    }
+
+private:
+    LatencyTimer(const LatencyTimer&);
+    LatencyTimer& operator=(const LatencyTimer&);
+
+    LatencyHistogram& histogram_;
+    uint64_t begin_;
+};
+
+} // namespace tnt
+
+#endif //TNT_LATENCY_HISTOGRAM_H
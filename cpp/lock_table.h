@@ -0,0 +1,294 @@
+/**
+ * @file:   lock_table.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  lock table 按 (uin, cmd) 加锁的开放寻址表
+ *
+ * 一个用户同时只能有一个处理特定命令的事务, 用它来记谁在锁着
+ *
+ * 1 一块连续数组, 线性探测, 加锁解锁都不分配内存
+ * 2 (uin, cmd) 拼成64位再混淆一次, uin 连续, cmd 相近也不会扎堆
+ * 3 删除时把后面的往前挪(backward shift), 没有墓碑, 用久了探测长度也不会变长
+ * 4 容量是2的幂, 至少是 Reserve 的两倍, 负载不超过一半;
+ *   加锁数不会超过同时在跑的事务数, Reserve 事务表的容量就不会满
+ *
+ * 锁冲突(同一个用户的同一个请求还没处理完又来了)会计数, 并记下冲突最多的
+ * 几个 (uin, cmd), 方便看是哪些用户在狂点
+ */
+
+#ifndef LOCK_TABLE_H
+#define LOCK_TABLE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace tnt
+{
+
+class LockTable
+{
+public:
+    // 冲突最多的记几个
+    static const std::size_t HOT_KEY_COUNT = 8;
+    static const std::size_t MAX_CAPACITY = 1U << 26;
+
+    struct HotKey
+    {
+        uint32_t uin;
+        uint32_t cmd;
+        // 一次持锁期间的冲突次数
+        uint32_t contention;
+    };
+
+public:
+    LockTable()
+        : mask_(0), size_(0),
+          lock_count_(0), contention_count_(0), full_count_(0), max_probe_(0)
+    {
+        for (std::size_t i=0; i<HOT_KEY_COUNT; ++i)
+        {
+            hot_keys_[i].uin = 0;
+            hot_keys_[i].cmd = 0;
+            hot_keys_[i].contention = 0;
+        }
+    }
+
+    /**
+     * @brief:  预分配, 最多同时有 max_locks 个锁, 只能变大
+     *
+     * 初始化时调用, 已经加的锁会重新放一遍
+     *
+     * @return: 0 成功, -1 太大了
+     */
+    int Reserve(std::size_t max_locks)
+    {
+        std::size_t capacity = 16;
+        while (capacity < max_locks * 2)
+        {
+            capacity <<= 1;
+        }
+
+        if (capacity > MAX_CAPACITY)
+        {
+            return -1;
+        }
+
+        if (capacity <= entries_.size())
+        {
+            return 0;
+        }
+
+        std::vector<Entry> old_entries(capacity);
+        old_entries.swap(entries_);
+        mask_ = capacity - 1;
+        size_ = 0;
+
+        for (std::size_t i=0; i<old_entries.size(); ++i)
+        {
+            if (old_entries[i].used)
+            {
+                Entry& entry = entries_[FindSlot(old_entries[i].key)];
+                entry = old_entries[i];
+                ++size_;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * @return: 0 成功, -1 已经锁着(记一次冲突), -2 满了
+     */
+    int TryLock(uint32_t uin, uint32_t cmd)
+    {
+        if (entries_.empty())
+        {
+            ++full_count_;
+            return -2;
+        }
+
+        uint64_t key = MakeKey(uin, cmd);
+        Entry& entry = entries_[FindSlot(key)];
+        if (entry.used)
+        {
+            ++contention_count_;
+            ++entry.contention;
+            RecordHotKey(uin, cmd, entry.contention);
+            return -1;
+        }
+
+        if (size_ * 2 >= entries_.size())
+        {
+            ++full_count_;
+            return -2;
+        }
+
+        entry.key = key;
+        entry.used = 1;
+        entry.contention = 0;
+        ++size_;
+        ++lock_count_;
+
+        return 0;
+    }
+
+    /**
+     * @return: 0 成功, -1 没有锁
+     */
+    int Unlock(uint32_t uin, uint32_t cmd)
+    {
+        if (0 == size_)
+        {
+            return -1;
+        }
+
+        std::size_t index = FindSlot(MakeKey(uin, cmd));
+        if (!entries_[index].used)
+        {
+            return -1;
+        }
+
+        // 后面同一串里的往前挪, 只要挪过去以后还在自己的位置之后
+        std::size_t hole = index;
+        std::size_t next = (index + 1) & mask_;
+        while (entries_[next].used)
+        {
+            std::size_t home = Hash(entries_[next].key) & mask_;
+            if (((next - home) & mask_) >= ((next - hole) & mask_))
+            {
+                entries_[hole] = entries_[next];
+                hole = next;
+            }
+            next = (next + 1) & mask_;
+        }
+
+        entries_[hole].used = 0;
+        entries_[hole].contention = 0;
+        --size_;
+
+        return 0;
+    }
+
+    bool IsLocked(uint32_t uin, uint32_t cmd) const
+    {
+        if (0 == size_)
+        {
+            return false;
+        }
+        return entries_[FindSlot(MakeKey(uin, cmd))].used;
+    }
+
+    inline std::size_t size() const {return size_;}
+    inline std::size_t capacity() const {return entries_.size();}
+
+    inline uint64_t lock_count() const {return lock_count_;}
+    // 加锁时已经锁着的次数
+    inline uint64_t contention_count() const {return contention_count_;}
+    inline uint64_t full_count() const {return full_count_;}
+    // 最长的探测长度, 平均不到两次, 这个用来看有没有扎堆
+    inline std::size_t max_probe() const {return max_probe_;}
+
+    // 冲突最多的几个, contention 是0的没用到
+    inline const HotKey* hot_keys() const {return hot_keys_;}
+
+    void ResetStatistic()
+    {
+        lock_count_ = 0;
+        contention_count_ = 0;
+        full_count_ = 0;
+        max_probe_ = 0;
+        for (std::size_t i=0; i<HOT_KEY_COUNT; ++i)
+        {
+            hot_keys_[i].contention = 0;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Entry() : key(0), contention(0), used(0) {}
+
+        uint64_t key;
+        uint32_t contention;
+        uint32_t used;
+    };
+
+    static inline uint64_t MakeKey(uint32_t uin, uint32_t cmd)
+    {
+        return (static_cast<uint64_t>(uin) << 32) | cmd;
+    }
+
+    // MurmurHash3 的 fmix64
+    static inline uint64_t Hash(uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    // 找到 key 所在的位置, 没有就是它应该放的空位
+    std::size_t FindSlot(uint64_t key) const
+    {
+        std::size_t index = Hash(key) & mask_;
+        std::size_t probe = 0;
+        while (entries_[index].used && entries_[index].key != key)
+        {
+            index = (index + 1) & mask_;
+            ++probe;
+        }
+
+        if (probe > max_probe_)
+        {
+            max_probe_ = probe;
+        }
+
+        return index;
+    }
+
+    void RecordHotKey(uint32_t uin, uint32_t cmd, uint32_t contention)
+    {
+        std::size_t coldest = 0;
+        for (std::size_t i=0; i<HOT_KEY_COUNT; ++i)
+        {
+            if (hot_keys_[i].uin == uin && hot_keys_[i].cmd == cmd)
+            {
+                if (contention > hot_keys_[i].contention)
+                {
+                    hot_keys_[i].contention = contention;
+                }
+                return;
+            }
+
+            if (hot_keys_[i].contention < hot_keys_[coldest].contention)
+            {
+                coldest = i;
+            }
+        }
+
+        if (contention > hot_keys_[coldest].contention)
+        {
+            hot_keys_[coldest].uin = uin;
+            hot_keys_[coldest].cmd = cmd;
+            hot_keys_[coldest].contention = contention;
+        }
+    }
+
+private:
+    std::vector<Entry> entries_;
+    std::size_t mask_;
+    std::size_t size_;
+
+    uint64_t lock_count_;
+    uint64_t contention_count_;
+    uint64_t full_count_;
+    mutable std::size_t max_probe_;
+
+    HotKey hot_keys_[HOT_KEY_COUNT];
+};
+
+} // namespace tnt
+
+#endif //LOCK_TABLE_H
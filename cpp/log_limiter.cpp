@@ -0,0 +1,413 @@
+/**
+ * @file:   log_limiter.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  日志限流和按uin打开TRACE
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "logging.h"
+#include "log_limiter.h"
+
+namespace tnt
+{
+
+namespace internal {
+std::atomic<int> log_limit_enabled_(0);
+std::atomic<int> log_trace_user_count_(0);
+} // end namespace internal
+
+// 令牌桶, 一个64位原子变量:
+// 高32位是上次取令牌的时间(ms, 会回绕), 低32位是令牌数(千分之一个)
+// 0 表示新桶, 是满的
+typedef std::atomic<uint64_t> LogTokenBucket;
+
+// 千分之一个令牌, 速率小的时候也能按毫秒补
+static const uint64_t LOG_TOKEN_UNIT = 1000;
+// 低32位放得下
+static const uint32_t MAX_LOG_BURST = 4000000;
+
+struct LogIdBucket
+{
+    // log_id + 1, 0 是空的
+    std::atomic<uint64_t> key;
+    std::atomic<uint32_t> rate;
+    std::atomic<uint32_t> burst;
+    LogTokenBucket bucket;
+};
+
+// 开放寻址, 装一半
+static const std::size_t LOG_ID_TABLE_SIZE = MAX_LOG_ID_LIMITS * 2;
+static const std::size_t LOG_USER_TABLE_SIZE = MAX_LOG_TRACE_USERS * 2;
+
+static std::atomic<uint32_t> log_site_rate(0);
+static std::atomic<uint32_t> log_site_burst(0);
+static LogTokenBucket log_site_buckets[MAX_LOG_SITES + 1];
+
+static std::atomic<int> log_id_limit_count(0);
+static LogIdBucket log_id_buckets[LOG_ID_TABLE_SIZE];
+
+// uin + 1, 0 是空的
+static std::atomic<uint64_t> log_trace_users[LOG_USER_TABLE_SIZE];
+
+static std::atomic<uint64_t> log_site_dropped(0);
+static std::atomic<uint64_t> log_id_dropped(0);
+
+static inline std::size_t HashSlot(uint64_t key, std::size_t table_size)
+{
+    // 表大小是2的幂
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & (table_size - 1);
+}
+
+static inline uint32_t CoarseNowMs()
+{
+    // 精度是一个jiffy, 比 CLOCK_MONOTONIC 便宜, 限流够用了
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<uint32_t>(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static bool TakeToken(LogTokenBucket& bucket, uint32_t now_ms, uint32_t rate, uint32_t burst)
+{
+    const uint64_t capacity = static_cast<uint64_t>(burst) * LOG_TOKEN_UNIT;
+
+    uint64_t state = bucket.load(std::memory_order_relaxed);
+    while (true)
+    {
+        uint64_t tokens = capacity;
+        if (0 != state)
+        {
+            uint32_t elapsed = now_ms - static_cast<uint32_t>(state >> 32);
+            // rate 条每秒 = rate 个千分之一每毫秒
+            tokens = (state & 0xFFFFFFFF) + static_cast<uint64_t>(elapsed) * rate;
+            if (tokens > capacity)
+            {
+                tokens = capacity;
+            }
+        }
+
+        if (tokens < LOG_TOKEN_UNIT)
+        {
+            return false;
+        }
+
+        uint64_t next = (static_cast<uint64_t>(now_ms) << 32) | (tokens - LOG_TOKEN_UNIT);
+        if (0 == next)
+        {
+            // 不能和新桶混了
+            next = 1;
+        }
+
+        if (bucket.compare_exchange_weak(state, next, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+static LogIdBucket* FindLogIdBucket(std::size_t log_id)
+{
+    uint64_t key = static_cast<uint64_t>(log_id) + 1;
+    std::size_t slot = HashSlot(key, LOG_ID_TABLE_SIZE);
+    for (std::size_t i=0; i<LOG_ID_TABLE_SIZE; ++i)
+    {
+        LogIdBucket& entry = log_id_buckets[slot];
+        uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+        if (key == entry_key)
+        {
+            return &entry;
+        }
+        else if (0 == entry_key)
+        {
+            return NULL;
+        }
+
+        slot = (slot + 1) & (LOG_ID_TABLE_SIZE - 1);
+    }
+
+    return NULL;
+}
+
+namespace internal {
+
+bool IsLogRateAllowedSlow(uint32_t site_id, std::size_t log_id)
+{
+    uint32_t now_ms = CoarseNowMs();
+
+    uint32_t rate = log_site_rate.load(std::memory_order_relaxed);
+    if (0 != rate && 0 != site_id && site_id <= MAX_LOG_SITES)
+    {
+        uint32_t burst = log_site_burst.load(std::memory_order_relaxed);
+        if (!TakeToken(log_site_buckets[site_id], now_ms, rate, burst))
+        {
+            log_site_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    if (0 != log_id_limit_count.load(std::memory_order_relaxed))
+    {
+        LogIdBucket* entry = FindLogIdBucket(log_id);
+        if (NULL != entry)
+        {
+            uint32_t id_rate = entry->rate.load(std::memory_order_relaxed);
+            uint32_t id_burst = entry->burst.load(std::memory_order_relaxed);
+            if (!TakeToken(entry->bucket, now_ms, id_rate, id_burst))
+            {
+                log_id_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool IsLogTraceUserSlow(std::size_t user_id)
+{
+    uint64_t key = static_cast<uint64_t>(user_id) + 1;
+    std::size_t slot = HashSlot(key, LOG_USER_TABLE_SIZE);
+    for (std::size_t i=0; i<LOG_USER_TABLE_SIZE; ++i)
+    {
+        uint64_t entry_key = log_trace_users[slot].load(std::memory_order_relaxed);
+        if (key == entry_key)
+        {
+            return true;
+        }
+        else if (0 == entry_key)
+        {
+            return false;
+        }
+
+        slot = (slot + 1) & (LOG_USER_TABLE_SIZE - 1);
+    }
+
+    return false;
+}
+
+} // end namespace internal
+
+// burst 没填时等于 rate
+static void NormalizeLimit(const LogRateLimit& limit, uint32_t& rate, uint32_t& burst)
+{
+    rate = limit.rate;
+    burst = (0 == limit.burst) ? limit.rate : limit.burst;
+    if (burst > MAX_LOG_BURST)
+    {
+        burst = MAX_LOG_BURST;
+    }
+}
+
+int ConfigureLogLimiter(const LogLimitConfig& config)
+{
+    if (config.log_id_limits.size() > MAX_LOG_ID_LIMITS
+        || config.trace_users.size() > MAX_LOG_TRACE_USERS)
+    {
+        return -1;
+    }
+
+    // 先关掉, 改完再打开, 中间的日志不限流
+    internal::log_limit_enabled_.store(0, std::memory_order_relaxed);
+    internal::log_trace_user_count_.store(0, std::memory_order_relaxed);
+
+    uint32_t rate = 0;
+    uint32_t burst = 0;
+    NormalizeLimit(config.site_limit, rate, burst);
+    log_site_rate.store(rate, std::memory_order_relaxed);
+    log_site_burst.store(burst, std::memory_order_relaxed);
+    for (std::size_t i=0; i<=MAX_LOG_SITES; ++i)
+    {
+        log_site_buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    log_id_limit_count.store(0, std::memory_order_relaxed);
+    for (std::size_t i=0; i<LOG_ID_TABLE_SIZE; ++i)
+    {
+        log_id_buckets[i].key.store(0, std::memory_order_relaxed);
+        log_id_buckets[i].bucket.store(0, std::memory_order_relaxed);
+    }
+
+    int log_id_count = 0;
+    for (std::map<std::size_t, LogRateLimit>::const_iterator it = config.log_id_limits.begin();
+         it != config.log_id_limits.end(); ++it)
+    {
+        NormalizeLimit(it->second, rate, burst);
+        if (0 == rate)
+        {
+            continue;
+        }
+
+        uint64_t key = static_cast<uint64_t>(it->first) + 1;
+        std::size_t slot = HashSlot(key, LOG_ID_TABLE_SIZE);
+        while (0 != log_id_buckets[slot].key.load(std::memory_order_relaxed))
+        {
+            slot = (slot + 1) & (LOG_ID_TABLE_SIZE - 1);
+        }
+
+        LogIdBucket& entry = log_id_buckets[slot];
+        entry.rate.store(rate, std::memory_order_relaxed);
+        entry.burst.store(burst, std::memory_order_relaxed);
+        entry.key.store(key, std::memory_order_release);
+        ++log_id_count;
+    }
+    log_id_limit_count.store(log_id_count, std::memory_order_relaxed);
+
+    for (std::size_t i=0; i<LOG_USER_TABLE_SIZE; ++i)
+    {
+        log_trace_users[i].store(0, std::memory_order_relaxed);
+    }
+
+    int user_count = 0;
+    for (std::size_t i=0; i<config.trace_users.size(); ++i)
+    {
+        uint64_t key = static_cast<uint64_t>(config.trace_users[i]) + 1;
+        std::size_t slot = HashSlot(key, LOG_USER_TABLE_SIZE);
+        uint64_t entry_key = 0;
+        while (0 != (entry_key = log_trace_users[slot].load(std::memory_order_relaxed)) && key != entry_key)
+        {
+            slot = (slot + 1) & (LOG_USER_TABLE_SIZE - 1);
+        }
+
+        if (0 == entry_key)
+        {
+            log_trace_users[slot].store(key, std::memory_order_relaxed);
+            ++user_count;
+        }
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    internal::log_trace_user_count_.store(user_count, std::memory_order_relaxed);
+    internal::log_limit_enabled_.store((0 != log_site_rate.load() || 0 != log_id_count) ? 1 : 0,
+                                       std::memory_order_relaxed);
+
+    return 0;
+}
+
+/**
+ * @brief:  "100/200" 或者 "100"
+ */
+static int ParseRateLimit(const char* value, LogRateLimit& limit)
+{
+    char* end = NULL;
+    unsigned long rate = strtoul(value, &end, 10);
+    if (end == value)
+    {
+        return -1;
+    }
+
+    unsigned long burst = 0;
+    if ('/' == *end)
+    {
+        const char* burst_begin = end + 1;
+        burst = strtoul(burst_begin, &end, 10);
+        if (end == burst_begin)
+        {
+            return -1;
+        }
+    }
+
+    if ('\0' != *end || rate > 0xFFFFFFFFUL || burst > 0xFFFFFFFFUL)
+    {
+        return -1;
+    }
+
+    limit.rate = static_cast<uint32_t>(rate);
+    limit.burst = static_cast<uint32_t>(burst);
+    return 0;
+}
+
+static int ParseUserList(const char* value, std::vector<std::size_t>& users)
+{
+    const char* pos = value;
+    while ('\0' != *pos)
+    {
+        char* end = NULL;
+        unsigned long long user_id = strtoull(pos, &end, 10);
+        if (end == pos || (',' != *end && '\0' != *end))
+        {
+            return -1;
+        }
+
+        users.push_back(static_cast<std::size_t>(user_id));
+        pos = (',' == *end) ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+int ParseLogLimitConfig(const std::string& str, LogLimitConfig& config)
+{
+    static const char* LOG_ID_PREFIX = "log_id.";
+
+    config = LogLimitConfig();
+
+    std::string item;
+    for (std::size_t begin=0; begin<=str.size(); )
+    {
+        std::size_t end = str.find_first_of(" \t\r\n;", begin);
+        if (std::string::npos == end)
+        {
+            end = str.size();
+        }
+
+        item.assign(str, begin, end - begin);
+        begin = end + 1;
+        if (item.empty())
+        {
+            continue;
+        }
+
+        std::size_t eq = item.find('=');
+        if (std::string::npos == eq)
+        {
+            return -1;
+        }
+
+        item[eq] = '\0';
+        const char* key = item.c_str();
+        const char* value = key + eq + 1;
+
+        int ret = 0;
+        if (0 == strcmp(key, "site"))
+        {
+            ret = ParseRateLimit(value, config.site_limit);
+        }
+        else if (0 == strncmp(key, LOG_ID_PREFIX, strlen(LOG_ID_PREFIX)))
+        {
+            const char* id_begin = key + strlen(LOG_ID_PREFIX);
+            char* id_end = NULL;
+            unsigned long long log_id = strtoull(id_begin, &id_end, 10);
+            if (id_end == id_begin || '\0' != *id_end)
+            {
+                return -1;
+            }
+            ret = ParseRateLimit(value, config.log_id_limits[static_cast<std::size_t>(log_id)]);
+        }
+        else if (0 == strcmp(key, "trace_uin"))
+        {
+            ret = ParseUserList(value, config.trace_users);
+        }
+        else
+        {
+            ret = -1;
+        }
+
+        if (0 != ret)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+LogLimitStats GetLogLimitStats()
+{
+    LogLimitStats stats;
+    stats.site_dropped = log_site_dropped.load(std::memory_order_relaxed);
+    stats.log_id_dropped = log_id_dropped.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace tnt
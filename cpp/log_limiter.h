@@ -0,0 +1,139 @@
+/**
+ * @file:   log_limiter.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  日志限流和按uin打开TRACE
+ *
+ * 某个uin出问题时同一行WARN会刷满磁盘, 主循环也被写日志拖住,
+ * 所以 LOG_* 在级别判断之后再过一道令牌桶:
+ * 1 按位置: 每个 LOG_* 位置一个桶, 同样的速率和容量
+ *   (fmt 不是字面量的位置没有注册, 不按位置限)
+ * 2 按log_id: 单独给某些log_id配速率和容量
+ * 两个桶都拿到令牌才输出, 丢掉的只计数, 见 GetLogLimitStats
+ *
+ * uin白名单: 名单里的uin所有级别都输出(相当于对这个uin开了TRACE),
+ * 方便线上只看一个号的详细日志, 同样要过限流
+ *
+ * 快速路径:
+ * 没配置时只多读一个全局变量, 配了限流也只有一次粗粒度时钟
+ * (CLOCK_MONOTONIC_COARSE, vdso) 和一次CAS, 不加锁
+ * 白名单是空的时候, 级别不够的 LOG_* 里 user_id 不会被求值
+ *
+ * 配置一般在 OnReload 里重新加载, 只能在一个线程里改, 改的过程中其他线程
+ * 可能看到一半的配置, 最多多打或者少打几行
+ *
+ * XXX: 名单不是空时, 级别不够的 LOG_* 也要求值 user_id 来查名单(只求值一次),
+ *      user_id 不要写开销大的表达式
+ *
+ * use like this:
+ *   int MyApp::OnReload()
+ *   {
+ *       tnt::LogLimitConfig config;
+ *       if (0 == tnt::ParseLogLimitConfig("site=100/200 log_id.1001=10/20 trace_uin=10001,10002", config))
+ *       {
+ *           tnt::ConfigureLogLimiter(config);
+ *       }
+ *       return 0;
+ *   }
+ */
+
+#ifndef TNT_LOG_LIMITER_H
+#define TNT_LOG_LIMITER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tnt
+{
+
+// 0 不限
+struct LogRateLimit
+{
+    LogRateLimit() : rate(0), burst(0) {}
+    LogRateLimit(uint32_t r, uint32_t b) : rate(r), burst(b) {}
+
+    // 每秒多少条
+    uint32_t rate;
+    // 桶的容量, 最多连续输出多少条
+    uint32_t burst;
+};
+
+struct LogLimitConfig
+{
+    // 每个位置
+    LogRateLimit site_limit;
+    // log_id -> 限制
+    std::map<std::size_t, LogRateLimit> log_id_limits;
+    // 所有级别都输出的uin
+    std::vector<std::size_t> trace_users;
+};
+
+struct LogLimitStats
+{
+    // 被位置的桶丢掉的
+    uint64_t site_dropped;
+    // 被log_id的桶丢掉的
+    uint64_t log_id_dropped;
+};
+
+// 按log_id限流的最多个数
+static const std::size_t MAX_LOG_ID_LIMITS = 256;
+// 白名单最多个数
+static const std::size_t MAX_LOG_TRACE_USERS = 1024;
+
+namespace internal {
+// 有没有配置限流
+extern std::atomic<int> log_limit_enabled_;
+// 白名单里有多少个uin
+extern std::atomic<int> log_trace_user_count_;
+
+bool IsLogRateAllowedSlow(uint32_t site_id, std::size_t log_id);
+bool IsLogTraceUserSlow(std::size_t user_id);
+} // end namespace internal
+
+/**
+ * @brief:  整个替换限流和白名单的配置, 桶都重新装满
+ *
+ * @return: 0 成功, -1 log_id 或者 uin 太多
+ */
+int ConfigureLogLimiter(const LogLimitConfig& config);
+
+/**
+ * @brief:  解析配置, 空格或者分号隔开, 没写的就是不限
+ *
+ *   site=100/200               每个位置每秒100条, 最多连续200条
+ *   log_id.1001=10/20          log_id 1001 每秒10条, 最多连续20条
+ *   trace_uin=10001,10002      白名单
+ *
+ * @return: 0 成功, -1 格式不对
+ */
+int ParseLogLimitConfig(const std::string& str, LogLimitConfig& config);
+
+LogLimitStats GetLogLimitStats();
+
+inline bool IsLogRateAllowed(uint32_t site_id, std::size_t log_id)
+{
+    if (__builtin_expect(0 == internal::log_limit_enabled_.load(std::memory_order_relaxed), 1))
+    {
+        return true;
+    }
+
+    return internal::IsLogRateAllowedSlow(site_id, log_id);
+}
+
+inline bool HasLogTraceUsers()
+{
+    return __builtin_expect(0 != internal::log_trace_user_count_.load(std::memory_order_relaxed), 0);
+}
+
+inline bool IsLogTraceUser(std::size_t user_id)
+{
+    return HasLogTraceUsers() && internal::IsLogTraceUserSlow(user_id);
+}
+
+} // namespace tnt
+
+#endif //TNT_LOG_LIMITER_H
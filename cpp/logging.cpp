@@ -34,6 +34,8 @@ void NullVaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
 
 static VaLogHandler* va_log_handler_ = &DefaultVaLogHandler;
 
+std::atomic<int> log_level_(LOG_LEVEL_TRACE);
+
 } // end namespace internal
 
 VaLogHandler* SetVaLogHandler(VaLogHandler* new_func)
@@ -50,6 +52,11 @@ VaLogHandler* SetVaLogHandler(VaLogHandler* new_func)
     return old;
 }
 
+LogLevel SetLogLevel(LogLevel log_level)
+{
+    return static_cast<LogLevel>(internal::log_level_.exchange(log_level, std::memory_order_relaxed));
+}
+
 void Logging(const LogRecord& lr, const char* fmt, ...)
 {
     va_list args;
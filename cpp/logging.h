@@ -11,6 +11,16 @@
  * SetVaLogHandler
  * 来改变日志输出
  *
+ * 日志级别过滤, 都在宏里参数求值之前做:
+ * 1 编译期: TNT_LOG_MIN_LEVEL, 低于它的 LOG_* 整个被编译掉
+ *   例如 -DTNT_LOG_MIN_LEVEL=2 只留下INFO及以上, FUNC_TRACE 只去掉文本的进出日志
+ * 2 运行期: SetLogLevel, 低于它的只多一次比较和一个预测得准的分支,
+ *   不会构造 LogRecord, 也不会调用 handler
+ *
+ * 级别过滤之后还有限流, uin白名单里的不看级别, 见 log_limiter.h
+ *
+ * FUNC_TRACE 可以切到二进制模式, 见 func_trace.h
+ *
  */
 // use like this:
 // void MyVaLogHandler(const tnt::LogRecord& lr, const char* fmt, va_list vl)
@@ -28,24 +38,64 @@
 #ifndef TNT_LOGGING_H
 #define TNT_LOGGING_H
 
+#include <stdint.h>
 #include <cstddef>
 #include <cstdio>
 #include <cstdarg>
+#include <atomic>
 #include <string>
+#include "func_trace.h"
+#include "log_limiter.h"
 
 namespace tnt
 {
 
+// 预处理器里要比较, 所以用数字
+#ifndef TNT_LOG_MIN_LEVEL
+#define TNT_LOG_MIN_LEVEL 0
+#endif
+
 enum LogLevel
 {
-  LOG_LEVEL_TRACE,
-  LOG_LEVEL_DEBUG,
-  LOG_LEVEL_INFO,
-  LOG_LEVEL_WARN,
-  LOG_LEVEL_ERROR,
-  LOG_LEVEL_FATAL,
+  LOG_LEVEL_TRACE = 0,
+  LOG_LEVEL_DEBUG = 1,
+  LOG_LEVEL_INFO = 2,
+  LOG_LEVEL_WARN = 3,
+  LOG_LEVEL_ERROR = 4,
+  LOG_LEVEL_FATAL = 5,
 };
 
+namespace internal {
+// 工作线程读, OnReload 时可能在改, 只要求原子, 不要求顺序
+extern std::atomic<int> log_level_;
+} // end namespace internal
+
+// 运行期的级别, 低于它的不输出, 返回原来的
+LogLevel SetLogLevel(LogLevel log_level);
+
+inline LogLevel GetLogLevel()
+{
+    return static_cast<LogLevel>(internal::log_level_.load(std::memory_order_relaxed));
+}
+
+// 只有 TRACE/DEBUG 在线上一般是关的, 提示编译器不太会走; INFO 以上不加提示
+inline bool IsLogLevelEnabled(int log_level)
+{
+    if (log_level <= LOG_LEVEL_DEBUG)
+    {
+        return __builtin_expect(log_level >= internal::log_level_.load(std::memory_order_relaxed), 0);
+    }
+    return log_level >= internal::log_level_.load(std::memory_order_relaxed);
+}
+
+// 编译期的判断放在宏里, 每个编译单元可以不一样
+#define TNT_LOG_ENABLED(log_level) \
+    ((log_level) >= TNT_LOG_MIN_LEVEL && tnt::IsLogLevelEnabled(log_level))
+
+// 级别不够但是配了uin白名单, 要再看 user_id, 名单是空的时候不求值 user_id
+#define TNT_LOG_USER_MAYBE_ENABLED(log_level) \
+    ((log_level) >= TNT_LOG_MIN_LEVEL && tnt::HasLogTraceUsers())
+
 struct LogRecord
 {
     LogRecord(LogLevel log_level, std::size_t log_id, std::size_t user_id, const std::string& user_name,
@@ -56,7 +106,8 @@ struct LogRecord
         user_name_(user_name),
         file_(file),
         line_(line),
-        func_(func)
+        func_(func),
+        site_id_(0)
     {
     }
 
@@ -68,6 +119,9 @@ struct LogRecord
     const char* file_;
     std::size_t line_;
     const char* func_;
+
+    // LOG_* 位置注册的id, 0 是没注册, 见 binary_logging.h
+    uint32_t site_id_;
 };
 
 typedef void VaLogHandler(const LogRecord& lr, const char* fmt, va_list vl);
@@ -76,12 +130,36 @@ VaLogHandler* SetVaLogHandler(VaLogHandler* new_func);
 
 void Logging(const LogRecord& lr, const char* fmt, ...);
 
+// 最多注册多少个 LOG_* 位置
+static const uint32_t MAX_LOG_SITES = 65536;
+
+/**
+ * @brief:  注册一个 LOG_* 的位置, 宏里用, 见 binary_logging.h
+ *
+ * @return: site_id, 从1开始, 注册满了返回0
+ */
+uint32_t RegisterLogSite(const char* file, std::size_t line, const char* func, const char* fmt);
+
 
 #define LOG(log_level, log_id, user_id, user_name, fmt, args...) \
     do\
     {\
-        tnt::LogRecord lr(log_level, log_id, user_id, user_name, __FILE__, __LINE__, __FUNCTION__);\
-        tnt::Logging(lr, fmt, ##args);\
+        if (TNT_LOG_ENABLED(log_level) || TNT_LOG_USER_MAYBE_ENABLED(log_level))\
+        {\
+            const std::size_t temp_user_id = (user_id);\
+            if (TNT_LOG_ENABLED(log_level) || tnt::internal::IsLogTraceUserSlow(temp_user_id))\
+            {\
+                static const uint32_t temp_log_site_id = __builtin_constant_p(fmt) ?\
+                    tnt::RegisterLogSite(__FILE__, __LINE__, __FUNCTION__, fmt) : 0;\
+                const std::size_t temp_log_id = (log_id);\
+                if (tnt::IsLogRateAllowed(temp_log_site_id, temp_log_id))\
+                {\
+                    tnt::LogRecord lr(log_level, temp_log_id, temp_user_id, user_name, __FILE__, __LINE__, __FUNCTION__);\
+                    lr.site_id_ = temp_log_site_id;\
+                    tnt::Logging(lr, fmt, ##args);\
+                }\
+            }\
+        }\
     } while(0)
 
 #define LOG_ERROR(log_id, user_id, user_name, fmt, args...)   LOG(tnt::LOG_LEVEL_ERROR, log_id, user_id, user_name, fmt, ##args)
@@ -92,37 +170,124 @@ void Logging(const LogRecord& lr, const char* fmt, ...);
 
 struct FuncTraceStruct
 {
+    // text_enabled 是 false 时只有二进制模式, FUNC_TRACE 按 TNT_LOG_MIN_LEVEL 传
+    FuncTraceStruct(uint32_t func_id, const char* file_name, std::size_t file_line, const char* func_name,
+                    unsigned int user_id, bool text_enabled = true) :
+        file_name_(file_name),
+        file_line_(file_line),
+        func_name_(func_name),
+        user_id_(user_id),
+        func_id_(func_id),
+        traced_(TRACED_NONE)
+    {
+        Enter("", text_enabled);
+    }
+
+    FuncTraceStruct(const char* file_name, std::size_t file_line, const char* func_name,
+                    unsigned int user_id, const char* user_name) :
+        file_name_(file_name),
+        file_line_(file_line),
+        func_name_(func_name),
+        user_id_(user_id),
+        func_id_(0),
+        traced_(TRACED_NONE)
+    {
+        Enter(user_name);
+    }
+
     FuncTraceStruct(const char* file_name, std::size_t file_line, const char* func_name,
                     unsigned int user_id, const std::string& user_name) :
         file_name_(file_name),
         file_line_(file_line),
         func_name_(func_name),
         user_id_(user_id),
-        user_name_(user_name)
+        func_id_(0),
+        traced_(TRACED_NONE)
     {
-        LogRecord lr(tnt::LOG_LEVEL_TRACE, 0, user_id_, user_name_, file_name_, file_line_, func_name_);
-        tnt::Logging(lr, "Enter Function");
+        Enter(user_name.c_str());
     }
 
     ~FuncTraceStruct()
     {
-        LogRecord lr(tnt::LOG_LEVEL_TRACE, 0, user_id_, user_name_, file_name_, file_line_, func_name_);
-        tnt::Logging(lr, "Leave Function");
+        // 进入时记了, 离开时一定记, 中间改级别或模式也能配对
+        if (TRACED_BINARY == traced_)
+        {
+            RecordFuncTrace(func_id_, user_id_, FUNC_TRACE_LEAVE);
+            LeaveFuncTrace();
+        }
+        else if (TRACED_SKIPPED == traced_)
+        {
+            LeaveFuncTrace();
+        }
+        else if (TRACED_TEXT == traced_)
+        {
+            Trace("Leave Function");
+        }
     }
 
 private:
+    enum TracedState
+    {
+        TRACED_NONE,
+        TRACED_TEXT,
+        TRACED_BINARY,
+        // 二进制模式没采中
+        TRACED_SKIPPED,
+    };
+
+    void Enter(const char* user_name = "", bool text_enabled = true)
+    {
+        int mode = GetFuncTraceMode();
+        if (FUNC_TRACE_BINARY == mode && 0 != func_id_)
+        {
+            if (EnterFuncTrace())
+            {
+                traced_ = TRACED_BINARY;
+                RecordFuncTrace(func_id_, user_id_, FUNC_TRACE_ENTER);
+            }
+            else
+            {
+                traced_ = TRACED_SKIPPED;
+            }
+        }
+        else if (text_enabled && FUNC_TRACE_OFF != mode
+                 && (IsLogLevelEnabled(LOG_LEVEL_TRACE) || IsLogTraceUser(user_id_)))
+        {
+            traced_ = TRACED_TEXT;
+            user_name_ = user_name;
+            Trace("Enter Function");
+        }
+    }
+
+    void Trace(const char* msg)
+    {
+        LogRecord lr(tnt::LOG_LEVEL_TRACE, 0, user_id_, user_name_, file_name_, file_line_, func_name_);
+        tnt::Logging(lr, "%s", msg);
+    }
+
     const char* file_name_;
     std::size_t file_line_;
     const char* func_name_;
     unsigned int user_id_;
+    uint32_t func_id_;
+    int traced_;
     std::string user_name_;
 };
 
 // 在进如函数的时候定义一下就可以打印进出函数的trace日志
 // 没有uin 时填0
+// 每个位置第一次执行时注册一个函数id, 给二进制模式用, 见 func_trace.h
+// TRACE 级别被编译掉(TNT_LOG_MIN_LEVEL > 0)时只去掉文本的进出日志, 二进制的还能线上打开
+// 定义了 TNT_FUNC_TRACE_DISABLE 时整个编译掉, 二进制模式也没有了
 #ifndef FUNC_TRACE
+#ifdef TNT_FUNC_TRACE_DISABLE
+#define FUNC_TRACE(user_id) do {} while(0)
+#else
 #define FUNC_TRACE(user_id) \
-    tnt::FuncTraceStruct temp_func_trace_struct(__FILE__, __LINE__, __PRETTY_FUNCTION__, user_id, "")
+    static const uint32_t temp_func_trace_id = tnt::RegisterFuncTrace(__FILE__, __LINE__, __PRETTY_FUNCTION__);\
+    tnt::FuncTraceStruct temp_func_trace_struct(temp_func_trace_id, __FILE__, __LINE__, __PRETTY_FUNCTION__, user_id,\
+                                                (TNT_LOG_MIN_LEVEL <= 0))
+#endif
 #endif
 
 };
@@ -0,0 +1,330 @@
+/**
+ * @file:   mpmc_ring_queue.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  多生产者多消费者的有界无锁队列
+ *
+ * 网关上多个收包线程往一组工作线程里投递
+ *
+ * 1 每个槽带一个序号(Dmitry Vyukov 的有界MPMC队列), 生产者和消费者都只
+ *   CAS 自己那一端的位置, 不用锁
+ * 2 try_push/try_pop 不阻塞, 满/空时返回false
+ * 3 push/pop 阻塞, 先自旋一小会儿, 还不行就在futex上睡, 有人等的时候
+ *   另一端才会去 FUTEX_WAKE, 没人等时没有系统调用
+ *
+ * XXX: futex 用的是 PRIVATE, 只能在同一个进程的线程之间用
+ */
+
+#ifndef TNT_MPMC_RING_QUEUE_H
+#define TNT_MPMC_RING_QUEUE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <cstddef>
+#include <atomic>
+#include "code_inbox.h"
+
+namespace tnt
+{
+
+/**
+ * @brief: 多生产者多消费者的固定大小队列
+ *
+ * @tparam T 数据类型
+ * @tparam SIZE 队列大小, 必须是2的幂
+ */
+template<typename T, size_t SIZE>
+class mpmc_ring_queue
+{
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+private:
+    typedef T value_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+
+    static const size_t MASK = SIZE - 1;
+
+    // 阻塞前自旋的次数
+    static const int SPIN_COUNT = 128;
+
+public:
+    mpmc_ring_queue()
+        : enqueue_pos_(0), dequeue_pos_(0),
+        not_full_seq_(0), not_full_waiters_(0),
+        not_empty_seq_(0), not_empty_waiters_(0)
+    {
+        for (size_t i=0; i<SIZE; ++i)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // 满了返回false
+    bool try_push(const value_type& value)
+    {
+        if (!enqueue(value))
+        {
+            return false;
+        }
+
+        Notify(not_empty_seq_, not_empty_waiters_);
+        return true;
+    }
+
+    // 空的时候返回false
+    bool try_pop(reference value)
+    {
+        if (!dequeue(value))
+        {
+            return false;
+        }
+
+        Notify(not_full_seq_, not_full_waiters_);
+        return true;
+    }
+
+    // 满了就一直等
+    void push(const value_type& value)
+    {
+        while (!enqueue(value))
+        {
+            if (Spin(&mpmc_ring_queue::full))
+            {
+                continue;
+            }
+
+            uint32_t seq = not_full_seq_.load(std::memory_order_acquire);
+            not_full_waiters_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (full())
+            {
+                FutexWait(not_full_seq_, seq, -1);
+            }
+
+            not_full_waiters_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        Notify(not_empty_seq_, not_empty_waiters_);
+    }
+
+    // 空的时候一直等
+    void pop(reference value)
+    {
+        pop(value, -1);
+    }
+
+    /**
+     * @brief:  空的时候最多等 timeout_ms 毫秒(被别人抢走时会重新计时)
+     *
+     * @param  timeout_ms <0 一直等
+     *
+     * @return: 超时返回false
+     */
+    bool pop(reference value, int timeout_ms)
+    {
+        while (!dequeue(value))
+        {
+            if (Spin(&mpmc_ring_queue::empty))
+            {
+                continue;
+            }
+
+            uint32_t seq = not_empty_seq_.load(std::memory_order_acquire);
+            not_empty_waiters_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            bool timeout = false;
+            if (empty())
+            {
+                timeout = (FutexWait(not_empty_seq_, seq, timeout_ms) == ETIMEDOUT);
+            }
+
+            not_empty_waiters_.fetch_sub(1, std::memory_order_relaxed);
+
+            if (timeout)
+            {
+                if (!dequeue(value))
+                {
+                    return false;
+                }
+                break;
+            }
+        }
+
+        Notify(not_full_seq_, not_full_waiters_);
+        return true;
+    }
+
+    // 都是近似值
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    bool full() const
+    {
+        return size() >= SIZE;
+    }
+
+    size_t size() const
+    {
+        size_t head = dequeue_pos_.load(std::memory_order_acquire);
+        size_t tail = enqueue_pos_.load(std::memory_order_acquire);
+        return (tail > head) ? (tail - head) : 0;
+    }
+
+    size_t capacity() const
+    {
+        return SIZE;
+    }
+
+private:
+    bool enqueue(const value_type& value)
+    {
+        Cell* cell = NULL;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            cell = &cells_[pos & MASK];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (0 == diff)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // 这个槽上一圈的数据还没被取走
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool dequeue(reference value)
+    {
+        Cell* cell = NULL;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            cell = &cells_[pos & MASK];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+            if (0 == diff)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // 这个槽还没写进来
+                return false;
+            }
+            else
+            {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = cell->data;
+        cell->sequence.store(pos + SIZE, std::memory_order_release);
+
+        return true;
+    }
+
+    // 自旋等条件变化, 返回true表示可以再试一次
+    bool Spin(bool (mpmc_ring_queue::*blocked)() const) const
+    {
+        for (int i=0; i<SPIN_COUNT; ++i)
+        {
+            if (!(this->*blocked)())
+            {
+                return true;
+            }
+
+            TNT_CPU_RELAX();
+        }
+
+        return false;
+    }
+
+    // 另一端有人等的时候才唤醒
+    // 和等待方的 waiters++/fence/再检查 配对, 不会丢唤醒:
+    // 要么这里看到了 waiters, 要么等待方再检查时看到了数据
+    static void Notify(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiters)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (waiters.load(std::memory_order_relaxed) > 0)
+        {
+            seq.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+
+    static int FutexWait(std::atomic<uint32_t>& seq, uint32_t expected, int timeout_ms)
+    {
+        struct timespec ts;
+        struct timespec* pts = NULL;
+        if (timeout_ms >= 0)
+        {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            pts = &ts;
+        }
+
+        if (0 != syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAIT_PRIVATE, expected, pts, NULL, 0))
+        {
+            return errno;
+        }
+
+        return 0;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    alignas(TNT_CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos_;
+    alignas(TNT_CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos_;
+
+    // 等"不满"的生产者
+    alignas(TNT_CACHE_LINE_SIZE) std::atomic<uint32_t> not_full_seq_;
+    std::atomic<uint32_t> not_full_waiters_;
+
+    // 等"不空"的消费者
+    alignas(TNT_CACHE_LINE_SIZE) std::atomic<uint32_t> not_empty_seq_;
+    std::atomic<uint32_t> not_empty_waiters_;
+
+    alignas(TNT_CACHE_LINE_SIZE) Cell cells_[SIZE];
+
+}; // class mpmc_ring_queue
+
+} // namespace tnt
+
+#endif //TNT_MPMC_RING_QUEUE_H
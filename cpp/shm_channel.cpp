@@ -0,0 +1,306 @@
+/**
+ * @file:   shm_channel.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  基于ShmMmap的进程间消息通道
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include "shm_channel.h"
+
+namespace tnt
+{
+
+// 数据区紧跟在头后面, 按缓存行对齐
+static const std::size_t SHM_CHANNEL_DATA_OFFSET =
+    (sizeof(ShmChannel::Header) + TNT_CACHE_LINE_SIZE - 1) & ~static_cast<std::size_t>(TNT_CACHE_LINE_SIZE - 1);
+
+ShmChannel::ShmChannel()
+{
+    header_ = NULL;
+    data_ = NULL;
+    capacity_ = 0;
+    mask_ = 0;
+
+    write_pos_ = 0;
+    read_pos_cache_ = 0;
+    reserve_len_ = 0;
+    reserve_record_ = NULL;
+
+    read_pos_ = 0;
+    write_pos_cache_ = 0;
+    peek_next_pos_ = 0;
+
+    doorbell_fd_ = -1;
+}
+
+ShmChannel::~ShmChannel()
+{
+    Close();
+}
+
+int ShmChannel::Open(const char* mmap_file, std::size_t capacity)
+{
+    if (NULL == mmap_file || capacity < 64 || 0 != (capacity & (capacity - 1)))
+    {
+        return -1;
+    }
+
+    // 先挂已有的, 没有(或者不是ShmMmap文件)才创建
+    std::size_t shm_size = SHM_CHANNEL_DATA_OFFSET + capacity;
+    shm_.SetLayout(VERSION, ShmMmap::LayoutChecksum("ShmChannel", sizeof(Header)));
+
+    int ret = shm_.Open(mmap_file, shm_size, true);
+    if (ShmMmap::SHM_ERR_NOT_EXIST == ret || ShmMmap::SHM_ERR_HEADER == ret)
+    {
+        ret = shm_.Open(mmap_file, shm_size, false);
+    }
+
+    if (ShmMmap::SHM_ERR_SIZE == ret || ShmMmap::SHM_ERR_LAYOUT == ret)
+    {
+        return -3;
+    }
+    else if (0 != ret)
+    {
+        return -2;
+    }
+
+    header_ = static_cast<Header*>(shm_.addr());
+    data_ = static_cast<char*>(shm_.addr()) + SHM_CHANNEL_DATA_OFFSET;
+
+    if (MAGIC != header_->magic)
+    {
+        // 新文件, 最后再写magic
+        header_->version = VERSION;
+        header_->capacity = capacity;
+        header_->write_pos.store(0, std::memory_order_relaxed);
+        header_->read_pos.store(0, std::memory_order_relaxed);
+        header_->reader_waiting.store(0, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        header_->magic = MAGIC;
+    }
+    else if (VERSION != header_->version || capacity != header_->capacity)
+    {
+        shm_.Close();
+        header_ = NULL;
+        data_ = NULL;
+        return -3;
+    }
+
+    capacity_ = capacity;
+    mask_ = capacity - 1;
+
+    write_pos_ = header_->write_pos.load(std::memory_order_acquire);
+    read_pos_ = header_->read_pos.load(std::memory_order_acquire);
+    read_pos_cache_ = read_pos_;
+    write_pos_cache_ = write_pos_;
+    peek_next_pos_ = read_pos_;
+
+    return 0;
+}
+
+int ShmChannel::Close()
+{
+    if (NULL == header_)
+    {
+        return 0;
+    }
+
+    header_ = NULL;
+    data_ = NULL;
+    reserve_record_ = NULL;
+
+    return shm_.Close();
+}
+
+std::size_t ShmChannel::max_msg_len() const
+{
+    // 最坏情况下前面还要放一个填充记录
+    return capacity_ / 2 - sizeof(Record);
+}
+
+void* ShmChannel::Reserve(std::size_t len)
+{
+    if (len > max_msg_len())
+    {
+        return NULL;
+    }
+
+    std::size_t total = RecordSize(len);
+    std::size_t offset = write_pos_ & mask_;
+    std::size_t tail = capacity_ - offset;
+    std::size_t need = (tail < total) ? (tail + total) : total;
+
+    if (capacity_ - (write_pos_ - read_pos_cache_) < need)
+    {
+        read_pos_cache_ = header_->read_pos.load(std::memory_order_acquire);
+        if (capacity_ - (write_pos_ - read_pos_cache_) < need)
+        {
+            return NULL;
+        }
+    }
+
+    if (tail < total)
+    {
+        // 尾部放不下, 填充掉, 和这条记录一起提交
+        Record* pad = reinterpret_cast<Record*>(data_ + offset);
+        pad->len = static_cast<uint32_t>(tail - sizeof(Record));
+        pad->flag = RECORD_PAD;
+
+        write_pos_ += tail;
+        offset = 0;
+    }
+
+    reserve_record_ = reinterpret_cast<Record*>(data_ + offset);
+    reserve_len_ = len;
+
+    return reserve_record_ + 1;
+}
+
+void ShmChannel::Commit(std::size_t len)
+{
+    if (NULL == reserve_record_ || len > reserve_len_)
+    {
+        return;
+    }
+
+    reserve_record_->len = static_cast<uint32_t>(len);
+    reserve_record_->flag = RECORD_DATA;
+    reserve_record_ = NULL;
+
+    write_pos_ += RecordSize(len);
+    header_->write_pos.store(write_pos_, std::memory_order_release);
+
+    if (-1 != doorbell_fd_)
+    {
+        // 和 ArmDoorbell 配对, 要么这里看到读者在等, 要么读者再检查时看到数据
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (0 != header_->reader_waiting.load(std::memory_order_relaxed))
+        {
+            header_->reader_waiting.store(0, std::memory_order_relaxed);
+
+            uint64_t one = 1;
+            ssize_t ret = write(doorbell_fd_, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+}
+
+int ShmChannel::Send(const void* data, std::size_t len)
+{
+    void* buf = Reserve(len);
+    if (NULL == buf)
+    {
+        return -1;
+    }
+
+    memcpy(buf, data, len);
+    Commit(len);
+
+    return 0;
+}
+
+const void* ShmChannel::Peek(std::size_t& len)
+{
+    if (read_pos_ == write_pos_cache_)
+    {
+        write_pos_cache_ = header_->write_pos.load(std::memory_order_acquire);
+        if (read_pos_ == write_pos_cache_)
+        {
+            return NULL;
+        }
+    }
+
+    Record* record = reinterpret_cast<Record*>(data_ + (read_pos_ & mask_));
+    if (RECORD_PAD == record->flag)
+    {
+        // 填充记录总是和下一条一起提交的
+        read_pos_ += sizeof(Record) + record->len;
+        record = reinterpret_cast<Record*>(data_);
+    }
+
+    len = record->len;
+    peek_next_pos_ = read_pos_ + RecordSize(len);
+
+    return record + 1;
+}
+
+void ShmChannel::Release()
+{
+    if (peek_next_pos_ <= read_pos_)
+    {
+        return;
+    }
+
+    read_pos_ = peek_next_pos_;
+    header_->read_pos.store(read_pos_, std::memory_order_release);
+}
+
+int ShmChannel::Recv(void* buf, std::size_t& buf_len)
+{
+    std::size_t len = 0;
+    const void* msg = Peek(len);
+    if (NULL == msg)
+    {
+        return -1;
+    }
+
+    if (len > buf_len)
+    {
+        buf_len = len;
+        return -2;
+    }
+
+    memcpy(buf, msg, len);
+    buf_len = len;
+    Release();
+
+    return 0;
+}
+
+bool ShmChannel::ArmDoorbell()
+{
+    header_->reader_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (!empty())
+    {
+        header_->reader_waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+void ShmChannel::ClearDoorbell()
+{
+    header_->reader_waiting.store(0, std::memory_order_relaxed);
+
+    if (-1 != doorbell_fd_)
+    {
+        uint64_t value = 0;
+        ssize_t ret = read(doorbell_fd_, &value, sizeof(value));
+        (void)ret;
+    }
+}
+
+bool ShmChannel::empty() const
+{
+    return used_bytes() == 0;
+}
+
+std::size_t ShmChannel::used_bytes() const
+{
+    if (NULL == header_)
+    {
+        return 0;
+    }
+
+    uint64_t read_pos = header_->read_pos.load(std::memory_order_acquire);
+    uint64_t write_pos = header_->write_pos.load(std::memory_order_acquire);
+
+    return static_cast<std::size_t>(write_pos - read_pos);
+}
+
+} // namespace tnt
@@ -0,0 +1,195 @@
+/**
+ * @file:   shm_channel.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  基于ShmMmap的进程间消息通道
+ *
+ * 同一台机器上两个进程之间单向传消息, 不依赖bus
+ * 共享内存里放一个变长记录的单生产者单消费者环形缓冲:
+ *
+ *   | 头: magic version capacity | 写位置(独占缓存行) | 读位置(独占缓存行) | 数据区 |
+ *
+ * 1 数据区大小是2的幂, 读写位置一直递增, 用掩码定位
+ * 2 每条记录 8字节头(长度, 标记) + 数据(8字节对齐), 尾部放不下时写一个
+ *   填充记录, 从头开始放
+ * 3 Reserve/Commit, Peek/Release 直接在共享内存上读写, 没有拷贝,
+ *   快路径上也没有系统调用
+ * 4 可选的eventfd门铃: 读者准备睡之前 ArmDoorbell, 写者Commit时发现读者在
+ *   等才去写eventfd. eventfd 需要通过fork或者unix socket传给两个进程,
+ *   读者可以把它加到 ApplicationBase::AddPollFd 里
+ *
+ * XXX: 一个通道只能有一个进程写, 一个进程读
+ *
+ * use like this:
+ *   // 写
+ *   void* buf = channel.Reserve(len);
+ *   if (buf) { memcpy/序列化到buf; channel.Commit(len); }
+ *
+ *   // 读
+ *   std::size_t len = 0;
+ *   const void* msg = channel.Peek(len);
+ *   if (msg) { 处理msg; channel.Release(); }
+ */
+
+#ifndef TNT_SHM_CHANNEL_H
+#define TNT_SHM_CHANNEL_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include "code_inbox.h"
+#include "shm_mmap.h"
+
+namespace tnt
+{
+
+class ShmChannel
+{
+public:
+    static const uint32_t MAGIC = 0x544E5443;   // "TNTC"
+    static const uint32_t VERSION = 1;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;
+
+        // 写者
+        alignas(TNT_CACHE_LINE_SIZE) std::atomic<uint64_t> write_pos;
+        // 读者
+        alignas(TNT_CACHE_LINE_SIZE) std::atomic<uint64_t> read_pos;
+        // 读者是否在等门铃
+        std::atomic<uint32_t> reader_waiting;
+    };
+
+public:
+    ShmChannel();
+    ~ShmChannel();
+
+public:
+    /**
+     * @brief:  打开通道
+     *
+     * 文件里还没有通道时初始化, 已经有了就校验后直接使用
+     * 所以两个进程谁先打开都可以, 但不要同时第一次打开
+     *
+     * @param  mmap_file mmap文件
+     * @param  capacity 数据区大小, 必须是2的幂
+     *
+     * @return: 0 成功
+     *          -1 参数错误
+     *          -2 mmap失败
+     *          -3 版本或大小和已有的通道不一致
+     */
+    int Open(const char* mmap_file, std::size_t capacity);
+
+    int Close();
+
+    // 设置门铃, 不设置就不通知
+    void SetDoorbell(int event_fd)
+    {
+        doorbell_fd_ = event_fd;
+    }
+
+    // 写者
+    /**
+     * @brief:  预留一条长度为len的记录
+     *
+     * @return: 可以直接写的地址, 空间不够时返回NULL
+     */
+    void* Reserve(std::size_t len);
+
+    /**
+     * @brief:  提交上次Reserve的记录, len 不能超过Reserve时的长度
+     */
+    void Commit(std::size_t len);
+
+    // 拷贝一次的写法
+    int Send(const void* data, std::size_t len);
+
+    // 读者
+    /**
+     * @brief:  取下一条记录, 不移动读位置
+     *
+     * @return: 记录的地址, 没有时返回NULL
+     */
+    const void* Peek(std::size_t& len);
+
+    /**
+     * @brief:  释放上次Peek的记录
+     */
+    void Release();
+
+    // 拷贝一次的写法, buf_len 传入时是buf的大小, 返回时是消息长度
+    // 0 成功, -1 没有消息, -2 buf不够
+    int Recv(void* buf, std::size_t& buf_len);
+
+    /**
+     * @brief:  读者准备睡之前调用
+     *
+     * @return: false 已经有数据了, 不用睡
+     */
+    bool ArmDoorbell();
+
+    /**
+     * @brief:  读者被唤醒后调用, 把eventfd读掉
+     */
+    void ClearDoorbell();
+
+    // 一条记录最大的长度
+    std::size_t max_msg_len() const;
+
+    bool empty() const;
+
+    // 数据区已经用掉的字节数
+    std::size_t used_bytes() const;
+
+    std::size_t capacity() const
+    {
+        return capacity_;
+    }
+
+private:
+    struct Record
+    {
+        uint32_t len;
+        uint32_t flag;
+    };
+
+    enum RecordFlag
+    {
+        RECORD_DATA = 0,
+        RECORD_PAD = 1,
+    };
+
+    static std::size_t RecordSize(std::size_t len)
+    {
+        return sizeof(Record) + ((len + 7) & ~static_cast<std::size_t>(7));
+    }
+
+    ShmMmap shm_;
+
+    Header* header_;
+    char* data_;
+    std::size_t capacity_;
+    std::size_t mask_;
+
+    // 写者本地
+    uint64_t write_pos_;
+    uint64_t read_pos_cache_;
+    std::size_t reserve_len_;
+    Record* reserve_record_;
+
+    // 读者本地
+    uint64_t read_pos_;
+    uint64_t write_pos_cache_;
+    uint64_t peek_next_pos_;
+
+    int doorbell_fd_;
+
+}; // class ShmChannel
+
+} // namespace tnt
+
+#endif //TNT_SHM_CHANNEL_H
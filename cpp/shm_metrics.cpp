@@ -0,0 +1,439 @@
+/**
+ * @file:   shm_metrics.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  把统计数据发布到共享内存, 其他进程来读
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <map>
+#include "shm_metrics.h"
+
+namespace tnt
+{
+
+const uint32_t ShmMetricsRegion::MAGIC;
+const uint32_t ShmMetricsRegion::VERSION;
+const std::size_t ShmMetricsRegion::MAX_COUNTERS;
+const std::size_t ShmMetricsRegion::MAX_HISTOGRAMS;
+
+// 读的时候最多重试多少次
+static const int SHM_METRICS_READ_RETRY = 1000;
+
+static void CopyName(char* dst, std::size_t size, const char* src)
+{
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+ShmMetrics::ShmMetrics()
+{
+    region_ = NULL;
+}
+
+ShmMetrics::~ShmMetrics()
+{
+    Close();
+}
+
+int ShmMetrics::Open(const char* mmap_file, const char* app_name, const char* id, int64_t now_ms)
+{
+    if (NULL == mmap_file || NULL == app_name || NULL == id || NULL != region_)
+    {
+        return -1;
+    }
+
+    // 先挂原来的, 上一个进程可能还没退出, 不能截断它正在用的文件
+    shm_.SetLayout(ShmMetricsRegion::VERSION,
+                   ShmMmap::LayoutChecksum("ShmMetricsRegion", sizeof(ShmMetricsRegion)));
+
+    int ret = shm_.Open(mmap_file, sizeof(ShmMetricsRegion), true);
+    if (0 != ret)
+    {
+        ret = shm_.Open(mmap_file, sizeof(ShmMetricsRegion), false);
+    }
+
+    if (0 != ret)
+    {
+        return -2;
+    }
+
+    region_ = static_cast<ShmMetricsRegion*>(shm_.addr());
+    counters_.clear();
+    histograms_.clear();
+
+    BeginWrite();
+    region_->version = ShmMetricsRegion::VERSION;
+    region_->pid = getpid();
+    region_->counter_count = 0;
+    region_->histogram_count = 0;
+    region_->start_time = now_ms;
+    region_->publish_time = now_ms;
+    CopyName(region_->app_name, sizeof(region_->app_name), app_name);
+    CopyName(region_->id, sizeof(region_->id), id);
+    region_->magic = ShmMetricsRegion::MAGIC;
+    EndWrite();
+
+    return 0;
+}
+
+int ShmMetrics::Close()
+{
+    if (NULL == region_)
+    {
+        return 0;
+    }
+
+    region_ = NULL;
+    counters_.clear();
+    histograms_.clear();
+
+    return shm_.Close();
+}
+
+int ShmMetrics::RegisterCounter(const char* name, const uint64_t* value)
+{
+    if (NULL == region_ || NULL == name || NULL == value
+        || counters_.size() >= ShmMetricsRegion::MAX_COUNTERS)
+    {
+        return -1;
+    }
+
+    BeginWrite();
+    ShmMetricsCounter& counter = region_->counters[counters_.size()];
+    CopyName(counter.name, sizeof(counter.name), name);
+    counter.value = *value;
+    counters_.push_back(value);
+    region_->counter_count = counters_.size();
+    EndWrite();
+
+    return 0;
+}
+
+int ShmMetrics::RegisterHistogram(const char* name, const LatencyHistogram* histogram)
+{
+    if (NULL == region_ || NULL == name || NULL == histogram
+        || histograms_.size() >= ShmMetricsRegion::MAX_HISTOGRAMS)
+    {
+        return -1;
+    }
+
+    BeginWrite();
+    ShmMetricsHistogram& shm_histogram = region_->histograms[histograms_.size()];
+    memset(&shm_histogram, 0, sizeof(shm_histogram));
+    CopyName(shm_histogram.name, sizeof(shm_histogram.name), name);
+    histograms_.push_back(histogram);
+    region_->histogram_count = histograms_.size();
+    EndWrite();
+
+    return 0;
+}
+
+void ShmMetrics::Publish(int64_t now_ms)
+{
+    if (NULL == region_)
+    {
+        return;
+    }
+
+    // 分位数先算好, 写的窗口尽量短
+    struct Quantiles
+    {
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+        uint64_t p999;
+    } quantiles[ShmMetricsRegion::MAX_HISTOGRAMS];
+
+    for (std::size_t i=0; i<histograms_.size(); ++i)
+    {
+        quantiles[i].p50 = histograms_[i]->Percentile(50);
+        quantiles[i].p90 = histograms_[i]->Percentile(90);
+        quantiles[i].p99 = histograms_[i]->Percentile(99);
+        quantiles[i].p999 = histograms_[i]->Percentile(99.9);
+    }
+
+    BeginWrite();
+    region_->publish_time = now_ms;
+
+    for (std::size_t i=0; i<counters_.size(); ++i)
+    {
+        region_->counters[i].value = *counters_[i];
+    }
+
+    for (std::size_t i=0; i<histograms_.size(); ++i)
+    {
+        const LatencyHistogram* histogram = histograms_[i];
+        ShmMetricsHistogram& shm_histogram = region_->histograms[i];
+        shm_histogram.count = histogram->count();
+        shm_histogram.sum = histogram->sum();
+        shm_histogram.total_count = histogram->total_count();
+        shm_histogram.total_sum = histogram->total_sum();
+        shm_histogram.min = histogram->min();
+        shm_histogram.max = histogram->max();
+        shm_histogram.p50 = quantiles[i].p50;
+        shm_histogram.p90 = quantiles[i].p90;
+        shm_histogram.p99 = quantiles[i].p99;
+        shm_histogram.p999 = quantiles[i].p999;
+    }
+    EndWrite();
+}
+
+void ShmMetrics::BeginWrite()
+{
+    // 只有一个写者, 不用CAS
+    uint64_t seq = region_->seq.load(std::memory_order_relaxed);
+    if (seq & 1)
+    {
+        // 上个进程写到一半挂了
+        ++seq;
+    }
+    region_->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ShmMetrics::EndWrite()
+{
+    uint64_t seq = region_->seq.load(std::memory_order_relaxed);
+    region_->seq.store(seq + 1, std::memory_order_release);
+}
+
+ShmMetricsReader::ShmMetricsReader()
+{
+    addr_ = NULL;
+    size_ = 0;
+    region_ = NULL;
+}
+
+ShmMetricsReader::~ShmMetricsReader()
+{
+    Close();
+}
+
+int ShmMetricsReader::Open(const char* mmap_file)
+{
+    Close();
+
+    int fd = open(mmap_file, O_RDONLY);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st) || static_cast<std::size_t>(st.st_size) < ShmMmap::HEADER_SIZE + sizeof(ShmMetricsRegion))
+    {
+        close(fd);
+        return -2;
+    }
+
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == addr)
+    {
+        return -1;
+    }
+
+    addr_ = addr;
+    size_ = st.st_size;
+
+    const ShmMmapHeader* header = static_cast<const ShmMmapHeader*>(addr_);
+    const ShmMetricsRegion* region = reinterpret_cast<const ShmMetricsRegion*>(
+        static_cast<const char*>(addr_) + ShmMmap::HEADER_SIZE);
+    if (ShmMmap::MAGIC != header->magic
+        || header->data_size < sizeof(ShmMetricsRegion)
+        || ShmMetricsRegion::MAGIC != region->magic
+        || ShmMetricsRegion::VERSION != region->version)
+    {
+        Close();
+        return -2;
+    }
+
+    region_ = region;
+    return 0;
+}
+
+void ShmMetricsReader::Close()
+{
+    if (NULL != addr_)
+    {
+        munmap(addr_, size_);
+    }
+
+    addr_ = NULL;
+    size_ = 0;
+    region_ = NULL;
+}
+
+int ShmMetricsReader::Snapshot(ShmMetricsSnapshot& snapshot) const
+{
+    if (NULL == region_)
+    {
+        return -1;
+    }
+
+    for (int retry=0; retry<SHM_METRICS_READ_RETRY; ++retry)
+    {
+        uint64_t begin_seq = region_->seq.load(std::memory_order_acquire);
+        if (begin_seq & 1)
+        {
+            TNT_CPU_RELAX();
+            continue;
+        }
+
+        uint32_t counter_count = region_->counter_count;
+        uint32_t histogram_count = region_->histogram_count;
+        if (counter_count > ShmMetricsRegion::MAX_COUNTERS)
+        {
+            counter_count = ShmMetricsRegion::MAX_COUNTERS;
+        }
+        if (histogram_count > ShmMetricsRegion::MAX_HISTOGRAMS)
+        {
+            histogram_count = ShmMetricsRegion::MAX_HISTOGRAMS;
+        }
+
+        snapshot.pid = region_->pid;
+        snapshot.start_time = region_->start_time;
+        snapshot.publish_time = region_->publish_time;
+        snapshot.app_name.assign(region_->app_name, strnlen(region_->app_name, sizeof(region_->app_name)));
+        snapshot.id.assign(region_->id, strnlen(region_->id, sizeof(region_->id)));
+        snapshot.counters.assign(region_->counters, region_->counters + counter_count);
+        snapshot.histograms.assign(region_->histograms, region_->histograms + histogram_count);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (begin_seq != region_->seq.load(std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        // 名字可能不是0结尾的
+        for (std::size_t i=0; i<snapshot.counters.size(); ++i)
+        {
+            snapshot.counters[i].name[sizeof(snapshot.counters[i].name) - 1] = '\0';
+        }
+        for (std::size_t i=0; i<snapshot.histograms.size(); ++i)
+        {
+            snapshot.histograms[i].name[sizeof(snapshot.histograms[i].name) - 1] = '\0';
+        }
+
+        snapshot.alive = (0 == kill(snapshot.pid, 0) || EPERM == errno);
+        return 0;
+    }
+
+    return -2;
+}
+
+// Prometheus 的名字只能是 [a-zA-Z0-9_:]
+static std::string PrometheusName(const char* name)
+{
+    std::string result = "tnt_";
+    for (const char* p=name; *p; ++p)
+    {
+        char c = *p;
+        bool valid = ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || '_' == c || ':' == c;
+        result.push_back(valid ? c : '_');
+    }
+    return result;
+}
+
+static std::string PrometheusLabelValue(const std::string& value)
+{
+    std::string result;
+    for (std::size_t i=0; i<value.size(); ++i)
+    {
+        if ('\\' == value[i] || '"' == value[i])
+        {
+            result.push_back('\\');
+            result.push_back(value[i]);
+        }
+        else if ('\n' == value[i])
+        {
+            result.append("\\n");
+        }
+        else
+        {
+            result.push_back(value[i]);
+        }
+    }
+    return result;
+}
+
+std::string ShmMetricsToPrometheus(const std::vector<ShmMetricsSnapshot>& snapshots)
+{
+    // 名字 -> 行, 同名的要放在一起, 前面一行 TYPE
+    std::map<std::string, std::string> counters;
+    std::map<std::string, std::string> summaries;
+
+    char buf[512];
+    for (std::size_t i=0; i<snapshots.size(); ++i)
+    {
+        const ShmMetricsSnapshot& snapshot = snapshots[i];
+
+        std::string labels = "app=\"" + PrometheusLabelValue(snapshot.app_name)
+            + "\",id=\"" + PrometheusLabelValue(snapshot.id) + "\"";
+        snprintf(buf, sizeof(buf), ",pid=\"%d\"", snapshot.pid);
+        labels.append(buf);
+
+        for (std::size_t j=0; j<snapshot.counters.size(); ++j)
+        {
+            std::string name = PrometheusName(snapshot.counters[j].name);
+            snprintf(buf, sizeof(buf), "%s{%s} %llu\n", name.c_str(), labels.c_str(),
+                     static_cast<unsigned long long>(snapshot.counters[j].value));
+            counters[name].append(buf);
+        }
+
+        for (std::size_t j=0; j<snapshot.histograms.size(); ++j)
+        {
+            const ShmMetricsHistogram& histogram = snapshot.histograms[j];
+            std::string name = PrometheusName(histogram.name) + "_seconds";
+            std::string& lines = summaries[name];
+
+            const struct
+            {
+                const char* quantile;
+                uint64_t value;
+            } quantiles[] = {
+                {"0.5", histogram.p50},
+                {"0.9", histogram.p90},
+                {"0.99", histogram.p99},
+                {"0.999", histogram.p999},
+                {"1", histogram.max},
+            };
+
+            for (std::size_t k=0; k<sizeof(quantiles)/sizeof(quantiles[0]); ++k)
+            {
+                snprintf(buf, sizeof(buf), "%s{%s,quantile=\"%s\"} %.9f\n", name.c_str(), labels.c_str(),
+                         quantiles[k].quantile, quantiles[k].value / 1e9);
+                lines.append(buf);
+            }
+
+            // summary 的 _sum/_count 要单调递增, 周期性 Reset 的会让 rate() 算错
+            snprintf(buf, sizeof(buf), "%s_sum{%s} %.9f\n%s_count{%s} %llu\n",
+                     name.c_str(), labels.c_str(), histogram.total_sum / 1e9,
+                     name.c_str(), labels.c_str(), static_cast<unsigned long long>(histogram.total_count));
+            lines.append(buf);
+        }
+    }
+
+    std::string result;
+    for (std::map<std::string, std::string>::const_iterator it = counters.begin(); it != counters.end(); ++it)
+    {
+        result.append("# TYPE " + it->first + " counter\n");
+        result.append(it->second);
+    }
+
+    for (std::map<std::string, std::string>::const_iterator it = summaries.begin(); it != summaries.end(); ++it)
+    {
+        result.append("# TYPE " + it->first + " summary\n");
+        result.append(it->second);
+    }
+
+    return result;
+}
+
+} // namespace tnt
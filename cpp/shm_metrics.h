@@ -0,0 +1,191 @@
+/**
+ * @file:   shm_metrics.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  把统计数据发布到共享内存, 其他进程来读
+ *
+ * 一台机器几百个进程, 不能每个都去调 StatStr, 所以每个进程把计数器和
+ * 耗时直方图定期拷到一块定长的 ShmMmap 里, 采集工具直接读文件:
+ *
+ *   | ShmMmapHeader | ShmMetricsRegion: 进程信息 seq 计数器[] 直方图[] |
+ *
+ * 1 注册的是变量的地址, 业务照常改自己的变量, 不用关心共享内存
+ * 2 Publish 时在seqlock里整体拷一遍, 只有内存读写, 没有系统调用
+ *   读的一方 seq 是奇数或者前后不一样就重读, 不会拿到拷了一半的数据
+ * 3 直方图的计数和分位数是从上次 Reset 开始的, 另外发布从进程启动开始
+ *   累计的 total_count/total_sum, Prometheus 的 _count/_sum 用累计的
+ * 4 文件按 app_name.id 命名, 进程重启还用同一个文件, 里面记着pid,
+ *   读的时候可以判断进程还在不在
+ *
+ * 读: tools/tnt_metrics, 可以输出成Prometheus的文本格式
+ *
+ * use like this:
+ *   tnt::ShmMetrics metrics;
+ *   metrics.Open("/dev/shm/tnt_metrics/mysvr.1.metrics", "mysvr", "1");
+ *   metrics.RegisterCounter("cmd_count", &cmd_count_);
+ *   metrics.RegisterHistogram("cmd_latency", &cmd_cost_);
+ *   ...
+ *   metrics.Publish(now_ms);   // 定期
+ */
+
+#ifndef TNT_SHM_METRICS_H
+#define TNT_SHM_METRICS_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "code_inbox.h"
+#include "shm_mmap.h"
+#include "latency_histogram.h"
+
+namespace tnt
+{
+
+struct ShmMetricsCounter
+{
+    char name[56];
+    uint64_t value;
+};
+
+// 单位是纳秒
+struct ShmMetricsHistogram
+{
+    char name[56];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    // 累计的, 不会因为 Reset 变小
+    uint64_t total_count;
+    uint64_t total_sum;
+};
+
+struct ShmMetricsRegion
+{
+    static const uint32_t MAGIC = 0x544E5458;   // "TNTX"
+    static const uint32_t VERSION = 2;
+    static const std::size_t MAX_COUNTERS = 256;
+    static const std::size_t MAX_HISTOGRAMS = 32;
+
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t counter_count;
+    uint32_t histogram_count;
+    uint32_t reserved;
+    // 毫秒
+    int64_t start_time;
+    int64_t publish_time;
+    char app_name[64];
+    char id[64];
+
+    // 奇数表示正在写
+    alignas(TNT_CACHE_LINE_SIZE) std::atomic<uint64_t> seq;
+
+    alignas(TNT_CACHE_LINE_SIZE) ShmMetricsCounter counters[MAX_COUNTERS];
+    ShmMetricsHistogram histograms[MAX_HISTOGRAMS];
+};
+
+// 读出来的一份, seq 以外的部分
+struct ShmMetricsSnapshot
+{
+    int32_t pid;
+    bool alive;
+    int64_t start_time;
+    int64_t publish_time;
+    std::string app_name;
+    std::string id;
+    std::vector<ShmMetricsCounter> counters;
+    std::vector<ShmMetricsHistogram> histograms;
+};
+
+class ShmMetrics
+{
+public:
+    ShmMetrics();
+    ~ShmMetrics();
+
+public:
+    /**
+     * @brief:  创建共享内存, 原来的内容清掉
+     *
+     * @return: 0 成功, -1 参数不对, -2 打开共享内存失败
+     */
+    int Open(const char* mmap_file, const char* app_name, const char* id, int64_t now_ms = 0);
+
+    int Close();
+
+    /**
+     * @brief:  注册计数器, 名字最长55个字符, Publish 时读 *value
+     *
+     * @return: 0 成功, -1 满了或者参数不对
+     */
+    int RegisterCounter(const char* name, const uint64_t* value);
+
+    int RegisterHistogram(const char* name, const LatencyHistogram* histogram);
+
+    // 把注册的变量都拷过去
+    void Publish(int64_t now_ms);
+
+    bool is_open() const {return NULL != region_;}
+
+private:
+    void BeginWrite();
+    void EndWrite();
+
+private:
+    ShmMmap shm_;
+    ShmMetricsRegion* region_;
+
+    std::vector<const uint64_t*> counters_;
+    std::vector<const LatencyHistogram*> histograms_;
+};
+
+class ShmMetricsReader
+{
+public:
+    ShmMetricsReader();
+    ~ShmMetricsReader();
+
+public:
+    /**
+     * @brief:  只读映射, 不改文件里的任何东西
+     *
+     * @return: 0 成功, -1 打开失败, -2 不是 ShmMetrics 的文件
+     */
+    int Open(const char* mmap_file);
+
+    void Close();
+
+    /**
+     * @brief:  读一份一致的数据
+     *
+     * @return: 0 成功, -1 没打开, -2 一直在写, 重试多次没读到
+     */
+    int Snapshot(ShmMetricsSnapshot& snapshot) const;
+
+private:
+    void* addr_;
+    std::size_t size_;
+    const ShmMetricsRegion* region_;
+};
+
+/**
+ * @brief:  转成Prometheus的文本格式, 同名的放在一起
+ *
+ *   tnt_total_proc_count{app="mysvr",id="1",pid="1234"} 100
+ *   tnt_proc_latency_seconds{app="mysvr",id="1",pid="1234",quantile="0.99"} 0.000012
+ *   tnt_proc_latency_seconds_count{app="mysvr",id="1",pid="1234"} 100
+ *
+ * 分位数是这个统计周期的, _count/_sum 是累计的, rate() 才算得对
+ */
+std::string ShmMetricsToPrometheus(const std::vector<ShmMetricsSnapshot>& snapshots);
+
+} // namespace tnt
+
+#endif //TNT_SHM_METRICS_H
@@ -2,7 +2,14 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <cstdio>
 #include <string>
 #include <assert.h>
@@ -13,11 +20,36 @@
 namespace tnt
 {
 
+enum ShmMmapState
+{
+    SHM_STATE_CLEAN = 1,
+    SHM_STATE_DIRTY = 2,
+};
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+// 透明大页要求地址按大页对齐
+static const std::size_t SHM_THP_ALIGN = 2 * 1024 * 1024;
+
 ShmMmap::ShmMmap()
 {
     shm_size_ = 0;
     shm_addr_ = NULL;
     mmap_fd_ = -1;
+    map_size_ = 0;
+    writable_ = false;
+
+    layout_version_ = 0;
+    layout_checksum_ = 0;
+
+    restore_state_ = SHM_NOT_OPEN;
+
+    applied_options_ = 0;
 }
 
 ShmMmap::~ShmMmap()
@@ -28,6 +60,17 @@ ShmMmap::~ShmMmap()
     }
 }
 
+void ShmMmap::SetLayout(uint32_t layout_version, uint32_t layout_checksum)
+{
+    layout_version_ = layout_version;
+    layout_checksum_ = layout_checksum;
+}
+
+void ShmMmap::SetOptions(const ShmMmapOptions& options)
+{
+    options_ = options;
+}
+
 // 打开
 int ShmMmap::Open(const char* mmap_file,
          std::size_t shm_size,
@@ -41,37 +84,357 @@ int ShmMmap::Open(const char* mmap_file,
 
     shm_name_.assign(mmap_file);
     shm_size_ = shm_size;
+    writable_ = (0 != (mmap_prot & PROT_WRITE));
+
+    int ret = if_restore ? Attach(mmap_prot, mmap_flags) : Create(mmap_prot, mmap_flags);
+    if (0 != ret)
+    {
+        Unmap();
+        shm_size_ = 0;
+        return ret;
+    }
 
-    // 根据mmap的参数设置file open的参数
-    int file_open_flags = O_CREAT|O_RDWR;
-    int file_open_mode = 0;
+    // 只读的不改头, 也不算在用的进程里
+    if (writable_)
+    {
+        // 每个写的进程持有一个共享锁, 挂掉时内核会释放, Close 时据此判断是不是最后一个
+        flock(mmap_fd_, LOCK_SH);
+
+        // 用起来以后就是脏的了, 最后一个正常Close才会变回来
+        ShmMmapHeader* header = static_cast<ShmMmapHeader*>(shm_addr_);
+        header->state = SHM_STATE_DIRTY;
+        msync(shm_addr_, HEADER_SIZE, MS_SYNC);
+    }
+
+    return 0;
+}
 
-    mmap_fd_ = open(shm_name_.c_str(), file_open_flags, file_open_mode);
+// 创建: 截断文件再扩大, 数据区都是0
+int ShmMmap::Create(int mmap_prot, int mmap_flags)
+{
+    if (!writable_)
+    {
+        return SHM_ERR_PROT;
+    }
+
+    mmap_fd_ = open(shm_name_.c_str(), O_CREAT|O_RDWR, 0644);
     if (-1 == mmap_fd_)
     {
-        return -1;
+        return SHM_ERR_OPEN;
     }
 
+    int ret = CheckFileSystem();
+    if (0 != ret)
+    {
+        return ret;
+    }
 
-    shm_addr_ = mmap(NULL, shm_size, mmap_prot, mmap_flags, mmap_fd_, 0);
-    if (NULL == shm_addr_)
+    // 还有写的进程挂着(持有共享锁)时截断, 它再访问映射就是SIGBUS
+    // 拿到排他锁才截断, Open 最后换成共享锁
+    if (0 != flock(mmap_fd_, LOCK_EX|LOCK_NB))
     {
-        close(mmap_fd_);
-        return -2;
+        return SHM_ERR_BUSY;
+    }
+
+    if (0 != ftruncate(mmap_fd_, 0) || 0 != ftruncate(mmap_fd_, map_size_))
+    {
+        return SHM_ERR_TRUNCATE;
+    }
+
+    ret = Map(mmap_prot, mmap_flags);
+    if (0 != ret)
+    {
+        return ret;
+    }
+
+    ShmMmapHeader* header = static_cast<ShmMmapHeader*>(shm_addr_);
+    header->header_version = HEADER_VERSION;
+    header->header_size = HEADER_SIZE;
+    header->data_size = shm_size_;
+    header->layout_version = layout_version_;
+    header->layout_checksum = layout_checksum_;
+    header->state = SHM_STATE_DIRTY;
+    header->restore_count = 0;
+    header->create_time = time(NULL);
+    header->attach_time = header->create_time;
+    header->close_time = 0;
+
+    // 头都写好了最后才写magic, 创建到一半挂掉的不会被当成有效的
+    __sync_synchronize();
+    header->magic = MAGIC;
+
+    restore_state_ = SHM_CREATED;
+
+    return 0;
+}
+
+// 挂载: 校验通过才用
+int ShmMmap::Attach(int mmap_prot, int mmap_flags)
+{
+    mmap_fd_ = open(shm_name_.c_str(), writable_ ? O_RDWR : O_RDONLY);
+    if (-1 == mmap_fd_)
+    {
+        return (ENOENT == errno) ? SHM_ERR_NOT_EXIST : SHM_ERR_OPEN;
+    }
+
+    int ret = CheckFileSystem();
+    if (0 != ret)
+    {
+        return ret;
+    }
+
+    struct stat st;
+    if (0 != fstat(mmap_fd_, &st))
+    {
+        return SHM_ERR_OPEN;
+    }
+
+    if (static_cast<std::size_t>(st.st_size) != map_size_)
+    {
+        return SHM_ERR_SIZE;
+    }
+
+    ret = Map(mmap_prot, mmap_flags);
+    if (0 != ret)
+    {
+        return ret;
+    }
+
+    ShmMmapHeader* header = static_cast<ShmMmapHeader*>(shm_addr_);
+    if (MAGIC != header->magic ||
+        HEADER_VERSION != header->header_version ||
+        HEADER_SIZE != header->header_size)
+    {
+        return SHM_ERR_HEADER;
+    }
+
+    if (shm_size_ != header->data_size)
+    {
+        return SHM_ERR_SIZE;
+    }
+
+    if (layout_version_ != header->layout_version ||
+        layout_checksum_ != header->layout_checksum)
+    {
+        return SHM_ERR_LAYOUT;
+    }
+
+    restore_state_ = (SHM_STATE_CLEAN == header->state) ? SHM_RESTORED_CLEAN : SHM_RESTORED_DIRTY;
+
+    if (writable_)
+    {
+        ++header->restore_count;
+        header->attach_time = time(NULL);
     }
 
     return 0;
 }
 
+// 映射大小, hugetlbfs上的文件大小必须是大页的整数倍
+int ShmMmap::CheckFileSystem()
+{
+    map_size_ = HEADER_SIZE + shm_size_;
+
+    struct statfs fs;
+    if (0 != fstatfs(mmap_fd_, &fs))
+    {
+        return SHM_ERR_OPEN;
+    }
+
+    // hugetlbfs 上的文件只能用大页, 不管有没有要求
+    if (HUGETLBFS_MAGIC == static_cast<uint32_t>(fs.f_type))
+    {
+        std::size_t huge_page_size = fs.f_bsize;
+        map_size_ = (map_size_ + huge_page_size - 1) / huge_page_size * huge_page_size;
+        applied_options_ |= SHM_OPT_HUGE_TLB;
+    }
+    else if (options_.huge_tlb)
+    {
+        // 要求了大页但是文件放错了地方, 不要悄悄退回小页
+        return SHM_ERR_HUGE_TLB;
+    }
+
+    return 0;
+}
+
+int ShmMmap::Map(int mmap_prot, int mmap_flags)
+{
+    void* hint = NULL;
+    void* reserve = MAP_FAILED;
+    std::size_t reserve_size = 0;
+
+    if (options_.transparent_huge && 0 == (applied_options_ & SHM_OPT_HUGE_TLB))
+    {
+        // 先占一段多出一个大页的地址, 在里面找对齐的位置
+        reserve_size = map_size_ + SHM_THP_ALIGN;
+        reserve = mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (MAP_FAILED != reserve)
+        {
+            uintptr_t aligned = (reinterpret_cast<uintptr_t>(reserve) + SHM_THP_ALIGN - 1) & ~(SHM_THP_ALIGN - 1);
+            hint = reinterpret_cast<void*>(aligned);
+            mmap_flags |= MAP_FIXED;
+        }
+    }
+
+    // 要绑NUMA节点时不能在mmap时就分配页
+    if (options_.populate && options_.numa_node < 0)
+    {
+        mmap_flags |= MAP_POPULATE;
+    }
+
+    void* addr = mmap(hint, map_size_, mmap_prot, mmap_flags, mmap_fd_, 0);
+
+    if (MAP_FAILED != reserve)
+    {
+        // 还给系统前后多出来的部分, 映射失败时全部还回去
+        char* begin = static_cast<char*>(reserve);
+        char* end = begin + reserve_size;
+        if (MAP_FAILED == addr)
+        {
+            munmap(begin, reserve_size);
+        }
+        else
+        {
+            char* map_begin = static_cast<char*>(addr);
+            char* map_end = map_begin + map_size_;
+            if (map_begin > begin)
+            {
+                munmap(begin, map_begin - begin);
+            }
+            if (end > map_end)
+            {
+                munmap(map_end, end - map_end);
+            }
+        }
+    }
+
+    if (MAP_FAILED == addr)
+    {
+        return SHM_ERR_MMAP;
+    }
+
+    shm_addr_ = addr;
+
+    ApplyOptions(mmap_prot);
+
+    return 0;
+}
+
+// 都是尽力而为, 失败了只是不记到 applied_options_ 里
+void ShmMmap::ApplyOptions(int mmap_prot)
+{
+    if (options_.numa_node >= 0)
+    {
+        unsigned long node_mask[16] = {0};
+        unsigned long max_node = sizeof(node_mask) * 8;
+        if (static_cast<unsigned long>(options_.numa_node) < max_node)
+        {
+            std::size_t bits = sizeof(node_mask[0]) * 8;
+            node_mask[options_.numa_node / bits] |= 1UL << (options_.numa_node % bits);
+
+            // 恢复时已经有的页也搬过去
+            if (0 == syscall(SYS_mbind, shm_addr_, map_size_, MPOL_BIND, node_mask, max_node, MPOL_MF_MOVE))
+            {
+                applied_options_ |= SHM_OPT_NUMA;
+            }
+        }
+    }
+
+    if (options_.transparent_huge && 0 == (applied_options_ & SHM_OPT_HUGE_TLB))
+    {
+        if (0 == madvise(shm_addr_, map_size_, MADV_HUGEPAGE))
+        {
+            applied_options_ |= SHM_OPT_TRANSPARENT_HUGE;
+        }
+    }
+
+    if (options_.lock)
+    {
+        // mlock 也会把页都分配好
+        if (0 == mlock(shm_addr_, map_size_))
+        {
+            applied_options_ |= SHM_OPT_LOCK;
+            if (options_.populate)
+            {
+                applied_options_ |= SHM_OPT_POPULATE;
+            }
+        }
+    }
+
+    if (options_.populate && 0 == (applied_options_ & SHM_OPT_POPULATE))
+    {
+        if (options_.numa_node < 0)
+        {
+            // MAP_POPULATE
+            applied_options_ |= SHM_OPT_POPULATE;
+        }
+        else
+        {
+            // mbind 之后再预取; 不能自己读了再写回去, 恢复时别的进程可能正在写同一个字节
+            int advice = (mmap_prot & PROT_WRITE) ? MADV_POPULATE_WRITE : MADV_POPULATE_READ;
+            if (0 != madvise(shm_addr_, map_size_, advice))
+            {
+                // 老内核(5.14以前)没有, 只读着碰一遍, 页也会分配好
+                std::size_t page_size = sysconf(_SC_PAGESIZE);
+                const volatile char* p = static_cast<const volatile char*>(shm_addr_);
+                for (std::size_t i=0; i<map_size_; i+=page_size)
+                {
+                    (void)p[i];
+                }
+            }
+            applied_options_ |= SHM_OPT_POPULATE;
+        }
+    }
+}
+
+void ShmMmap::Unmap()
+{
+    if (NULL != shm_addr_)
+    {
+        munmap(shm_addr_, map_size_);
+        shm_addr_ = NULL;
+    }
+
+    if (-1 != mmap_fd_)
+    {
+        close(mmap_fd_);
+        mmap_fd_ = -1;
+    }
+
+    map_size_ = 0;
+    writable_ = false;
+    restore_state_ = SHM_NOT_OPEN;
+    applied_options_ = 0;
+}
+
 // 关闭
 int ShmMmap::Close()
 {
-    munmap(shm_addr_, shm_size_);
-    shm_addr_ = NULL;
+    if (NULL == shm_addr_)
+    {
+        return 0;
+    }
+
+    if (writable_)
+    {
+        ShmMmapHeader* header = static_cast<ShmMmapHeader*>(shm_addr_);
+        header->close_time = time(NULL);
+
+        // 数据先落地, 再标记为正常关闭
+        msync(shm_addr_, map_size_, MS_SYNC);
+
+        // 拿得到排他锁说明没有别的写进程了(挂掉的进程的锁内核已经释放);
+        // 还有别人在用时保持DIRTY, 它要是挂了, 下次挂载不会把写了一半的数据当成干净的
+        if (0 == flock(mmap_fd_, LOCK_EX | LOCK_NB))
+        {
+            header->state = SHM_STATE_CLEAN;
+            msync(shm_addr_, HEADER_SIZE, MS_SYNC);
+        }
+    }
+
+    Unmap();
     shm_size_ = 0;
 
-    close(mmap_fd_);
-    mmap_fd_ = -1;
     return 0;
 }
 
@@ -79,7 +442,7 @@ int ShmMmap::Close()
 int ShmMmap::sync()
 {
     // 不能阻塞
-    return msync(shm_addr_, shm_size_, MS_ASYNC);
+    return msync(shm_addr_, map_size_, MS_ASYNC);
 }
 
 // 删除文件
@@ -91,8 +454,67 @@ int ShmMmap::remove()
 // 内存
 void* ShmMmap::addr() const
 {
-    return shm_addr_;
+    if (NULL == shm_addr_)
+    {
+        return NULL;
+    }
+
+    return static_cast<char*>(shm_addr_) + HEADER_SIZE;
+}
+
+std::size_t ShmMmap::size() const
+{
+    return shm_size_;
+}
+
+ShmRestoreState ShmMmap::restore_state() const
+{
+    return restore_state_;
 }
+
+const ShmMmapHeader* ShmMmap::header() const
+{
+    return static_cast<const ShmMmapHeader*>(shm_addr_);
 }
 
+unsigned int ShmMmap::applied_options() const
+{
+    return applied_options_;
+}
 
+std::string ShmMmap::applied_options_str() const
+{
+    char buf[128];
+    char node[16] = "-";
+    if (applied_options_ & SHM_OPT_NUMA)
+    {
+        snprintf(node, sizeof(node), "%d", options_.numa_node);
+    }
+
+    snprintf(buf, sizeof(buf), "huge_tlb=%d transparent_huge=%d populate=%d lock=%d numa_node=%s",
+             (applied_options_ & SHM_OPT_HUGE_TLB) ? 1 : 0,
+             (applied_options_ & SHM_OPT_TRANSPARENT_HUGE) ? 1 : 0,
+             (applied_options_ & SHM_OPT_POPULATE) ? 1 : 0,
+             (applied_options_ & SHM_OPT_LOCK) ? 1 : 0,
+             node);
+
+    return buf;
+}
+
+// FNV-1a
+uint32_t ShmMmap::LayoutChecksum(const char* desc, std::size_t size)
+{
+    uint32_t hash = 2166136261U;
+    for (const char* p = desc; NULL != p && '\0' != *p; ++p)
+    {
+        hash = (hash ^ static_cast<unsigned char>(*p)) * 16777619U;
+    }
+
+    for (std::size_t i=0; i<sizeof(size); ++i)
+    {
+        hash = (hash ^ ((size >> (i * 8)) & 0xFF)) * 16777619U;
+    }
+
+    return hash;
+}
+}
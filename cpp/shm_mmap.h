@@ -4,31 +4,150 @@
  * @author: jameyli <lgy AT live DOT com>
  * @date:   2013-10-12
  * @brief:  基于MMAP实现共享内存
+ *
+ * 恢复模式:
+ * 进程重启时直接挂上原来的共享内存, 不用再从DB重建
+ *
+ * 映射的最前面是一页 ShmMmapHeader, addr() 返回的是它后面的数据区
+ * 1 if_restore = false 创建: 文件截断后重新初始化, 数据区全是0
+ *   还有别的写进程挂着时不截断, 返回 SHM_ERR_BUSY
+ * 2 if_restore = true  挂载: 文件必须已经存在, 大小, 头的版本, 数据布局的
+ *   版本和校验和都要一致, 否则失败, 由调用者决定是否改为创建
+ * 3 挂上以后状态标记为DIRTY, 最后一个写的进程 Close 时才标记为CLEAN, 所以进程
+ *   被kill或者core掉以后再挂载, restore_state() 会是 SHM_RESTORED_DIRTY, 数据
+ *   可能只改了一半, 调用者自己决定要不要用
+ *   可以有多个进程同时写(例如 ShmChannel 两端), 每个写的进程对文件持有一个
+ *   flock 共享锁, Close 时拿不到排他锁说明还有别人在用, 不标记CLEAN
+ * 4 mmap_prot 不带 PROT_WRITE 时只读挂载, 不改头, 也不能创建
+ *
+ * 数据布局变化(结构体加字段, 改大小)时要改 layout_version 或者
+ * layout_checksum, 避免按新的结构去解释旧的内存
+ *
+ * 大页和NUMA:
+ * 几个G的区域TLB miss很明显, 可以通过 SetOptions 打开, 除了 huge_tlb 都是
+ * 尽力而为, 实际生效了哪些看 applied_options(), 启动时打到日志里
+ * 1 huge_tlb: 文件要放在hugetlbfs上(例如 /dev/hugepages/xxx), 大小会向上
+ *   对齐到大页. 要求了但文件不在hugetlbfs上时 Open 返回 SHM_ERR_HUGE_TLB;
+ *   反过来hugetlbfs上的文件总是用大页, 不设也一样
+ * 2 transparent_huge: 映射地址按2M对齐再 madvise(MADV_HUGEPAGE), 要
+ *   /sys/kernel/mm/transparent_hugepage/shmem_enabled 是advise或always
+ * 3 populate: 启动时就把页都分配好, 避免运行时缺页, 不会改数据
+ * 4 lock: mlock, 不会被换出, 受 RLIMIT_MEMLOCK 限制
+ * 5 numa_node: mbind到指定节点, 要在分配页之前做, 所以和populate一起用时
+ *   先mbind再预取
  */
 
 #ifndef TNT_SHM_MMAP_H
 #define TNT_SHM_MMAP_H
 
+#include <stdint.h>
 #include <sys/mman.h>
+#include <cstddef>
+#include <string>
 
 namespace tnt
 {
 
+struct ShmMmapHeader
+{
+    uint32_t magic;
+    uint32_t header_version;
+    uint64_t header_size;
+    uint64_t data_size;
+
+    // 调用者的数据布局
+    uint32_t layout_version;
+    uint32_t layout_checksum;
+
+    // 上次是否正常关闭
+    uint32_t state;
+    // 被挂载的次数
+    uint32_t restore_count;
+
+    int64_t create_time;
+    int64_t attach_time;
+    int64_t close_time;
+};
+
+struct ShmMmapOptions
+{
+    ShmMmapOptions()
+        : huge_tlb(false), transparent_huge(false), populate(false), lock(false), numa_node(-1)
+    {
+    }
+
+    bool huge_tlb;
+    bool transparent_huge;
+    bool populate;
+    bool lock;
+    // -1 不绑定
+    int numa_node;
+};
+
+// applied_options() 的各位
+enum ShmMmapAppliedOption
+{
+    SHM_OPT_HUGE_TLB = 0x01,
+    SHM_OPT_TRANSPARENT_HUGE = 0x02,
+    SHM_OPT_POPULATE = 0x04,
+    SHM_OPT_LOCK = 0x08,
+    SHM_OPT_NUMA = 0x10,
+};
+
+enum ShmRestoreState
+{
+    SHM_NOT_OPEN = 0,
+    SHM_CREATED = 1,            // 新创建的
+    SHM_RESTORED_CLEAN = 2,     // 挂载, 上次正常关闭
+    SHM_RESTORED_DIRTY = 3,     // 挂载, 上次没有正常关闭(或者还有别的进程在用)
+};
+
 class ShmMmap
 {
+public:
+    static const uint32_t MAGIC = 0x544E544D;   // "TNTM"
+    static const uint32_t HEADER_VERSION = 1;
+    static const std::size_t HEADER_SIZE = 4096;
+
+    enum ShmMmapError
+    {
+        SHM_ERR_OPEN = -1,          // 打开文件失败
+        SHM_ERR_MMAP = -2,          // mmap失败
+        SHM_ERR_TRUNCATE = -3,      // 设置文件大小失败
+        SHM_ERR_NOT_EXIST = -4,     // 挂载时文件不存在
+        SHM_ERR_SIZE = -5,          // 挂载时大小不一致
+        SHM_ERR_HEADER = -6,        // 挂载时头不对, 不是ShmMmap创建的或者版本不对
+        SHM_ERR_LAYOUT = -7,        // 挂载时数据布局不一致
+        SHM_ERR_PROT = -8,          // 只读的不能创建
+        SHM_ERR_HUGE_TLB = -9,      // 要求大页, 但文件不在hugetlbfs上
+        SHM_ERR_BUSY = -10,         // 创建时还有别的写进程在用
+    };
+
 public:
     ShmMmap();
     ~ShmMmap();
 
 public:
+    /**
+     * @brief:  设置数据布局的版本和校验和, 在Open之前调用
+     */
+    void SetLayout(uint32_t layout_version, uint32_t layout_checksum);
+
+    /**
+     * @brief:  设置大页, 预取, mlock, NUMA, 在Open之前调用
+     */
+    void SetOptions(const ShmMmapOptions& options);
+
     // 打开
+    // shm_size 是数据区的大小, 不含头
+    // 0 成功, <0 见 ShmMmapError
     int Open(const char* mmap_file,
              std::size_t shm_size,
              bool if_restore = false,
              int mmap_prot=PROT_READ|PROT_WRITE,
              int mmap_flags=MAP_SHARED);
 
-    // 关闭
+    // 关闭, 没有别的写进程时标记为正常关闭
     int Close();
 
     // 同步
@@ -40,6 +159,34 @@ public:
     // 内存
     void* addr() const;
 
+    // 数据区大小
+    std::size_t size() const;
+
+    ShmRestoreState restore_state() const;
+
+    const ShmMmapHeader* header() const;
+
+    // 实际生效的选项, ShmMmapAppliedOption 的组合
+    unsigned int applied_options() const;
+
+    // 例如 "huge_tlb=0 transparent_huge=1 populate=1 lock=1 numa_node=-"
+    std::string applied_options_str() const;
+
+    /**
+     * @brief:  计算数据布局的校验和
+     *
+     * 例如 LayoutChecksum("PlayerCache", sizeof(PlayerCache))
+     */
+    static uint32_t LayoutChecksum(const char* desc, std::size_t size);
+
+private:
+    int Create(int mmap_prot, int mmap_flags);
+    int Attach(int mmap_prot, int mmap_flags);
+    int Map(int mmap_prot, int mmap_flags);
+    void Unmap();
+    int CheckFileSystem();
+    void ApplyOptions(int mmap_prot);
+
 private:
     // mmap文件名
     std::string shm_name_;
@@ -49,10 +196,21 @@ private:
     void* shm_addr_;
     // mmap文件描述符
     int mmap_fd_;
+    // 映射的大小, 头 + 数据区, hugetlbfs上对齐到大页
+    std::size_t map_size_;
+    // 带 PROT_WRITE, 只有写的才改头
+    bool writable_;
+
+    uint32_t layout_version_;
+    uint32_t layout_checksum_;
+
+    ShmRestoreState restore_state_;
+
+    ShmMmapOptions options_;
+    unsigned int applied_options_;
 
 }; // class ShmMmap
 
 } // namespace tnt
 
 #endif //TNT_SHM_MMAP_H
-
@@ -0,0 +1,257 @@
+/**
+ * @file:   shm_slab.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  放在一块内存(一般是ShmMmap)上的定长对象分配器
+ */
+
+#include <string.h>
+#include "shm_slab.h"
+
+namespace tnt
+{
+
+const uint32_t ShmSlab::MAGIC;
+const uint32_t ShmSlab::VERSION;
+const uint32_t ShmSlab::npos;
+
+ShmSlab::ShmSlab()
+{
+    header_ = NULL;
+    slots_ = NULL;
+    slot_size_ = 0;
+}
+
+std::size_t ShmSlab::HeaderSize()
+{
+    return (sizeof(Header) + 63) & ~static_cast<std::size_t>(63);
+}
+
+std::size_t ShmSlab::SlotSize(std::size_t object_size)
+{
+    return (sizeof(Slot) + object_size + 7) & ~static_cast<std::size_t>(7);
+}
+
+std::size_t ShmSlab::MemSize(std::size_t object_size, uint32_t capacity)
+{
+    return HeaderSize() + SlotSize(object_size) * capacity;
+}
+
+int ShmSlab::Init(void* mem, std::size_t mem_size, std::size_t object_size, bool if_restore)
+{
+    if (NULL == mem || 0 == object_size || mem_size < MemSize(object_size, 1))
+    {
+        return -1;
+    }
+
+    std::size_t slot_size = SlotSize(object_size);
+    std::size_t capacity = (mem_size - HeaderSize()) / slot_size;
+    if (capacity >= npos)
+    {
+        capacity = npos - 1;
+    }
+
+    Header* header = static_cast<Header*>(mem);
+    if (if_restore)
+    {
+        if (MAGIC != header->magic || VERSION != header->version)
+        {
+            return -2;
+        }
+
+        if (object_size != header->object_size || slot_size != header->slot_size ||
+            capacity != header->stats.capacity)
+        {
+            return -3;
+        }
+    }
+    else
+    {
+        // 槽不用清, 用到时再初始化
+        memset(header, 0, sizeof(Header));
+        header->version = VERSION;
+        header->object_size = object_size;
+        header->slot_size = slot_size;
+        header->free_head = npos;
+        header->stats.capacity = static_cast<uint32_t>(capacity);
+        header->magic = MAGIC;
+    }
+
+    header_ = header;
+    slots_ = static_cast<char*>(mem) + HeaderSize();
+    slot_size_ = slot_size;
+
+    return 0;
+}
+
+void ShmSlab::Rebuild()
+{
+    ShmSlabStats& stats = header_->stats;
+
+    // 从后往前串, 分配时先用前面的
+    header_->free_head = npos;
+    stats.used = 0;
+    for (uint32_t i=stats.high_water; i>0; --i)
+    {
+        Slot* s = slot(i - 1);
+        if (SLOT_USED == s->state)
+        {
+            ++stats.used;
+        }
+        else
+        {
+            s->state = SLOT_FREE;
+            s->next_free = header_->free_head;
+            header_->free_head = i - 1;
+        }
+    }
+
+    if (stats.peak_used < stats.used)
+    {
+        stats.peak_used = stats.used;
+    }
+}
+
+void* ShmSlab::Alloc()
+{
+    ShmSlabStats& stats = header_->stats;
+
+    uint32_t index = header_->free_head;
+    if (npos != index)
+    {
+        header_->free_head = slot(index)->next_free;
+    }
+    else if (stats.high_water < stats.capacity)
+    {
+        index = stats.high_water++;
+    }
+    else
+    {
+        ++stats.alloc_fail_count;
+        return NULL;
+    }
+
+    Slot* s = slot(index);
+    s->state = SLOT_USED;
+    s->next_free = npos;
+    memset(s + 1, 0, header_->object_size);
+
+    ++stats.used;
+    ++stats.alloc_count;
+    if (stats.peak_used < stats.used)
+    {
+        stats.peak_used = stats.used;
+    }
+
+    return s + 1;
+}
+
+int ShmSlab::Free(void* obj)
+{
+    uint32_t index = SlotIndex(obj);
+    if (npos == index)
+    {
+        return -1;
+    }
+
+    Slot* s = slot(index);
+    if (SLOT_USED != s->state)
+    {
+        return -2;
+    }
+
+    s->state = SLOT_FREE;
+    s->next_free = header_->free_head;
+    header_->free_head = index;
+
+    --header_->stats.used;
+    ++header_->stats.free_count;
+
+    return 0;
+}
+
+void* ShmSlab::get(uint32_t index) const
+{
+    if (index >= header_->stats.high_water)
+    {
+        return NULL;
+    }
+
+    Slot* s = slot(index);
+    if (SLOT_USED != s->state)
+    {
+        return NULL;
+    }
+
+    return s + 1;
+}
+
+uint32_t ShmSlab::index_of(const void* obj) const
+{
+    uint32_t index = SlotIndex(obj);
+    if (npos == index || SLOT_USED != slot(index)->state)
+    {
+        return npos;
+    }
+
+    return index;
+}
+
+// 只看地址, 不看状态
+uint32_t ShmSlab::SlotIndex(const void* obj) const
+{
+    const char* p = static_cast<const char*>(obj);
+    if (NULL == p || p < slots_ + sizeof(Slot))
+    {
+        return npos;
+    }
+
+    std::size_t offset = p - sizeof(Slot) - slots_;
+    if (0 != offset % slot_size_)
+    {
+        return npos;
+    }
+
+    std::size_t index = offset / slot_size_;
+    if (index >= header_->stats.high_water)
+    {
+        return npos;
+    }
+
+    return static_cast<uint32_t>(index);
+}
+
+uint32_t ShmSlab::first() const
+{
+    return next(npos);
+}
+
+uint32_t ShmSlab::next(uint32_t index) const
+{
+    // npos + 1 == 0
+    for (uint32_t i=index+1; i<header_->stats.high_water; ++i)
+    {
+        if (SLOT_USED == slot(i)->state)
+        {
+            return i;
+        }
+    }
+
+    return npos;
+}
+
+const ShmSlabStats& ShmSlab::stats() const
+{
+    return header_->stats;
+}
+
+uint32_t ShmSlab::capacity() const
+{
+    return header_->stats.capacity;
+}
+
+uint32_t ShmSlab::size() const
+{
+    return header_->stats.used;
+}
+
+} // namespace tnt
@@ -0,0 +1,218 @@
+/**
+ * @file:   shm_slab.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  放在一块内存(一般是ShmMmap)上的定长对象分配器
+ *
+ * 长期存在的对象(事务, 会话, 定时器)放到共享内存里, 进程重启后还在
+ *
+ *   | 头: magic version object_size capacity 统计 | 槽0 | 槽1 | ... |
+ *   槽: | state next_free | 对象 |
+ *
+ * 1 只存下标不存指针, 重新映射到别的地址也能用, 对象之间互相引用也要
+ *   用 index_of 得到的下标
+ * 2 Alloc/Free O(1): 先用空闲链表, 再用从没用过的槽(high_water),
+ *   创建时不用把整块内存摸一遍
+ * 3 遍历活着的对象: for (i = first(); i != npos; i = next(i))
+ * 4 进程挂掉时空闲链表可能只改了一半, 恢复到 SHM_RESTORED_DIRTY 时调用
+ *   Rebuild 按槽的状态重建
+ *
+ * XXX: 对象要能直接按字节拷贝, 不能有虚函数和指针, 也不会调用构造析构;
+ *      对象只保证8字节对齐
+ *
+ * use like this:
+ *   ShmMmap shm;
+ *   shm.Open(file, ShmObjectPool<Session>::MemSize(10000), true);
+ *   ShmObjectPool<Session> pool;
+ *   pool.Init(shm.addr(), shm.size(), shm.restore_state() != SHM_CREATED);
+ *   Session* s = pool.Alloc();
+ *   uint32_t id = pool.index_of(s);
+ *   ...
+ *   pool.Free(pool.get(id));
+ */
+
+#ifndef TNT_SHM_SLAB_H
+#define TNT_SHM_SLAB_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <type_traits>
+
+namespace tnt
+{
+
+struct ShmSlabStats
+{
+    uint32_t capacity;
+    uint32_t used;
+    // 最多同时用了多少
+    uint32_t peak_used;
+    // 用过的槽, 后面的还没碰过
+    uint32_t high_water;
+
+    uint64_t alloc_count;
+    uint64_t free_count;
+    uint64_t alloc_fail_count;
+};
+
+class ShmSlab
+{
+public:
+    static const uint32_t MAGIC = 0x544E5453;   // "TNTS"
+    static const uint32_t VERSION = 1;
+    static const uint32_t npos = 0xFFFFFFFF;
+
+public:
+    ShmSlab();
+
+public:
+    /**
+     * @brief:  object_size 的对象放 capacity 个需要多大的内存
+     */
+    static std::size_t MemSize(std::size_t object_size, uint32_t capacity);
+
+    /**
+     * @brief:  初始化
+     *
+     * @param  mem 内存, 至少8字节对齐
+     * @param  mem_size 内存大小, 能放多少就放多少
+     * @param  object_size 对象大小
+     * @param  if_restore true 沿用内存里已有的, 要校验; false 重新格式化
+     *
+     * @return: 0 成功
+     *          -1 参数错误, 内存一个对象都放不下
+     *          -2 恢复时头不对
+     *          -3 恢复时对象大小或容量不一致
+     */
+    int Init(void* mem, std::size_t mem_size, std::size_t object_size, bool if_restore);
+
+    /**
+     * @brief:  按槽的状态重建空闲链表和统计
+     */
+    void Rebuild();
+
+    // 没有空间返回NULL
+    void* Alloc();
+
+    // 0 成功, -1 不是这里的对象, -2 重复释放
+    int Free(void* obj);
+
+    // 下标和对象互相转换, 下标无效或者槽没在用时返回NULL/npos
+    void* get(uint32_t index) const;
+    uint32_t index_of(const void* obj) const;
+
+    // 遍历活着的对象
+    uint32_t first() const;
+    uint32_t next(uint32_t index) const;
+
+    const ShmSlabStats& stats() const;
+
+    uint32_t capacity() const;
+    uint32_t size() const;
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t object_size;
+        uint64_t slot_size;
+
+        uint32_t free_head;
+        uint32_t reserved;
+
+        ShmSlabStats stats;
+    };
+
+    struct Slot
+    {
+        uint32_t state;
+        uint32_t next_free;
+    };
+
+    enum SlotState
+    {
+        SLOT_FREE = 0x46524545,     // "FREE"
+        SLOT_USED = 0x55534544,     // "USED"
+    };
+
+    static std::size_t HeaderSize();
+    static std::size_t SlotSize(std::size_t object_size);
+
+    uint32_t SlotIndex(const void* obj) const;
+
+    Slot* slot(uint32_t index) const
+    {
+        return reinterpret_cast<Slot*>(slots_ + slot_size_ * index);
+    }
+
+private:
+    Header* header_;
+    char* slots_;
+    std::size_t slot_size_;
+
+}; // class ShmSlab
+
+/**
+ * @brief: 带类型的对象池
+ *
+ * @tparam T 对象类型, 要能直接按字节拷贝; 槽只按8字节对齐,
+ *           alignas(16/64) 的类型(按cache line补齐的计数, 128位原子变量)放不了
+ */
+template<typename T>
+class ShmObjectPool
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ShmObjectPool need trivially copyable type");
+    static_assert(alignof(T) <= 8, "ShmObjectPool slots are only 8-byte aligned");
+
+public:
+    static const uint32_t npos = ShmSlab::npos;
+
+    static std::size_t MemSize(uint32_t capacity)
+    {
+        return ShmSlab::MemSize(sizeof(T), capacity);
+    }
+
+    int Init(void* mem, std::size_t mem_size, bool if_restore)
+    {
+        return slab_.Init(mem, mem_size, sizeof(T), if_restore);
+    }
+
+    void Rebuild()
+    { slab_.Rebuild(); }
+
+    // 内存清零, 不调用构造函数
+    T* Alloc()
+    { return static_cast<T*>(slab_.Alloc()); }
+
+    int Free(T* obj)
+    { return slab_.Free(obj); }
+
+    T* get(uint32_t index) const
+    { return static_cast<T*>(slab_.get(index)); }
+
+    uint32_t index_of(const T* obj) const
+    { return slab_.index_of(obj); }
+
+    uint32_t first() const
+    { return slab_.first(); }
+
+    uint32_t next(uint32_t index) const
+    { return slab_.next(index); }
+
+    const ShmSlabStats& stats() const
+    { return slab_.stats(); }
+
+    uint32_t capacity() const
+    { return slab_.capacity(); }
+
+    uint32_t size() const
+    { return slab_.size(); }
+
+private:
+    ShmSlab slab_;
+
+}; // class ShmObjectPool
+
+} // namespace tnt
+
+#endif //TNT_SHM_SLAB_H
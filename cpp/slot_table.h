@@ -0,0 +1,210 @@
+/**
+ * @file:   slot_table.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  slot table 用带代数的ID直接下标访问的表
+ *
+ * ID = 代数 << INDEX_BITS | 槽位下标
+ * 查找只是一次下标越界检查加一次代数比较, 不用哈希, 插入删除也不分配内存
+ * 槽位释放时代数加1, 之前发出去的ID就找不到了, 过期的回包自然被挡掉
+ *
+ * 空闲的槽位先进先出, 同一个槽位要等其他空闲的都用过一轮才会再用到,
+ * 代数 GENERATION_MASK 一圈之后才会重复, 一般回包早就超时了
+ *
+ * ID 不会是0, 0 留给调用者表示"没有"
+ */
+
+#ifndef SLOT_TABLE_H
+#define SLOT_TABLE_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace tnt
+{
+
+template<typename T>
+class SlotTable
+{
+public:
+    static const uint32_t INDEX_BITS = 20;
+    static const uint32_t MAX_SLOTS = 1U << INDEX_BITS;
+    static const uint32_t INDEX_MASK = MAX_SLOTS - 1;
+    static const uint32_t GENERATION_MASK = (1U << (32 - INDEX_BITS)) - 1;
+
+public:
+    explicit SlotTable(uint32_t seed = 0)
+        : seed_(seed), size_(0), free_head_(INVALID_INDEX), free_tail_(INVALID_INDEX)
+    {
+    }
+
+    /**
+     * @brief:  预分配槽位, 只能变大
+     *
+     * 初始化时调用, 已经发出去的ID不受影响
+     *
+     * @return: 0 成功, -1 超过 MAX_SLOTS
+     */
+    int Reserve(std::size_t capacity)
+    {
+        if (capacity > MAX_SLOTS)
+        {
+            return -1;
+        }
+
+        for (std::size_t index=slots_.size(); index<capacity; ++index)
+        {
+            Slot slot;
+            slot.generation = FirstGeneration(static_cast<uint32_t>(index));
+            slot.in_use = false;
+            slot.next_free = INVALID_INDEX;
+            slot.value = T();
+            slots_.push_back(slot);
+
+            PushFree(static_cast<uint32_t>(index));
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief:  换一个代数的起点, 重启以后不会认上一个进程发出去的ID
+     * 只影响空闲的槽位
+     */
+    void Seed(uint32_t seed)
+    {
+        seed_ = seed;
+        for (std::size_t index=0; index<slots_.size(); ++index)
+        {
+            if (!slots_[index].in_use)
+            {
+                slots_[index].generation = FirstGeneration(static_cast<uint32_t>(index));
+            }
+        }
+    }
+
+    /**
+     * @return: 新的ID, 0 表示满了
+     */
+    uint32_t Insert(const T& value)
+    {
+        if (INVALID_INDEX == free_head_)
+        {
+            return 0;
+        }
+
+        uint32_t index = free_head_;
+        Slot& slot = slots_[index];
+        free_head_ = slot.next_free;
+        if (INVALID_INDEX == free_head_)
+        {
+            free_tail_ = INVALID_INDEX;
+        }
+
+        slot.in_use = true;
+        slot.next_free = INVALID_INDEX;
+        slot.value = value;
+        ++size_;
+
+        return (slot.generation << INDEX_BITS) | index;
+    }
+
+    /**
+     * @return: NULL 没有这个ID, 或者已经释放了
+     */
+    T* Find(uint32_t id)
+    {
+        uint32_t index = id & INDEX_MASK;
+        if (index >= slots_.size())
+        {
+            return NULL;
+        }
+
+        Slot& slot = slots_[index];
+        if (!slot.in_use || slot.generation != (id >> INDEX_BITS))
+        {
+            return NULL;
+        }
+
+        return &slot.value;
+    }
+
+    /**
+     * @return: 0 成功, -1 没有这个ID
+     */
+    int Erase(uint32_t id)
+    {
+        if (NULL == Find(id))
+        {
+            return -1;
+        }
+
+        uint32_t index = id & INDEX_MASK;
+        Slot& slot = slots_[index];
+        slot.in_use = false;
+        slot.value = T();
+        slot.generation = NextGeneration(slot.generation);
+        --size_;
+
+        PushFree(index);
+
+        return 0;
+    }
+
+    inline std::size_t size() const {return size_;}
+    inline std::size_t capacity() const {return slots_.size();}
+
+private:
+    static const uint32_t INVALID_INDEX = 0xFFFFFFFF;
+
+    struct Slot
+    {
+        uint32_t generation;
+        uint32_t next_free;
+        bool in_use;
+        T value;
+    };
+
+    // 代数不能是0, 不然下标0的ID就是0了
+    static uint32_t NextGeneration(uint32_t generation)
+    {
+        generation = (generation + 1) & GENERATION_MASK;
+        return (0 == generation) ? 1 : generation;
+    }
+
+    uint32_t FirstGeneration(uint32_t index) const
+    {
+        return NextGeneration(seed_ + index);
+    }
+
+    void PushFree(uint32_t index)
+    {
+        slots_[index].next_free = INVALID_INDEX;
+        if (INVALID_INDEX == free_tail_)
+        {
+            free_head_ = index;
+        }
+        else
+        {
+            slots_[free_tail_].next_free = index;
+        }
+        free_tail_ = index;
+    }
+
+private:
+    std::vector<Slot> slots_;
+    uint32_t seed_;
+    std::size_t size_;
+    // 空闲槽位的链表, 先进先出
+    uint32_t free_head_;
+    uint32_t free_tail_;
+};
+
+template<typename T> const uint32_t SlotTable<T>::INDEX_BITS;
+template<typename T> const uint32_t SlotTable<T>::MAX_SLOTS;
+template<typename T> const uint32_t SlotTable<T>::INDEX_MASK;
+template<typename T> const uint32_t SlotTable<T>::GENERATION_MASK;
+template<typename T> const uint32_t SlotTable<T>::INVALID_INDEX;
+
+} // namespace tnt
+
+#endif //SLOT_TABLE_H
@@ -0,0 +1,175 @@
+/**
+ * @file:   spsc_ring_queue.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  单生产者单消费者的无锁环形队列
+ *
+ * ring_queue 只能单线程用, 网络线程把包交给主循环(OnProc)线程时又不想加锁
+ *
+ * 1 生产者只写 tail_, 消费者只写 head_, 分别占一个缓存行, 不会伪共享
+ * 2 head_/tail_ 一直递增, SIZE 必须是2的幂, 用掩码代替取模
+ * 3 两边各缓存一份对方的位置, 只有看起来满/空的时候才去读对方的原子变量
+ * 4 push_n/pop_n 批量操作, 一批只同步一次
+ *
+ * XXX: 只能有一个线程 push, 一个线程 pop
+ */
+
+#ifndef TNT_SPSC_RING_QUEUE_H
+#define TNT_SPSC_RING_QUEUE_H
+
+#include <cstddef>
+#include <atomic>
+#include "code_inbox.h"
+
+namespace tnt
+{
+
+/**
+ * @brief: 单生产者单消费者的固定大小环形队列
+ *
+ * @tparam T 数据类型
+ * @tparam SIZE 队列大小, 必须是2的幂
+ */
+template<typename T, size_t SIZE>
+class spsc_ring_queue
+{
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+private:
+    typedef T value_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+
+    static const size_t MASK = SIZE - 1;
+
+public:
+    spsc_ring_queue()
+        : head_(0), tail_cache_(0), tail_(0), head_cache_(0)
+    {
+    }
+
+    // 生产者调用
+    // 满了返回false
+    bool push(const value_type& value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == SIZE)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == SIZE)
+            {
+                return false;
+            }
+        }
+
+        data_[tail & MASK] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // 生产者调用
+    // 返回实际放进去的个数
+    size_t push_n(const value_type* values, size_t n)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ + n > SIZE)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+        }
+
+        size_t free_num = SIZE - (tail - head_cache_);
+        if (n > free_num)
+        {
+            n = free_num;
+        }
+
+        for (size_t i=0; i<n; ++i)
+        {
+            data_[(tail + i) & MASK] = values[i];
+        }
+
+        tail_.store(tail + n, std::memory_order_release);
+
+        return n;
+    }
+
+    // 消费者调用
+    // 空的时候返回false
+    bool pop(reference value)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_)
+            {
+                return false;
+            }
+        }
+
+        value = data_[head & MASK];
+        head_.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // 消费者调用
+    // 返回实际取出的个数
+    size_t pop_n(value_type* values, size_t n)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (tail_cache_ - head < n)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        }
+
+        size_t used_num = tail_cache_ - head;
+        if (n > used_num)
+        {
+            n = used_num;
+        }
+
+        for (size_t i=0; i<n; ++i)
+        {
+            values[i] = data_[(head + i) & MASK];
+        }
+
+        head_.store(head + n, std::memory_order_release);
+
+        return n;
+    }
+
+    // 两边都可以调用, 结果只是一个近似值
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    size_t size() const
+    {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    size_t capacity() const
+    {
+        return SIZE;
+    }
+
+private:
+    // 消费者
+    alignas(TNT_CACHE_LINE_SIZE) std::atomic<size_t> head_;
+    size_t tail_cache_;
+
+    // 生产者
+    alignas(TNT_CACHE_LINE_SIZE) std::atomic<size_t> tail_;
+    size_t head_cache_;
+
+    alignas(TNT_CACHE_LINE_SIZE) T data_[SIZE];
+
+}; // class spsc_ring_queue
+
+} // namespace tnt
+
+#endif //TNT_SPSC_RING_QUEUE_H
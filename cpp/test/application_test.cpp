@@ -8,6 +8,15 @@
 #include <gtest/gtest.h>
 #include "gmock/gmock.h"
 #include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+#include <thread>
 #include "application_base.h"
 #include <iostream>
 
@@ -75,3 +84,678 @@ protected:
 //    app.Run();
 //}
 //
+
+TEST_F(ApplicationTest, ProcBudget)
+{
+    LatencyHistogram msg_cost;
+
+    // 条数
+    ProcBudget count_budget(MonotonicNowNs(), 3, MonotonicNowNs() + 1000000000ULL, &msg_cost);
+    EXPECT_TRUE(count_budget.Consume());
+    EXPECT_TRUE(count_budget.Consume());
+    EXPECT_FALSE(count_budget.Consume());
+    EXPECT_EQ(3u, count_budget.processed());
+    EXPECT_EQ(3u, msg_cost.count());
+
+    // 时间, 每条100us, 1ms 的预算
+    uint64_t begin_ns = MonotonicNowNs();
+    ProcBudget time_budget(begin_ns, (size_t)-1, begin_ns + 1000000, &msg_cost);
+    do
+    {
+        uint64_t msg_begin = MonotonicNowNs();
+        while (MonotonicNowNs() < msg_begin + 100000)
+        {
+        }
+    } while (time_budget.Consume());
+    // 单核机器上可能被抢占, 下限放宽
+    EXPECT_GE(time_budget.processed(), 1u);
+    EXPECT_LE(time_budget.processed(), 10u);
+}
+
+class BatchApplication : public ApplicationBase
+{
+public:
+    BatchApplication() : proc_count_(0), tick_count_(0) {}
+
+    virtual int OnInit(const char* conf_file)
+    {
+        return 0;
+    }
+
+    virtual int OnTick()
+    {
+        ++tick_count_;
+        return 0;
+    }
+
+    virtual int OnProc()
+    {
+        if (proc_count_ >= MSG_COUNT)
+        {
+            raise(SIGQUIT);
+            return -1;
+        }
+
+        ++proc_count_;
+        return 0;
+    }
+
+    static const int MSG_COUNT = 100000;
+    int proc_count_;
+    int tick_count_;
+};
+
+const int BatchApplication::MSG_COUNT;
+
+// Init/Run 会改信号处理和进程控制的静态变量, 放到子进程里跑, 结果通过管道传回来
+struct AppResult
+{
+    uint64_t values[8];
+};
+
+template <typename Func>
+static int RunInChild(Func func, AppResult& result)
+{
+    int fds[2];
+    if (0 != pipe(fds))
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return -1;
+    }
+
+    if (0 == pid)
+    {
+        close(fds[0]);
+        AppResult child_result;
+        memset(&child_result, 0, sizeof(child_result));
+        func(child_result);
+        fflush(stdout);
+        ssize_t ret = write(fds[1], &child_result, sizeof(child_result));
+        _exit(sizeof(child_result) == ret ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t len = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    return (sizeof(result) == len && WIFEXITED(status) && 0 == WEXITSTATUS(status)) ? 0 : -1;
+}
+
+// 一批最多64条, 主循环转的圈数少很多, Tick照常
+TEST_F(ApplicationTest, ProcBatch)
+{
+    AppResult result;
+    ASSERT_EQ(0, RunInChild([](AppResult& r) {
+        const char* argv[] = {"/tmp/tnt_batch_app_test", "--proc_batch=64", "--tick_timer=1", "start"};
+        unlink("tnt_batch_app_test.pid");
+
+        BatchApplication app;
+        app.Init(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+        app.Run();
+        unlink("tnt_batch_app_test.pid");
+        printf("%s", app.StatStr().c_str());
+
+        r.values[0] = app.proc_count_;
+        r.values[1] = app.msg_cost().count();
+        r.values[2] = app.proc_cost().count();
+        r.values[3] = app.total_tick_count();
+        r.values[4] = app.tick_count_;
+    }, result));
+
+    EXPECT_EQ((uint64_t)BatchApplication::MSG_COUNT, result.values[0]);
+    EXPECT_EQ((uint64_t)BatchApplication::MSG_COUNT, result.values[1]);
+    EXPECT_GE(result.values[2], (uint64_t)BatchApplication::MSG_COUNT / 64);
+    // 到了Tick会提前结束一批
+    EXPECT_LE(result.values[2], (uint64_t)BatchApplication::MSG_COUNT / 64 + result.values[3] + 2);
+    EXPECT_GT(result.values[4], 0u);
+}
+
+// 第3个Tick卡住55ms, 错过5个
+class SlowTickApplication : public ApplicationBase
+{
+public:
+    SlowTickApplication() : tick_calls_(0), begin_ns_(0), elapsed_ms_(0) {}
+
+    virtual int OnInit(const char* conf_file)
+    {
+        begin_ns_ = MonotonicNowNs();
+        return 0;
+    }
+
+    virtual int OnTick()
+    {
+        if (3 == ++tick_calls_)
+        {
+            usleep(55000);
+        }
+        return 0;
+    }
+
+    virtual int OnProc()
+    {
+        uint64_t elapsed_ns = MonotonicNowNs() - begin_ns_;
+        if (elapsed_ns > 300000000ULL && 0 == elapsed_ms_)
+        {
+            elapsed_ms_ = elapsed_ns / 1000000;
+            raise(SIGQUIT);
+        }
+        return -1;
+    }
+
+    uint64_t tick_calls_;
+    uint64_t begin_ns_;
+    uint64_t elapsed_ms_;
+};
+
+static int RunSlowTick(const char* catchup, AppResult& result)
+{
+    return RunInChild([catchup](AppResult& r) {
+        std::string catchup_arg = std::string("--tick_catchup=") + catchup;
+        const char* argv[] = {"/tmp/tnt_tick_app_test", "--tick_timer=10", "--idle_count=1", "--idle_sleep=1",
+                              "--epoll_wait=-1", catchup_arg.c_str(), "start"};
+        unlink("tnt_tick_app_test.pid");
+
+        SlowTickApplication app;
+        app.Init(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+        app.Run();
+        unlink("tnt_tick_app_test.pid");
+        printf("%s", app.StatStr().c_str());
+
+        r.values[0] = app.tick_calls_;
+        r.values[1] = app.total_tick_count();
+        r.values[2] = app.total_tick_skipped();
+        // 从OnInit到最后一个Tick应该有多少个, 第一个在0ms
+        r.values[3] = app.elapsed_ms_ / 10 + 1;
+        r.values[4] = app.tick_jitter().Percentile(50);
+    }, result);
+}
+
+TEST_F(ApplicationTest, TickCatchup)
+{
+    AppResult result;
+
+    // 错过的不调用, 计划还在格子上
+    ASSERT_EQ(0, RunSlowTick("skip", result));
+    EXPECT_EQ(result.values[0], result.values[1]);
+    EXPECT_GE(result.values[2], 4u);
+    EXPECT_NEAR((double)result.values[3], (double)(result.values[1] + result.values[2]), 2);
+    // 没有累积的延迟, 一般是准时的
+    EXPECT_LT(result.values[4], 5000000u);
+
+    // 只调一次, 计数补上
+    ASSERT_EQ(0, RunSlowTick("coalesce", result));
+    EXPECT_NEAR((double)result.values[3], (double)result.values[1], 2);
+    EXPECT_LE(result.values[0] + 4, result.values[1]);
+    EXPECT_EQ(0u, result.values[2]);
+
+    // 补调
+    ASSERT_EQ(0, RunSlowTick("replay", result));
+    EXPECT_NEAR((double)result.values[3], (double)result.values[1], 2);
+    EXPECT_EQ(result.values[0], result.values[1]);
+    EXPECT_EQ(0u, result.values[2]);
+}
+
+// 每个线程一个分片
+struct WorkerShard
+{
+    pthread_t thread;
+    int cpu;
+    uint64_t proc_count;
+    uint64_t reload_count;
+    uint64_t tick_count;
+};
+
+class WorkerApplication : public ApplicationBase
+{
+public:
+    static const int WORKERS = 2;
+
+    WorkerApplication() : reload_count_(0), exit_count_(0), signal_sent_(0)
+    {
+        memset(shards_, 0, sizeof(shards_));
+    }
+
+    virtual int OnInit(const char* conf_file)
+    {
+        return 0;
+    }
+
+    virtual int OnProc()
+    {
+        return -1;
+    }
+
+    virtual int OnReload()
+    {
+        ++reload_count_;
+        return 0;
+    }
+
+    virtual int OnWorkerInit(WorkerContext& ctx)
+    {
+        WorkerShard* shard = new WorkerShard;
+        memset(shard, 0, sizeof(*shard));
+        shard->thread = pthread_self();
+        shard->cpu = sched_getcpu();
+        ctx.set_data(shard);
+        return 0;
+    }
+
+    virtual int OnWorkerProc(WorkerContext& ctx)
+    {
+        WorkerShard* shard = static_cast<WorkerShard*>(ctx.data());
+        if (shard->proc_count >= 1000)
+        {
+            return -1;
+        }
+
+        ++shard->proc_count;
+        return 0;
+    }
+
+    virtual int OnWorkerTick(WorkerContext& ctx)
+    {
+        WorkerShard* shard = static_cast<WorkerShard*>(ctx.data());
+        ++shard->tick_count;
+
+        // 第一个线程负责发信号, 主线程reload了再stop
+        if (0 == ctx.worker_id() && shard->tick_count >= 3)
+        {
+            if (0 == signal_sent_)
+            {
+                signal_sent_ = 1;
+                kill(getpid(), SIGUSR1);
+            }
+            else if (1 == signal_sent_ && reload_count_ > 0)
+            {
+                signal_sent_ = 2;
+                kill(getpid(), SIGQUIT);
+            }
+        }
+        return 0;
+    }
+
+    virtual int OnWorkerReload(WorkerContext& ctx)
+    {
+        static_cast<WorkerShard*>(ctx.data())->reload_count += 1;
+        return 0;
+    }
+
+    virtual int OnWorkerExit(WorkerContext& ctx)
+    {
+        WorkerShard* shard = static_cast<WorkerShard*>(ctx.data());
+        shards_[ctx.worker_id()] = *shard;
+        delete shard;
+        ++exit_count_;
+        return 0;
+    }
+
+    virtual int OnExit()
+    {
+        ++exit_count_;
+        return 0;
+    }
+
+    std::atomic<int> reload_count_;
+    std::atomic<int> exit_count_;
+    int signal_sent_;
+    WorkerShard shards_[WORKERS];
+};
+
+const int WorkerApplication::WORKERS;
+
+// 两个工作线程, 信号经过signalfd转给每个线程
+TEST_F(ApplicationTest, Workers)
+{
+    AppResult result;
+    ASSERT_EQ(0, RunInChild([](AppResult& r) {
+        const char* argv[] = {"/tmp/tnt_worker_app_test", "--workers=2", "--tick_timer=5", "start"};
+        unlink("tnt_worker_app_test.pid");
+
+        WorkerApplication app;
+        app.Init(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+        r.values[0] = app.Run();
+        unlink("tnt_worker_app_test.pid");
+
+        r.values[1] = app.reload_count_;
+        r.values[2] = app.exit_count_;
+        r.values[3] = !pthread_equal(app.shards_[0].thread, app.shards_[1].thread);
+        r.values[4] = app.shards_[0].proc_count + app.shards_[1].proc_count;
+        r.values[5] = app.shards_[0].reload_count + app.shards_[1].reload_count;
+        r.values[6] = (app.shards_[0].tick_count >= 3 && app.shards_[1].tick_count > 0);
+    }, result));
+
+    EXPECT_EQ(0u, result.values[0]);
+    EXPECT_EQ(1u, result.values[1]);
+    // 两个线程加上主线程的 OnExit
+    EXPECT_EQ(3u, result.values[2]);
+    EXPECT_EQ(1u, result.values[3]);
+    EXPECT_EQ(2000u, result.values[4]);
+    EXPECT_EQ(2u, result.values[5]);
+    EXPECT_EQ(1u, result.values[6]);
+}
+
+// 另一个线程敲eventfd, 看主循环多久才发现
+class WakeupApplication : public ApplicationBase
+{
+public:
+    static const int SAMPLES = 100;
+
+    WakeupApplication() : event_fd_(-1), sent_ns_(0), received_(0) {}
+
+    virtual int OnInit(const char* conf_file)
+    {
+        event_fd_ = eventfd(0, EFD_NONBLOCK);
+        if (-1 == event_fd_)
+        {
+            return -1;
+        }
+
+        // 只有epoll模式才会用到
+        AddPollFd(event_fd_);
+
+        producer_ = std::thread([this]() {
+            for (int i=0; i<SAMPLES; ++i)
+            {
+                usleep(2000);
+                sent_ns_.store(MonotonicNowNs(), std::memory_order_release);
+                uint64_t value = 1;
+                ssize_t ret = write(event_fd_, &value, sizeof(value));
+                (void)ret;
+
+                // 收到了再发下一个
+                while (received_.load(std::memory_order_acquire) <= i)
+                {
+                    usleep(100);
+                }
+            }
+            kill(getpid(), SIGQUIT);
+        });
+        return 0;
+    }
+
+    virtual int OnProc()
+    {
+        return Receive() ? 0 : -1;
+    }
+
+    virtual int OnPoll(int fd, unsigned int events)
+    {
+        Receive();
+        return 0;
+    }
+
+    virtual int OnExit()
+    {
+        producer_.join();
+        close(event_fd_);
+        return 0;
+    }
+
+    bool Receive()
+    {
+        uint64_t value = 0;
+        if (sizeof(value) != read(event_fd_, &value, sizeof(value)))
+        {
+            return false;
+        }
+
+        latency_.Record(MonotonicNowNs() - sent_ns_.load(std::memory_order_acquire));
+        received_.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    int event_fd_;
+    std::thread producer_;
+    std::atomic<uint64_t> sent_ns_;
+    std::atomic<int> received_;
+    LatencyHistogram latency_;
+};
+
+const int WakeupApplication::SAMPLES;
+
+static int RunWakeup(const char* mode, const char* mode2, AppResult& result)
+{
+    return RunInChild([mode, mode2](AppResult& r) {
+        const char* argv[] = {"/tmp/tnt_wakeup_app_test", "--tick_timer=1000", mode, mode2, "start"};
+        unlink("tnt_wakeup_app_test.pid");
+
+        WakeupApplication app;
+        app.Init(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+        app.Run();
+        unlink("tnt_wakeup_app_test.pid");
+
+        r.values[0] = app.latency_.count();
+        r.values[1] = app.latency_.Percentile(50);
+        r.values[2] = app.latency_.Percentile(99);
+        r.values[3] = app.latency_.max();
+        r.values[4] = app.idle_cost().count();
+    }, result);
+}
+
+// 几种空闲方式的唤醒延迟, 单核机器上忙轮询会和发送线程抢CPU, 只看多核隔离核上的数
+TEST_F(ApplicationTest, WakeupLatencyBenchmark)
+{
+    const char* modes[][2] = {
+        {"--idle_sleep=10", "--idle_count=10"},
+        {"--idle_sleep=1", "--idle_count=10"},
+        {"--epoll_wait=-1", "--idle_count=1"},
+        {"--busy_poll", "--idle_count=10"},
+        {"--busy_poll", "--epoll_wait=-1"},
+    };
+
+    AppResult results[sizeof(modes)/sizeof(modes[0])];
+    for (std::size_t i=0; i<sizeof(modes)/sizeof(modes[0]); ++i)
+    {
+        ASSERT_EQ(0, RunWakeup(modes[i][0], modes[i][1], results[i]));
+        EXPECT_EQ((uint64_t)WakeupApplication::SAMPLES, results[i].values[0]);
+    }
+
+    for (std::size_t i=0; i<sizeof(modes)/sizeof(modes[0]); ++i)
+    {
+        printf("%-16s %-16s p50 %8.1fus p99 %8.1fus max %8.1fus idle %llu\n", modes[i][0], modes[i][1],
+               results[i].values[1] / 1000.0, results[i].values[2] / 1000.0, results[i].values[3] / 1000.0,
+               (unsigned long long)results[i].values[4]);
+    }
+
+    // 阻塞在epoll上比睡10ms醒得快
+    EXPECT_LT(results[2].values[1], results[0].values[1]);
+}
+
+// OnProc 一直有事做, 注册的fd也要能收到
+class BusyPollApplication : public ApplicationBase
+{
+public:
+    BusyPollApplication() : event_fd_(-1), proc_count_(0), poll_count_(0), tick_count_(0) {}
+
+    virtual int OnInit(const char* conf_file)
+    {
+        // 一开始就是可读的
+        event_fd_ = eventfd(1, EFD_NONBLOCK);
+        if (-1 == event_fd_)
+        {
+            return -1;
+        }
+
+        return AddPollFd(event_fd_);
+    }
+
+    virtual int OnProc()
+    {
+        ++proc_count_;
+        return 0;
+    }
+
+    virtual int OnPoll(int fd, unsigned int events)
+    {
+        uint64_t value = 0;
+        if (sizeof(value) == read(fd, &value, sizeof(value)))
+        {
+            ++poll_count_;
+            kill(getpid(), SIGQUIT);
+        }
+        return 0;
+    }
+
+    virtual int OnTick()
+    {
+        // 收不到也别一直跑下去
+        if (++tick_count_ >= 3)
+        {
+            kill(getpid(), SIGQUIT);
+        }
+        return 0;
+    }
+
+    virtual int OnExit()
+    {
+        close(event_fd_);
+        return 0;
+    }
+
+    int event_fd_;
+    uint64_t proc_count_;
+    uint64_t poll_count_;
+    uint64_t tick_count_;
+};
+
+TEST_F(ApplicationTest, PollWhileBusy)
+{
+    AppResult result;
+    ASSERT_EQ(0, RunInChild([](AppResult& r) {
+        const char* argv[] = {"/tmp/tnt_busy_poll_app_test", "--tick_timer=1000", "--epoll_wait=-1", "start"};
+        unlink("tnt_busy_poll_app_test.pid");
+
+        BusyPollApplication app;
+        app.Init(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+        app.Run();
+        unlink("tnt_busy_poll_app_test.pid");
+
+        r.values[0] = app.poll_count_;
+        r.values[1] = app.proc_count_;
+        r.values[2] = app.tick_count_;
+    }, result));
+
+    EXPECT_EQ(1u, result.values[0]);
+    EXPECT_GT(result.values[1], 0u);
+    // 不是等到超时退出的
+    EXPECT_LT(result.values[2], 3u);
+}
+
+TEST_F(ApplicationTest, ParseCpuList)
+{
+    std::vector<int> cpus;
+    ASSERT_EQ(0, ApplicationBase::ParseCpuList("0,2-4,7", cpus));
+    ASSERT_EQ(5u, cpus.size());
+    EXPECT_EQ(0, cpus[0]);
+    EXPECT_EQ(2, cpus[1]);
+    EXPECT_EQ(4, cpus[3]);
+    EXPECT_EQ(7, cpus[4]);
+
+    // sysfs 里的带换行
+    ASSERT_EQ(0, ApplicationBase::ParseCpuList("0-1\n", cpus));
+    EXPECT_EQ(2u, cpus.size());
+
+    EXPECT_EQ(-1, ApplicationBase::ParseCpuList("", cpus));
+    EXPECT_EQ(-1, ApplicationBase::ParseCpuList("3-1", cpus));
+    EXPECT_EQ(-1, ApplicationBase::ParseCpuList("a", cpus));
+    EXPECT_EQ(-1, ApplicationBase::ParseCpuList("1;2", cpus));
+}
+
+// 工作线程模式没有 RunTick, 各个线程的统计由主线程发布
+TEST_F(ApplicationTest, WorkerMetrics)
+{
+    const char* metrics_file = "/tmp/tnt_app_test_metrics/tnt_worker_metrics_app_test.1.metrics";
+    unlink(metrics_file);
+
+    AppResult result;
+    ASSERT_EQ(0, RunInChild([metrics_file](AppResult& r) {
+        const char* argv[] = {"/tmp/tnt_worker_metrics_app_test", "--workers=2", "--tick_timer=5",
+            "--id=1", "--metrics_dir=/tmp/tnt_app_test_metrics", "start"};
+        unlink("tnt_worker_metrics_app_test.pid");
+
+        WorkerApplication app;
+        app.Init(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+        r.values[0] = app.Run();
+        unlink("tnt_worker_metrics_app_test.pid");
+
+        ShmMetricsReader reader;
+        ShmMetricsSnapshot snapshot;
+        if (0 != reader.Open(metrics_file) || 0 != reader.Snapshot(snapshot))
+        {
+            r.values[1] = 1;
+            return;
+        }
+
+        for (std::size_t i=0; i<snapshot.counters.size(); ++i)
+        {
+            if (0 == strcmp("worker0_total_proc_count", snapshot.counters[i].name))
+            {
+                r.values[2] = snapshot.counters[i].value;
+            }
+            else if (0 == strcmp("worker1_total_tick_count", snapshot.counters[i].name))
+            {
+                r.values[3] = snapshot.counters[i].value;
+            }
+        }
+
+        for (std::size_t i=0; i<snapshot.histograms.size(); ++i)
+        {
+            if (0 == strcmp("worker1_proc_latency", snapshot.histograms[i].name))
+            {
+                r.values[4] = snapshot.histograms[i].count;
+            }
+        }
+        r.values[5] = app.shards_[1].tick_count;
+    }, result));
+    unlink(metrics_file);
+
+    EXPECT_EQ(0u, result.values[0]);
+    ASSERT_EQ(0u, result.values[1]);
+    // 每圈都算一次 proc, 至少是处理的那1000次
+    EXPECT_GE(result.values[2], 1000u);
+    EXPECT_GE(result.values[3], result.values[5]);
+    EXPECT_GT(result.values[3], 0u);
+    EXPECT_GE(result.values[4], 1000u);
+}
+
+// 在 OnInit 之前生效, 工作线程也只在这些CPU上
+TEST_F(ApplicationTest, RuntimeOptions)
+{
+    AppResult result;
+    ASSERT_EQ(0, RunInChild([](AppResult& r) {
+        const char* argv[] = {"/tmp/tnt_runtime_app_test", "--cpu_affinity=0", "--sched_policy=other",
+            "--workers=2", "--tick_timer=5", "start"};
+        unlink("tnt_runtime_app_test.pid");
+
+        WorkerApplication app;
+        app.Init(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        sched_getaffinity(0, sizeof(cpu_set), &cpu_set);
+        r.values[0] = CPU_COUNT(&cpu_set);
+        r.values[1] = CPU_ISSET(0, &cpu_set);
+        r.values[2] = (SCHED_OTHER == sched_getscheduler(0));
+
+        r.values[3] = app.Run();
+        unlink("tnt_runtime_app_test.pid");
+        r.values[4] = app.shards_[0].cpu;
+        r.values[5] = app.shards_[1].cpu;
+    }, result));
+
+    EXPECT_EQ(1u, result.values[0]);
+    EXPECT_EQ(1u, result.values[1]);
+    EXPECT_EQ(1u, result.values[2]);
+    EXPECT_EQ(0u, result.values[3]);
+    EXPECT_EQ(0u, result.values[4]);
+    EXPECT_EQ(0u, result.values[5]);
+}
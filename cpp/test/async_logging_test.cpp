@@ -0,0 +1,233 @@
+/**
+ * @file:   async_logging_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  async_logging_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/time.h>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "async_logging.h"
+
+using namespace testing;
+using namespace tnt;
+
+static const char* TEST_LOG_FILE = "/tmp/tnt_async_logging_test.log";
+
+class AsyncLoggingTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        RemoveFiles();
+    }
+
+    virtual void TearDown()
+    {
+        SetVaLogHandler(old_handler_);
+        AsyncLogging::Instance().Stop();
+        RemoveFiles();
+    }
+
+    void Install()
+    {
+        old_handler_ = SetVaLogHandler(AsyncLogging::VaLogHandler);
+    }
+
+    void Uninstall()
+    {
+        SetVaLogHandler(old_handler_);
+        old_handler_ = NULL;
+    }
+
+    // 当前文件和切出来的文件
+    static std::vector<std::string> Files()
+    {
+        std::vector<std::string> files;
+        glob_t g;
+        std::string pattern = std::string(TEST_LOG_FILE) + "*";
+        if (0 == glob(pattern.c_str(), 0, NULL, &g))
+        {
+            for (std::size_t i=0; i<g.gl_pathc; ++i)
+            {
+                files.push_back(g.gl_pathv[i]);
+            }
+        }
+        globfree(&g);
+        return files;
+    }
+
+    static void RemoveFiles()
+    {
+        std::vector<std::string> files = Files();
+        for (std::size_t i=0; i<files.size(); ++i)
+        {
+            unlink(files[i].c_str());
+        }
+    }
+
+    static std::size_t CountLines(const char* keyword)
+    {
+        std::size_t count = 0;
+        std::vector<std::string> files = Files();
+        for (std::size_t i=0; i<files.size(); ++i)
+        {
+            std::ifstream in(files[i].c_str());
+            std::string line;
+            while (std::getline(in, line))
+            {
+                if (std::string::npos != line.find(keyword))
+                {
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+
+    VaLogHandler* old_handler_ = NULL;
+};
+
+TEST_F(AsyncLoggingTest, MultiThread)
+{
+    AsyncLogOptions options;
+    options.file_path = TEST_LOG_FILE;
+    options.memory_budget = 64 * 1024 * 1024;
+    ASSERT_EQ(0, AsyncLogging::Instance().Start(options));
+    EXPECT_EQ(-2, AsyncLogging::Instance().Start(options));
+    Install();
+
+    const int thread_count = 4;
+    const int count = 10000;
+    std::vector<std::thread> threads;
+    for (int t=0; t<thread_count; ++t)
+    {
+        threads.push_back(std::thread([t]()
+        {
+            for (int i=0; i<count; ++i)
+            {
+                LOG_INFO(t, i, "async", "thread %d line %d", t, i);
+            }
+        }));
+    }
+    for (int t=0; t<thread_count; ++t)
+    {
+        threads[t].join();
+    }
+
+    Uninstall();
+    AsyncLogging::Instance().Stop();
+
+    AsyncLogStats stats = AsyncLogging::Instance().stats();
+    EXPECT_EQ(static_cast<uint64_t>(thread_count * count), stats.written + stats.dropped);
+    EXPECT_EQ(stats.written, CountLines("|async|"));
+
+    // 超长的截断
+    ASSERT_EQ(0, AsyncLogging::Instance().Start(options));
+    Install();
+    std::string big(4096, 'x');
+    LOG_INFO(0, 0, "big", "%s", big.c_str());
+    Uninstall();
+    AsyncLogging::Instance().Stop();
+    EXPECT_EQ(1u, CountLines("|big|"));
+}
+
+// 内存很小, 写线程来不及的时候丢掉, 不阻塞
+TEST_F(AsyncLoggingTest, DropAndRotate)
+{
+    AsyncLogOptions options;
+    options.file_path = TEST_LOG_FILE;
+    options.memory_budget = 16 * 1024;
+    options.max_file_size = 64 * 1024;
+    ASSERT_EQ(0, AsyncLogging::Instance().Start(options));
+    Install();
+
+    AsyncLogStats before = AsyncLogging::Instance().stats();
+    for (int i=0; i<20000; ++i)
+    {
+        LOG_DEBUG(0, i, "storm", "line %d", i);
+    }
+
+    Uninstall();
+    AsyncLogging::Instance().Stop();
+
+    AsyncLogStats stats = AsyncLogging::Instance().stats();
+    uint64_t written = stats.written - before.written;
+    uint64_t dropped = stats.dropped - before.dropped;
+    printf("written %lu dropped %lu rotations %lu files %zu\n", (unsigned long)written, (unsigned long)dropped,
+           (unsigned long)(stats.rotations - before.rotations), Files().size());
+
+    EXPECT_EQ(20000u, written + dropped);
+    EXPECT_EQ(written, CountLines("|storm|"));
+    if (dropped > 0)
+    {
+        EXPECT_LE(1u, CountLines("dropped"));
+    }
+
+    // 每个文件都不会比上限大太多
+    EXPECT_EQ(stats.rotations - before.rotations + 1, Files().size());
+}
+
+static FILE* sync_log_fp = NULL;
+
+// 和 DefaultVaLogHandler 一样, 只是写到文件里
+static void SyncFileVaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
+{
+    FILE* fp = sync_log_fp;
+    static const char* level_names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+    fprintf(fp, "%s|%lu|%lu|%s|%s:%lu(%s)|", level_names[lr.log_level_], lr.log_id_, lr.user_id_,
+            lr.user_name_.c_str(), lr.file_, lr.line_, lr.func_);
+    vfprintf(fp, fmt, vl);
+    fprintf(fp, "\n");
+    fflush(fp);
+}
+
+// 调用线程上的耗时
+TEST_F(AsyncLoggingTest, Benchmark)
+{
+    const int count = 200000;
+    struct timeval begin, end;
+
+    std::string sync_file = std::string(TEST_LOG_FILE) + ".sync";
+    sync_log_fp = fopen(sync_file.c_str(), "w");
+    ASSERT_TRUE(NULL != sync_log_fp);
+
+    VaLogHandler* old = SetVaLogHandler(SyncFileVaLogHandler);
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LOG_TRACE(0, i, "bench", "Enter Function %d", i);
+    }
+    gettimeofday(&end, NULL);
+    SetVaLogHandler(old);
+    fclose(sync_log_fp);
+    unlink(sync_file.c_str());
+    long sync_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+
+    AsyncLogOptions options;
+    options.file_path = TEST_LOG_FILE;
+    options.memory_budget = 64 * 1024 * 1024;
+    ASSERT_EQ(0, AsyncLogging::Instance().Start(options));
+    Install();
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LOG_TRACE(0, i, "bench", "Enter Function %d", i);
+    }
+    gettimeofday(&end, NULL);
+    Uninstall();
+    long async_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+    AsyncLogging::Instance().Stop();
+
+    // 单核机器上写线程的时间也算在里面
+    printf("sync fprintf+fflush: %.1f ns/log, async: %.1f ns/log\n",
+           sync_us * 1000.0 / count, async_us * 1000.0 / count);
+}
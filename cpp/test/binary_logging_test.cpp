@@ -0,0 +1,229 @@
+/**
+ * @file:   binary_logging_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  binary_logging_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include "async_logging.h"
+#include "binary_logging.h"
+
+using namespace testing;
+using namespace tnt;
+
+static const char* TEST_BINARY_LOG_FILE = "/tmp/tnt_binary_logging_test.log";
+static const char* TEST_TEXT_LOG_FILE = "/tmp/tnt_binary_logging_test.txt";
+
+class BinaryLoggingTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        unlink(TEST_BINARY_LOG_FILE);
+        unlink(TEST_TEXT_LOG_FILE);
+        old_level_ = SetLogLevel(LOG_LEVEL_TRACE);
+    }
+
+    virtual void TearDown()
+    {
+        SetVaLogHandler(NULL);
+        AsyncLogging::Instance().Stop();
+        SetVaLogHandler(old_handler_);
+        SetLogLevel(old_level_);
+        unlink(TEST_BINARY_LOG_FILE);
+        unlink(TEST_TEXT_LOG_FILE);
+    }
+
+    void Start(const char* file, bool binary)
+    {
+        AsyncLogOptions options;
+        options.file_path = file;
+        options.binary = binary;
+        options.memory_budget = 64 * 1024 * 1024;
+        ASSERT_EQ(0, AsyncLogging::Instance().Start(options));
+        old_handler_ = SetVaLogHandler(AsyncLogging::VaLogHandler);
+    }
+
+    void Stop()
+    {
+        SetVaLogHandler(old_handler_);
+        AsyncLogging::Instance().Stop();
+    }
+
+    // 去掉时间, 只比后面的
+    static std::vector<std::string> ReadLines(FILE* fp)
+    {
+        std::vector<std::string> lines;
+        char line[4096];
+        while (NULL != fgets(line, sizeof(line), fp))
+        {
+            const char* p = strchr(line, '|');
+            lines.push_back(NULL != p ? p : line);
+        }
+        return lines;
+    }
+
+    static std::vector<std::string> Decode(const char* file)
+    {
+        FILE* in = fopen(file, "rb");
+        EXPECT_TRUE(NULL != in);
+
+        char* buf = NULL;
+        std::size_t len = 0;
+        FILE* out = open_memstream(&buf, &len);
+        EXPECT_EQ(0, DecodeBinaryLog(in, out));
+        fclose(in);
+        fclose(out);
+
+        FILE* mem = fmemopen(buf, len, "r");
+        std::vector<std::string> lines = ReadLines(mem);
+        fclose(mem);
+        free(buf);
+        return lines;
+    }
+
+    static long FileSize(const char* file)
+    {
+        struct stat st;
+        return (0 == stat(file, &st)) ? st.st_size : -1;
+    }
+
+    VaLogHandler* old_handler_ = NULL;
+    LogLevel old_level_;
+};
+
+static void LogAll(int i)
+{
+    const char* null_str = NULL;
+    char dynamic_fmt[32];
+    snprintf(dynamic_fmt, sizeof(dynamic_fmt), "dynamic %%d|%d", i);
+
+    LOG_INFO(1, 10000 + i, "player", "login|%d|%u|%s", i, 0xFFFFFFFFu, "hello");
+    LOG_DEBUG(2, i, "", "%ld|%lld|%lu|%zu|%hd|%c|%%|%x|%08X", -1L, 1LL << 40, 123UL, sizeof(int), (short)-3, 'z', i, i);
+    LOG_WARN(3, i, "", "%.3f|%10.2e|%Lf|%-6s|%*d|%.*s|%p", 3.14159, 1e10, (long double)2.5, "ab", 5, i, 2, "xyz", (void*)0x1234);
+    LOG_ERROR(4, i, "", "%s|%s", null_str, std::string(2000, 'a').c_str());
+    LOG_INFO(5, i, "", "%ls unsupported", L"wide");
+    LOG(LOG_LEVEL_INFO, 6, i, "", dynamic_fmt, i);
+}
+
+// 二进制解出来和直接写文本一样
+TEST_F(BinaryLoggingTest, SameAsText)
+{
+    Start(TEST_TEXT_LOG_FILE, false);
+    for (int i=0; i<3; ++i)
+    {
+        LogAll(i);
+    }
+    Stop();
+
+    Start(TEST_BINARY_LOG_FILE, true);
+    for (int i=0; i<3; ++i)
+    {
+        LogAll(i);
+    }
+    Stop();
+
+    FILE* fp = fopen(TEST_TEXT_LOG_FILE, "r");
+    ASSERT_TRUE(NULL != fp);
+    std::vector<std::string> text = ReadLines(fp);
+    fclose(fp);
+
+    std::vector<std::string> binary = Decode(TEST_BINARY_LOG_FILE);
+    ASSERT_EQ(text.size(), binary.size());
+    for (std::size_t i=0; i<text.size(); ++i)
+    {
+        if (std::string::npos != text[i].find("|aaaa"))
+        {
+            // 长字符串两边截断的地方不一样
+            EXPECT_EQ(text[i].substr(0, 200), binary[i].substr(0, 200));
+            continue;
+        }
+        EXPECT_EQ(text[i], binary[i]);
+    }
+}
+
+// 定长的协议字段没有'\0', 按精度只读这么多, 后面是不能读的页
+TEST_F(BinaryLoggingTest, NonTerminatedString)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char* pages = static_cast<char*>(mmap(NULL, page * 2, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(MAP_FAILED, pages);
+    ASSERT_EQ(0, mprotect(pages + page, page, PROT_NONE));
+
+    char* field = pages + page - 8;
+    memcpy(field, "abcdefgh", 8);
+
+    Start(TEST_BINARY_LOG_FILE, true);
+    LOG_INFO(0, 1, "", "star|%.*s|%d", 8, field, 1);
+    LOG_INFO(0, 2, "", "literal|%.8s|%.3s|%-10.*s|", field, field, 4, field);
+    LOG_INFO(0, 3, "", "zero|%.s|%.0s|", field, field);
+    Stop();
+
+    munmap(pages, page * 2);
+
+    std::vector<std::string> lines = Decode(TEST_BINARY_LOG_FILE);
+    ASSERT_EQ(3u, lines.size());
+    EXPECT_NE(std::string::npos, lines[0].find("star|abcdefgh|1"));
+    EXPECT_NE(std::string::npos, lines[1].find("literal|abcdefgh|abc|abcd      |"));
+    EXPECT_NE(std::string::npos, lines[2].find("zero|||"));
+}
+
+// 切文件后新文件也能单独解码
+TEST_F(BinaryLoggingTest, Rotate)
+{
+    AsyncLogOptions options;
+    options.file_path = TEST_BINARY_LOG_FILE;
+    options.binary = true;
+    options.max_file_size = 1;
+    options.memory_budget = 64 * 1024 * 1024;
+    ASSERT_EQ(0, AsyncLogging::Instance().Start(options));
+    old_handler_ = SetVaLogHandler(AsyncLogging::VaLogHandler);
+
+    LOG_INFO(0, 1, "", "before rotate %d", 1);
+    usleep(50000);
+    LOG_INFO(0, 2, "", "after rotate %d", 2);
+    Stop();
+
+    std::vector<std::string> lines = Decode(TEST_BINARY_LOG_FILE);
+    ASSERT_EQ(1u, lines.size());
+    EXPECT_NE(std::string::npos, lines[0].find("after rotate 2"));
+
+    // 删掉切出来的
+    std::string cmd = std::string("rm -f ") + TEST_BINARY_LOG_FILE + ".*";
+    EXPECT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(BinaryLoggingTest, Benchmark)
+{
+    const int count = 60000;
+    struct timeval begin, end;
+    long cost_us[2];
+    long file_size[2];
+    const char* files[2] = {TEST_TEXT_LOG_FILE, TEST_BINARY_LOG_FILE};
+
+    for (int b=0; b<2; ++b)
+    {
+        Start(files[b], 1 == b);
+        gettimeofday(&begin, NULL);
+        for (int i=0; i<count; ++i)
+        {
+            LOG_INFO(1001, 10000 + i, "player", "login|%d|%u|%s|%d", i, 0xFFFFu, "hello", i * 3);
+        }
+        gettimeofday(&end, NULL);
+        Stop();
+        cost_us[b] = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+        file_size[b] = FileSize(files[b]);
+    }
+
+    printf("text: %.1f ns/log %ld bytes, binary: %.1f ns/log %ld bytes\n",
+           cost_us[0] * 1000.0 / count, file_size[0], cost_us[1] * 1000.0 / count, file_size[1]);
+}
@@ -0,0 +1,167 @@
+/**
+ * @file:   coro_task_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  coro_task_test
+ *
+ * 需要 -std=c++20, 见 SConstruct 里的 unit_test_cxx20
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <sys/time.h>
+#include <stdexcept>
+#include <vector>
+#include "coro_task.h"
+
+#ifdef TNT_HAS_COROUTINE
+
+using namespace testing;
+using namespace tnt;
+
+// 模拟 TransactionMgr: 协程等一个回包, 外面收到回包或者超时了再 Resume
+struct FakeReply
+{
+    bool waiting;
+    int value;      // <0 超时
+};
+
+struct ReplyAwaiter
+{
+    FakeReply* reply;
+
+    bool await_ready() const noexcept {return false;}
+    void await_suspend(std::coroutine_handle<>) {reply->waiting = true;}
+    int await_resume() const {return reply->value;}
+};
+
+// 两步的异步流程, 顺序写
+static CoroTask TwoStepFlow(FakeReply* reply, int* steps)
+{
+    int first = co_await ReplyAwaiter{reply};
+    if (first < 0)
+    {
+        co_return -1;
+    }
+    ++*steps;
+
+    int second = co_await ReplyAwaiter{reply};
+    if (second < 0)
+    {
+        co_return -2;
+    }
+    ++*steps;
+
+    co_return first + second;
+}
+
+static CoroTask ThrowFlow(FakeReply* reply)
+{
+    co_await ReplyAwaiter{reply};
+    throw std::runtime_error("bad reply");
+    co_return 0;
+}
+
+TEST(CoroTaskTest, ResumeAndTimeout)
+{
+    FakeReply reply = {false, 0};
+    int steps = 0;
+
+    CoroTask task = TwoStepFlow(&reply, &steps);
+    // 创建以后先挂起
+    EXPECT_FALSE(task.done());
+    EXPECT_FALSE(reply.waiting);
+
+    EXPECT_FALSE(task.Resume());
+    EXPECT_TRUE(reply.waiting);
+
+    reply.value = 10;
+    EXPECT_FALSE(task.Resume());
+    EXPECT_EQ(1, steps);
+
+    reply.value = 20;
+    EXPECT_TRUE(task.Resume());
+    EXPECT_EQ(2, steps);
+    EXPECT_EQ(30, task.result());
+
+    // 第二步超时
+    steps = 0;
+    task = TwoStepFlow(&reply, &steps);
+    task.Resume();
+    reply.value = 1;
+    task.Resume();
+    reply.value = -1;
+    EXPECT_TRUE(task.Resume());
+    EXPECT_EQ(-2, task.result());
+
+    // 没跑完就释放, 帧还回池里
+    task.Reset();
+    uint64_t in_use = CoroFramePool::Instance().in_use_count();
+    task = TwoStepFlow(&reply, &steps);
+    task.Resume();
+    EXPECT_EQ(in_use + 1, CoroFramePool::Instance().in_use_count());
+    task.Reset();
+    EXPECT_EQ(in_use, CoroFramePool::Instance().in_use_count());
+}
+
+TEST(CoroTaskTest, Exception)
+{
+    FakeReply reply = {false, 0};
+    CoroTask task = ThrowFlow(&reply);
+    task.Resume();
+    EXPECT_THROW(task.Resume(), std::runtime_error);
+    EXPECT_TRUE(task.done());
+}
+
+static double NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+// 同时 ACTIVE 个流程在等回包, 一个结束马上开一个新的
+// 预热以后不再向系统申请协程帧
+TEST(CoroTaskTest, Benchmark)
+{
+    const int ACTIVE = 1024;
+    const int LOOP = 1000000;
+
+    std::vector<FakeReply> replies(ACTIVE);
+    std::vector<CoroTask> tasks(ACTIVE);
+    int steps = 0;
+
+    for (int i=0; i<ACTIVE; ++i)
+    {
+        replies[i].value = 1;
+        tasks[i] = TwoStepFlow(&replies[i], &steps);
+        tasks[i].Resume();
+    }
+
+    const CoroFramePool& pool = CoroFramePool::Instance();
+    uint64_t warm_alloc = pool.system_alloc_count();
+
+    int64_t sum = 0;
+    double begin = NowUs();
+    for (int i=0; i<LOOP; ++i)
+    {
+        int slot = i % ACTIVE;
+        if (tasks[slot].Resume())
+        {
+            sum += tasks[slot].result();
+            // 先释放再创建, 刚还回去的帧马上复用
+            tasks[slot].Reset();
+            tasks[slot] = TwoStepFlow(&replies[slot], &steps);
+            tasks[slot].Resume();
+        }
+    }
+    double used_us = NowUs() - begin;
+
+    EXPECT_EQ(warm_alloc, pool.system_alloc_count());
+    EXPECT_GT(sum, 0);
+
+    printf("resume %.1f ns, frames from system %llu (warm %llu), reused %llu\n",
+           used_us * 1000 / LOOP,
+           (unsigned long long)pool.system_alloc_count(), (unsigned long long)warm_alloc,
+           (unsigned long long)pool.reuse_count());
+}
+
+#endif // TNT_HAS_COROUTINE
@@ -0,0 +1,201 @@
+/**
+ * @file:   coro_transaction_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  coro_transaction_test
+ *
+ * 需要 -std=c++20, 和事务模块一起编译, 见 SConstruct 里的 unit_test_cxx20
+ */
+#include "gtest/gtest.h"
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+#include "transaction_mgr.h"
+#include "coro_transaction.h"
+
+#ifdef TNT_HAS_COROUTINE
+
+using namespace testing;
+
+static const unsigned int CMD_QUERY_REQ = 0x1001;
+static const unsigned int CMD_THROW_REQ = 0x1002;
+static const unsigned int CMD_DB_RSP = 0x2001;
+static const unsigned int CMD_CACHE_RSP = 0x2002;
+
+// 每个流程的结果, 测试里看
+struct FlowResult
+{
+    unsigned int trans_id;
+    int steps;
+    // 0 还没结束
+    int exit_code;
+};
+
+static FlowResult g_flow;
+
+// 等两个回包, 每一步都可能超时
+class QueryTransaction : public CoroTransaction
+{
+public:
+    explicit QueryTransaction(unsigned int cmd) : CoroTransaction(cmd)
+    {
+    }
+
+protected:
+    virtual tnt::CoroTask Run()
+    {
+        g_flow.trans_id = id();
+
+        const AppFrame* rsp = co_await WaitCmd(CMD_DB_RSP, WAIT_ONE_SECONDS);
+        if (NULL == rsp)
+        {
+            g_flow.exit_code = -1;
+            co_return -1;
+        }
+        EXPECT_EQ(CMD_DB_RSP, rsp->app_header->ushCmdID);
+        ++g_flow.steps;
+
+        rsp = co_await WaitCmd(CMD_CACHE_RSP, WAIT_ONE_SECONDS);
+        if (NULL == rsp)
+        {
+            g_flow.exit_code = -2;
+            co_return -2;
+        }
+        ++g_flow.steps;
+
+        g_flow.exit_code = 1;
+        co_return 0;
+    }
+};
+
+// 回包以后抛异常
+class ThrowTransaction : public CoroTransaction
+{
+public:
+    explicit ThrowTransaction(unsigned int cmd) : CoroTransaction(cmd)
+    {
+    }
+
+protected:
+    virtual tnt::CoroTask Run()
+    {
+        g_flow.trans_id = id();
+
+        co_await WaitCmd(CMD_DB_RSP, WAIT_ONE_SECONDS);
+        ++g_flow.steps;
+        throw std::runtime_error("bad rsp");
+        co_return 0;
+    }
+};
+
+class CoroTransactionTest : public Test
+{
+protected:
+    static void SetUpTestCase()
+    {
+        TransactionMgr& mgr = TransactionMgrSigleton::get_mutable_instance();
+        ASSERT_EQ(0, mgr.InitTransactionMgr());
+
+        TransactionPoolConfig config = {4, 16, 4};
+        ASSERT_EQ(0, mgr.RegisterCommand<QueryTransaction>(CMD_QUERY_REQ, config));
+        ASSERT_EQ(0, mgr.RegisterCommand<ThrowTransaction>(CMD_THROW_REQ, config));
+    }
+
+    virtual void SetUp()
+    {
+        memset(&g_flow, 0, sizeof(g_flow));
+        memset(buff_, 0, sizeof(buff_));
+        in_use_ = tnt::CoroFramePool::Instance().in_use_count();
+    }
+
+    // 发一个消息, trans_id 是0时新建事务
+    int Send(unsigned int cmd, unsigned int trans_id)
+    {
+        AppFrame app_frame(buff_, sizeof(buff_));
+        app_frame.app_header->ushCmdID = cmd;
+        app_frame.app_header->uiTransactionID = trans_id;
+        return TransactionMgrSigleton::get_mutable_instance().ProcessAppFrame(app_frame);
+    }
+
+    // 跑到没有定时器为止
+    void RunTimeout()
+    {
+        TransactionMgr& mgr = TransactionMgrSigleton::get_mutable_instance();
+        for (time_t wait = mgr.NextTimeout(); wait >= 0; wait = mgr.NextTimeout())
+        {
+            usleep(static_cast<useconds_t>(wait * 1000 + 1000));
+            mgr.HandleTimeout();
+        }
+    }
+
+    // 协程结束了帧就要还回池里
+    uint64_t FramesInUse() const
+    {
+        return tnt::CoroFramePool::Instance().in_use_count() - in_use_;
+    }
+
+    char buff_[256];
+    uint64_t in_use_;
+};
+
+// 两次回包, 协程跑完事务就回收
+TEST_F(CoroTransactionTest, WaitCmdReply)
+{
+    Send(CMD_QUERY_REQ, 0);
+    ASSERT_NE(0u, g_flow.trans_id);
+    EXPECT_EQ(0, g_flow.steps);
+    EXPECT_EQ(1u, FramesInUse());
+
+    // 等的不是这个CMD, 不会唤醒
+    Send(CMD_CACHE_RSP, g_flow.trans_id);
+    EXPECT_EQ(0, g_flow.steps);
+
+    Send(CMD_DB_RSP, g_flow.trans_id);
+    EXPECT_EQ(1, g_flow.steps);
+    EXPECT_EQ(0, g_flow.exit_code);
+
+    Send(CMD_CACHE_RSP, g_flow.trans_id);
+    EXPECT_EQ(2, g_flow.steps);
+    EXPECT_EQ(1, g_flow.exit_code);
+    EXPECT_EQ(0u, FramesInUse());
+
+    // 事务已经回收, 再来的回包找不到事务
+    Send(CMD_CACHE_RSP, g_flow.trans_id);
+    EXPECT_EQ(2, g_flow.steps);
+}
+
+// 第二步超时, co_await 得到 NULL
+TEST_F(CoroTransactionTest, WaitCmdTimeout)
+{
+    Send(CMD_QUERY_REQ, 0);
+    Send(CMD_DB_RSP, g_flow.trans_id);
+    EXPECT_EQ(1, g_flow.steps);
+
+    RunTimeout();
+    EXPECT_EQ(1, g_flow.steps);
+    EXPECT_EQ(-2, g_flow.exit_code);
+    EXPECT_EQ(0u, FramesInUse());
+
+    // 超时以后的回包也不会再唤醒
+    Send(CMD_CACHE_RSP, g_flow.trans_id);
+    EXPECT_EQ(1, g_flow.steps);
+}
+
+// 协程里的异常由 OnEvent 接住, 事务退出, 帧还回池里
+TEST_F(CoroTransactionTest, Exception)
+{
+    Send(CMD_THROW_REQ, 0);
+    ASSERT_NE(0u, g_flow.trans_id);
+    EXPECT_EQ(1u, FramesInUse());
+
+    Send(CMD_DB_RSP, g_flow.trans_id);
+    EXPECT_EQ(1, g_flow.steps);
+    EXPECT_EQ(0u, FramesInUse());
+
+    // 超时的时候抛也一样, 池里的事务还能接着用
+    Send(CMD_THROW_REQ, 0);
+    EXPECT_EQ(1u, FramesInUse());
+    RunTimeout();
+    EXPECT_EQ(0u, FramesInUse());
+}
+
+#endif // TNT_HAS_COROUTINE
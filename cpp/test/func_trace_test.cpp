@@ -0,0 +1,175 @@
+/**
+ * @file:   func_trace_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  func_trace_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <string>
+#include <thread>
+#include "logging.h"
+#include "func_trace.h"
+
+using namespace testing;
+using namespace tnt;
+
+static const char* TEST_TRACE_FILE = "/tmp/tnt_func_trace_test.bin";
+
+static int text_log_count = 0;
+
+static void CountVaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
+{
+    ++text_log_count;
+}
+
+static int TraceInner(int i)
+{
+    FUNC_TRACE(i);
+    return i * 2;
+}
+
+static int TraceOuter(int i)
+{
+    FUNC_TRACE(i);
+    return TraceInner(i) + 1;
+}
+
+class FuncTraceTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        text_log_count = 0;
+        old_handler_ = SetVaLogHandler(CountVaLogHandler);
+        old_level_ = SetLogLevel(LOG_LEVEL_TRACE);
+    }
+
+    virtual void TearDown()
+    {
+        SetFuncTraceMode(FUNC_TRACE_TEXT);
+        SetFuncTraceSample(1);
+        SetLogLevel(old_level_);
+        SetVaLogHandler(old_handler_);
+        unlink(TEST_TRACE_FILE);
+    }
+
+    static std::string Decode()
+    {
+        char* buf = NULL;
+        std::size_t len = 0;
+        FILE* out = open_memstream(&buf, &len);
+        EXPECT_EQ(0, FuncTraceToChromeJson(TEST_TRACE_FILE, out));
+        fclose(out);
+        std::string json(buf, len);
+        free(buf);
+        return json;
+    }
+
+    static std::size_t Count(const std::string& str, const std::string& sub)
+    {
+        std::size_t count = 0;
+        for (std::size_t pos=str.find(sub); pos!=std::string::npos; pos=str.find(sub, pos + 1))
+        {
+            ++count;
+        }
+        return count;
+    }
+
+    VaLogHandler* old_handler_;
+    LogLevel old_level_;
+};
+
+TEST_F(FuncTraceTest, Mode)
+{
+    TraceOuter(1);
+    EXPECT_EQ(4, text_log_count);
+
+    SetFuncTraceMode(FUNC_TRACE_OFF);
+    TraceOuter(1);
+    EXPECT_EQ(4, text_log_count);
+
+    // 二进制模式不走日志
+    SetFuncTraceMode(FUNC_TRACE_BINARY);
+    TraceOuter(12345);
+    EXPECT_EQ(4, text_log_count);
+
+    // 中间切模式, 离开也要记
+    {
+        FUNC_TRACE(1);
+        SetFuncTraceMode(FUNC_TRACE_TEXT);
+    }
+    EXPECT_EQ(4, text_log_count);
+
+    ASSERT_EQ(0, DumpFuncTrace(TEST_TRACE_FILE));
+    std::string json = Decode();
+    EXPECT_NE(std::string::npos, json.find("TraceOuter"));
+    EXPECT_NE(std::string::npos, json.find("\"uin\":12345"));
+    EXPECT_EQ(Count(json, "\"ph\":\"B\""), Count(json, "\"ph\":\"E\""));
+}
+
+TEST_F(FuncTraceTest, SampleAndWrap)
+{
+    SetFuncTraceRingSize(1024);
+    SetFuncTraceMode(FUNC_TRACE_BINARY);
+    SetFuncTraceSample(10);
+
+    // 新线程用新的环
+    std::thread t([]()
+    {
+        for (int i=0; i<100000; ++i)
+        {
+            TraceOuter(i);
+        }
+    });
+    t.join();
+    SetFuncTraceRingSize(65536);
+
+    ASSERT_EQ(0, DumpFuncTrace(TEST_TRACE_FILE));
+    std::string json = Decode();
+
+    // 整棵调用树一起采, 只剩最后的1024个事件
+    EXPECT_EQ(4u, Count(json, "\"uin\":99990,"));
+    EXPECT_EQ(0u, Count(json, "\"uin\":99991,"));
+    EXPECT_EQ(0u, Count(json, "\"uin\":10,"));
+    EXPECT_GE(Count(json, "\"ph\":\"B\""), Count(json, "\"ph\":\"E\""));
+}
+
+TEST_F(FuncTraceTest, Benchmark)
+{
+    const int count = 2000000;
+    struct timeval begin, end;
+    int sum = 0;
+
+    SetLogLevel(LOG_LEVEL_INFO);
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        sum += TraceOuter(i);
+    }
+    gettimeofday(&end, NULL);
+    long off_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+
+    SetFuncTraceMode(FUNC_TRACE_BINARY);
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        sum += TraceOuter(i);
+    }
+    gettimeofday(&end, NULL);
+    long binary_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+
+    SetFuncTraceSample(100);
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        sum += TraceOuter(i);
+    }
+    gettimeofday(&end, NULL);
+    long sample_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+
+    // 每次调用两个FUNC_TRACE
+    printf("FUNC_TRACE per call: level off %.1f ns, binary %.1f ns, binary 1/100 %.1f ns (%d)\n",
+           off_us * 500.0 / count, binary_us * 500.0 / count, sample_us * 500.0 / count, sum & 1);
+}
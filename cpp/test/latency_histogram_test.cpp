@@ -0,0 +1,141 @@
+/**
+ * @file:   latency_histogram_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  latency_histogram_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include "latency_histogram.h"
+#include "random_util.h"
+
+using namespace testing;
+using namespace tnt;
+
+TEST(LatencyHistogramTest, Bucket)
+{
+    // 小的值是精确的
+    for (uint64_t v=0; v<LatencyHistogram::SUB_BUCKET_COUNT; ++v)
+    {
+        EXPECT_EQ(v, LatencyHistogram::BucketIndex(v));
+        EXPECT_EQ(v, LatencyHistogram::BucketHighestValue(v));
+    }
+
+    // 桶是连续的, 每个值都落在自己的桶里
+    std::size_t last_index = 0;
+    for (uint64_t v=1; v<=LatencyHistogram::MAX_VALUE; v += 1 + v / 3)
+    {
+        std::size_t index = LatencyHistogram::BucketIndex(v);
+        ASSERT_LT(index, LatencyHistogram::BUCKET_COUNT);
+        ASSERT_GE(index, last_index);
+        ASSERT_GE(LatencyHistogram::BucketHighestValue(index), v);
+        if (index > 0)
+        {
+            ASSERT_LT(LatencyHistogram::BucketHighestValue(index - 1), v);
+        }
+        last_index = index;
+    }
+
+    EXPECT_EQ(LatencyHistogram::BUCKET_COUNT - 1, LatencyHistogram::BucketIndex(LatencyHistogram::MAX_VALUE));
+}
+
+// 和排序后的精确值比, 误差在 1/SUB_BUCKET_COUNT 以内
+TEST(LatencyHistogramTest, Percentile)
+{
+    LatencyHistogram histogram;
+    EXPECT_EQ(0u, histogram.Percentile(99));
+    EXPECT_EQ(0u, histogram.min());
+
+    std::vector<uint64_t> values;
+    for (int i=0; i<100000; ++i)
+    {
+        // 大部分是几微秒, 少数几毫秒
+        uint64_t v = (i % 1000 == 0) ? 1000000 + RandomUtil::Random(9000000)
+                                     : 1000 + RandomUtil::Random(9000);
+        values.push_back(v);
+        histogram.Record(v);
+    }
+    std::sort(values.begin(), values.end());
+
+    EXPECT_EQ(values.size(), histogram.count());
+    EXPECT_EQ(values.front(), histogram.min());
+    EXPECT_EQ(values.back(), histogram.max());
+    EXPECT_EQ(values.back(), histogram.Percentile(100));
+
+    const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+    for (std::size_t i=0; i<sizeof(percentiles)/sizeof(percentiles[0]); ++i)
+    {
+        uint64_t rank = static_cast<uint64_t>(percentiles[i] / 100.0 * values.size() + 0.5);
+        uint64_t exact = values[rank - 1];
+        uint64_t estimate = histogram.Percentile(percentiles[i]);
+        EXPECT_GE(estimate, exact) << percentiles[i];
+        EXPECT_LE(estimate, exact + exact / LatencyHistogram::SUB_BUCKET_COUNT) << percentiles[i];
+    }
+
+    printf("%s\n", histogram.StatStr("test").c_str());
+}
+
+TEST(LatencyHistogramTest, ResetMerge)
+{
+    LatencyHistogram a;
+    LatencyHistogram b;
+
+    a.Record(10);
+    a.Record(LatencyHistogram::MAX_VALUE + 100);
+    EXPECT_EQ(LatencyHistogram::MAX_VALUE, a.max());
+
+    b.Record(5);
+    b.Record(1000);
+    a.Merge(b);
+    EXPECT_EQ(4u, a.count());
+    EXPECT_EQ(5u, a.min());
+    EXPECT_EQ(10u, a.Percentile(50));
+
+    a.Reset();
+    EXPECT_EQ(0u, a.count());
+    EXPECT_EQ(0u, a.max());
+    EXPECT_EQ(0u, a.Percentile(50));
+    EXPECT_EQ(std::string("x_count:0;x_p50_us:0.000;x_p90_us:0.000;x_p99_us:0.000;x_p999_us:0.000;"
+                          "x_max_us:0.000;x_mean_us:0.000;"), a.StatStr("x"));
+
+    // 累计的 Reset 不清
+    EXPECT_EQ(4u, a.total_count());
+    EXPECT_EQ(10u + LatencyHistogram::MAX_VALUE + 5 + 1000, a.total_sum());
+    a.Record(20);
+    EXPECT_EQ(1u, a.count());
+    EXPECT_EQ(5u, a.total_count());
+
+    // 这个周期没有数据的, 累计的也要合并
+    b.Reset();
+    LatencyHistogram c;
+    c.Merge(b);
+    EXPECT_EQ(0u, c.count());
+    EXPECT_EQ(2u, c.total_count());
+    EXPECT_EQ(1005u, c.total_sum());
+}
+
+// 记一次的开销, 以及带计时的开销
+TEST(LatencyHistogramTest, Benchmark)
+{
+    const int count = 10000000;
+    LatencyHistogram histogram;
+
+    uint64_t begin = MonotonicNowNs();
+    for (int i=0; i<count; ++i)
+    {
+        histogram.Record(static_cast<uint64_t>(i) * 7919 % 10000000);
+    }
+    uint64_t record_ns = MonotonicNowNs() - begin;
+
+    LatencyHistogram timed;
+    begin = MonotonicNowNs();
+    for (int i=0; i<count; ++i)
+    {
+        LatencyTimer timer(timed);
+    }
+    uint64_t timer_ns = MonotonicNowNs() - begin;
+
+    printf("record %.2f ns, timer %.2f ns, %s\n",
+           record_ns * 1.0 / count, timer_ns * 1.0 / count, timed.StatStr("empty").c_str());
+}
@@ -0,0 +1,243 @@
+/**
+ * @file:   lock_table_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  lock_table_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <sys/time.h>
+#include <tr1/unordered_set>
+#include "lock_table.h"
+
+using namespace testing;
+using namespace tnt;
+
+TEST(LockTableTest, LockUnlock)
+{
+    LockTable table;
+    // 没有 Reserve 的时候什么都锁不了
+    EXPECT_EQ(-2, table.TryLock(1, 1));
+    EXPECT_EQ(-1, table.Unlock(1, 1));
+    EXPECT_FALSE(table.IsLocked(1, 1));
+
+    ASSERT_EQ(0, table.Reserve(4));
+    EXPECT_EQ(16u, table.capacity());
+
+    EXPECT_EQ(0, table.TryLock(10001, 0x100));
+    EXPECT_TRUE(table.IsLocked(10001, 0x100));
+    // 同一个用户的不同命令, 不同用户的同一个命令, 互不影响
+    EXPECT_EQ(0, table.TryLock(10001, 0x101));
+    EXPECT_EQ(0, table.TryLock(10002, 0x100));
+    EXPECT_EQ(-1, table.TryLock(10001, 0x100));
+    EXPECT_EQ(3u, table.size());
+
+    EXPECT_EQ(0, table.Unlock(10001, 0x100));
+    EXPECT_EQ(-1, table.Unlock(10001, 0x100));
+    EXPECT_FALSE(table.IsLocked(10001, 0x100));
+    EXPECT_TRUE(table.IsLocked(10001, 0x101));
+    EXPECT_EQ(0, table.TryLock(10001, 0x100));
+
+    EXPECT_EQ(4u, table.lock_count());
+    EXPECT_EQ(1u, table.contention_count());
+
+    // 负载到一半就满了
+    for (uint32_t uin=1; table.size() < 8; ++uin)
+    {
+        EXPECT_EQ(0, table.TryLock(uin, 1));
+    }
+    EXPECT_EQ(-2, table.TryLock(20000, 1));
+    // 已经锁着的还是冲突, 不是满了
+    EXPECT_EQ(-1, table.TryLock(10001, 0x101));
+    // 加上最开始没有 Reserve 的那次
+    EXPECT_EQ(2u, table.full_count());
+
+    // 变大以后原来的锁还在
+    ASSERT_EQ(0, table.Reserve(100));
+    EXPECT_EQ(256u, table.capacity());
+    EXPECT_EQ(8u, table.size());
+    EXPECT_TRUE(table.IsLocked(10001, 0x101));
+    EXPECT_TRUE(table.IsLocked(10002, 0x100));
+    EXPECT_EQ(0, table.TryLock(20000, 1));
+
+    EXPECT_EQ(-1, table.Reserve(LockTable::MAX_CAPACITY));
+}
+
+// 随机加锁解锁, 和 unordered_set 的结果对一遍, 主要是看删除时往前挪有没有挪错
+TEST(LockTableTest, MatchSet)
+{
+    LockTable table;
+    ASSERT_EQ(0, table.Reserve(512));
+
+    typedef std::tr1::unordered_set<uint64_t> KeySet;
+    KeySet keys;
+
+    uint32_t seed = 12345;
+    for (int i=0; i<200000; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        // 取值范围小, 冲突和删除都多
+        uint32_t uin = (seed >> 8) % 700;
+        uint32_t cmd = (seed >> 20) % 3;
+        uint64_t key = (static_cast<uint64_t>(uin) << 32) | cmd;
+
+        if (keys.count(key))
+        {
+            ASSERT_EQ(-1, table.TryLock(uin, cmd));
+            ASSERT_EQ(0, table.Unlock(uin, cmd));
+            keys.erase(key);
+        }
+        else if (keys.size() < 512)
+        {
+            ASSERT_EQ(0, table.TryLock(uin, cmd));
+            keys.insert(key);
+        }
+        ASSERT_EQ(keys.size(), table.size());
+    }
+
+    for (uint32_t uin=0; uin<700; ++uin)
+    {
+        for (uint32_t cmd=0; cmd<3; ++cmd)
+        {
+            uint64_t key = (static_cast<uint64_t>(uin) << 32) | cmd;
+            ASSERT_EQ(keys.count(key) > 0, table.IsLocked(uin, cmd));
+        }
+    }
+}
+
+TEST(LockTableTest, HotKeys)
+{
+    LockTable table;
+    ASSERT_EQ(0, table.Reserve(64));
+
+    table.TryLock(1, 1);
+    table.TryLock(2, 1);
+    for (int i=0; i<5; ++i)
+    {
+        table.TryLock(1, 1);
+    }
+    table.TryLock(2, 1);
+
+    const LockTable::HotKey* hot = table.hot_keys();
+    uint32_t hot_1 = 0;
+    uint32_t hot_2 = 0;
+    for (std::size_t i=0; i<LockTable::HOT_KEY_COUNT; ++i)
+    {
+        if (1 == hot[i].uin && 1 == hot[i].cmd) hot_1 = hot[i].contention;
+        if (2 == hot[i].uin && 1 == hot[i].cmd) hot_2 = hot[i].contention;
+    }
+    EXPECT_EQ(5u, hot_1);
+    EXPECT_EQ(1u, hot_2);
+    EXPECT_EQ(6u, table.contention_count());
+
+    table.ResetStatistic();
+    EXPECT_EQ(0u, table.contention_count());
+}
+
+static double NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+// 原来的写法: 哈希是 uin + cmd, 每次加锁分配一个节点
+struct OldLocker
+{
+    unsigned int uin_;
+    unsigned int cmd_;
+};
+
+struct OldLockerHash
+{
+    size_t operator() (const OldLocker& locker) const
+    {
+        return (size_t(locker.uin_) + locker.cmd_);
+    }
+};
+
+struct OldLockerEqual
+{
+    bool operator() (const OldLocker& rhs, const OldLocker& lhs) const
+    {
+        return ((rhs.uin_ == lhs.uin_) && (rhs.cmd_ == lhs.cmd_));
+    }
+};
+
+// 100万个用户同时锁着, 一个结束马上来一个新的, 每次再有一个重复的请求被挡掉
+TEST(LockTableTest, Benchmark)
+{
+    const uint32_t USERS = 1000000;
+    const uint32_t CMD_BASE = 0x1001;
+    const int LOOP = 2000000;
+
+    // uin 是连续的号段, 命令字也是挨着的几个
+    std::vector<uint32_t> uins(USERS);
+    std::vector<uint32_t> cmds(USERS);
+    for (uint32_t i=0; i<USERS; ++i)
+    {
+        uins[i] = 10000 + i;
+        cmds[i] = CMD_BASE + i % 4;
+    }
+
+    typedef std::tr1::unordered_set<OldLocker, OldLockerHash, OldLockerEqual> OldLockerPool;
+    OldLockerPool old_pool;
+    for (uint32_t i=0; i<USERS; ++i)
+    {
+        OldLocker locker = {uins[i], cmds[i]};
+        old_pool.insert(locker);
+    }
+
+    uint64_t blocked = 0;
+    uint32_t next_uin = 10000 + USERS;
+    double begin = NowUs();
+    for (int i=0; i<LOOP; ++i)
+    {
+        uint32_t slot = static_cast<uint32_t>((i * 7919ULL) % USERS);
+        uint32_t other = static_cast<uint32_t>((i * 104729ULL) % USERS);
+
+        OldLocker locker = {uins[slot], cmds[slot]};
+        old_pool.erase(locker);
+        uins[slot] = next_uin++;
+        locker.uin_ = uins[slot];
+        old_pool.insert(locker);
+
+        OldLocker again = {uins[other], cmds[other]};
+        blocked += !old_pool.insert(again).second;
+    }
+    double old_us = NowUs() - begin;
+
+    for (uint32_t i=0; i<USERS; ++i)
+    {
+        uins[i] = 10000 + i;
+    }
+
+    LockTable table;
+    ASSERT_EQ(0, table.Reserve(USERS));
+    for (uint32_t i=0; i<USERS; ++i)
+    {
+        ASSERT_EQ(0, table.TryLock(uins[i], cmds[i]));
+    }
+
+    next_uin = 10000 + USERS;
+    begin = NowUs();
+    for (int i=0; i<LOOP; ++i)
+    {
+        uint32_t slot = static_cast<uint32_t>((i * 7919ULL) % USERS);
+        uint32_t other = static_cast<uint32_t>((i * 104729ULL) % USERS);
+
+        table.Unlock(uins[slot], cmds[slot]);
+        uins[slot] = next_uin++;
+        table.TryLock(uins[slot], cmds[slot]);
+
+        blocked += (0 != table.TryLock(uins[other], cmds[other]));
+    }
+    double table_us = NowUs() - begin;
+
+    EXPECT_EQ(2u * LOOP, blocked);
+    EXPECT_EQ(USERS, table.size());
+    EXPECT_EQ(static_cast<uint64_t>(LOOP), table.contention_count());
+
+    printf("%u users, unlock+lock+blocked lock: unordered_set %.1f ns, lock table %.1f ns, max probe %lu\n",
+           USERS, old_us * 1000 / LOOP, table_us * 1000 / LOOP,
+           (unsigned long)table.max_probe());
+}
@@ -0,0 +1,262 @@
+/**
+ * @file:   log_limiter_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  log_limiter_test
+ */
+#include "gtest/gtest.h"
+#include <sys/time.h>
+#include <unistd.h>
+#include "logging.h"
+
+using namespace testing;
+using namespace tnt;
+
+static int log_count = 0;
+
+static void CountVaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
+{
+    ++log_count;
+}
+
+static int Evaluate(int& count)
+{
+    return ++count;
+}
+
+static std::size_t GetUin(int& count, std::size_t uin)
+{
+    ++count;
+    return uin;
+}
+
+class LogLimiterTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        log_count = 0;
+        old_level_ = GetLogLevel();
+        old_handler_ = SetVaLogHandler(CountVaLogHandler);
+    }
+
+    virtual void TearDown()
+    {
+        ConfigureLogLimiter(LogLimitConfig());
+        SetLogLevel(old_level_);
+        SetVaLogHandler(old_handler_);
+    }
+
+    LogLevel old_level_;
+    VaLogHandler* old_handler_;
+};
+
+TEST_F(LogLimiterTest, Parse)
+{
+    LogLimitConfig config;
+    ASSERT_EQ(0, ParseLogLimitConfig("site=100/200; log_id.1001=10  trace_uin=7,8,9\n", config));
+    EXPECT_EQ(100u, config.site_limit.rate);
+    EXPECT_EQ(200u, config.site_limit.burst);
+    ASSERT_EQ(1u, config.log_id_limits.size());
+    EXPECT_EQ(10u, config.log_id_limits[1001].rate);
+    EXPECT_EQ(0u, config.log_id_limits[1001].burst);
+    ASSERT_EQ(3u, config.trace_users.size());
+    EXPECT_EQ(9u, config.trace_users[2]);
+
+    EXPECT_EQ(0, ParseLogLimitConfig("", config));
+    EXPECT_EQ(0u, config.site_limit.rate);
+
+    EXPECT_EQ(-1, ParseLogLimitConfig("site", config));
+    EXPECT_EQ(-1, ParseLogLimitConfig("site=abc", config));
+    EXPECT_EQ(-1, ParseLogLimitConfig("site=1/", config));
+    EXPECT_EQ(-1, ParseLogLimitConfig("log_id.x=1", config));
+    EXPECT_EQ(-1, ParseLogLimitConfig("trace_uin=1,,2", config));
+    EXPECT_EQ(-1, ParseLogLimitConfig("unknown=1", config));
+}
+
+static void FloodWarn(int count)
+{
+    for (int i=0; i<count; ++i)
+    {
+        LOG_WARN(0, 10001, "", "trans id is not exist, %d", i);
+    }
+}
+
+// 同一个位置刷屏, 只出 burst 条, 别的位置不受影响
+TEST_F(LogLimiterTest, SiteLimit)
+{
+    LogLimitConfig config;
+    config.site_limit = LogRateLimit(1, 5);
+    ASSERT_EQ(0, ConfigureLogLimiter(config));
+
+    uint64_t dropped = GetLogLimitStats().site_dropped;
+    FloodWarn(100);
+    EXPECT_EQ(5, log_count);
+    EXPECT_EQ(dropped + 95, GetLogLimitStats().site_dropped);
+
+    LOG_WARN(0, 10001, "", "other site");
+    EXPECT_EQ(6, log_count);
+
+    // 一秒补一个
+    usleep(1100000);
+    FloodWarn(100);
+    EXPECT_GE(log_count, 7);
+    EXPECT_LE(log_count, 8);
+
+    // 重新配置, 桶装满
+    log_count = 0;
+    ASSERT_EQ(0, ConfigureLogLimiter(config));
+    FloodWarn(100);
+    EXPECT_EQ(5, log_count);
+
+    // 不限
+    ConfigureLogLimiter(LogLimitConfig());
+    log_count = 0;
+    FloodWarn(100);
+    EXPECT_EQ(100, log_count);
+}
+
+// 按log_id, 跨位置共用一个桶
+TEST_F(LogLimiterTest, LogIdLimit)
+{
+    LogLimitConfig config;
+    config.log_id_limits[1001] = LogRateLimit(1, 3);
+    ASSERT_EQ(0, ConfigureLogLimiter(config));
+
+    uint64_t dropped = GetLogLimitStats().log_id_dropped;
+    for (int i=0; i<10; ++i)
+    {
+        LOG_ERROR(1001, 0, "", "first %d", i);
+        LOG_ERROR(1001, 0, "", "second %d", i);
+        LOG_ERROR(1002, 0, "", "other log_id %d", i);
+    }
+    EXPECT_EQ(3 + 10, log_count);
+    EXPECT_EQ(dropped + 17, GetLogLimitStats().log_id_dropped);
+
+    // log_id 太多
+    for (std::size_t i=0; i<=MAX_LOG_ID_LIMITS; ++i)
+    {
+        config.log_id_limits[i] = LogRateLimit(1, 1);
+    }
+    EXPECT_EQ(-1, ConfigureLogLimiter(config));
+}
+
+// 白名单里的uin不看级别
+TEST_F(LogLimiterTest, TraceUser)
+{
+    int evaluated = 0;
+    SetLogLevel(LOG_LEVEL_WARN);
+
+    LOG_DEBUG(0, 10001, "", "%d", Evaluate(evaluated));
+    EXPECT_EQ(0, log_count);
+    EXPECT_EQ(0, evaluated);
+
+    LogLimitConfig config;
+    ASSERT_EQ(0, ParseLogLimitConfig("trace_uin=10001,10002", config));
+    ASSERT_EQ(0, ConfigureLogLimiter(config));
+
+    LOG_TRACE(0, 10001, "", "%d", Evaluate(evaluated));
+    LOG_DEBUG(0, 10002, "", "%d", Evaluate(evaluated));
+    LOG_DEBUG(0, 10003, "", "%d", Evaluate(evaluated));
+    EXPECT_EQ(2, log_count);
+    EXPECT_EQ(2, evaluated);
+
+    // 文本模式的 FUNC_TRACE 也一样
+    {
+        FUNC_TRACE(10001);
+    }
+    EXPECT_EQ(4, log_count);
+    {
+        FUNC_TRACE(10003);
+    }
+    EXPECT_EQ(4, log_count);
+
+    ConfigureLogLimiter(LogLimitConfig());
+    LOG_DEBUG(0, 10001, "", "%d", Evaluate(evaluated));
+    EXPECT_EQ(4, log_count);
+}
+
+// user_id 最多求值一次, 名单是空的时候级别不够就不求值
+TEST_F(LogLimiterTest, UserIdEvaluation)
+{
+    int evaluated = 0;
+    SetLogLevel(LOG_LEVEL_INFO);
+
+    for (int i=0; i<5; ++i)
+    {
+        LOG_DEBUG(0, GetUin(evaluated, 10001), "", "not enabled");
+    }
+    EXPECT_EQ(0, evaluated);
+    EXPECT_EQ(0, log_count);
+
+    LOG_INFO(0, GetUin(evaluated, 10001), "", "enabled");
+    EXPECT_EQ(1, evaluated);
+    EXPECT_EQ(1, log_count);
+
+    LogLimitConfig config;
+    ASSERT_EQ(0, ParseLogLimitConfig("trace_uin=10001", config));
+    ASSERT_EQ(0, ConfigureLogLimiter(config));
+
+    evaluated = 0;
+    LOG_DEBUG(0, GetUin(evaluated, 10001), "", "in list");
+    LOG_DEBUG(0, GetUin(evaluated, 10002), "", "not in list");
+    LOG_INFO(0, GetUin(evaluated, 10002), "", "enabled");
+    EXPECT_EQ(3, evaluated);
+    EXPECT_EQ(3, log_count);
+}
+
+static void NullVaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
+{
+}
+
+static long ElapsedUs(const struct timeval& begin, const struct timeval& end)
+{
+    return (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+}
+
+// 限流的开销和关掉的日志比
+TEST_F(LogLimiterTest, Benchmark)
+{
+    const int count = 10000000;
+    std::string user_name = "benchmark_user_name_longer_than_sso";
+    struct timeval begin, end;
+
+    SetVaLogHandler(NullVaLogHandler);
+    LogLimitConfig config;
+    ASSERT_EQ(0, ParseLogLimitConfig("trace_uin=1", config));
+    config.site_limit = LogRateLimit(1, 1);
+    ASSERT_EQ(0, ConfigureLogLimiter(config));
+
+    // 以前关掉的日志: 总是构造 LogRecord 再调 handler
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LogRecord lr(LOG_LEVEL_DEBUG, 0, i, user_name, __FILE__, __LINE__, __FUNCTION__);
+        Logging(lr, "debug %d", i);
+    }
+    gettimeofday(&end, NULL);
+    long always_us = ElapsedUs(begin, end);
+
+    // 级别关掉, 白名单不是空的, 要多查一次uin
+    SetLogLevel(LOG_LEVEL_INFO);
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LOG_DEBUG(0, i + 2, user_name, "debug %d", i);
+    }
+    gettimeofday(&end, NULL);
+    long disabled_us = ElapsedUs(begin, end);
+
+    // 级别打开, 被限流丢掉
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LOG_WARN(0, i, user_name, "warn %d", i);
+    }
+    gettimeofday(&end, NULL);
+    long limited_us = ElapsedUs(begin, end);
+
+    EXPECT_GE(GetLogLimitStats().site_dropped, static_cast<uint64_t>(count - 100));
+
+    printf("always build record %.2f ns, disabled with trace users %.2f ns, rate limited %.2f ns\n",
+           always_us * 1000.0 / count, disabled_us * 1000.0 / count, limited_us * 1000.0 / count);
+}
@@ -0,0 +1,153 @@
+/**
+ * @file:   logging_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  logging_test
+ */
+
+// 这个文件里 DEBUG 以下的都编译掉
+#define TNT_LOG_MIN_LEVEL 1
+
+#include "gtest/gtest.h"
+#include <sys/time.h>
+#include "logging.h"
+
+using namespace testing;
+using namespace tnt;
+
+static int log_count = 0;
+
+static void CountVaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
+{
+    ++log_count;
+}
+
+static int Evaluate(int& count)
+{
+    return ++count;
+}
+
+class LoggingTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        log_count = 0;
+        old_level_ = GetLogLevel();
+        old_handler_ = SetVaLogHandler(CountVaLogHandler);
+    }
+
+    virtual void TearDown()
+    {
+        SetLogLevel(old_level_);
+        SetVaLogHandler(old_handler_);
+    }
+
+    LogLevel old_level_;
+    VaLogHandler* old_handler_;
+};
+
+TEST_F(LoggingTest, Level)
+{
+    int evaluated = 0;
+
+    SetLogLevel(LOG_LEVEL_TRACE);
+    // 编译期去掉了
+    LOG_TRACE(0, 0, "", "%d", Evaluate(evaluated));
+    FUNC_TRACE(0);
+    EXPECT_EQ(0, log_count);
+    EXPECT_EQ(0, evaluated);
+
+    LOG_DEBUG(0, 0, "", "%d", Evaluate(evaluated));
+    LOG_ERROR(0, 0, "", "%d", Evaluate(evaluated));
+    EXPECT_EQ(2, log_count);
+    EXPECT_EQ(2, evaluated);
+
+    // 运行期
+    EXPECT_EQ(LOG_LEVEL_TRACE, SetLogLevel(LOG_LEVEL_WARN));
+    LOG_DEBUG(0, 0, "", "%d", Evaluate(evaluated));
+    LOG_INFO(0, 0, "", "%d", Evaluate(evaluated));
+    LOG_WARN(0, 0, "", "%d", Evaluate(evaluated));
+    EXPECT_EQ(3, log_count);
+    EXPECT_EQ(3, evaluated);
+}
+
+// FuncTraceStruct 不走宏, 只有运行期的判断, 进出是配对的
+TEST_F(LoggingTest, FuncTrace)
+{
+    SetLogLevel(LOG_LEVEL_TRACE);
+    {
+        FuncTraceStruct trace(__FILE__, __LINE__, __FUNCTION__, 0, "");
+        EXPECT_EQ(1, log_count);
+        SetLogLevel(LOG_LEVEL_INFO);
+    }
+    EXPECT_EQ(2, log_count);
+
+    {
+        FuncTraceStruct trace(__FILE__, __LINE__, __FUNCTION__, 0, std::string("name"));
+        SetLogLevel(LOG_LEVEL_TRACE);
+    }
+    EXPECT_EQ(2, log_count);
+}
+
+// TRACE 编译掉了, 二进制模式的 FUNC_TRACE 还在
+TEST_F(LoggingTest, BinaryFuncTraceKept)
+{
+    SetLogLevel(LOG_LEVEL_TRACE);
+    FuncTraceMode old_mode = SetFuncTraceMode(FUNC_TRACE_BINARY);
+
+    FuncTraceRing* ring = tnt::internal::func_trace_ring_;
+    uint64_t before = (NULL != ring) ? ring->pos.load() : 0;
+    {
+        FUNC_TRACE(10001);
+    }
+    ring = tnt::internal::func_trace_ring_;
+    ASSERT_TRUE(NULL != ring);
+    EXPECT_EQ(before + 2, ring->pos.load());
+    EXPECT_EQ(0, log_count);
+
+    SetFuncTraceMode(old_mode);
+}
+
+static void NullVaLogHandler(const LogRecord& lr, const char* fmt, va_list vl)
+{
+}
+
+// 关掉的日志每次调用的开销
+TEST_F(LoggingTest, Benchmark)
+{
+    const int count = 10000000;
+    std::string user_name = "benchmark_user_name_longer_than_sso";
+    struct timeval begin, end;
+
+    SetVaLogHandler(NullVaLogHandler);
+
+    // 以前的做法: 总是构造 LogRecord 再调 handler
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LogRecord lr(LOG_LEVEL_DEBUG, 0, i, user_name, __FILE__, __LINE__, __FUNCTION__);
+        Logging(lr, "debug %d", i);
+    }
+    gettimeofday(&end, NULL);
+    long always_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+
+    SetLogLevel(LOG_LEVEL_INFO);
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LOG_DEBUG(0, i, user_name, "debug %d", i);
+    }
+    gettimeofday(&end, NULL);
+    long runtime_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+
+    gettimeofday(&begin, NULL);
+    for (int i=0; i<count; ++i)
+    {
+        LOG_TRACE(0, i, user_name, "trace %d", i);
+    }
+    gettimeofday(&end, NULL);
+    long compile_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+
+    printf("disabled log: always build record %.2f ns, runtime check %.2f ns, compile time %.2f ns\n",
+           always_us * 1000.0 / count, runtime_us * 1000.0 / count, compile_us * 1000.0 / count);
+}
@@ -0,0 +1,151 @@
+/**
+ * @file:   mpmc_ring_queue_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  mpmc_ring_queue_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <sys/time.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include "mpmc_ring_queue.h"
+
+using namespace testing;
+using namespace tnt;
+
+class MpmcRingQueueTest : public Test
+{
+protected:
+    static void SetUpTestCase()
+    {
+    }
+
+    static void TearDownTestCase()
+    {
+    }
+
+protected:
+};
+
+static double NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+TEST_F(MpmcRingQueueTest, TryPushPop)
+{
+    mpmc_ring_queue<int, 8> queue;
+    int value = 0;
+
+    ASSERT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.try_pop(value));
+
+    for (int i=0; i<100; ++i)
+    {
+        for (int j=0; j<8; ++j)
+        {
+            ASSERT_TRUE(queue.try_push(i * 8 + j));
+        }
+        EXPECT_FALSE(queue.try_push(-1));
+        EXPECT_TRUE(queue.full());
+
+        for (int j=0; j<8; ++j)
+        {
+            ASSERT_TRUE(queue.try_pop(value));
+            EXPECT_EQ(i * 8 + j, value);
+        }
+        EXPECT_TRUE(queue.empty());
+    }
+}
+
+TEST_F(MpmcRingQueueTest, PopTimeout)
+{
+    mpmc_ring_queue<int, 8> queue;
+    int value = 0;
+
+    double t0 = NowUs();
+    EXPECT_FALSE(queue.pop(value, 20));
+    EXPECT_GE(NowUs() - t0, 15000);
+
+    queue.push(1);
+    EXPECT_TRUE(queue.pop(value, 20));
+    EXPECT_EQ(1, value);
+}
+
+// 生产者和消费者各 n 个线程, 队列很小, 让两边都会阻塞
+// 返回每个元素的平均耗时(ns)
+static double RunProducersConsumers(size_t thread_num, size_t count_per_producer, bool check)
+{
+    static mpmc_ring_queue<size_t, 64> queue;
+    std::atomic<size_t> sum(0);
+    std::atomic<size_t> popped(0);
+
+    double t0 = NowUs();
+
+    std::vector<std::thread> threads;
+    for (size_t p=0; p<thread_num; ++p)
+    {
+        threads.push_back(std::thread([=]() {
+            for (size_t i=0; i<count_per_producer; ++i)
+            {
+                queue.push(p * count_per_producer + i + 1);
+            }
+        }));
+    }
+
+    const size_t total = thread_num * count_per_producer;
+    for (size_t c=0; c<thread_num; ++c)
+    {
+        threads.push_back(std::thread([&]() {
+            size_t value = 0;
+            size_t local_sum = 0;
+            while (popped.fetch_add(1) < total)
+            {
+                queue.pop(value);
+                local_sum += value;
+            }
+            sum += local_sum;
+        }));
+    }
+
+    for (size_t i=0; i<threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+
+    double t1 = NowUs();
+
+    if (check)
+    {
+        EXPECT_EQ(total * (total + 1) / 2, sum.load());
+        EXPECT_TRUE(queue.empty());
+    }
+
+    return (t1 - t0) * 1000 / total;
+}
+
+TEST_F(MpmcRingQueueTest, ProducersConsumers)
+{
+    RunProducersConsumers(4, 100000, true);
+}
+
+// 从1对生产/消费线程到 N 对, 看扩展性
+TEST_F(MpmcRingQueueTest, Benchmark)
+{
+    size_t cores = std::thread::hardware_concurrency();
+    if (cores < 2)
+    {
+        cores = 2;
+    }
+
+    printf("hardware_concurrency %u\n", std::thread::hardware_concurrency());
+    for (size_t n=1; n<=cores; n*=2)
+    {
+        const size_t total = 2000000;
+        double cost = RunProducersConsumers(n, total / n, false);
+        printf("%2lu producers %2lu consumers  %7.2f ns/op  %6.2f Mops/s\n", n, n, cost, 1000 / cost);
+    }
+}
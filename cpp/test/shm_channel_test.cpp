@@ -0,0 +1,175 @@
+/**
+ * @file:   shm_channel_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  shm_channel_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include "shm_channel.h"
+
+using namespace testing;
+using namespace tnt;
+
+static const char* TEST_CHANNEL_FILE = "/tmp/tnt_shm_channel_test.mmap";
+
+class ShmChannelTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        unlink(TEST_CHANNEL_FILE);
+    }
+
+    virtual void TearDown()
+    {
+        unlink(TEST_CHANNEL_FILE);
+    }
+};
+
+TEST_F(ShmChannelTest, SendRecv)
+{
+    ShmChannel writer;
+    ShmChannel reader;
+
+    ASSERT_EQ(0, writer.Open(TEST_CHANNEL_FILE, 4096));
+    ASSERT_EQ(0, reader.Open(TEST_CHANNEL_FILE, 4096));
+
+    char buf[4096];
+    std::size_t len = sizeof(buf);
+    EXPECT_EQ(-1, reader.Recv(buf, len));
+
+    // 长度不一样的消息, 绕很多圈
+    unsigned int next_send = 0;
+    unsigned int next_recv = 0;
+    for (int i=0; i<10000; ++i)
+    {
+        while (true)
+        {
+            std::size_t msg_len = 1 + (next_send * 37) % 500;
+            void* msg = writer.Reserve(msg_len);
+            if (NULL == msg)
+            {
+                break;
+            }
+            memset(msg, next_send & 0xFF, msg_len);
+            writer.Commit(msg_len);
+            ++next_send;
+        }
+
+        for (int j=0; j<3; ++j)
+        {
+            std::size_t msg_len = 0;
+            const char* msg = static_cast<const char*>(reader.Peek(msg_len));
+            ASSERT_TRUE(NULL != msg);
+            ASSERT_EQ(1 + (next_recv * 37) % 500, msg_len);
+            ASSERT_EQ((char)(next_recv & 0xFF), msg[0]);
+            ASSERT_EQ((char)(next_recv & 0xFF), msg[msg_len - 1]);
+            reader.Release();
+            ++next_recv;
+        }
+    }
+
+    while (0 == reader.Recv(buf, len = sizeof(buf)))
+    {
+        ++next_recv;
+    }
+
+    EXPECT_EQ(next_send, next_recv);
+    EXPECT_TRUE(reader.empty());
+}
+
+TEST_F(ShmChannelTest, ReopenCheck)
+{
+    ShmChannel channel;
+    ASSERT_EQ(-1, channel.Open(TEST_CHANNEL_FILE, 1000));
+    ASSERT_EQ(0, channel.Open(TEST_CHANNEL_FILE, 1024));
+    ASSERT_EQ(0, channel.Send("hello", 5));
+    channel.Close();
+
+    ShmChannel other;
+    EXPECT_EQ(-3, other.Open(TEST_CHANNEL_FILE, 2048));
+
+    // 重新打开后数据还在
+    ASSERT_EQ(0, other.Open(TEST_CHANNEL_FILE, 1024));
+    char buf[16];
+    std::size_t len = sizeof(buf);
+    ASSERT_EQ(0, other.Recv(buf, len));
+    EXPECT_EQ(5u, len);
+    EXPECT_EQ(0, memcmp(buf, "hello", 5));
+
+    // 超过最大长度
+    EXPECT_TRUE(NULL == other.Reserve(other.max_msg_len() + 1));
+}
+
+// 两个进程, 读者在门铃上睡
+TEST_F(ShmChannelTest, CrossProcessDoorbell)
+{
+    const unsigned int count = 100000;
+    int doorbell = eventfd(0, EFD_NONBLOCK);
+    ASSERT_NE(-1, doorbell);
+
+    // 读者先打开, 创建通道
+    ShmChannel reader;
+    ASSERT_EQ(0, reader.Open(TEST_CHANNEL_FILE, 65536));
+    reader.SetDoorbell(doorbell);
+
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (0 == pid)
+    {
+        ShmChannel writer;
+        if (0 != writer.Open(TEST_CHANNEL_FILE, 65536))
+        {
+            _exit(1);
+        }
+        writer.SetDoorbell(doorbell);
+
+        for (unsigned int i=0; i<count; )
+        {
+            if (0 == writer.Send(&i, sizeof(i)))
+            {
+                ++i;
+            }
+            else
+            {
+                usleep(10);
+            }
+        }
+        _exit(0);
+    }
+
+    unsigned int expect = 0;
+    while (expect < count)
+    {
+        unsigned int value = 0;
+        std::size_t len = sizeof(value);
+        if (0 == reader.Recv(&value, len))
+        {
+            ASSERT_EQ(expect, value);
+            ++expect;
+            continue;
+        }
+
+        if (reader.ArmDoorbell())
+        {
+            struct pollfd pfd;
+            pfd.fd = doorbell;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 1000);
+            reader.ClearDoorbell();
+        }
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+
+    close(doorbell);
+}
@@ -0,0 +1,176 @@
+/**
+ * @file:   shm_metrics_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  shm_metrics_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include "shm_metrics.h"
+
+using namespace testing;
+using namespace tnt;
+
+static const char* TEST_METRICS_FILE = "/tmp/tnt_shm_metrics_test.metrics";
+
+class ShmMetricsTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        unlink(TEST_METRICS_FILE);
+    }
+
+    virtual void TearDown()
+    {
+        unlink(TEST_METRICS_FILE);
+    }
+};
+
+TEST_F(ShmMetricsTest, PublishAndRead)
+{
+    ShmMetricsReader reader;
+    EXPECT_EQ(-1, reader.Open(TEST_METRICS_FILE));
+
+    uint64_t proc_count = 0;
+    LatencyHistogram proc_latency;
+
+    ShmMetrics metrics;
+    EXPECT_EQ(-1, metrics.RegisterCounter("proc_count", &proc_count));
+    ASSERT_EQ(0, metrics.Open(TEST_METRICS_FILE, "mysvr", "1.2.3", 1000));
+    ASSERT_EQ(0, metrics.RegisterCounter("proc_count", &proc_count));
+    ASSERT_EQ(0, metrics.RegisterHistogram("proc-latency", &proc_latency));
+
+    ASSERT_EQ(0, reader.Open(TEST_METRICS_FILE));
+
+    ShmMetricsSnapshot snapshot;
+    ASSERT_EQ(0, reader.Snapshot(snapshot));
+    EXPECT_EQ(getpid(), snapshot.pid);
+    EXPECT_TRUE(snapshot.alive);
+    EXPECT_EQ("mysvr", snapshot.app_name);
+    EXPECT_EQ("1.2.3", snapshot.id);
+    ASSERT_EQ(1u, snapshot.counters.size());
+    EXPECT_EQ(0u, snapshot.counters[0].value);
+
+    // 没发布之前读不到新的值
+    proc_count = 100;
+    for (int i=1; i<=1000; ++i)
+    {
+        proc_latency.Record(i * 1000);
+    }
+    ASSERT_EQ(0, reader.Snapshot(snapshot));
+    EXPECT_EQ(0u, snapshot.counters[0].value);
+
+    metrics.Publish(2000);
+    ASSERT_EQ(0, reader.Snapshot(snapshot));
+    EXPECT_EQ(2000, snapshot.publish_time);
+    EXPECT_EQ(100u, snapshot.counters[0].value);
+    ASSERT_EQ(1u, snapshot.histograms.size());
+    EXPECT_STREQ("proc-latency", snapshot.histograms[0].name);
+    EXPECT_EQ(1000u, snapshot.histograms[0].count);
+    EXPECT_EQ(proc_latency.Percentile(99), snapshot.histograms[0].p99);
+    EXPECT_EQ(1000000u, snapshot.histograms[0].max);
+
+    std::vector<ShmMetricsSnapshot> snapshots(1, snapshot);
+    std::string text = ShmMetricsToPrometheus(snapshots);
+    char pid_label[64];
+    snprintf(pid_label, sizeof(pid_label), "pid=\"%d\"", getpid());
+    EXPECT_NE(std::string::npos, text.find("# TYPE tnt_proc_count counter\n"));
+    EXPECT_NE(std::string::npos, text.find("tnt_proc_count{app=\"mysvr\",id=\"1.2.3\"," + std::string(pid_label) + "} 100\n"));
+    EXPECT_NE(std::string::npos, text.find("# TYPE tnt_proc_latency_seconds summary\n"));
+    EXPECT_NE(std::string::npos, text.find("quantile=\"1\"} 0.001000000\n"));
+    EXPECT_NE(std::string::npos, text.find("tnt_proc_latency_seconds_count{app=\"mysvr\",id=\"1.2.3\","
+                                           + std::string(pid_label) + "} 1000\n"));
+    printf("%s", text.c_str());
+
+    // 统计周期 Reset 以后, 分位数是新周期的, _count/_sum 还是累计的
+    proc_latency.Reset();
+    for (int i=0; i<10; ++i)
+    {
+        proc_latency.Record(1000);
+    }
+    metrics.Publish(3000);
+    ASSERT_EQ(0, reader.Snapshot(snapshot));
+    EXPECT_EQ(10u, snapshot.histograms[0].count);
+    EXPECT_EQ(1010u, snapshot.histograms[0].total_count);
+    EXPECT_EQ(500500000u + 10000u, snapshot.histograms[0].total_sum);
+
+    snapshots.assign(1, snapshot);
+    text = ShmMetricsToPrometheus(snapshots);
+    EXPECT_NE(std::string::npos, text.find("quantile=\"1\"} 0.000001000\n"));
+    EXPECT_NE(std::string::npos, text.find("tnt_proc_latency_seconds_count{app=\"mysvr\",id=\"1.2.3\","
+                                           + std::string(pid_label) + "} 1010\n"));
+    EXPECT_NE(std::string::npos, text.find("tnt_proc_latency_seconds_sum{app=\"mysvr\",id=\"1.2.3\","
+                                           + std::string(pid_label) + "} 0.500510000\n"));
+
+    // 重新打开, 原来注册的都清掉
+    metrics.Close();
+    ShmMetrics other;
+    ASSERT_EQ(0, other.Open(TEST_METRICS_FILE, "mysvr", "1.2.3", 3000));
+    ASSERT_EQ(0, reader.Snapshot(snapshot));
+    EXPECT_EQ(0u, snapshot.counters.size());
+    EXPECT_EQ(3000, snapshot.start_time);
+}
+
+// 一个线程一直发布, 读到的每一份都是一致的
+TEST_F(ShmMetricsTest, Consistent)
+{
+    const int counter_count = 64;
+    uint64_t counters[counter_count] = {0};
+
+    ShmMetrics metrics;
+    ASSERT_EQ(0, metrics.Open(TEST_METRICS_FILE, "mysvr", "1"));
+    for (int i=0; i<counter_count; ++i)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "counter_%d", i);
+        ASSERT_EQ(0, metrics.RegisterCounter(name, &counters[i]));
+    }
+
+    ShmMetricsReader reader;
+    ASSERT_EQ(0, reader.Open(TEST_METRICS_FILE));
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        for (uint64_t value=1; !stop.load(std::memory_order_relaxed); ++value)
+        {
+            for (int i=0; i<counter_count; ++i)
+            {
+                counters[i] = value;
+            }
+            metrics.Publish(value);
+        }
+    });
+
+    int torn = 0;
+    uint64_t last_value = 0;
+    for (int n=0; n<20000; ++n)
+    {
+        ShmMetricsSnapshot snapshot;
+        if (0 != reader.Snapshot(snapshot))
+        {
+            continue;
+        }
+
+        uint64_t value = snapshot.counters[0].value;
+        for (int i=1; i<counter_count; ++i)
+        {
+            if (snapshot.counters[i].value != value)
+            {
+                ++torn;
+                break;
+            }
+        }
+        EXPECT_GE(value, last_value);
+        last_value = value;
+    }
+
+    stop = true;
+    writer.join();
+
+    EXPECT_EQ(0, torn);
+    EXPECT_GT(last_value, 0u);
+}
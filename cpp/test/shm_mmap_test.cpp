@@ -0,0 +1,292 @@
+/**
+ * @file:   shm_mmap_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  shm_mmap_test
+ */
+#include "gtest/gtest.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "shm_mmap.h"
+
+using namespace testing;
+using namespace tnt;
+
+static const char* TEST_MMAP_FILE = "/tmp/tnt_shm_mmap_test.mmap";
+
+struct TestCache
+{
+    int count;
+    char name[60];
+};
+
+class ShmMmapTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        unlink(TEST_MMAP_FILE);
+        checksum_ = ShmMmap::LayoutChecksum("TestCache", sizeof(TestCache));
+    }
+
+    virtual void TearDown()
+    {
+        unlink(TEST_MMAP_FILE);
+    }
+
+    uint32_t checksum_;
+};
+
+TEST_F(ShmMmapTest, CreateAndRestore)
+{
+    ShmMmap shm;
+    shm.SetLayout(1, checksum_);
+
+    // 没有文件不能挂载
+    EXPECT_EQ(ShmMmap::SHM_ERR_NOT_EXIST, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+    EXPECT_TRUE(NULL == shm.addr());
+
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache)));
+    EXPECT_EQ(SHM_CREATED, shm.restore_state());
+    EXPECT_EQ(sizeof(TestCache), shm.size());
+
+    TestCache* cache = static_cast<TestCache*>(shm.addr());
+    EXPECT_EQ(0, cache->count);
+    cache->count = 42;
+    strcpy(cache->name, "tnt");
+    shm.Close();
+
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+    EXPECT_EQ(SHM_RESTORED_CLEAN, shm.restore_state());
+    EXPECT_EQ(1u, shm.header()->restore_count);
+
+    cache = static_cast<TestCache*>(shm.addr());
+    EXPECT_EQ(42, cache->count);
+    EXPECT_STREQ("tnt", cache->name);
+    shm.Close();
+
+    // 创建会清掉原来的数据
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), false));
+    EXPECT_EQ(SHM_CREATED, shm.restore_state());
+    EXPECT_EQ(0, static_cast<TestCache*>(shm.addr())->count);
+}
+
+// 进程没有Close就退出了
+TEST_F(ShmMmapTest, RestoreDirty)
+{
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (0 == pid)
+    {
+        ShmMmap shm;
+        shm.SetLayout(1, checksum_);
+        if (0 != shm.Open(TEST_MMAP_FILE, sizeof(TestCache)))
+        {
+            _exit(1);
+        }
+        static_cast<TestCache*>(shm.addr())->count = 7;
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    ShmMmap shm;
+    shm.SetLayout(1, checksum_);
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+    EXPECT_EQ(SHM_RESTORED_DIRTY, shm.restore_state());
+    EXPECT_EQ(7, static_cast<TestCache*>(shm.addr())->count);
+}
+
+TEST_F(ShmMmapTest, RestoreMismatch)
+{
+    {
+        ShmMmap shm;
+        shm.SetLayout(1, checksum_);
+        ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache)));
+    }
+
+    ShmMmap shm;
+
+    shm.SetLayout(1, checksum_);
+    EXPECT_EQ(ShmMmap::SHM_ERR_SIZE, shm.Open(TEST_MMAP_FILE, sizeof(TestCache) * 2, true));
+
+    shm.SetLayout(2, checksum_);
+    EXPECT_EQ(ShmMmap::SHM_ERR_LAYOUT, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+
+    shm.SetLayout(1, ShmMmap::LayoutChecksum("TestCache", sizeof(TestCache) + 1));
+    EXPECT_EQ(ShmMmap::SHM_ERR_LAYOUT, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+
+    shm.SetLayout(1, checksum_);
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+    shm.Close();
+
+    // 不是ShmMmap创建的文件
+    FILE* fp = fopen(TEST_MMAP_FILE, "r+");
+    ASSERT_TRUE(NULL != fp);
+    fwrite("garbage!", 1, 8, fp);
+    fclose(fp);
+    EXPECT_EQ(ShmMmap::SHM_ERR_HEADER, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+}
+
+// 只读挂载不改头
+TEST_F(ShmMmapTest, ReadOnly)
+{
+    ShmMmap shm;
+    shm.SetLayout(1, checksum_);
+    EXPECT_EQ(ShmMmap::SHM_ERR_PROT, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), false, PROT_READ));
+
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache)));
+    static_cast<TestCache*>(shm.addr())->count = 3;
+    shm.Close();
+
+    ShmMmap reader;
+    reader.SetLayout(1, checksum_);
+    ASSERT_EQ(0, reader.Open(TEST_MMAP_FILE, sizeof(TestCache), true, PROT_READ));
+    EXPECT_EQ(SHM_RESTORED_CLEAN, reader.restore_state());
+    EXPECT_EQ(3, static_cast<const TestCache*>(reader.addr())->count);
+    EXPECT_EQ(0u, reader.header()->restore_count);
+    reader.Close();
+
+    // 只读的来过也还是干净的
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+    EXPECT_EQ(SHM_RESTORED_CLEAN, shm.restore_state());
+    EXPECT_EQ(1u, shm.header()->restore_count);
+}
+
+// 两个写的, 先关的不能标记为干净
+TEST_F(ShmMmapTest, LastWriterClose)
+{
+    ShmMmap first;
+    first.SetLayout(1, checksum_);
+    ASSERT_EQ(0, first.Open(TEST_MMAP_FILE, sizeof(TestCache)));
+
+    ShmMmap second;
+    second.SetLayout(1, checksum_);
+    ASSERT_EQ(0, second.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+    EXPECT_EQ(SHM_RESTORED_DIRTY, second.restore_state());
+
+    first.Close();
+
+    ShmMmap check;
+    check.SetLayout(1, checksum_);
+    ASSERT_EQ(0, check.Open(TEST_MMAP_FILE, sizeof(TestCache), true, PROT_READ));
+    EXPECT_EQ(SHM_RESTORED_DIRTY, check.restore_state());
+    check.Close();
+
+    second.Close();
+    ASSERT_EQ(0, check.Open(TEST_MMAP_FILE, sizeof(TestCache), true, PROT_READ));
+    EXPECT_EQ(SHM_RESTORED_CLEAN, check.restore_state());
+    check.Close();
+
+    // 另一个写的进程挂掉了, 它的锁由内核释放, 剩下的关闭时还是干净的
+    ASSERT_EQ(0, first.Open(TEST_MMAP_FILE, sizeof(TestCache), true));
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (0 == pid)
+    {
+        ShmMmap shm;
+        shm.SetLayout(1, checksum_);
+        _exit(0 == shm.Open(TEST_MMAP_FILE, sizeof(TestCache), true) ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    first.Close();
+    ASSERT_EQ(0, check.Open(TEST_MMAP_FILE, sizeof(TestCache), true, PROT_READ));
+    EXPECT_EQ(SHM_RESTORED_CLEAN, check.restore_state());
+}
+
+// 还有写的进程挂着时不能重新创建, 截断了它会SIGBUS
+TEST_F(ShmMmapTest, CreateBusy)
+{
+    ShmMmap first;
+    first.SetLayout(1, checksum_);
+    ASSERT_EQ(0, first.Open(TEST_MMAP_FILE, sizeof(TestCache)));
+    TestCache* cache = static_cast<TestCache*>(first.addr());
+    cache->count = 42;
+
+    ShmMmap second;
+    second.SetLayout(1, checksum_);
+    EXPECT_EQ(ShmMmap::SHM_ERR_BUSY, second.Open(TEST_MMAP_FILE, sizeof(TestCache)));
+    // 另一个进程也一样
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (0 == pid)
+    {
+        ShmMmap shm;
+        shm.SetLayout(1, checksum_);
+        _exit(ShmMmap::SHM_ERR_BUSY == shm.Open(TEST_MMAP_FILE, sizeof(TestCache)) ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+
+    // 原来的还能用
+    EXPECT_EQ(42, cache->count);
+
+    first.Close();
+
+    // 没有写的了就可以创建
+    ASSERT_EQ(0, second.Open(TEST_MMAP_FILE, sizeof(TestCache)));
+    EXPECT_EQ(SHM_CREATED, second.restore_state());
+    EXPECT_EQ(0, static_cast<TestCache*>(second.addr())->count);
+}
+
+TEST_F(ShmMmapTest, Options)
+{
+    const std::size_t size = 8 * 1024 * 1024;
+
+    ShmMmapOptions options;
+    options.huge_tlb = true;
+
+    // /tmp 不是hugetlbfs, 要求大页就失败
+    ShmMmap shm;
+    shm.SetOptions(options);
+    EXPECT_EQ(ShmMmap::SHM_ERR_HUGE_TLB, shm.Open(TEST_MMAP_FILE, size));
+    EXPECT_TRUE(NULL == shm.addr());
+
+    options.huge_tlb = false;
+    options.transparent_huge = true;
+    options.populate = true;
+    options.lock = true;
+    shm.SetOptions(options);
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, size));
+    printf("%s\n", shm.applied_options_str().c_str());
+
+    EXPECT_EQ(0u, shm.applied_options() & SHM_OPT_HUGE_TLB);
+    EXPECT_NE(0u, shm.applied_options() & SHM_OPT_POPULATE);
+    EXPECT_EQ(0u, shm.applied_options() & SHM_OPT_NUMA);
+
+    // 透明大页的地址是对齐的, 数据区在头后面
+    if (shm.applied_options() & SHM_OPT_TRANSPARENT_HUGE)
+    {
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(shm.header()) % (2 * 1024 * 1024));
+    }
+
+    memset(shm.addr(), 1, size);
+    shm.Close();
+
+    // NUMA 绑定后再预取, 单节点机器上绑0号节点
+    options = ShmMmapOptions();
+    options.populate = true;
+    options.numa_node = 0;
+    shm.SetOptions(options);
+    ASSERT_EQ(0, shm.Open(TEST_MMAP_FILE, size, true));
+    printf("%s\n", shm.applied_options_str().c_str());
+    EXPECT_NE(0u, shm.applied_options() & SHM_OPT_POPULATE);
+    EXPECT_EQ(1, static_cast<char*>(shm.addr())[size - 1]);
+
+    // 只读的也能预取
+    ShmMmap reader;
+    reader.SetOptions(options);
+    ASSERT_EQ(0, reader.Open(TEST_MMAP_FILE, size, true, PROT_READ));
+    EXPECT_NE(0u, reader.applied_options() & SHM_OPT_POPULATE);
+    EXPECT_EQ(1, static_cast<const char*>(reader.addr())[0]);
+}
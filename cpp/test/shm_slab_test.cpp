@@ -0,0 +1,191 @@
+/**
+ * @file:   shm_slab_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  shm_slab_test
+ */
+#include "gtest/gtest.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <set>
+#include <vector>
+#include "shm_mmap.h"
+#include "shm_slab.h"
+
+using namespace testing;
+using namespace tnt;
+
+static const char* TEST_SLAB_FILE = "/tmp/tnt_shm_slab_test.mmap";
+
+struct TestSession
+{
+    uint64_t uin;
+    uint32_t next;  // 另一个对象的下标
+    char data[20];
+};
+
+class ShmSlabTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        unlink(TEST_SLAB_FILE);
+    }
+
+    virtual void TearDown()
+    {
+        unlink(TEST_SLAB_FILE);
+    }
+};
+
+TEST_F(ShmSlabTest, AllocFree)
+{
+    std::vector<char> mem(ShmObjectPool<TestSession>::MemSize(100));
+    ShmObjectPool<TestSession> pool;
+    ASSERT_EQ(-1, pool.Init(&mem[0], 16, false));
+    ASSERT_EQ(-2, pool.Init(&mem[0], mem.size(), true));
+    ASSERT_EQ(0, pool.Init(&mem[0], mem.size(), false));
+    EXPECT_EQ(100u, pool.capacity());
+
+    std::vector<TestSession*> sessions;
+    for (int i=0; i<100; ++i)
+    {
+        TestSession* s = pool.Alloc();
+        ASSERT_TRUE(NULL != s);
+        EXPECT_EQ(0u, s->uin);
+        s->uin = i;
+        sessions.push_back(s);
+    }
+    EXPECT_TRUE(NULL == pool.Alloc());
+    EXPECT_EQ(1u, pool.stats().alloc_fail_count);
+    EXPECT_EQ(100u, pool.size());
+
+    // 释放偶数的
+    for (int i=0; i<100; i+=2)
+    {
+        EXPECT_EQ(0, pool.Free(sessions[i]));
+    }
+    EXPECT_EQ(-2, pool.Free(sessions[0]));
+    EXPECT_EQ(-1, pool.Free(reinterpret_cast<TestSession*>(&sessions[1]->data[0])));
+    EXPECT_TRUE(NULL == pool.get(0));
+    EXPECT_EQ(ShmSlab::npos, pool.index_of(sessions[0]));
+
+    EXPECT_EQ(50u, pool.size());
+    EXPECT_EQ(100u, pool.stats().peak_used);
+
+    // 遍历
+    std::set<uint64_t> uins;
+    for (uint32_t i=pool.first(); i!=ShmSlab::npos; i=pool.next(i))
+    {
+        uins.insert(pool.get(i)->uin);
+        EXPECT_EQ(i, pool.index_of(pool.get(i)));
+    }
+    EXPECT_EQ(50u, uins.size());
+    EXPECT_EQ(1u, *uins.begin());
+
+    // 空出来的再用
+    for (int i=0; i<50; ++i)
+    {
+        ASSERT_TRUE(NULL != pool.Alloc());
+    }
+    EXPECT_TRUE(NULL == pool.Alloc());
+}
+
+// 重新映射到别的地址后, 下标还能用
+TEST_F(ShmSlabTest, Restore)
+{
+    const uint32_t count = 1000;
+    std::size_t size = ShmObjectPool<TestSession>::MemSize(count);
+    uint32_t head = ShmSlab::npos;
+
+    {
+        ShmMmap shm;
+        ASSERT_EQ(0, shm.Open(TEST_SLAB_FILE, size));
+        ShmObjectPool<TestSession> pool;
+        ASSERT_EQ(0, pool.Init(shm.addr(), shm.size(), false));
+
+        // 串成链表
+        for (uint32_t i=0; i<count; ++i)
+        {
+            TestSession* s = pool.Alloc();
+            s->uin = 10000 + i;
+            s->next = head;
+            head = pool.index_of(s);
+        }
+        for (uint32_t i=0; i<count; i+=3)
+        {
+            pool.Free(pool.get(i));
+        }
+    }
+
+    // 占住原来的地址
+    void* block = mmap(NULL, size + ShmMmap::HEADER_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    ShmMmap shm;
+    ASSERT_EQ(0, shm.Open(TEST_SLAB_FILE, size, true));
+    ShmObjectPool<TestSession> pool;
+    ASSERT_EQ(0, pool.Init(shm.addr(), shm.size(), true));
+    EXPECT_EQ(count - (count + 2) / 3, pool.size());
+
+    // 下标还能用, 被释放的为NULL
+    uint32_t alive = 0;
+    for (uint32_t i=head; i!=ShmSlab::npos; )
+    {
+        TestSession* s = pool.get(i);
+        uint32_t next = (i > 0) ? (i - 1) : ShmSlab::npos;
+        if (0 == i % 3)
+        {
+            EXPECT_TRUE(NULL == s);
+        }
+        else
+        {
+            ASSERT_TRUE(NULL != s);
+            EXPECT_EQ(10000u + i, s->uin);
+            EXPECT_EQ(next, s->next);
+            ++alive;
+        }
+        i = next;
+    }
+    EXPECT_EQ(pool.size(), alive);
+
+    // 重建后结果一样
+    ShmSlabStats before = pool.stats();
+    pool.Rebuild();
+    EXPECT_EQ(before.used, pool.stats().used);
+    for (uint32_t i=0; i<count; i+=3)
+    {
+        ASSERT_TRUE(NULL != pool.Alloc());
+    }
+    EXPECT_TRUE(NULL == pool.Alloc());
+
+    munmap(block, size + ShmMmap::HEADER_SIZE);
+}
+
+TEST_F(ShmSlabTest, Benchmark)
+{
+    const uint32_t count = 1000000;
+    std::vector<char> mem(ShmObjectPool<TestSession>::MemSize(count));
+    ShmObjectPool<TestSession> pool;
+    ASSERT_EQ(0, pool.Init(&mem[0], mem.size(), false));
+
+    std::vector<TestSession*> sessions(count);
+
+    struct timeval begin, end;
+    gettimeofday(&begin, NULL);
+    for (int round=0; round<5; ++round)
+    {
+        for (uint32_t i=0; i<count; ++i)
+        {
+            sessions[i] = pool.Alloc();
+        }
+        for (uint32_t i=0; i<count; ++i)
+        {
+            pool.Free(sessions[(static_cast<uint64_t>(i) * 7919) % count]);
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    time_t cost_us = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+    printf("alloc+free %u x 5: %ld us, %.1f ns/op\n", count, cost_us, cost_us * 1000.0 / (count * 10.0));
+    EXPECT_EQ(0u, pool.size());
+}
@@ -0,0 +1,206 @@
+/**
+ * @file:   slot_table_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  slot_table_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <sys/time.h>
+#include <vector>
+#include <tr1/unordered_map>
+#include "slot_table.h"
+
+using namespace testing;
+using namespace tnt;
+
+TEST(SlotTableTest, InsertFindErase)
+{
+    SlotTable<int> table;
+    EXPECT_EQ(0u, table.Insert(1));
+    EXPECT_EQ(NULL, table.Find(0));
+
+    ASSERT_EQ(0, table.Reserve(4));
+    EXPECT_EQ(4u, table.capacity());
+
+    uint32_t ids[4];
+    for (int i=0; i<4; ++i)
+    {
+        ids[i] = table.Insert(100 + i);
+        EXPECT_NE(0u, ids[i]);
+    }
+    // 满了
+    EXPECT_EQ(0u, table.Insert(5));
+    EXPECT_EQ(4u, table.size());
+
+    for (int i=0; i<4; ++i)
+    {
+        ASSERT_TRUE(NULL != table.Find(ids[i]));
+        EXPECT_EQ(100 + i, *table.Find(ids[i]));
+    }
+
+    // 释放以后旧的ID找不到, 槽位再用时ID也不一样
+    EXPECT_EQ(0, table.Erase(ids[1]));
+    EXPECT_EQ(-1, table.Erase(ids[1]));
+    EXPECT_EQ(NULL, table.Find(ids[1]));
+    EXPECT_EQ(3u, table.size());
+
+    uint32_t id = table.Insert(200);
+    EXPECT_EQ(ids[1] & SlotTable<int>::INDEX_MASK, id & SlotTable<int>::INDEX_MASK);
+    EXPECT_NE(ids[1], id);
+    EXPECT_EQ(NULL, table.Find(ids[1]));
+    EXPECT_EQ(200, *table.Find(id));
+
+    // 越界的下标
+    EXPECT_EQ(NULL, table.Find(ids[0] | SlotTable<int>::INDEX_MASK));
+
+    EXPECT_EQ(-1, table.Reserve(SlotTable<int>::MAX_SLOTS + 1));
+}
+
+// 先进先出, 一个槽位要等别的都用过一轮才会再用
+TEST(SlotTableTest, FifoReuse)
+{
+    SlotTable<int> table(12345);
+    ASSERT_EQ(0, table.Reserve(8));
+
+    uint32_t first = table.Insert(1);
+    table.Erase(first);
+
+    for (int i=0; i<7; ++i)
+    {
+        uint32_t id = table.Insert(i);
+        EXPECT_NE(first & SlotTable<int>::INDEX_MASK, id & SlotTable<int>::INDEX_MASK);
+        table.Erase(id);
+    }
+
+    uint32_t again = table.Insert(1);
+    EXPECT_EQ(first & SlotTable<int>::INDEX_MASK, again & SlotTable<int>::INDEX_MASK);
+
+    // 代数转一圈也不会是0
+    SlotTable<int> one;
+    ASSERT_EQ(0, one.Reserve(1));
+    for (uint32_t i=0; i<2 * (SlotTable<int>::GENERATION_MASK + 1); ++i)
+    {
+        uint32_t id = one.Insert(1);
+        ASSERT_NE(0u, id);
+        one.Erase(id);
+    }
+}
+
+// 和 TransactionMgr 一样: 很多命令字注册时只留 min_size 个, 满了一次长 grow_size 个,
+// 长的时候已经发出去的ID照样能找到
+TEST(SlotTableTest, GrowWhileInUse)
+{
+    const std::size_t COMMANDS = 1000;
+    const std::size_t MIN_SIZE = 64;
+    const std::size_t GROW_SIZE = 64;
+    const std::size_t BURST = 8192;
+
+    SlotTable<std::size_t> table(12345);
+    for (std::size_t cmd=0; cmd<COMMANDS; ++cmd)
+    {
+        ASSERT_EQ(0, table.Reserve(table.capacity() + MIN_SIZE));
+    }
+    EXPECT_EQ(COMMANDS * MIN_SIZE, table.capacity());
+
+    // 一个命令字突然来了很多, 其他的没什么请求
+    std::vector<uint32_t> ids;
+    for (std::size_t i=0; i<COMMANDS * MIN_SIZE + BURST; ++i)
+    {
+        if (table.size() >= table.capacity())
+        {
+            ASSERT_EQ(0, table.Reserve(table.capacity() + GROW_SIZE));
+        }
+
+        uint32_t id = table.Insert(i);
+        ASSERT_NE(0u, id);
+        ids.push_back(id);
+    }
+    EXPECT_EQ(COMMANDS * MIN_SIZE + BURST, table.capacity());
+
+    for (std::size_t i=0; i<ids.size(); ++i)
+    {
+        ASSERT_TRUE(NULL != table.Find(ids[i]));
+        ASSERT_EQ(i, *table.Find(ids[i]));
+    }
+
+    // 加起来不能超过 MAX_SLOTS
+    EXPECT_EQ(-1, table.Reserve(table.capacity() + SlotTable<std::size_t>::MAX_SLOTS));
+    EXPECT_EQ(ids.size(), table.size());
+}
+
+static double NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+// 和 TransactionMgr 的用法一样: 新请求插入, 回包查两次, 结束时删除
+// 同时有 ACTIVE 个事务在跑
+TEST(SlotTableTest, Benchmark)
+{
+    const int ACTIVE = 4096;
+    const int LOOP = 1000000;
+
+    struct Dummy
+    {
+        uint32_t id;
+    };
+    std::vector<Dummy> objects(ACTIVE);
+    std::vector<uint32_t> active_ids(ACTIVE);
+
+    // 原来的 unordered_map, id 自增
+    typedef std::tr1::unordered_map<unsigned int, Dummy*> TransactionMap;
+    TransactionMap map;
+    uint32_t id_generator = 1000;
+    for (int i=0; i<ACTIVE; ++i)
+    {
+        active_ids[i] = ++id_generator;
+        map[active_ids[i]] = &objects[i];
+    }
+
+    uint64_t found = 0;
+    double begin = NowUs();
+    for (int i=0; i<LOOP; ++i)
+    {
+        int slot = i % ACTIVE;
+        int other = static_cast<int>((i * 7919ULL) % ACTIVE);
+
+        map.erase(active_ids[slot]);
+        active_ids[slot] = ++id_generator;
+        map[active_ids[slot]] = &objects[slot];
+
+        TransactionMap::iterator iter = map.find(active_ids[other]);
+        found += (iter != map.end());
+        iter = map.find(active_ids[(other + 1) % ACTIVE]);
+        found += (iter != map.end());
+    }
+    double map_us = NowUs() - begin;
+
+    SlotTable<Dummy*> table;
+    ASSERT_EQ(0, table.Reserve(ACTIVE * 2));
+    for (int i=0; i<ACTIVE; ++i)
+    {
+        active_ids[i] = table.Insert(&objects[i]);
+    }
+
+    begin = NowUs();
+    for (int i=0; i<LOOP; ++i)
+    {
+        int slot = i % ACTIVE;
+        int other = static_cast<int>((i * 7919ULL) % ACTIVE);
+
+        table.Erase(active_ids[slot]);
+        active_ids[slot] = table.Insert(&objects[slot]);
+
+        found += (NULL != table.Find(active_ids[other]));
+        found += (NULL != table.Find(active_ids[(other + 1) % ACTIVE]));
+    }
+    double table_us = NowUs() - begin;
+
+    EXPECT_EQ(4u * LOOP, found);
+    EXPECT_EQ((std::size_t)ACTIVE, table.size());
+
+    printf("free+new+2 lookups: unordered_map %.1f ns, slot table %.1f ns\n",
+           map_us * 1000 / LOOP, table_us * 1000 / LOOP);
+}
@@ -0,0 +1,293 @@
+/**
+ * @file:   spsc_ring_queue_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  spsc_ring_queue_test
+ */
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <sys/time.h>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include "ring_queue.h"
+#include "spsc_ring_queue.h"
+
+using namespace testing;
+using namespace tnt;
+
+class SpscRingQueueTest : public Test
+{
+protected:
+    static void SetUpTestCase()
+    {
+    }
+
+    static void TearDownTestCase()
+    {
+    }
+
+protected:
+};
+
+static double NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+TEST_F(SpscRingQueueTest, PushPop)
+{
+    spsc_ring_queue<int, 8> queue;
+    int value = 0;
+
+    ASSERT_TRUE(queue.empty());
+    EXPECT_EQ(8u, queue.capacity());
+    EXPECT_FALSE(queue.pop(value));
+
+    // 多绕几圈
+    for (int i=0; i<100; ++i)
+    {
+        for (int j=0; j<8; ++j)
+        {
+            ASSERT_TRUE(queue.push(i * 8 + j));
+        }
+        EXPECT_FALSE(queue.push(-1));
+        EXPECT_EQ(8u, queue.size());
+
+        for (int j=0; j<8; ++j)
+        {
+            ASSERT_TRUE(queue.pop(value));
+            EXPECT_EQ(i * 8 + j, value);
+        }
+        EXPECT_TRUE(queue.empty());
+    }
+}
+
+TEST_F(SpscRingQueueTest, PushPopN)
+{
+    spsc_ring_queue<int, 16> queue;
+    int in[10];
+    int out[10];
+
+    int next_in = 0;
+    int next_out = 0;
+    for (int i=0; i<100; ++i)
+    {
+        for (int j=0; j<10; ++j)
+        {
+            in[j] = next_in + j;
+        }
+
+        size_t n = queue.push_n(in, 10);
+        next_in += n;
+        EXPECT_LE(queue.size(), 16u);
+
+        n = queue.pop_n(out, 7);
+        for (size_t j=0; j<n; ++j)
+        {
+            ASSERT_EQ(next_out++, out[j]);
+        }
+    }
+
+    while (size_t n = queue.pop_n(out, 10))
+    {
+        for (size_t j=0; j<n; ++j)
+        {
+            ASSERT_EQ(next_out++, out[j]);
+        }
+    }
+
+    EXPECT_EQ(next_in, next_out);
+}
+
+TEST_F(SpscRingQueueTest, TwoThreads)
+{
+    static spsc_ring_queue<size_t, 1024> queue;
+    const size_t count = 1000000;
+
+    std::thread producer([&]() {
+        for (size_t i=0; i<count; )
+        {
+            if (queue.push(i))
+            {
+                ++i;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    size_t expect = 0;
+    size_t value = 0;
+    while (expect < count)
+    {
+        if (queue.pop(value))
+        {
+            ASSERT_EQ(expect, value);
+            ++expect;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}
+
+// 和 ring_queue 对比
+// 1 单线程 push + pop
+// 2 跨线程, ring_queue 加 mutex
+// 3 跨线程批量
+// 4 两个队列来回一次的延迟
+TEST_F(SpscRingQueueTest, Benchmark)
+{
+    const size_t count = 10000000;
+
+    {
+        static ring_queue<size_t, 1024> queue;
+        double t0 = NowUs();
+        for (size_t i=0; i<count; ++i)
+        {
+            queue.push(i);
+            queue.pop();
+        }
+        double t1 = NowUs();
+        printf("ring_queue single thread        %6.2f ns/op\n", (t1 - t0) * 1000 / count);
+    }
+
+    {
+        static spsc_ring_queue<size_t, 1024> queue;
+        size_t value = 0;
+        double t0 = NowUs();
+        for (size_t i=0; i<count; ++i)
+        {
+            queue.push(i);
+            queue.pop(value);
+        }
+        double t1 = NowUs();
+        printf("spsc_ring_queue single thread   %6.2f ns/op\n", (t1 - t0) * 1000 / count);
+    }
+
+    {
+        static ring_queue<size_t, 1024> queue;
+        std::mutex mutex;
+        double t0 = NowUs();
+        std::thread producer([&]() {
+            for (size_t i=0; i<count; )
+            {
+                bool full = false;
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    full = queue.full();
+                    if (!full)
+                    {
+                        queue.push(i++);
+                    }
+                }
+                if (full) std::this_thread::yield();
+            }
+        });
+        for (size_t i=0; i<count; )
+        {
+            bool empty = false;
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                empty = queue.empty();
+                if (!empty)
+                {
+                    queue.pop();
+                    ++i;
+                }
+            }
+            if (empty) std::this_thread::yield();
+        }
+        producer.join();
+        double t1 = NowUs();
+        printf("ring_queue + mutex two threads  %6.2f ns/op\n", (t1 - t0) * 1000 / count);
+    }
+
+    {
+        static spsc_ring_queue<size_t, 1024> queue;
+        double t0 = NowUs();
+        std::thread producer([&]() {
+            for (size_t i=0; i<count; )
+            {
+                if (queue.push(i)) ++i;
+                else std::this_thread::yield();
+            }
+        });
+        size_t value = 0;
+        for (size_t i=0; i<count; )
+        {
+            if (queue.pop(value)) ++i;
+            else std::this_thread::yield();
+        }
+        producer.join();
+        double t1 = NowUs();
+        printf("spsc_ring_queue two threads     %6.2f ns/op\n", (t1 - t0) * 1000 / count);
+    }
+
+    {
+        static spsc_ring_queue<size_t, 1024> queue;
+        const size_t batch = 64;
+        double t0 = NowUs();
+        std::thread producer([&]() {
+            size_t values[batch];
+            for (size_t i=0; i<count; )
+            {
+                for (size_t j=0; j<batch; ++j) values[j] = i + j;
+                size_t n = queue.push_n(values, std::min(batch, count - i));
+                if (n > 0) i += n;
+                else std::this_thread::yield();
+            }
+        });
+        size_t values[batch];
+        for (size_t i=0; i<count; )
+        {
+            size_t n = queue.pop_n(values, batch);
+            if (n > 0) i += n;
+            else std::this_thread::yield();
+        }
+        producer.join();
+        double t1 = NowUs();
+        printf("spsc_ring_queue push_n/pop_n    %6.2f ns/op\n", (t1 - t0) * 1000 / count);
+    }
+
+    {
+        static spsc_ring_queue<size_t, 1024> ping;
+        static spsc_ring_queue<size_t, 1024> pong;
+        const size_t rounds = 100000;
+        double t0 = NowUs();
+        std::thread echo([&]() {
+            size_t value = 0;
+            for (size_t i=0; i<rounds; )
+            {
+                if (ping.pop(value))
+                {
+                    while (!pong.push(value)) std::this_thread::yield();
+                    ++i;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        size_t value = 0;
+        for (size_t i=0; i<rounds; ++i)
+        {
+            ping.push(i);
+            while (!pong.pop(value)) std::this_thread::yield();
+        }
+        echo.join();
+        double t1 = NowUs();
+        printf("spsc_ring_queue round trip      %6.2f ns\n", (t1 - t0) * 1000 / rounds);
+    }
+}
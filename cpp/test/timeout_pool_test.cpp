@@ -6,7 +6,11 @@
  */
 #include "gtest/gtest.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
 #include "timeout_pool.h"
+#include "ordered_timeout_pool.h"
 
 using namespace testing;
 using namespace tnt;
@@ -36,8 +40,232 @@ TEST_F(TimeoutPoolTest, Simple)
     EXPECT_EQ(3, pool.AddRepeating(now, 15));
     EXPECT_EQ(4, pool.Add(now, 20));
 
+    std::vector<TimeoutPool::Event> expired;
+    pool.Run(now, expired);
+    EXPECT_TRUE(expired.empty());
+
+    pool.Run(now-30, expired);
+    EXPECT_TRUE(expired.empty());
+
+    EXPECT_EQ(now+10, pool.Run(now+5, expired));
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ(1, expired[0].id);
+    EXPECT_EQ(now+5, expired[0].expiration);
+
+    // 同一批里 2 和 3 都到期, 4 到期
+    EXPECT_EQ(now+30, pool.Run(now+20, expired));
+    ASSERT_EQ(3u, expired.size());
+    EXPECT_EQ(2u, pool.size());
+}
+
+// 到期时带回添加时的数据, 重复的每次都带
+TEST_F(TimeoutPoolTest, Data)
+{
+    tnt::TimeoutPool pool;
+
+    pool.Add(100, 5, 0x123456789ULL);
+    pool.AddRepeating(100, 10, 42);
+    pool.Add(100, 20);
+
+    std::vector<TimeoutPool::Event> expired;
+    pool.Run(105, expired);
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ(0x123456789ULL, expired[0].data);
+
+    pool.Run(120, expired);
+    ASSERT_EQ(2u, expired.size());
+    for (size_t i=0; i<expired.size(); ++i)
+    {
+        EXPECT_EQ((expired[i].repeat_interval > 0) ? 42u : 0u, expired[i].data);
+    }
+}
+
+struct CallbackRecord
+{
+    TimeoutPool* pool;
+    std::vector<TimeoutPool::Event> events;
+    std::vector<TimeoutPool::Id> erase_in_callback;
+};
+
+static void RecordCallback(const TimeoutPool::Event& event, int64_t now, void* arg)
+{
+    CallbackRecord* record = static_cast<CallbackRecord*>(arg);
+    record->events.push_back(event);
+
+    for (size_t i=0; i<record->erase_in_callback.size(); ++i)
+    {
+        record->pool->Erase(record->erase_in_callback[i]);
+    }
+    record->erase_in_callback.clear();
+}
+
+TEST_F(TimeoutPoolTest, Callback)
+{
+    tnt::TimeoutPool pool;
+    CallbackRecord record;
+    record.pool = &pool;
+
+    int64_t now = 1000;
+    TimeoutPool::Id a = pool.Add(now, 10);
+    TimeoutPool::Id b = pool.Add(now, 10);
+    TimeoutPool::Id c = pool.Add(now, 20);
+
+    // 第一个回调里删掉同一批的另一个, 它就不会再回调
+    record.erase_in_callback.push_back(a);
+    record.erase_in_callback.push_back(b);
+
+    EXPECT_EQ(1020, pool.Run(1015, RecordCallback, &record));
+    ASSERT_EQ(1u, record.events.size());
+    EXPECT_EQ(1010, record.events[0].expiration);
+
+    // 已经回调过的不能再删
+    EXPECT_FALSE(pool.Erase(record.events[0].id));
+
+    EXPECT_EQ(-1, pool.Run(1020, RecordCallback, &record));
+    ASSERT_EQ(2u, record.events.size());
+    EXPECT_EQ(c, record.events[1].id);
+    EXPECT_EQ(0u, pool.size());
+}
+
+TEST_F(TimeoutPoolTest, RepeatingNoDrift)
+{
+    tnt::TimeoutPool pool;
+    std::vector<TimeoutPool::Event> expired;
+
+    TimeoutPool::Id id = pool.AddRepeating(0, 100);
+
+    // 每次都晚到一点, 计划时间不能跟着漂移
+    EXPECT_EQ(200, pool.Run(103, expired));
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ(100, expired[0].expiration);
+
+    EXPECT_EQ(300, pool.Run(207, expired));
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ(200, expired[0].expiration);
+
+    // 落后好几个周期, 只回调一次, 下次还是对齐的
+    EXPECT_EQ(700, pool.Run(650, expired));
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ(300, expired[0].expiration);
+
+    EXPECT_TRUE(pool.Erase(id));
+    EXPECT_EQ(-1, pool.NextExpiration());
+}
+
+
+// 随机操作, 和 multi_index 版本对比最早的到期时间
+TEST_F(TimeoutPoolTest, SameAsOrdered)
+{
+    tnt::TimeoutPool pool;
+    tnt::OrderedTimeoutPool ordered;
+
+    std::vector<std::pair<TimeoutPool::Id, OrderedTimeoutPool::Id> > ids;
+    std::vector<TimeoutPool::Event> expired;
+
+    srand(20140416);
+    int64_t now = 1397600000000LL;
+    for (int i=0; i<200000; ++i)
+    {
+        int op = rand() % 10;
+        if (op < 6)
+        {
+            // 大部分是近的, 偶尔有很远的
+            int64_t delay = (rand() % 100 == 0) ? (int64_t)rand() * 1000 : rand() % 20000;
+            ids.push_back(std::make_pair(pool.Add(now, delay), ordered.Add(now, delay)));
+        }
+        else if (op < 8 && !ids.empty())
+        {
+            size_t idx = rand() % ids.size();
+            EXPECT_EQ(ordered.Erase(ids[idx].second), pool.Erase(ids[idx].first));
+            ids[idx] = ids.back();
+            ids.pop_back();
+        }
+        else
+        {
+            now += rand() % 300;
+            pool.Run(now, expired);
+            ordered.runInternal(now, true);
+        }
+
+        ASSERT_EQ(ordered.NextExpiration(), pool.NextExpiration()) << i;
+        ASSERT_EQ(ordered.timeouts_.size(), pool.size()) << i;
+    }
+}
+
+TEST_F(TimeoutPoolTest, EraseStaleId)
+{
+    tnt::TimeoutPool pool;
+
+    TimeoutPool::Id id = pool.Add(1000, 10);
+    EXPECT_TRUE(pool.Erase(id));
+    EXPECT_FALSE(pool.Erase(id));
+    EXPECT_EQ(-1, pool.NextExpiration());
+
+    // 节点复用后旧的id不能删掉新的
+    TimeoutPool::Id id2 = pool.Add(1000, 20);
+    EXPECT_NE(id, id2);
+    EXPECT_FALSE(pool.Erase(id));
+    EXPECT_EQ(1020, pool.NextExpiration());
+}
+
+static double NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static void RunPool(tnt::OrderedTimeoutPool& pool, int64_t now)
+{
     pool.runInternal(now, true);
-    pool.runInternal(now-30, true);
+}
 
+static void RunPool(tnt::TimeoutPool& pool, int64_t now)
+{
+    static std::vector<TimeoutPool::Event> expired;
+    pool.Run(now, expired);
+}
+
+// 1 加入n个定时器 2 随机删掉一半 3 按10ms推进直到全部到期
+template<typename Pool>
+static void BenchPool(const char* name, size_t n)
+{
+    Pool pool;
+    std::vector<typename Pool::Id> ids(n);
+
+    srand(1);
+    int64_t now = 1397600000000LL;
+
+    double t0 = NowUs();
+    for (size_t i=0; i<n; ++i)
+    {
+        ids[i] = pool.Add(now, rand() % 60000);
+    }
+
+    double t1 = NowUs();
+    for (size_t i=0; i<n; i+=2)
+    {
+        pool.Erase(ids[i]);
+    }
+
+    double t2 = NowUs();
+    for (int64_t end = now + 60000; now <= end; now += 10)
+    {
+        RunPool(pool, now);
+    }
+
+    double t3 = NowUs();
+
+    printf("%-20s n=%-8lu add %7.1f ns/op  erase %7.1f ns/op  expire %7.1f ns/op\n",
+           name, n, (t1 - t0) * 1000 / n, (t2 - t1) * 1000 / (n / 2), (t3 - t2) * 1000 / (n / 2));
 }
 
+TEST_F(TimeoutPoolTest, Benchmark)
+{
+    size_t counts[] = {10000, 100000, 1000000};
+    for (size_t i=0; i<sizeof(counts)/sizeof(counts[0]); ++i)
+    {
+        BenchPool<tnt::OrderedTimeoutPool>("OrderedTimeoutPool", counts[i]);
+        BenchPool<tnt::TimeoutPool>("TimeoutPool", counts[i]);
+    }
+}
@@ -0,0 +1,210 @@
+/**
+ * @file:   transaction_bucket_test.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  transaction_bucket_test
+ */
+#include "gtest/gtest.h"
+#include <set>
+#include <vector>
+#include "transaction_bucket.h"
+
+using namespace testing;
+using namespace tnt;
+
+struct FakeTransaction
+{
+    explicit FakeTransaction(unsigned int cmd) : cmd(cmd)
+    {
+        ++alive;
+    }
+
+    ~FakeTransaction()
+    {
+        --alive;
+    }
+
+    unsigned int cmd;
+
+    static int alive;
+    static int create_limit;
+};
+
+int FakeTransaction::alive = 0;
+int FakeTransaction::create_limit = -1;
+
+static FakeTransaction* CreateFake(unsigned int cmd)
+{
+    if (0 == FakeTransaction::create_limit)
+    {
+        return NULL;
+    }
+
+    if (FakeTransaction::create_limit > 0)
+    {
+        --FakeTransaction::create_limit;
+    }
+    return new FakeTransaction(cmd);
+}
+
+typedef TransactionBucket<FakeTransaction> FakeBucket;
+
+class TransactionBucketTest : public Test
+{
+protected:
+    virtual void SetUp()
+    {
+        FakeTransaction::alive = 0;
+        FakeTransaction::create_limit = -1;
+    }
+};
+
+// 一次长 grow_size 个, 到 max_size 为止, 再要就是 exhausted
+TEST_F(TransactionBucketTest, GrowToMax)
+{
+    TransactionPoolConfig config = {4, 10, 3};
+    FakeBucket bucket(0x100, config, CreateFake);
+    ASSERT_EQ(4u, bucket.Grow(config.min_size));
+    EXPECT_EQ(4u, bucket.size());
+    EXPECT_EQ(1u, bucket.total_grow());
+
+    std::vector<FakeTransaction*> active;
+    for (int i=0; i<10; ++i)
+    {
+        FakeTransaction* ptrans = bucket.pop();
+        ASSERT_TRUE(NULL != ptrans);
+        EXPECT_EQ(0x100u, ptrans->cmd);
+        active.push_back(ptrans);
+    }
+    // 4 + 3 + 3
+    EXPECT_EQ(10u, bucket.total_size());
+    EXPECT_EQ(10u, bucket.active_size());
+    EXPECT_EQ(3u, bucket.total_grow());
+    EXPECT_EQ(10u, bucket.peak_active());
+    EXPECT_EQ(10, FakeTransaction::alive);
+
+    EXPECT_EQ(NULL, bucket.pop());
+    EXPECT_EQ(NULL, bucket.pop());
+    EXPECT_EQ(2u, bucket.total_exhausted());
+    EXPECT_EQ(10u, bucket.total_pop());
+    EXPECT_EQ(10u, bucket.total_size());
+
+    // 还回去一个又能取到
+    bucket.push(active.back());
+    active.pop_back();
+    FakeTransaction* ptrans = bucket.pop();
+    ASSERT_TRUE(NULL != ptrans);
+    active.push_back(ptrans);
+    EXPECT_EQ(2u, bucket.total_exhausted());
+
+    for (std::size_t i=0; i<active.size(); ++i)
+    {
+        bucket.push(active[i]);
+    }
+    EXPECT_EQ(10u, bucket.size());
+}
+
+// 创建失败也算不够用
+TEST_F(TransactionBucketTest, CreateFailed)
+{
+    TransactionPoolConfig config = {2, 10, 4};
+    FakeBucket bucket(0x100, config, CreateFake);
+    FakeTransaction::create_limit = 3;
+    ASSERT_EQ(2u, bucket.Grow(config.min_size));
+
+    std::vector<FakeTransaction*> active;
+    active.push_back(bucket.pop());
+    active.push_back(bucket.pop());
+    // 只创建出来1个
+    active.push_back(bucket.pop());
+    EXPECT_TRUE(NULL != active.back());
+    EXPECT_EQ(NULL, bucket.pop());
+    EXPECT_EQ(1u, bucket.total_exhausted());
+    EXPECT_EQ(3u, bucket.total_size());
+
+    for (std::size_t i=0; i<active.size(); ++i)
+    {
+        bucket.push(active[i]);
+    }
+}
+
+// 收缩只释放一个周期里一直空闲的, 从冷的一端释放, 不低于 min_size
+TEST_F(TransactionBucketTest, Shrink)
+{
+    TransactionPoolConfig config = {4, 32, 8};
+    {
+        FakeBucket bucket(0x100, config, CreateFake);
+        ASSERT_EQ(4u, bucket.Grow(config.min_size));
+
+        // 高峰时长到20个
+        std::vector<FakeTransaction*> active;
+        for (int i=0; i<20; ++i)
+        {
+            active.push_back(bucket.pop());
+        }
+        for (std::size_t i=0; i<active.size(); ++i)
+        {
+            bucket.push(active[i]);
+        }
+        EXPECT_EQ(20u, bucket.total_size());
+
+        // 第一个周期谁都被取过, 不释放
+        EXPECT_EQ(0u, bucket.Shrink());
+        EXPECT_EQ(20u, bucket.total_size());
+
+        // 这个周期最多同时用了5个, 其他15个一直空闲, 一次最多释放 grow_size 个
+        std::set<FakeTransaction*> hot;
+        for (int round=0; round<3; ++round)
+        {
+            active.clear();
+            for (int i=0; i<5; ++i)
+            {
+                active.push_back(bucket.pop());
+                hot.insert(active.back());
+            }
+            for (std::size_t i=0; i<active.size(); ++i)
+            {
+                bucket.push(active[i]);
+            }
+        }
+        EXPECT_EQ(5u, hot.size());
+
+        EXPECT_EQ(8u, bucket.Shrink());
+        EXPECT_EQ(12u, bucket.total_size());
+        EXPECT_EQ(12, FakeTransaction::alive);
+
+        // 刚用过的都还在
+        active.clear();
+        for (int i=0; i<5; ++i)
+        {
+            FakeTransaction* ptrans = bucket.pop();
+            EXPECT_EQ(1u, hot.count(ptrans));
+            active.push_back(ptrans);
+        }
+        for (std::size_t i=0; i<active.size(); ++i)
+        {
+            bucket.push(active[i]);
+        }
+
+        // 剩下7个一直空闲, 但是不能低于 min_size
+        EXPECT_EQ(7u, bucket.Shrink());
+        EXPECT_EQ(5u, bucket.total_size());
+        EXPECT_EQ(1u, bucket.Shrink());
+        EXPECT_EQ(4u, bucket.total_size());
+        EXPECT_EQ(0u, bucket.Shrink());
+        EXPECT_EQ(4u, bucket.total_size());
+        EXPECT_EQ(3u, bucket.total_shrink());
+
+        // 一个周期内用光了的, 什么都不释放
+        active.clear();
+        for (int i=0; i<4; ++i)
+        {
+            active.push_back(bucket.pop());
+        }
+        for (std::size_t i=0; i<active.size(); ++i)
+        {
+            bucket.push(active[i]);
+        }
+        EXPECT_EQ(0u, bucket.Shrink());
+    }
+    EXPECT_EQ(0, FakeTransaction::alive);
+}
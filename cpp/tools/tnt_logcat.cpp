@@ -0,0 +1,48 @@
+/**
+ * @file:   tnt_logcat.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  把二进制日志转成文本
+ *
+ * use like this:
+ *   tnt_logcat svr.log svr.log.20140416-120000 | grep ERROR
+ *   tail -c +1 -f svr.log | tnt_logcat -      # 从标准输入读
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "binary_logging.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <binary_log_file|-> ...\n", argv[0]);
+        return 1;
+    }
+
+    int result = 0;
+    for (int i=1; i<argc; ++i)
+    {
+        FILE* in = (0 == strcmp(argv[i], "-")) ? stdin : fopen(argv[i], "rb");
+        if (NULL == in)
+        {
+            fprintf(stderr, "open %s failed\n", argv[i]);
+            result = 1;
+            continue;
+        }
+
+        int ret = tnt::DecodeBinaryLog(in, stdout);
+        if (0 != ret)
+        {
+            fprintf(stderr, "decode %s failed, ret=%d\n", argv[i], ret);
+            result = 1;
+        }
+
+        if (stdin != in)
+        {
+            fclose(in);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file:   tnt_metrics.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  读 ShmMetrics 发布的统计数据
+ *
+ * 只读映射, 不会打扰被读的进程
+ *
+ * use like this:
+ *   tnt_metrics /dev/shm/tnt_metrics                 # 目录下所有的 *.metrics
+ *   tnt_metrics -p /dev/shm/tnt_metrics > tnt.prom   # Prometheus 文本格式, 给node_exporter的textfile用
+ *   tnt_metrics -a mysvr.1.metrics                   # 进程不在了也输出
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "shm_metrics.h"
+
+static bool EndsWith(const std::string& str, const char* suffix)
+{
+    std::size_t len = strlen(suffix);
+    return str.size() >= len && 0 == str.compare(str.size() - len, len, suffix);
+}
+
+static void ListFiles(const char* path, std::vector<std::string>& files)
+{
+    struct stat st;
+    if (0 != stat(path, &st) || !S_ISDIR(st.st_mode))
+    {
+        files.push_back(path);
+        return;
+    }
+
+    DIR* dir = opendir(path);
+    if (NULL == dir)
+    {
+        return;
+    }
+
+    struct dirent* entry = NULL;
+    while (NULL != (entry = readdir(dir)))
+    {
+        std::string name = entry->d_name;
+        if (EndsWith(name, ".metrics"))
+        {
+            files.push_back(std::string(path) + "/" + name);
+        }
+    }
+
+    closedir(dir);
+}
+
+static void PrintText(const tnt::ShmMetricsSnapshot& snapshot)
+{
+    printf("%s.%s pid=%d%s start_time=%lld publish_time=%lld\n",
+           snapshot.app_name.c_str(), snapshot.id.c_str(), snapshot.pid, snapshot.alive ? "" : "(dead)",
+           static_cast<long long>(snapshot.start_time), static_cast<long long>(snapshot.publish_time));
+
+    for (std::size_t i=0; i<snapshot.counters.size(); ++i)
+    {
+        printf("  %s:%llu\n", snapshot.counters[i].name,
+               static_cast<unsigned long long>(snapshot.counters[i].value));
+    }
+
+    for (std::size_t i=0; i<snapshot.histograms.size(); ++i)
+    {
+        const tnt::ShmMetricsHistogram& histogram = snapshot.histograms[i];
+        printf("  %s: count=%llu p50=%.3fus p90=%.3fus p99=%.3fus p999=%.3fus max=%.3fus\n",
+               histogram.name, static_cast<unsigned long long>(histogram.count),
+               histogram.p50 / 1000.0, histogram.p90 / 1000.0, histogram.p99 / 1000.0,
+               histogram.p999 / 1000.0, histogram.max / 1000.0);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool prometheus = false;
+    bool all = false;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "pah")))
+    {
+        switch (opt)
+        {
+            case 'p':
+                prometheus = true;
+                break;
+
+            case 'a':
+                all = true;
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-p] [-a] <metrics_dir|metrics_file> ...\n", argv[0]);
+                fprintf(stderr, "  -p  Prometheus text format\n");
+                fprintf(stderr, "  -a  include processes that are not running\n");
+                return 1;
+        }
+    }
+
+    std::vector<std::string> files;
+    for (int i=optind; i<argc; ++i)
+    {
+        ListFiles(argv[i], files);
+    }
+
+    int result = 0;
+    std::vector<tnt::ShmMetricsSnapshot> snapshots;
+    for (std::size_t i=0; i<files.size(); ++i)
+    {
+        tnt::ShmMetricsReader reader;
+        tnt::ShmMetricsSnapshot snapshot;
+
+        int ret = reader.Open(files[i].c_str());
+        if (0 == ret)
+        {
+            ret = reader.Snapshot(snapshot);
+        }
+
+        if (0 != ret)
+        {
+            fprintf(stderr, "read %s failed, ret=%d\n", files[i].c_str(), ret);
+            result = 1;
+            continue;
+        }
+
+        if (all || snapshot.alive)
+        {
+            snapshots.push_back(snapshot);
+        }
+    }
+
+    if (prometheus)
+    {
+        fputs(tnt::ShmMetricsToPrometheus(snapshots).c_str(), stdout);
+    }
+    else
+    {
+        for (std::size_t i=0; i<snapshots.size(); ++i)
+        {
+            PrintText(snapshots[i]);
+        }
+    }
+
+    return result;
+}
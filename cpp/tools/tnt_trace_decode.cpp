@@ -0,0 +1,45 @@
+/**
+ * @file:   tnt_trace_decode.cpp
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  把 DumpFuncTrace 的文件转成Chrome trace的json
+ *
+ * use like this:
+ *   tnt_trace_decode func_trace.bin > func_trace.json
+ *   然后用 chrome://tracing 或者 https://ui.perfetto.dev 打开
+ */
+
+#include <stdio.h>
+#include "func_trace.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <func_trace_dump> [json_file]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (argc >= 3)
+    {
+        out = fopen(argv[2], "w");
+        if (NULL == out)
+        {
+            fprintf(stderr, "open %s failed\n", argv[2]);
+            return 1;
+        }
+    }
+
+    int ret = tnt::FuncTraceToChromeJson(argv[1], out);
+    if (0 != ret)
+    {
+        fprintf(stderr, "decode %s failed, ret=%d\n", argv[1], ret);
+    }
+
+    if (stdout != out)
+    {
+        fclose(out);
+    }
+
+    return (0 == ret) ? 0 : 1;
+}
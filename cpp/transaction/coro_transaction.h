@@ -0,0 +1,146 @@
+/**
+ * @file:   coro_transaction.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  Э, 첽д˳Ĵ
+ *
+ * ԭಽҪ EnterPhase/SetPhase/GetCurrCmd ״̬,
+ *  OnAwake/OnActive/OnTimeout  switch ׶. ֻʵһЭ Run,
+ *  co_await WaitCmd(cmd, ʱ) Ȼذ:
+ *
+ *   class QueryTransaction : public CoroTransaction
+ *   {
+ *       virtual tnt::CoroTask Run()
+ *       {
+ *           SendToDb(...);
+ *           const AppFrame* rsp = co_await WaitCmd(CMD_DB_QUERY_RSP, WAIT_THREE_SECONDS);
+ *           if (NULL == rsp)
+ *           {
+ *               co_return -1; // ʱ
+ *           }
+ *           ...
+ *           co_return 0;
+ *       }
+ *   };
+ *
+ * Ⱥͳʱ TransactionMgr ԭһ:
+ * WaitCmd ʱ EnterPhase õȴCMDͳʱ, OnEvent õ RETURN_WAIT;
+ * ذ OnActive / ʱ OnTimeout ʱ Resume; Э̽ RETURN_EXIT
+ *
+ * Э֡ tnt::CoroFramePool , ȶԺڴ,  coro_task.h
+ * Ҫ -std=c++20
+ */
+
+#ifndef CORO_TRANSACTION_H
+#define CORO_TRANSACTION_H
+
+#include "coro_task.h"
+#include "transaction_base.h"
+
+#ifdef TNT_HAS_COROUTINE
+
+class CoroTransaction : public TransactionBase
+{
+protected:
+    CoroTransaction(unsigned int cmd)
+        : TransactionBase(cmd), awaited_frame_(NULL)
+    {
+    }
+
+    virtual ~CoroTransaction()
+    {
+    }
+
+    /**
+     * @brief:  , һϢʱʼ
+     *
+     * @return: co_return ֵֻ־, Э̽ͻ
+     */
+    virtual tnt::CoroTask Run() = 0;
+
+    /**
+     * @brief:  co_await ȴĳCMDĻذ
+     *
+     * co_await Ľǻذ AppFrame, ʱΪ NULL
+     */
+    class CmdAwaiter
+    {
+    public:
+        CmdAwaiter(CoroTransaction* trans, unsigned int cmd, TransactionWaitInterval interval)
+            : trans_(trans), cmd_(cmd), interval_(interval)
+        {
+        }
+
+        bool await_ready() const noexcept {return false;}
+
+        void await_suspend(std::coroutine_handle<>)
+        {
+            trans_->awaited_frame_ = NULL;
+            trans_->EnterPhase(trans_->phase() + 1, interval_, cmd_);
+        }
+
+        const AppFrame* await_resume() const
+        {
+            return trans_->awaited_frame_;
+        }
+
+    private:
+        CoroTransaction* trans_;
+        unsigned int cmd_;
+        TransactionWaitInterval interval_;
+    };
+
+    inline CmdAwaiter WaitCmd(unsigned int cmd, TransactionWaitInterval interval)
+    {
+        return CmdAwaiter(this, cmd, interval);
+    }
+
+protected:
+    virtual TransactionReturn OnAwake()
+    {
+        task_ = Run();
+        return Resume(NULL);
+    }
+
+    virtual TransactionReturn OnActive()
+    {
+        return Resume(&GetAppFrame());
+    }
+
+    virtual TransactionReturn OnTimeout()
+    {
+        return Resume(NULL);
+    }
+
+    // 쳣˳, ߵȴʱûöʱ, ʱЭ̻û
+    virtual void ReDestruct()
+    {
+        task_.Reset();
+        awaited_frame_ = NULL;
+    }
+
+private:
+    TransactionReturn Resume(const AppFrame* frame)
+    {
+        awaited_frame_ = frame;
+
+        // Э쳣׳,  OnEvent ס
+        if (!task_.Resume())
+        {
+            return RETURN_WAIT;
+        }
+
+        TNT_LOG_DEBUG(0, uin(), "coro trans exit|%u|%u|%d", id(), cmd(), task_.result());
+
+        // ֡ϻس, һֱӸ
+        task_.Reset();
+        return RETURN_EXIT;
+    }
+
+private:
+    tnt::CoroTask task_;
+    const AppFrame* awaited_frame_;
+};
+
+#endif // TNT_HAS_COROUTINE
+
+#endif //CORO_TRANSACTION_H
@@ -31,25 +31,15 @@ TransactionBase::~TransactionBase()
 // ΪһֱڵģٴʹҪʼ
 // ҲпҪʼ, Ϊ˱ظú
 // ǵûķԽĺֿ
-void TransactionBase::ReConstructBase()
+void TransactionBase::ReConstructBase(unsigned int trans_id)
 {
     FUNC_TRACE(uin_);
 
-    static unsigned int trans_id_generator_ =
-        TransactionMgrSigleton::get_const_instance().trans_id_begin_;
-
-
-    ++trans_id_generator_;
-    if (0 == trans_id_generator_)
-    {
-        ++trans_id_generator_;
-    }
-
-    id_ = trans_id_generator_;
+    id_ = trans_id;
 
     state_ = STATE_AWAKE;
 
-    TNT_LOG_DEBUG(0, 0, "%u|%u", id_, trans_id_generator_);
+    TNT_LOG_DEBUG(0, 0, "%u", id_);
 
     return;
 }
@@ -60,11 +50,11 @@ void TransactionBase::ReConstruct()
 }
 
 // װһ
-void TransactionBase::ReConstructAll()
+void TransactionBase::ReConstructAll(unsigned int trans_id)
 {
     FUNC_TRACE(uin_);
 
-    ReConstructBase();
+    ReConstructBase(trans_id);
     ReConstruct();
 }
 
@@ -9,6 +9,11 @@
 
 #include "app_frame.h"
 
+namespace tnt
+{
+template<typename T> class TransactionBucket;
+} // namespace tnt
+
 /**
  * @brief:  
  * , ûйӿ
@@ -16,6 +21,8 @@
 class TransactionBase
 {
     friend class TransactionMgr;
+    // ʱͷ
+    friend class tnt::TransactionBucket<TransactionBase>;
 
 protected:
     /**
@@ -36,6 +43,7 @@ protected:
         RETURN_EXIT  = 3,       /// ˳ʱҪ
     };
 
+    // 
     enum TransactionWaitInterval
     {
         WAIT_ONE_SECONDS = 1000,
@@ -61,13 +69,14 @@ protected:
     // ΪһֱڵģٴʹҪʼ
     // ҲпҪʼ, Ϊ˱ظú
     // ǵûķԽĺֿ
-    void ReConstructBase();
+    // trans_id  TransactionMgr 
+    void ReConstructBase(unsigned int trans_id);
 
     // ṩĽӿ
     virtual void ReConstruct();
 
     // װһ
-    void ReConstructAll();
+    void ReConstructAll(unsigned int trans_id);
 
     void ReDestructBase();
 
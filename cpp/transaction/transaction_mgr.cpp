@@ -7,37 +7,46 @@
 #include "transaction_mgr.h"
 #include "app_frame.h"
 #include "logging.h"
+#include "latency_histogram.h"
+
+// ʱõʱ, , ܸϵͳʱӰ
+static int64_t NowMs()
+{
+    return static_cast<int64_t>(tnt::MonotonicNowNs() / 1000000);
+}
 
 TransactionMgr::TransactionMgr()
 {
     is_use_locker_ = false;
+
+    shrink_interval_ = DEFAULT_SHRINK_INTERVAL;
+    last_shrink_time_ = time(NULL);
+
+    next_expiration_ = -1;
 }
 
 TransactionMgr::~TransactionMgr()
 {
+    TransactionBucketMapIter iter = idle_transaction_map_.begin();
+    for (; iter != idle_transaction_map_.end(); ++iter)
+    {
+        delete iter->second;
+    }
+    idle_transaction_map_.clear();
 }
 
 int TransactionMgr::InitTransactionMgr()
 {
     FUNC_TRACE(0);
 
-    int ret = 0;
-    // TODO:ҪڴأʱĽӿǡ
-    char* timer_pool_mem = new char[102400];
-    ret = timer_pool_.Init(timer_pool_mem, 102400, 1);
-    if (0 != ret)
-    {
-        TNT_LOG_ERROR(0, 0, "init timer_pool failed, ret=%d|%s",
-                      ret, timer_pool_.GetErrMsg());
-
-        return -1;
-    }
-
-
+    // ʱ RegisterCommand ﰴصĴСԤ
     struct timeval t;
     gettimeofday(&t, NULL);
     trans_id_begin_ = (t.tv_sec % 3600) * 1000000  + t.tv_usec;
 
+    // Ժ󲻻һ̵ID
+    active_transaction_table_.Seed(trans_id_begin_);
+
     return 0;
 }
 
@@ -113,22 +122,23 @@ TransactionMgr::ProcessAppFrame(const AppFrame& app_frame)
 }
 
 // ʱӿ
-int TransactionMgr::SetTimer(unsigned int trans_id, time_t timeout_usec, size_t& timer_id)
+int TransactionMgr::SetTimer(unsigned int trans_id, time_t timeout_msec, size_t& timer_id)
 {
     FUNC_TRACE(0);
 
-    TransactionTimer timer;
-    timer.trans_id = trans_id;
-
-    long long unsigned int add_timer_id = 0;
-
-    int ret = timer_pool_.AddTimer(timeout_usec, timer, &add_timer_id);
-    if (0 != ret)
+    int64_t now = NowMs();
+    tnt::TimeoutPool::Id id = timer_pool_.Add(now, timeout_msec, trans_id);
+    if (id <= 0)
     {
         return -1;
     }
 
-    timer_id = add_timer_id;
+    if (next_expiration_ < 0 || now + timeout_msec < next_expiration_)
+    {
+        next_expiration_ = now + timeout_msec;
+    }
+
+    timer_id = static_cast<size_t>(id);
 
     return 0;
 }
@@ -137,10 +147,10 @@ int TransactionMgr::CancelTimer(size_t timer_id)
 {
     FUNC_TRACE(0);
 
-    int ret = timer_pool_.DelTimer(timer_id);
-    if (0 != ret)
+    // ȡĲ next_expiration_, һ
+    if (!timer_pool_.Erase(static_cast<tnt::TimeoutPool::Id>(timer_id)))
     {
-        return ret;
+        return -1;
     }
 
     return 0;
@@ -149,32 +159,75 @@ int TransactionMgr::CancelTimer(size_t timer_id)
 // ʱ
 void TransactionMgr::HandleTimeout()
 {
-    std::vector<unsigned long long> timer_id_list;
-    std::vector<TransactionTimer> timer_list;
+    if (next_expiration_ < 0)
+    {
+        return;
+    }
 
-    int ret = timer_pool_.GetTimer(timer_id_list, timer_list);
-    if (0 != ret)
+    int64_t now = NowMs();
+    if (now < next_expiration_)
     {
-        TNT_LOG_WARN(0, 0, "get timer failed, ret=%d, errmsg=%s",
-                     ret, timer_pool_.GetErrMsg());
         return;
     }
 
-    if (timer_id_list.size() > 0)
+    // 洦ʱʱĶʱ SetTimer  next_expiration_
+    next_expiration_ = timer_pool_.Run(now, expired_timers_);
+
+    if (expired_timers_.size() > 0)
     {
-        TNT_LOG_INFO(0, 0, "timeout num = %lu", timer_id_list.size());
+        TNT_LOG_INFO(0, 0, "timeout num = %lu", expired_timers_.size());
     }
 
-    for(unsigned int i=0; i<timer_id_list.size(); ++i)
+    for (size_t i=0; i<expired_timers_.size(); ++i)
     {
-        unsigned int trans_id = timer_list[i].trans_id;
+        const tnt::TimeoutPool::Event& event = expired_timers_[i];
+        unsigned int trans_id = static_cast<unsigned int>(event.data);
         TransactionBase* ptrans = GetTransaction(trans_id);
         if (NULL == ptrans)
         {
             continue;
         }
 
-        ptrans->ProcessTimeout(timer_id_list[i]);
+        // ͬһǰѾ˶ʱ
+        if (ptrans->timeout_timer_id_ != static_cast<size_t>(event.id))
+        {
+            continue;
+        }
+
+        ptrans->ProcessTimeout(event.id);
+    }
+}
+
+time_t TransactionMgr::NextTimeout() const
+{
+    if (next_expiration_ < 0)
+    {
+        return -1;
+    }
+
+    int64_t now = NowMs();
+    return (next_expiration_ > now) ? static_cast<time_t>(next_expiration_ - now) : 0;
+}
+
+// е
+void TransactionMgr::OnTick()
+{
+    time_t now = time(NULL);
+    if (now - last_shrink_time_ < shrink_interval_)
+    {
+        return;
+    }
+    last_shrink_time_ = now;
+
+    TransactionBucketMapIter iter = idle_transaction_map_.begin();
+    TransactionBucketMapIter iter_end = idle_transaction_map_.end();
+    for (; iter != iter_end; ++iter)
+    {
+        unsigned int num = iter->second->Shrink();
+        if (num > 0)
+        {
+            TNT_LOG_DEBUG(0, 0, "TransctionBucket shrink|0X%08X|%u|%lu", iter->first, num, iter->second->total_size());
+        }
     }
 }
 
@@ -191,9 +244,17 @@ void TransactionMgr::CheckStatistic()
     TransactionBucketMapIter iter_end = idle_transaction_map_.end();
     for (; iter != iter_end; ++iter)
     {
-        TNT_LOG_INFO(0, 0, "bucket info|0X%08X|%lu",
-                     iter->second->cmd(),
-                     iter->second->size());
+        const TransctionBucket* bucket = iter->second;
+        TNT_LOG_INFO(0, 0, "bucket info|0X%08X|idle=%lu|total=%lu|peak=%lu|max=%u|pop=%lu|exhausted=%lu|grow=%lu|shrink=%lu",
+                     bucket->cmd(),
+                     bucket->size(),
+                     bucket->total_size(),
+                     bucket->peak_active(),
+                     bucket->config().max_size,
+                     bucket->total_pop(),
+                     bucket->total_exhausted(),
+                     bucket->total_grow(),
+                     bucket->total_shrink());
 
         idle_transaction_num += iter->second->size();
     }
@@ -208,9 +269,35 @@ void TransactionMgr::CheckStatistic()
     //                   idle_transaction_num);
     // }
 
-    TNT_LOG_INFO(0, 0, "statistic|%lu|%lu",
-                 active_transaction_map_.size(),
-                 idle_transaction_num);
+    TNT_LOG_INFO(0, 0, "statistic|%lu|%lu|%lu",
+                 active_transaction_table_.size(),
+                 idle_transaction_num,
+                 active_transaction_table_.capacity());
+
+    if (is_use_locker_)
+    {
+        // contention ͬһûͬһû, Ĵ
+        TNT_LOG_INFO(0, 0, "locker info|locked=%lu|capacity=%lu|lock=%llu|contention=%llu|full=%llu|max_probe=%lu",
+                     locker_table_.size(),
+                     locker_table_.capacity(),
+                     (unsigned long long)locker_table_.lock_count(),
+                     (unsigned long long)locker_table_.contention_count(),
+                     (unsigned long long)locker_table_.full_count(),
+                     locker_table_.max_probe());
+
+        const tnt::LockTable::HotKey* hot_keys = locker_table_.hot_keys();
+        for (size_t i=0; i<tnt::LockTable::HOT_KEY_COUNT; ++i)
+        {
+            if (hot_keys[i].contention > 0)
+            {
+                TNT_LOG_INFO(0, hot_keys[i].uin, "locker hot|%u|0X%08X|%u",
+                             hot_keys[i].uin, hot_keys[i].cmd, hot_keys[i].contention);
+            }
+        }
+
+        // ÿͳһ
+        locker_table_.ResetStatistic();
+    }
 
     return;
 }
@@ -220,32 +307,51 @@ TransactionMgr::GetNewTransaction(unsigned int uin, unsigned int cmd)
 {
     FUNC_TRACE(0);
 
-    int ret = LockUinTrans(uin, cmd);
-    if (0 != ret && is_use_locker_)
+    TransactionBucketMapIter iter = idle_transaction_map_.find(cmd);
+    if (iter == idle_transaction_map_.end())
     {
+        TNT_LOG_WARN(0, 0, "Cmd is not Register|0X%08X", cmd);
         return NULL;
     }
 
-    TransactionBucketMapIter iter = idle_transaction_map_.find(cmd);
-    if (iter == idle_transaction_map_.end())
+    // ʱ
+    if (is_use_locker_ && 0 != LockUinTrans(uin, cmd))
     {
-        TNT_LOG_WARN(0, 0, "Cmd is not Register|0X%08X", cmd);
         return NULL;
     }
 
-    // idleȡһ
+    // idleȡһ, ûпеĻᰴ grow_size 
     TransactionBase* ptrans = iter->second->pop();
     if (NULL == ptrans)
     {
-        TNT_LOG_ERROR(0, 0, "idle transaction is not ehough, cmd = 0X%08X", cmd);
+        TNT_LOG_ERROR(0, 0, "idle transaction is not ehough, cmd = 0X%08X, max_size = %u",
+                      cmd, iter->second->config().max_size);
+        UnLockUinTrans(uin, cmd);
         return NULL;
     }
 
-    // ʼ
-    ptrans->ReConstructAll();
+    // س, ų, ʱ͵бԼ᳤
+    // ּ MAX_SLOTS ͳ,  Insert ʧ
+    size_t capacity = active_transaction_table_.capacity();
+    if (active_transaction_table_.size() >= capacity && capacity < TransactionTable::MAX_SLOTS)
+    {
+        capacity += iter->second->config().grow_size;
+        ReserveTransactions(capacity < TransactionTable::MAX_SLOTS ? capacity : TransactionTable::MAX_SLOTS);
+    }
+
+    // б, ID
+    unsigned int trans_id = active_transaction_table_.Insert(ptrans);
+    if (0 == trans_id)
+    {
+        TNT_LOG_ERROR(0, 0, "transaction table is full, cmd = 0X%08X, capacity = %lu",
+                      cmd, active_transaction_table_.capacity());
+        iter->second->push(ptrans);
+        UnLockUinTrans(uin, cmd);
+        return NULL;
+    }
 
-    // б
-    active_transaction_map_[ptrans->id()] = ptrans;
+    // ʼ
+    ptrans->ReConstructAll(trans_id);
 
     return ptrans;
 }
@@ -254,16 +360,16 @@ TransactionBase* TransactionMgr::GetTransaction(unsigned int trans_id)
 {
     FUNC_TRACE(0);
 
-    TransactionMapIter iter = active_transaction_map_.find(trans_id);
-    if (iter == active_transaction_map_.end())
+    TransactionBase** pptrans = active_transaction_table_.Find(trans_id);
+    if (NULL == pptrans)
     {
         TNT_LOG_WARN(0, 0, "trans id is not exist|%u", trans_id);
         return NULL;
     }
     else
     {
-        iter->second->Dump();
-        return iter->second;
+        (*pptrans)->Dump();
+        return *pptrans;
     }
 }
 
@@ -278,8 +384,8 @@ TransactionMgr::FreeTransaction(TransactionBase* ptrans)
     FUNC_TRACE(ptrans->uin());
     ptrans->Dump();
 
-    TransactionMapIter iter = active_transaction_map_.find(ptrans->id());
-    if (iter == active_transaction_map_.end())
+    TransactionBase** pptrans = active_transaction_table_.Find(ptrans->id());
+    if (NULL == pptrans || *pptrans != ptrans)
     {
         TNT_LOG_WARN(0, 0, "trans id is not exist|%u", ptrans->id());
         return -1;
@@ -295,7 +401,7 @@ TransactionMgr::FreeTransaction(TransactionBase* ptrans)
 
         {
             bucket_iter->second->push(ptrans);
-            active_transaction_map_.erase(iter);
+            active_transaction_table_.Erase(ptrans->id());
         }
 
         UnLockUinTrans(ptrans->uin(), ptrans->cmd());
@@ -306,19 +412,33 @@ TransactionMgr::FreeTransaction(TransactionBase* ptrans)
     }
 }
 
+int TransactionMgr::ReserveTransactions(size_t capacity)
+{
+    if (0 != active_transaction_table_.Reserve(capacity))
+    {
+        return -1;
+    }
+
+    // , û MAX_SLOTS Ͳ̫
+    if (is_use_locker_)
+    {
+        locker_table_.Reserve(capacity);
+    }
+
+    return 0;
+}
+
 /**
  * @brief:һֹͬһûͬͬͬʱڶ
  */
 int TransactionMgr::LockUinTrans(unsigned int uin, unsigned int cmd)
 {
     FUNC_TRACE(uin);
-    TransactionLocker locker(uin, cmd);
-
-    TransactionLockerPoolInserRet insert_ret = locker_pool_.insert(locker);
 
-    if (false == insert_ret.second)
+    int ret = locker_table_.TryLock(uin, cmd);
+    if (0 != ret)
     {
-        TNT_LOG_WARN(0, uin, "trans lock failed|%u|0X%08X", uin, cmd);
+        TNT_LOG_WARN(0, uin, "trans lock failed|%u|0X%08X|%d", uin, cmd, ret);
         return -1;
     }
 
@@ -328,11 +448,27 @@ int TransactionMgr::LockUinTrans(unsigned int uin, unsigned int cmd)
 void TransactionMgr::UnLockUinTrans(unsigned int uin, unsigned int cmd)
 {
     FUNC_TRACE(uin);
-    TransactionLocker locker(uin, cmd);
 
-    locker_pool_.erase(locker);
+    if (!is_use_locker_)
+    {
+        return;
+    }
+
+    locker_table_.Unlock(uin, cmd);
 
     return;
 }
 
+int TransactionMgr::SetUseLocker()
+{
+    // ѾעҲ
+    if (0 != locker_table_.Reserve(active_transaction_table_.capacity()))
+    {
+        TNT_LOG_ERROR(0, 0, "locker table too large|%lu", active_transaction_table_.capacity());
+        return -1;
+    }
+
+    is_use_locker_ = true;
 
+    return 0;
+}
@@ -28,6 +28,11 @@
  *ͬ첽
  *ֻͬҪһ͹
  *
+ * õ 2+3: ÿԼ min/max,  TransactionPoolConfig
+ * ʼֻ min , ʱһγ grow , ֱ max, Դ޵;
+ * ѭ OnTick  TransactionMgr::OnTick, һһֱе
+ * ͷ, ص min. õĴ CheckStatistic  exhausted
+ *
  * XXX:ǷҪ־ûܹȻãʵʱȴ
  * ϸҪǣȨȷһ汾Ȳǳ־û
  *
@@ -41,6 +46,8 @@
  * TODO:
  * 1 ʱ, ϶趨ʱ߼
  *   Ķʱά
+ *   õ tnt::TimeoutPool, , CLOCK_MONOTONIC; ÿһʱ,
+ *   עʱ min_size Ԥ, سԺԼų
  * 2 ͳһϢͽӿ
  *
  */
@@ -48,11 +55,14 @@
 #ifndef TRANSACTION_MGR_H
 #define TRANSACTION_MGR_H
 
+#include <time.h>
 #include <vector>
 #include <tr1/unordered_map>
-#include <tr1/unordered_set>
 #include "boost/serialization/singleton.hpp"
-#include "comm/timer_pool/timer_pool.h"
+#include "lock_table.h"
+#include "slot_table.h"
+#include "transaction_bucket.h"
+#include "timeout_pool.h"
 #include "tnt_transaction_base.h"
 
 enum TransctionMode
@@ -63,114 +73,21 @@ enum TransctionMode
     TRANSCTION_MODE_COUNT
 };
 
-/**
- * @brief: Ͱ
- * ǰеͳһ
- * עΪһΨһͰ
- *
- */
-class TransctionBucket
-{
-public:
-    TransctionBucket(unsigned int cmd)
-        : cmd_(cmd)
-    {
-        trans_list_.clear();
-    }
-
-    ~TransctionBucket()
-    {
-    }
-
-public:
-    unsigned int cmd() const
-    {
-        return cmd_;
-    }
-
-    int push(TransactionBase* ptrans)
-    {
-        FUNC_TRACE(0);
-
-        trans_list_.push_back(ptrans);
-        dump();
-
-        return 0;
-    }
-
-    TransactionBase* pop()
-    {
-        FUNC_TRACE(0);
-
-        dump();
-
-        if (trans_list_.size() <= 0)
-        {
-            LOG_WARN(0, 0, "there is no free transaction|%u", cmd_);
-            return NULL;
-        }
-
-        TransactionBase* ptrans = trans_list_.back();
-        trans_list_.pop_back();
-
-        return ptrans;
-    }
+typedef tnt::TransactionPoolConfig TransactionPoolConfig;
 
-    size_t size() const
-    {
-        return trans_list_.size();
-    }
-
-    void dump() const
-    {
-        LOG_DEBUG(0, 0, "TransctionBucket|%u|%lu", cmd_, trans_list_.size());
-    }
-
-private:
-    std::vector<TransactionBase*> trans_list_;
-
-private:
-    unsigned int cmd_;
-};
-
-typedef struct tagTransactionTimer
+// Ĵ, RegisterCommand ģ
+template<typename ConcreteTransactionType>
+TransactionBase* CreateTransaction(unsigned int cmd)
 {
-    unsigned int trans_id;
-}TransactionTimer;
-
-// һûͬʱֻһض
-class TransactionLocker
-{
-public:
-    TransactionLocker(unsigned int uin, unsigned cmd)
-    : uin_(uin), cmd_(uin)
-    {
-    }
-    ~TransactionLocker(){}
-
-    unsigned int uin_;
-    unsigned int cmd_;
-};
-
-class HashOfTransactionLocker
-{
-public:
-    size_t operator() (const TransactionLocker& locker) const
-    {
-        return (size_t(locker.uin_) +  locker.cmd_);
-    }
-};
-
-class EqualOfTransactionLocker
-{
-public:
-    size_t operator() (const TransactionLocker& rhs, const TransactionLocker& lhs) const
-    {
-        return ((rhs.uin_ == lhs.uin_) && (rhs.cmd_ == lhs.cmd_));
-    }
-};
-
+    return new ConcreteTransactionType(cmd);
+}
 
+/**
+ * @brief: Ͱ
+ * ǰеͳһ, עΪһΨһͰ,  transaction_bucket.h
+ */
+typedef tnt::TransactionBucket<TransactionBase> TransctionBucket;
+typedef TransctionBucket::Creator TransactionCreator;
 
 /**
  * @brief:  
@@ -183,6 +100,14 @@ class TransactionMgr
     static const unsigned int MAX_SYN_TRANSANCTION_NUM_PER_CMD = 1;
     static const unsigned int MAX_ASY_TRANSANCTION_NUM_PER_CMD = 1024;
 
+    // 첽ĬϳشС, ԭ̶ 1024 , ȷ 64 , Գ 8 
+    static const unsigned int MIN_ASY_TRANSANCTION_NUM_PER_CMD = 64;
+    static const unsigned int GROW_ASY_TRANSANCTION_NUM_PER_CMD = 64;
+    static const unsigned int LIMIT_ASY_TRANSANCTION_NUM_PER_CMD = 8 * MAX_ASY_TRANSANCTION_NUM_PER_CMD;
+
+    // , 
+    static const time_t DEFAULT_SHRINK_INTERVAL = 60;
+
 protected:
     TransactionMgr();
     ~TransactionMgr();
@@ -206,6 +131,20 @@ public:
     template<typename ConcreteTransactionType>
     int RegisterCommand(unsigned int cmd, TransctionMode tm = TRANSCTION_MODE_ASY);
 
+    /**
+     * @brief: ע, ָشС
+     *
+     * ƵʸߵԸһ max_size, õ min_size Сһ
+     *
+     * Ȱ min_size , سų,
+     * ͬʱõļ TransactionTable::MAX_SLOTS
+     *
+     * @return: 0 ɹ, -1 ظע, -2 ʧ, -3 ò,
+     *          -4 ֵ min_size  TransactionTable::MAX_SLOTS
+     */
+    template<typename ConcreteTransactionType>
+    int RegisterCommand(unsigned int cmd, const TransactionPoolConfig& config);
+
 
     /**
      * @brief:  ǷѾע
@@ -230,22 +169,48 @@ public:
 
     /**
      * @brief: 鳬ʱ, ѭʱ
+     *
+     * ûĵʱʱֻһαȽ, ÿȦѭ
      */
     void HandleTimeout();
 
     /**
-     * @brief: ͳϢ
+     * @brief: ʱжٺ, -1 ʾû
+     *
+     *  ApplicationBase::OnNextTimeout , epoll ģʽʱ
      */
-    void CheckStatistic();
+    time_t NextTimeout() const;
 
-    inline void SetUseLocker()
+    /**
+     * @brief: ѭ OnTick , ÿһοе
+     */
+    void OnTick();
+
+    /**
+     * @brief: , , Ĭ DEFAULT_SHRINK_INTERVAL
+     */
+    inline void SetShrinkInterval(time_t shrink_interval)
     {
-        is_use_locker_ = true;
+        shrink_interval_ = shrink_interval;
     }
 
+    /**
+     * @brief: ͳϢ
+     */
+    void CheckStatistic();
+
+    /**
+     * @brief: ͬһûͬһͬʱֻһ, ֱӶ
+     *
+     * ʼʱ, Ԥ
+     *
+     * @return: 0 ɹ, 0 ʧ
+     */
+    int SetUseLocker();
+
 private:
-    // ʱӿ
-    int SetTimer(unsigned int trans_id, time_t timeout_usec, size_t& timer_id);
+    // ʱӿ, 
+    int SetTimer(unsigned int trans_id, time_t timeout_msec, size_t& timer_id);
     int CancelTimer(size_t timer_id);
 
     // һµʵ
@@ -256,6 +221,9 @@ private:
     // ͷʵ
     int FreeTransaction(TransactionBase* ptrans);
 
+    // һ, 0 ɹ, -1  MAX_SLOTS
+    int ReserveTransactions(size_t capacity);
+
     /**
      * @brief:һֹͬһûͬͬͬʱڶ
      */
@@ -263,18 +231,17 @@ private:
     void UnLockUinTrans(unsigned int uin, unsigned int cmd);
 
 public:
-    // IDʼֵ
+    // IDʼֵ, ÿλ
     unsigned int trans_id_begin_;
 
 private:
-    // ǰбmapid
-    typedef std::tr1::unordered_map<unsigned int /*trans_id*/, TransactionBase*> TransactionMap;
-    typedef TransactionMap::value_type TransactionMapValueType;
-    typedef TransactionMap::iterator TransactionMapIter;
-    typedef TransactionMap::const_iterator TransactionMapConstIter;
-    typedef std::pair<TransactionMapIter, bool> TransactionMapInserRet;
+    // ǰб
+    // ID ǲλ±Ӵ, idֻһ±, ùϣҲڴ
+    // Ժ, ڵĻذҲ
+    // עʱ min_size Ԥ, ٰ grow_size , һռ max_size
+    typedef tnt::SlotTable<TransactionBase*> TransactionTable;
 
-    TransactionMap active_transaction_map_;
+    TransactionTable active_transaction_table_;
 
     // Ӧûиг, ֲ
     typedef std::tr1::unordered_map<unsigned int /*cmd*/, TransctionBucket*> TransctionBucketMap;
@@ -285,19 +252,19 @@ private:
 
     TransctionBucketMap idle_transaction_map_;
 
-    // ʱ
-    snslib::CTimerPool<TransactionTimer> timer_pool_;
-
-    // 
-    typedef std::tr1::unordered_set<TransactionLocker, HashOfTransactionLocker, EqualOfTransactionLocker> TransactionLockerPool;
-    typedef TransactionLockerPool::value_type TransactionLockerPoolValueType;
-    typedef TransactionLockerPool::iterator TransactionLockerPoolIter;
-    typedef TransactionLockerPool::const_iterator TransactionLockerPoolConstIter;
-    typedef std::pair<TransactionLockerPoolIter, bool> TransactionLockerPoolInserRet;
-
+    // ʱ, ¼ data ID
+    tnt::TimeoutPool timer_pool_;
+    // ĵʱ, ֻ, ; -1 ʾû
+    int64_t next_expiration_;
+    // ڵĶʱ, 
+    std::vector<tnt::TimeoutPool::Event> expired_timers_;
 
+    // , (uin, cmd) Ѱַ, ֻ is_use_locker_ ʱ
     bool is_use_locker_;
-    TransactionLockerPool locker_pool_;
+    tnt::LockTable locker_table_;
+
+    time_t shrink_interval_;
+    time_t last_shrink_time_;
 };
 
 typedef boost::serialization::singleton<TransactionMgr> TransactionMgrSigleton;
@@ -319,10 +286,31 @@ typedef boost::serialization::singleton<TransactionMgr> TransactionMgrSigleton;
  */
 template<typename ConcreteTransactionType> int
 TransactionMgr::RegisterCommand(unsigned int cmd, TransctionMode tm)
+{
+    TransactionPoolConfig config;
+    if (tm == TRANSCTION_MODE_SYN)
+    {
+        // ֻͬҪһ͹
+        config.min_size = MAX_SYN_TRANSANCTION_NUM_PER_CMD;
+        config.max_size = MAX_SYN_TRANSANCTION_NUM_PER_CMD;
+        config.grow_size = MAX_SYN_TRANSANCTION_NUM_PER_CMD;
+    }
+    else
+    {
+        config.min_size = MIN_ASY_TRANSANCTION_NUM_PER_CMD;
+        config.max_size = LIMIT_ASY_TRANSANCTION_NUM_PER_CMD;
+        config.grow_size = GROW_ASY_TRANSANCTION_NUM_PER_CMD;
+    }
+
+    return RegisterCommand<ConcreteTransactionType>(cmd, config);
+}
+
+template<typename ConcreteTransactionType> int
+TransactionMgr::RegisterCommand(unsigned int cmd, const TransactionPoolConfig& config)
 {
     FUNC_TRACE(0);
 
-    LOG_DEBUG(0, 0, "cmd = 0X%08X", cmd);
+    LOG_DEBUG(0, 0, "cmd = 0X%08X|%u|%u|%u", cmd, config.min_size, config.max_size, config.grow_size);
 
     TransactionBucketMapIter iter = idle_transaction_map_.find(cmd);
     if (iter != idle_transaction_map_.end())
@@ -331,21 +319,31 @@ TransactionMgr::RegisterCommand(unsigned int cmd, TransctionMode tm)
         return -1;
     }
 
-    // һµͰ
-    unsigned int trans_num = (tm == TRANSCTION_MODE_SYN) ?
-        MAX_SYN_TRANSANCTION_NUM_PER_CMD : MAX_ASY_TRANSANCTION_NUM_PER_CMD;
+    if (0 == config.max_size || 0 == config.grow_size || config.min_size > config.max_size
+        || config.max_size > TransactionTable::MAX_SLOTS)
+    {
+        LOG_ERROR(0, 0, "Cmd pool config error|0X%08X|%u|%u|%u",
+                  cmd, config.min_size, config.max_size, config.grow_size);
+        return -3;
+    }
+
+    // ȷ min_size , ID ĲλͶʱ,  GetNewTransaction 
+    if (0 != ReserveTransactions(active_transaction_table_.capacity() + config.min_size))
+    {
+        LOG_ERROR(0, 0, "Cmd pool too large|0X%08X|%u|%lu",
+                  cmd, config.min_size, active_transaction_table_.capacity());
+        return -4;
+    }
+    timer_pool_.Reserve(active_transaction_table_.capacity());
+    expired_timers_.reserve(active_transaction_table_.capacity());
 
-    TransctionBucket* trans_bucket = new TransctionBucket(cmd);
-    for (unsigned int i=0; i<trans_num; ++i)
+    // һµͰ, ȷ min_size 
+    TransctionBucket* trans_bucket = new TransctionBucket(cmd, config, CreateTransaction<ConcreteTransactionType>);
+    if (trans_bucket->Grow(config.min_size) != config.min_size)
     {
-        TransactionBase* ptrans = new ConcreteTransactionType(cmd);
-        if (NULL == ptrans)
-        {
-            TNT_LOG_ERROR(0, 0, "CreateTransaction failed|0X%08X", cmd);
-            return -2;
-        }
-
-        trans_bucket->push(ptrans);
+        TNT_LOG_ERROR(0, 0, "CreateTransaction failed|0X%08X", cmd);
+        delete trans_bucket;
+        return -2;
     }
 
     idle_transaction_map_[cmd] = trans_bucket;
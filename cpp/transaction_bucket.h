@@ -0,0 +1,207 @@
+/**
+ * @file:   transaction_bucket.h
+ * @author: jameyli <lgy AT live DOT com>
+ * @brief:  事务桶, 一个命令字的空闲事务池
+ *
+ * 1 注册时先分配 min_size 个, 空闲的用完了一次长 grow_size 个, 最多 max_size 个
+ *   到了 max_size 还不够就取不到, 记一次 exhausted
+ * 2 取和还都在尾部, 刚还回来的马上又被取走, 还在cache里
+ * 3 Shrink 由调用者按周期调用, 释放这个周期里一直没被取过的:
+ *   周期内空闲个数的最小值 low_water 说明头部这么多个一直没动过,
+ *   从头部(冷的一端)释放, 一次最多 grow_size 个, 不低于 min_size
+ *
+ * T 是事务的基类, 由 creator 创建, Shrink 和析构时 delete
+ */
+
+#ifndef TRANSACTION_BUCKET_H
+#define TRANSACTION_BUCKET_H
+
+#include <cstddef>
+#include <vector>
+
+namespace tnt
+{
+
+/**
+ * @brief: 事务池的大小
+ */
+struct TransactionPoolConfig
+{
+    // 注册时预分配, 收缩也不会低于这个
+    unsigned int min_size;
+    // 最多这么多个同时在用, 再多的请求丢掉
+    unsigned int max_size;
+    // 空闲的用完了一次多分配几个
+    unsigned int grow_size;
+};
+
+template<typename T>
+class TransactionBucket
+{
+public:
+    // 具体事务类的创建函数
+    typedef T* (*Creator)(unsigned int cmd);
+
+public:
+    TransactionBucket(unsigned int cmd, const TransactionPoolConfig& config, Creator creator)
+        : cmd_(cmd), config_(config), creator_(creator),
+          total_size_(0), low_water_(0), peak_active_(0),
+          total_pop_(0), total_exhausted_(0), total_grow_(0), total_shrink_(0)
+    {
+    }
+
+    ~TransactionBucket()
+    {
+        for (std::size_t i=0; i<trans_list_.size(); ++i)
+        {
+            delete trans_list_[i];
+        }
+        trans_list_.clear();
+    }
+
+public:
+    unsigned int cmd() const {return cmd_;}
+    const TransactionPoolConfig& config() const {return config_;}
+
+    /**
+     * @brief: 再创建 num 个空闲的事务, 不会超过 max_size
+     *
+     * @return: 实际创建的个数, 创建失败时比 num 少
+     */
+    unsigned int Grow(unsigned int num)
+    {
+        if (total_size_ + num > config_.max_size)
+        {
+            num = config_.max_size - total_size_;
+        }
+
+        unsigned int created = 0;
+        for (; created<num; ++created)
+        {
+            T* ptrans = creator_(cmd_);
+            if (NULL == ptrans)
+            {
+                break;
+            }
+
+            trans_list_.push_back(ptrans);
+            ++total_size_;
+        }
+
+        if (created > 0)
+        {
+            ++total_grow_;
+        }
+
+        return created;
+    }
+
+    /**
+     * @brief: 收缩, 释放上个周期里一直空闲的, 一次最多 grow_size 个, 不低于 min_size
+     *
+     * @return: 释放的个数
+     */
+    unsigned int Shrink()
+    {
+        std::size_t num = low_water_;
+        if (num > config_.grow_size)
+        {
+            num = config_.grow_size;
+        }
+
+        if (total_size_ < config_.min_size + num)
+        {
+            num = (total_size_ > config_.min_size) ? (total_size_ - config_.min_size) : 0;
+        }
+
+        // 头部的一直没被取过
+        for (std::size_t i=0; i<num; ++i)
+        {
+            delete trans_list_[i];
+        }
+        trans_list_.erase(trans_list_.begin(), trans_list_.begin() + num);
+        total_size_ -= num;
+
+        if (num > 0)
+        {
+            ++total_shrink_;
+        }
+
+        // 下一个周期重新看
+        low_water_ = trans_list_.size();
+
+        return static_cast<unsigned int>(num);
+    }
+
+    void push(T* ptrans)
+    {
+        trans_list_.push_back(ptrans);
+    }
+
+    /**
+     * @return: 没有空闲的也长不了时返回 NULL
+     */
+    T* pop()
+    {
+        if (trans_list_.empty() && 0 == Grow(config_.grow_size))
+        {
+            ++total_exhausted_;
+            return NULL;
+        }
+
+        T* ptrans = trans_list_.back();
+        trans_list_.pop_back();
+
+        ++total_pop_;
+        if (trans_list_.size() < low_water_)
+        {
+            low_water_ = trans_list_.size();
+        }
+        if (total_size_ - trans_list_.size() > peak_active_)
+        {
+            peak_active_ = total_size_ - trans_list_.size();
+        }
+
+        return ptrans;
+    }
+
+    // 空闲的个数
+    std::size_t size() const {return trans_list_.size();}
+    // 空闲的加上正在用的
+    std::size_t total_size() const {return total_size_;}
+    std::size_t active_size() const {return total_size_ - trans_list_.size();}
+
+    // 统计
+    std::size_t peak_active() const {return peak_active_;}
+    std::size_t total_pop() const {return total_pop_;}
+    std::size_t total_exhausted() const {return total_exhausted_;}
+    std::size_t total_grow() const {return total_grow_;}
+    std::size_t total_shrink() const {return total_shrink_;}
+
+private:
+    // 不能拷贝, 里面的指针归它管
+    TransactionBucket(const TransactionBucket&);
+    TransactionBucket& operator=(const TransactionBucket&);
+
+private:
+    // 头部冷, 尾部热
+    std::vector<T*> trans_list_;
+
+    unsigned int cmd_;
+    TransactionPoolConfig config_;
+    Creator creator_;
+
+    std::size_t total_size_;
+    // 这个收缩周期里空闲个数的最小值, 说明头部这么多一直没用到
+    std::size_t low_water_;
+    std::size_t peak_active_;
+    std::size_t total_pop_;
+    // 到了 max_size 还不够用的次数
+    std::size_t total_exhausted_;
+    std::size_t total_grow_;
+    std::size_t total_shrink_;
+};
+
+} // namespace tnt
+
+#endif //TRANSACTION_BUCKET_H